@@ -0,0 +1,229 @@
+/*
+ * This program is host test and throughput benchmark of the block device adapter.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+
+#include "testutil.h"
+#include "blockdevice.h"
+#include "w25q.h"
+#include "w25n01g.h"
+
+#define BLOCKDEVICE_TEST_APPEND			100		//!< Odd sized appends, the cache has to merge them
+#define BLOCKDEVICE_TEST_FIRST_BLOCK	16
+
+/*
+ * A file the way a littlefs-style filesystem lays it out: whole blocks from firstBlock on,
+ * appends collected in a cacheSize cache and programmed in progSize units.
+ */
+typedef struct {
+	const BlockDevice *bd;
+	uint32_t firstBlock;
+	uint32_t length;
+	uint8_t *cache;
+	uint32_t cached;
+} BlockDeviceTestFile;
+
+static uint8_t *blockDeviceTestData;
+static uint8_t *blockDeviceTestRead;
+
+static bool BlockDeviceTest_create(BlockDeviceTestFile *file, const BlockDevice *bd, uint32_t firstBlock)
+{
+	file->bd = bd;
+	file->firstBlock = firstBlock;
+	file->length = 0;
+	file->cached = 0;
+	file->cache = malloc(bd->cacheSize);
+
+	return (file->cache != NULL) && (bd->erase(bd, firstBlock) == BLOCKDEVICE_OK);
+}
+
+static bool BlockDeviceTest_flush(BlockDeviceTestFile *file)
+{
+	const BlockDevice *bd = file->bd;
+	uint32_t position = file->length - file->cached;
+	uint32_t block = file->firstBlock + (position / bd->blockSize);
+	uint32_t offset = position % bd->blockSize;
+	bool success = true;
+
+	// A new block is erased when the file first reaches it
+	if ((offset == 0) && (position != 0)) {
+		success = (bd->erase(bd, block) == BLOCKDEVICE_OK);
+	}
+
+	if (success && (file->cached > 0)) {
+		success = (bd->prog(bd, block, offset, file->cache, file->cached) == BLOCKDEVICE_OK);
+	}
+
+	file->cached = 0;
+
+	return success;
+}
+
+static bool BlockDeviceTest_append(BlockDeviceTestFile *file, const uint8_t *data, uint32_t length)
+{
+	bool success = true;
+
+	while (success && (length > 0)) {
+		uint32_t room = file->bd->cacheSize - file->cached;
+		uint32_t chunk = (length < room) ? length : room;
+
+		memcpy(&file->cache[file->cached], data, chunk);
+		file->cached += chunk;
+		file->length += chunk;
+		data += chunk;
+		length -= chunk;
+
+		if (file->cached == file->bd->cacheSize) {
+			success = BlockDeviceTest_flush(file);
+		}
+	}
+
+	return success;
+}
+
+static bool BlockDeviceTest_read(const BlockDeviceTestFile *file, uint8_t *data)
+{
+	const BlockDevice *bd = file->bd;
+	bool success = true;
+
+	for (uint32_t position = 0; success && (position < file->length); position += bd->cacheSize) {
+		uint32_t chunk = ((file->length - position) < bd->cacheSize) ? (file->length - position) : bd->cacheSize;
+
+		success = (bd->read(bd, file->firstBlock + (position / bd->blockSize), position % bd->blockSize, &data[position], chunk) == BLOCKDEVICE_OK);
+	}
+
+	return success;
+}
+
+static void BlockDeviceTest_report(const char *part, const char *phase, uint32_t bytes, uint64_t startNs)
+{
+	uint64_t elapsedNs = SimQspi_nowNs() - startNs;
+
+	TEST_CHECK(elapsedNs > 0);
+	printf("%s,%s,%u,%.1f,%.3f\n", part, phase, bytes, (double)elapsedNs / 1e3,
+			(elapsedNs > 0) ? ((double)bytes * 1e3 / (double)elapsedNs) : 0.0);
+}
+
+//! Create, append and read back one file, reports simulated MB/s of each phase
+static void BlockDeviceTest_throughput(const char *part, const BlockDevice *bd, uint32_t fileSize)
+{
+	BlockDeviceTestFile file;
+	uint64_t start = SimQspi_nowNs();
+
+	TEST_CHECK(BlockDeviceTest_create(&file, bd, BLOCKDEVICE_TEST_FIRST_BLOCK));
+	BlockDeviceTest_report(part, "create", 0, start);
+
+	start = SimQspi_nowNs();
+	for (uint32_t written = 0; written < fileSize; written += BLOCKDEVICE_TEST_APPEND) {
+		uint32_t chunk = ((fileSize - written) < BLOCKDEVICE_TEST_APPEND) ? (fileSize - written) : BLOCKDEVICE_TEST_APPEND;
+
+		TEST_CHECK(BlockDeviceTest_append(&file, &blockDeviceTestData[written], chunk));
+	}
+	TEST_CHECK(BlockDeviceTest_flush(&file));
+	TEST_CHECK(bd->sync(bd) == BLOCKDEVICE_OK);
+	BlockDeviceTest_report(part, "append", fileSize, start);
+	uint64_t appendNs = SimQspi_nowNs() - start;
+
+	memset(blockDeviceTestRead, 0, fileSize);
+	start = SimQspi_nowNs();
+	TEST_CHECK(BlockDeviceTest_read(&file, blockDeviceTestRead));
+	BlockDeviceTest_report(part, "read", fileSize, start);
+	uint64_t readNs = SimQspi_nowNs() - start;
+
+	TEST_CHECK(file.length == fileSize);
+	TEST_CHECK(memcmp(blockDeviceTestData, blockDeviceTestRead, fileSize) == 0);
+	TEST_CHECK(readNs < appendNs);
+
+	free(file.cache);
+}
+
+static void BlockDeviceTest_w25q(void)
+{
+	BlockDevice bd;
+
+	TEST_CHECK(Test_attach(&SimFlash_w25q128jvIm, TEST_NOR_FLASH_SIZE));
+	TEST_CHECK(W25q_init(&testQspi));
+	TEST_CHECK(BlockDevice_w25qInit(&bd));
+
+	TEST_CHECK(bd.progSize == W25Q_PAGE_SIZE);
+	TEST_CHECK(bd.blockSize == W25Q_SECTOR_SIZE);
+	TEST_CHECK(bd.blockCount == (W25Q_CHIP_SIZE / W25Q_SECTOR_SIZE));
+	TEST_CHECK(bd.cacheSize == BLOCKDEVICE_W25Q_CACHE_SIZE);
+	TEST_CHECK(!BlockDevice_isBad(&bd, 0));
+
+	uint8_t byte = 0;
+	TEST_CHECK(bd.read(&bd, bd.blockCount, 0, &byte, 1) == BLOCKDEVICE_ERR_INVAL);
+	TEST_CHECK(bd.read(&bd, 0, bd.blockSize - 1u, blockDeviceTestRead, 2) == BLOCKDEVICE_ERR_INVAL);
+	TEST_CHECK(bd.erase(&bd, bd.blockCount) == BLOCKDEVICE_ERR_INVAL);
+
+	BlockDeviceTest_throughput("W25Q128JV", &bd, 64u * 1024u);
+	Test_checkProtocol();
+}
+
+static void BlockDeviceTest_w25n01g(void)
+{
+	BlockDevice bd;
+	const uint32_t badBlock = BLOCKDEVICE_TEST_FIRST_BLOCK - 2u;
+	const uint32_t failingBlock = BLOCKDEVICE_TEST_FIRST_BLOCK - 1u;
+
+	TEST_CHECK(Test_attach(&SimFlash_w25n01gv, TEST_NAND_FLASH_SIZE));
+	SimFlash_markBadBlock(badBlock);
+	TEST_CHECK(W25n01g_init(&testQspi));
+	TEST_CHECK(BlockDevice_w25n01gInit(&bd, &testQspi));
+
+	TEST_CHECK(bd.progSize == W25N01G_PAGE_SIZE);
+	TEST_CHECK(bd.blockSize == W25N01G_BLOCK_SIZE);
+	TEST_CHECK(bd.blockCount == W25N01G_BLOCKS_PER_DIE);
+
+	// Factory marked blocks are refused, an erase failure adds the block to the list
+	TEST_CHECK(BlockDevice_badBlockCount(&bd) == 1);
+	TEST_CHECK(BlockDevice_isBad(&bd, badBlock));
+	TEST_CHECK(bd.erase(&bd, badBlock) == BLOCKDEVICE_ERR_CORRUPT);
+	TEST_CHECK(bd.prog(&bd, badBlock, 0, blockDeviceTestData, bd.progSize) == BLOCKDEVICE_ERR_CORRUPT);
+
+	SimFlash_failErase(failingBlock * bd.blockSize);
+	TEST_CHECK(bd.erase(&bd, failingBlock) == BLOCKDEVICE_ERR_CORRUPT);
+	TEST_CHECK(BlockDevice_isBad(&bd, failingBlock));
+	TEST_CHECK(BlockDevice_badBlockCount(&bd) == 2);
+
+	TEST_CHECK(bd.prog(&bd, BLOCKDEVICE_TEST_FIRST_BLOCK, 1, blockDeviceTestData, 1) == BLOCKDEVICE_ERR_INVAL);
+
+	BlockDeviceTest_throughput("W25N01GV", &bd, 512u * 1024u);
+	TEST_CHECK(SimFlash_getStats()->busyViolations == 0);
+	TEST_CHECK(SimFlash_getStats()->protocolErrors == 0);
+}
+
+int main(void)
+{
+	blockDeviceTestData = malloc(1024u * 1024u);
+	blockDeviceTestRead = malloc(1024u * 1024u);
+
+	TEST_CHECK((blockDeviceTestData != NULL) && (blockDeviceTestRead != NULL));
+	Test_fill(blockDeviceTestData, 1024u * 1024u, 26);
+
+	printf("part,phase,bytes,sim_us,mb_per_s\n");
+	BlockDeviceTest_w25q();
+	BlockDeviceTest_w25n01g();
+
+	free(blockDeviceTestData);
+	free(blockDeviceTestRead);
+
+	return Test_result("blockdevicetest");
+}
@@ -0,0 +1,98 @@
+/*
+ * This program is host test of the W25Q DTR read and its fallback to SDR on parts that cannot do it.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testutil.h"
+#include "w25q.h"
+
+#define DTR_TEST_ADDRESS		0x20000
+#define DTR_TEST_LENGTH			1024
+#define DTR_TEST_SFDP_DTR_BYTE	(SIM_FLASH_SFDP_ADDRESS + 2u)	//!< DWORD 1 bit 19
+#define DTR_TEST_SFDP_DTR_BIT	(1u << 3)
+
+static uint8_t dtrTestData[DTR_TEST_LENGTH];
+static uint8_t dtrTestRead[DTR_TEST_LENGTH];
+static uint8_t dtrTestSfdp[SIM_FLASH_SFDP_SIZE];
+
+static uint32_t DtrTest_dtrCommands(void)
+{
+	return SimQspi_getStats()->opcodes[W25Q_INSTR_FAST_READ_QUAD_DTR] + SimQspi_getStats()->opcodes[W25Q_INSTR_FAST_READ_QUAD_DTR_4B];
+}
+
+//! Indirect and memory-mapped reads return the data, DTR on the bus only when expected
+static void DtrTest_reads(bool expectDtr)
+{
+	uint32_t before = DtrTest_dtrCommands();
+
+	memset(dtrTestRead, 0, sizeof(dtrTestRead));
+	TEST_CHECK(W25q_readBytes(DTR_TEST_ADDRESS, dtrTestRead, sizeof(dtrTestRead)));
+	TEST_CHECK(memcmp(dtrTestRead, dtrTestData, sizeof(dtrTestData)) == 0);
+
+	TEST_CHECK(W25q_memoryMappedModeEnable());
+	SimQspi_mappedFetch(DTR_TEST_ADDRESS, sizeof(dtrTestData));
+	TEST_CHECK(memcmp((const uint8_t *)QSPI_BASE + DTR_TEST_ADDRESS, dtrTestData, sizeof(dtrTestData)) == 0);
+	TEST_CHECK(W25q_memoryMappedModeDisable());
+
+	TEST_CHECK((DtrTest_dtrCommands() - before) == (expectDtr ? 2u : 0u));
+}
+
+//! What init picked, then DTR asked for again at runtime
+static void DtrTest_part(const char *name, bool expectDtr)
+{
+	TEST_CHECK(SimFlash_load(DTR_TEST_ADDRESS, dtrTestData, sizeof(dtrTestData)));
+	TEST_CHECK(W25q_init(&testQspi));
+	TEST_CHECK(W25q_getConfig()->read.ddr == expectDtr);
+	DtrTest_reads(expectDtr);
+
+	TEST_CHECK(W25q_setDtrRead(true) == expectDtr);
+	TEST_CHECK(W25q_getConfig()->read.ddr == expectDtr);
+	DtrTest_reads(expectDtr);
+
+	// Off is always possible and gives back the SDR read init chose
+	TEST_CHECK(W25q_setDtrRead(false));
+	TEST_CHECK(!W25q_getConfig()->read.ddr);
+	TEST_CHECK(W25q_getConfig()->read.instruction != W25Q_INSTR_FAST_READ_QUAD_DTR);
+	DtrTest_reads(false);
+
+	printf("%s,%s,0x%02X\n", name, expectDtr ? "dtr" : "sdr", (unsigned)W25q_getConfig()->read.instruction);
+	Test_checkProtocol();
+}
+
+int main(void)
+{
+	Test_fill(dtrTestData, sizeof(dtrTestData), 30);
+
+	printf("part,init_read,sdr_instruction\n");
+
+	TEST_CHECK(Test_attach(&SimFlash_w25q128jvIm, TEST_NOR_FLASH_SIZE));
+	DtrTest_part("W25Q128JV-IM", true);
+
+	// The IQ variant has no DTR, init falls back to SDR on its own
+	TEST_CHECK(Test_attach(&SimFlash_w25q256jvIq, TEST_NOR_FLASH_SIZE));
+	DtrTest_part("W25Q256JV-IQ", false);
+
+	// A DTR capable ID whose SFDP says no, the table wins
+	TEST_CHECK(Test_attach(&SimFlash_w25q128jvIm, TEST_NOR_FLASH_SIZE));
+	memcpy(dtrTestSfdp, SimFlash_sfdp(), sizeof(dtrTestSfdp));
+	dtrTestSfdp[DTR_TEST_SFDP_DTR_BYTE] &= (uint8_t)~DTR_TEST_SFDP_DTR_BIT;
+	TEST_CHECK(SimFlash_setSfdp(dtrTestSfdp, sizeof(dtrTestSfdp)));
+	DtrTest_part("W25Q128JV-IM_sfdp_no_dtr", false);
+
+	return Test_result("dtrtest");
+}
@@ -0,0 +1,164 @@
+/*
+ * This program is host test of the W25Q fast boot path, timing the first read after reset on a simulated bus.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testutil.h"
+#include "w25q.h"
+
+#define BOOT_TEST_FLASH_SIZE	24			//!< 32MB, the W25Q256 needs the 4-byte read
+#define BOOT_TEST_ASSET			0x1800000	//!< Above 16MB, only reachable with the address mode restored
+#define BOOT_TEST_LINE			32
+
+typedef enum {
+	BOOT_TEST_FULL,				//!< W25q_init, what boot does today
+	BOOT_TEST_FAST,				//!< W25q_fastInit with the saved snapshot
+} BootTestPath;
+
+static W25qBootState bootTestState;
+static uint8_t bootTestAsset[W25Q_PAGE_SIZE];
+
+//! MCU reset with the part kept powered, or a power cycle of both
+static void BootTest_reset(bool powerCycle)
+{
+	if (powerCycle) {
+		SimFlash_powerCycle();
+	}
+
+	SimQspi_reset();
+	memset(&testQspi, 0, sizeof(testQspi));
+	TEST_CHECK(QuadSpi_Init(&testQspi, BOOT_TEST_FLASH_SIZE));
+}
+
+//! Boots one way and reads the asset, returns the time from QuadSpi_Init to the data
+static uint64_t BootTest_firstRead(const char *name, BootTestPath path, bool memoryMapped, bool *fromSnapshot)
+{
+	uint8_t line[BOOT_TEST_LINE];
+	bool success;
+
+	*fromSnapshot = false;
+	uint64_t start = SimQspi_nowNs();
+
+	if (path == BOOT_TEST_FAST) {
+		success = W25q_fastInit(&testQspi, &bootTestState, memoryMapped, fromSnapshot);
+	} else {
+		success = W25q_init(&testQspi) && (!memoryMapped || W25q_memoryMappedModeEnable());
+	}
+
+	TEST_CHECK(success);
+
+	if (memoryMapped) {
+		SimQspi_mappedFetch(BOOT_TEST_ASSET, sizeof(line));
+		memcpy(line, (const uint8_t *)QSPI_BASE + BOOT_TEST_ASSET, sizeof(line));
+	} else {
+		TEST_CHECK(W25q_readBytes(BOOT_TEST_ASSET, line, sizeof(line)));
+	}
+
+	uint64_t elapsedNs = SimQspi_nowNs() - start;
+
+	TEST_CHECK(memcmp(line, bootTestAsset, sizeof(line)) == 0);
+	printf("%s,%s,%s,%llu,%.2f\n", name, (path == BOOT_TEST_FAST) ? "fast" : "full", memoryMapped ? "mapped" : "indirect",
+			(unsigned long long)SimQspi_getStats()->transactions, elapsedNs / 1e3);
+
+	if (memoryMapped) {
+		TEST_CHECK(W25q_memoryMappedModeDisable());
+	}
+
+	Test_checkProtocol();
+
+	return elapsedNs;
+}
+
+//! Full and fast boot of the same part, after a reset and after a power cycle
+static void BootTest_part(const SimFlashModel *model, const char *name)
+{
+	bool fromSnapshot;
+
+	TEST_CHECK(Test_attach(model, BOOT_TEST_FLASH_SIZE));
+	TEST_CHECK(SimFlash_load(BOOT_TEST_ASSET, bootTestAsset, sizeof(bootTestAsset)));
+	TEST_CHECK(W25q_init(&testQspi));
+	TEST_CHECK(W25q_setWrapRead(BOOT_TEST_LINE));
+	TEST_CHECK(W25q_saveBootState(&bootTestState, NULL));
+
+	for (uint32_t i = 0; i < 2; i++) {
+		bool memoryMapped = (i == 0);
+
+		BootTest_reset(true);
+		uint64_t fullNs = BootTest_firstRead(name, BOOT_TEST_FULL, memoryMapped, &fromSnapshot);
+
+		BootTest_reset(true);
+		uint64_t fastNs = BootTest_firstRead(name, BOOT_TEST_FAST, memoryMapped, &fromSnapshot);
+
+		TEST_CHECK(fromSnapshot);
+		TEST_CHECK(fastNs < (fullNs / 2u));
+
+		// An MCU reset leaves the part as it was, the snapshot still holds
+		BootTest_reset(false);
+		BootTest_firstRead(name, BOOT_TEST_FAST, memoryMapped, &fromSnapshot);
+		TEST_CHECK(fromSnapshot);
+	}
+
+	// The restored read is the one the full init chose, wrap included
+	TEST_CHECK(W25q_getConfig()->wrapSize == BOOT_TEST_LINE);
+	TEST_CHECK(memcmp(&W25q_getConfig()->read, &bootTestState.config.read, sizeof(W25qReadConfig)) == 0);
+}
+
+//! A snapshot that no longer matches takes the full path and still boots
+static void BootTest_mismatch(void)
+{
+	bool fromSnapshot;
+
+	TEST_CHECK(Test_attach(&SimFlash_w25q256jvIq, BOOT_TEST_FLASH_SIZE));
+	TEST_CHECK(SimFlash_load(BOOT_TEST_ASSET, bootTestAsset, sizeof(bootTestAsset)));
+	TEST_CHECK(W25q_init(&testQspi));
+	TEST_CHECK(W25q_saveBootState(&bootTestState, NULL));
+
+	// Block protection set since the snapshot was taken
+	TEST_CHECK(W25q_writeStatusRegister(W25Q_INSTR_WRITE_STATUS_REG1, W25Q_STATUS_REG1_BP0));
+	W25q_waitForReady();
+	BootTest_reset(true);
+	BootTest_firstRead("protection_changed", BOOT_TEST_FAST, true, &fromSnapshot);
+	TEST_CHECK(!fromSnapshot);
+
+	// A damaged snapshot is never trusted
+	TEST_CHECK(W25q_writeStatusRegister(W25Q_INSTR_WRITE_STATUS_REG1, 0));
+	W25q_waitForReady();
+	bootTestState.config.read.dummyCycles++;
+	BootTest_reset(true);
+	BootTest_firstRead("bad_checksum", BOOT_TEST_FAST, true, &fromSnapshot);
+	TEST_CHECK(!fromSnapshot);
+
+	// Another part on the board
+	TEST_CHECK(W25q_saveBootState(&bootTestState, NULL));
+	TEST_CHECK(Test_attach(&SimFlash_w25q128jvIm, BOOT_TEST_FLASH_SIZE));
+	TEST_CHECK(W25q_fastInit(&testQspi, &bootTestState, false, &fromSnapshot));
+	TEST_CHECK(!fromSnapshot);
+	TEST_CHECK(W25q_getDevice() != NULL);
+	Test_checkProtocol();
+}
+
+int main(void)
+{
+	Test_fill(bootTestAsset, sizeof(bootTestAsset), 49);
+
+	printf("boot,path,first_read,commands,us\n");
+	BootTest_part(&SimFlash_w25q256jvIq, "W25Q256JV");
+	BootTest_mismatch();
+
+	return Test_result("fastboottest");
+}
@@ -0,0 +1,221 @@
+/*
+ * This program is host test of factory bulk programming, timed against the per-page API on simulated parts.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+
+#include "testutil.h"
+#include "flashbulk.h"
+#include "flashverify.h"
+#include "w25q.h"
+#include "w25n01g.h"
+
+#define BULK_TEST_NOR_BYTES		(16u * 1024u * 1024u)		//!< The whole W25Q128JV
+#define BULK_TEST_NAND_BYTES	(16u * 1024u * 1024u)		//!< 128 blocks of the W25N01GV
+#define BULK_TEST_BLANK_EVERY	16u							//!< Every 16th page of the image is left erased
+#define BULK_TEST_BAD_BLOCK		100u						//!< Inside the NAND image, the image is blank there
+
+static uint8_t *bulkTestImage;
+static uint8_t *bulkTestRead;
+
+//! Image with blank pages, as a linker leaves between sections
+static void BulkTest_image(uint32_t length, uint32_t pageSize)
+{
+	Test_fill(bulkTestImage, length, 46);
+
+	for (uint32_t page = 0; page < (length / pageSize); page += BULK_TEST_BLANK_EVERY) {
+		memset(&bulkTestImage[page * pageSize], 0xFF, pageSize);
+	}
+}
+
+static void BulkTest_report(const char *part, const char *path, uint32_t length, uint64_t elapsedNs)
+{
+	printf("%s,%s,%u,%.0f,%.2f\n", part, path, length, elapsedNs / 1e6, (double)length * 1e3 / (double)elapsedNs);
+}
+
+//! Today's path on a blank part: one W25q_quadPageProgram per page, read back the whole image
+static uint64_t BulkTest_w25qPerPage(uint32_t length)
+{
+	uint64_t start = SimQspi_nowNs();
+
+	for (uint32_t offset = 0; offset < length; offset += W25Q_PAGE_SIZE) {
+		TEST_CHECK(W25q_quadPageProgram(offset, &bulkTestImage[offset], W25Q_PAGE_SIZE));
+	}
+
+	W25q_waitForReady();
+	TEST_CHECK(W25q_readBytes(0, bulkTestRead, length));
+	TEST_CHECK(memcmp(bulkTestRead, bulkTestImage, length) == 0);
+
+	return SimQspi_nowNs() - start;
+}
+
+static void BulkTest_w25q(void)
+{
+	const SimFlashModel *model = &SimFlash_w25q128jvIm;
+	FlashBulkResult result;
+	uint32_t pages = BULK_TEST_NOR_BYTES / W25Q_PAGE_SIZE;
+	uint32_t blankPages = pages / BULK_TEST_BLANK_EVERY;
+
+	BulkTest_image(BULK_TEST_NOR_BYTES, W25Q_PAGE_SIZE);
+
+	TEST_CHECK(Test_attach(model, TEST_NOR_FLASH_SIZE));
+	TEST_CHECK(W25q_init(&testQspi));
+
+	uint64_t perPageNs = BulkTest_w25qPerPage(BULK_TEST_NOR_BYTES);
+
+	BulkTest_report("W25Q128JV", "per_page", BULK_TEST_NOR_BYTES, perPageNs);
+	TEST_CHECK(SimFlash_getStats()->programs == pages);
+	Test_checkProtocol();
+
+	// Same image on a fresh part through the bulk path
+	TEST_CHECK(Test_attach(model, TEST_NOR_FLASH_SIZE));
+	TEST_CHECK(W25q_init(&testQspi));
+
+	uint64_t start = SimQspi_nowNs();
+
+	TEST_CHECK(FlashBulk_w25qProgram(0, BULK_TEST_NOR_BYTES, FlashBulk_memorySource, bulkTestImage, FLASH_BULK_ASSUME_BLANK, &result));
+
+	uint64_t bulkNs = SimQspi_nowNs() - start;
+
+	BulkTest_report("W25Q128JV", "bulk", BULK_TEST_NOR_BYTES, bulkNs);
+
+	TEST_CHECK(result.verified);
+	TEST_CHECK(result.mismatchOffset == FLASH_VERIFY_NO_OFFSET);
+	TEST_CHECK(result.crc == FlashVerify_crc32Update(0, bulkTestImage, BULK_TEST_NOR_BYTES));
+	TEST_CHECK(result.pagesSkipped == blankPages);
+	TEST_CHECK(result.pagesProgrammed == (pages - blankPages));
+	TEST_CHECK(SimFlash_getStats()->programs == result.pagesProgrammed);
+	TEST_CHECK(bulkNs < perPageNs);
+
+	// Back to back programs, the bus and the read-back add a few percent to the part's own time
+	uint64_t programNs = (uint64_t)result.pagesProgrammed * model->pageProgramUs * 1000u;
+
+	TEST_CHECK(bulkNs < (programNs + (programNs / 20u)));
+	Test_checkProtocol();
+
+	// Chip erase clears what was there, without it a page that is not blank is caught by the digest
+	uint8_t zeros[W25Q_PAGE_SIZE] = { 0 };
+	uint32_t dirty = BULK_TEST_BLANK_EVERY * W25Q_PAGE_SIZE;
+
+	TEST_CHECK(Test_attach(model, TEST_NOR_FLASH_SIZE));
+	TEST_CHECK(W25q_init(&testQspi));
+	TEST_CHECK(SimFlash_load(dirty, zeros, sizeof(zeros)));
+	TEST_CHECK(FlashBulk_w25qProgram(0, 64u * 1024u, FlashBulk_memorySource, bulkTestImage, FLASH_BULK_CHIP_ERASE, &result));
+	TEST_CHECK(result.verified);
+	TEST_CHECK(result.elapsedMs >= model->chipEraseMs);
+
+	TEST_CHECK(Test_attach(model, TEST_NOR_FLASH_SIZE));
+	TEST_CHECK(W25q_init(&testQspi));
+	TEST_CHECK(SimFlash_load(dirty, zeros, sizeof(zeros)));
+	TEST_CHECK(!FlashBulk_w25qProgram(0, 64u * 1024u, FlashBulk_memorySource, bulkTestImage, FLASH_BULK_ASSUME_BLANK, &result));
+	TEST_CHECK(!result.verified);
+	Test_checkProtocol();
+}
+
+//! Today's path: erase the blocks, w25n01g_writeFlash, read back
+static uint64_t BulkTest_w25n01gPerPage(uint32_t length)
+{
+	uint64_t start = SimQspi_nowNs();
+
+	for (uint32_t address = 0; address < length; address += W25N01G_BLOCK_SIZE) {
+		TEST_CHECK(W25n01g_blockErase(&testQspi, address));
+		W25n01g_waitForReady(&testQspi);
+	}
+
+	TEST_CHECK(w25n01g_writeFlash(&testQspi, 0, bulkTestImage, length));
+	W25n01g_waitForReady(&testQspi);
+
+	for (uint32_t address = 0; address < length; address += W25N01G_PAGE_SIZE) {
+		TEST_CHECK(W25n01g_readBytes(&testQspi, address, &bulkTestRead[address], W25N01G_PAGE_SIZE, true) == W25N01G_PAGE_SIZE);
+	}
+
+	TEST_CHECK(memcmp(bulkTestRead, bulkTestImage, length) == 0);
+
+	return SimQspi_nowNs() - start;
+}
+
+static void BulkTest_w25n01g(void)
+{
+	FlashBulkResult result;
+	uint32_t pages = BULK_TEST_NAND_BYTES / W25N01G_PAGE_SIZE;
+	uint32_t blankPages = pages / BULK_TEST_BLANK_EVERY;
+
+	BulkTest_image(BULK_TEST_NAND_BYTES, W25N01G_PAGE_SIZE);
+
+	TEST_CHECK(Test_attach(&SimFlash_w25n01gv, TEST_NAND_FLASH_SIZE));
+	TEST_CHECK(W25n01g_init(&testQspi));
+
+	uint64_t perPageNs = BulkTest_w25n01gPerPage(BULK_TEST_NAND_BYTES);
+
+	BulkTest_report("W25N01GV", "per_page", BULK_TEST_NAND_BYTES, perPageNs);
+	Test_checkProtocol();
+
+	TEST_CHECK(Test_attach(&SimFlash_w25n01gv, TEST_NAND_FLASH_SIZE));
+	TEST_CHECK(W25n01g_init(&testQspi));
+
+	uint64_t start = SimQspi_nowNs();
+
+	TEST_CHECK(FlashBulk_w25n01gProgram(&testQspi, 0, BULK_TEST_NAND_BYTES, FlashBulk_memorySource, bulkTestImage, FLASH_BULK_ERASE_RANGE, &result));
+
+	uint64_t bulkNs = SimQspi_nowNs() - start;
+
+	BulkTest_report("W25N01GV", "bulk", BULK_TEST_NAND_BYTES, bulkNs);
+
+	TEST_CHECK(result.verified);
+	TEST_CHECK(result.crc == FlashVerify_crc32Update(0, bulkTestImage, BULK_TEST_NAND_BYTES));
+	TEST_CHECK(result.pagesSkipped == blankPages);
+	TEST_CHECK(result.pagesProgrammed == (pages - blankPages));
+	TEST_CHECK(result.blocksErased == (BULK_TEST_NAND_BYTES / W25N01G_BLOCK_SIZE));
+	TEST_CHECK(result.badBlocks == 0);
+	TEST_CHECK(bulkNs < perPageNs);
+	Test_checkProtocol();
+
+	// A factory bad block under blank image pages is left alone, under data it fails the run
+	uint32_t badAddress = BULK_TEST_BAD_BLOCK * W25N01G_BLOCK_SIZE;
+
+	memset(&bulkTestImage[badAddress], 0xFF, W25N01G_BLOCK_SIZE);
+	TEST_CHECK(Test_attach(&SimFlash_w25n01gv, TEST_NAND_FLASH_SIZE));
+	SimFlash_markBadBlock(BULK_TEST_BAD_BLOCK);
+	TEST_CHECK(W25n01g_init(&testQspi));
+	TEST_CHECK(FlashBulk_w25n01gProgram(&testQspi, 0, BULK_TEST_NAND_BYTES, FlashBulk_memorySource, bulkTestImage, FLASH_BULK_ASSUME_BLANK, &result));
+	TEST_CHECK(result.verified);
+	TEST_CHECK(result.badBlocks == 1);
+
+	bulkTestImage[badAddress] = 0x00;
+	TEST_CHECK(!FlashBulk_w25n01gProgram(&testQspi, 0, BULK_TEST_NAND_BYTES, FlashBulk_memorySource, bulkTestImage, FLASH_BULK_ERASE_RANGE, &result));
+	TEST_CHECK(result.mismatchOffset == badAddress);
+	Test_checkProtocol();
+}
+
+int main(void)
+{
+	bulkTestImage = malloc(BULK_TEST_NOR_BYTES);
+	bulkTestRead = malloc(BULK_TEST_NOR_BYTES);
+
+	TEST_CHECK((bulkTestImage != NULL) && (bulkTestRead != NULL));
+
+	printf("part,path,bytes,sim_ms,mb_per_s\n");
+	BulkTest_w25q();
+	BulkTest_w25n01g();
+
+	free(bulkTestImage);
+	free(bulkTestRead);
+
+	return Test_result("flashbulktest");
+}
@@ -0,0 +1,177 @@
+/*
+ * This program is host test of the device table, every simulated part against the geometry the driver reports for it.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testutil.h"
+#include "w25q.h"
+#include "w25n01g.h"
+
+#define DEVICE_TEST_NOR_SECTOR		4096u
+#define DEVICE_TEST_MAX_PAGE		2048u
+
+static const SimFlashModel *const deviceTestModels[] = {
+	&SimFlash_w25q128jvIm,
+	&SimFlash_w25q256jvIq,
+	&SimFlash_w25q512jvIq,
+	&SimFlash_w25m512jv,
+	&SimFlash_w25n01gv,
+	&SimFlash_w25n02kv,
+	&SimFlash_w25m02gv,
+};
+
+static uint8_t deviceTestData[DEVICE_TEST_MAX_PAGE];
+static uint8_t deviceTestRead[DEVICE_TEST_MAX_PAGE];
+
+//! Last page of the last die programmed through the driver, nothing lands at the address one die bit lower
+static void DeviceTest_lastPage(const SimFlashModel *model, const FlashDevice *device)
+{
+	uint32_t pageSize = FlashDevice_pageSize(device);
+	uint32_t address = FlashDevice_totalCapacity(device) - pageSize;
+	uint32_t alias = address - (FlashDevice_capacity(device) >> 1);
+
+	if (model->type == SIM_FLASH_NOR) {
+		TEST_CHECK(W25q_sectorErase(address));
+		TEST_CHECK(W25q_writeBytes(address, deviceTestData, pageSize));
+		TEST_CHECK(W25q_waitForReady());
+		TEST_CHECK(W25q_readBytes(address, deviceTestRead, pageSize));
+	} else {
+		TEST_CHECK(W25n01g_blockErase(&testQspi, address));
+		TEST_CHECK(w25n01g_writeFlash(&testQspi, address, deviceTestData, pageSize));
+		TEST_CHECK(W25n01g_readBytes(&testQspi, address, deviceTestRead, pageSize, true) == pageSize);
+	}
+
+	TEST_CHECK(memcmp(deviceTestRead, deviceTestData, pageSize) == 0);
+	TEST_CHECK(SimFlash_peek(address, deviceTestRead, pageSize));
+	TEST_CHECK(memcmp(deviceTestRead, deviceTestData, pageSize) == 0);
+	TEST_CHECK(SimFlash_peek(alias, deviceTestRead, pageSize));
+	TEST_CHECK((deviceTestRead[0] == 0xFF) && (deviceTestRead[pageSize - 1u] == 0xFF));
+}
+
+//! ECC-1:0 after a page read, 11 is a correction on 8-bit ECC parts and a failure on the others
+static void DeviceTest_ecc(const FlashDevice *device)
+{
+	bool ecc8 = ((device->features & FLASH_DEVICE_FEATURE_ECC_8BIT) != 0);
+	static const struct {
+		uint8_t bits;
+		W25n01gEcc ecc1;
+		W25n01gEcc ecc8;
+	} cases[] = {
+		{ 0, W25N01G_ECC_CLEAN, W25N01G_ECC_CLEAN },
+		{ 1, W25N01G_ECC_CORRECTED, W25N01G_ECC_CORRECTED },
+		{ 2, W25N01G_ECC_UNCORRECTABLE, W25N01G_ECC_UNCORRECTABLE },
+		{ 3, W25N01G_ECC_UNCORRECTABLE, W25N01G_ECC_CORRECTED },
+	};
+
+	TEST_CHECK(W25n01g_selectDie(&testQspi, 0));
+
+	// A new page each time, the loaded one would not be read again
+	for (uint32_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		SimFlash_injectEcc(cases[i].bits);
+		TEST_CHECK(W25n01g_readPageData(&testQspi, i + 1u, 0, deviceTestRead, 16));
+		TEST_CHECK(W25n01g_readEcc(&testQspi) == (ecc8 ? cases[i].ecc8 : cases[i].ecc1));
+	}
+
+	TEST_CHECK(W25n01g_readPageData(&testQspi, 0, 0, deviceTestRead, 16));
+	TEST_CHECK(W25n01g_readEcc(&testQspi) == W25N01G_ECC_CLEAN);
+}
+
+//! Spare area to its last byte and the factory marker of the last block
+static void DeviceTest_spare(const FlashDevice *device)
+{
+	uint32_t lastBlock = FlashDevice_totalBlocks(device) - 1u;
+	uint32_t page = FlashDevice_blockToPage(device, lastBlock) & (FlashDevice_pagesPerDie(device) - 1u);
+	uint8_t spare = 0;
+
+	TEST_CHECK(W25n01g_selectDie(&testQspi, (uint8_t)(device->dieCount - 1u)));
+	TEST_CHECK(W25n01g_readPageData(&testQspi, page, (uint16_t)(FlashDevice_pageSize(device) + device->spareSize - 1u), &spare, 1));
+	TEST_CHECK(spare == 0xFF);
+
+	TEST_CHECK(!W25n01g_isBlockBad(&testQspi, lastBlock));
+
+	// Marked behind the driver's back while another page sits in the buffer
+	TEST_CHECK(!W25n01g_isBlockBad(&testQspi, lastBlock - 1u));
+	SimFlash_markBadBlock(lastBlock);
+	TEST_CHECK(W25n01g_isBlockBad(&testQspi, lastBlock));
+}
+
+static void DeviceTest_part(const SimFlashModel *model)
+{
+	const FlashDevice *device = NULL;
+	bool nand = (model->type == SIM_FLASH_NAND);
+
+	TEST_CHECK(Test_attach(model, nand ? TEST_NAND_FLASH_SIZE : TEST_NOR_FLASH_SIZE));
+
+	if (nand) {
+		TEST_CHECK(W25n01g_init(&testQspi));
+		device = W25n01g_getDevice();
+	} else {
+		TEST_CHECK(W25q_init(&testQspi));
+		device = W25q_getDevice();
+	}
+
+	TEST_CHECK(device != NULL);
+	if (device == NULL) {
+		return;
+	}
+
+	TEST_CHECK(strcmp(device->name, model->name) == 0);
+	TEST_CHECK(device->type == (nand ? FLASH_DEVICE_TYPE_NAND : FLASH_DEVICE_TYPE_NOR));
+	TEST_CHECK(FlashDevice_pageSize(device) == model->pageSize);
+	TEST_CHECK(FlashDevice_capacity(device) == model->dieCapacity);
+	TEST_CHECK(device->dieCount == model->dieCount);
+	TEST_CHECK(FlashDevice_totalCapacity(device) == (model->dieCapacity * model->dieCount));
+
+	if (nand) {
+		TEST_CHECK(FlashDevice_blockSize(device) == (model->pageSize * model->pagesPerBlock));
+		TEST_CHECK(FlashDevice_sectorSize(device) == FlashDevice_blockSize(device));
+		TEST_CHECK(device->spareSize == model->spareSize);
+		TEST_CHECK(FlashDevice_totalBlocks(device) == ((model->dieCapacity / (model->pageSize * model->pagesPerBlock)) * model->dieCount));
+		TEST_CHECK(FlashDevice_totalBlocks(device) <= FLASH_DEVICE_NAND_MAX_BLOCKS);
+		DeviceTest_ecc(device);
+	} else {
+		TEST_CHECK(FlashDevice_sectorSize(device) == DEVICE_TEST_NOR_SECTOR);
+		TEST_CHECK(device->addressBytes == model->addressBytes);
+		TEST_CHECK(device->spareSize == 0);
+		TEST_CHECK(((device->features & FLASH_DEVICE_FEATURE_DTR) != 0) == model->dtr);
+	}
+
+	DeviceTest_lastPage(model, device);
+
+	if (nand) {
+		DeviceTest_spare(device);
+	}
+
+	printf("%s,%s,%u,%u,%u,%u,%u,%u\n", device->name, nand ? "nand" : "nor",
+			(unsigned)FlashDevice_pageSize(device), (unsigned)device->spareSize, (unsigned)FlashDevice_sectorSize(device),
+			(unsigned)FlashDevice_blockSize(device), (unsigned)(FlashDevice_capacity(device) >> 20), (unsigned)device->dieCount);
+	Test_checkProtocol();
+}
+
+int main(void)
+{
+	Test_fill(deviceTestData, sizeof(deviceTestData), 27);
+
+	printf("part,type,page,spare,sector,block,die_mb,dies\n");
+
+	for (uint32_t i = 0; i < sizeof(deviceTestModels) / sizeof(deviceTestModels[0]); i++) {
+		DeviceTest_part(deviceTestModels[i]);
+	}
+
+	return Test_result("flashdevicetest");
+}
@@ -0,0 +1,201 @@
+/*
+ * This program is host test of the scatter-gather paths, fragments across NOR pages and NAND buffer loads.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testutil.h"
+#include "w25q.h"
+#include "w25n01g.h"
+
+#define IO_TEST_NOR				(0x50000 + 200u)					//!< 56 bytes short of a page end
+#define IO_TEST_NAND			((48u * W25N01G_BLOCK_SIZE) + 1500u)	//!< 548 bytes short of a page end
+#define IO_TEST_BUFFER			(3u * W25N01G_PAGE_SIZE)
+#define IO_TEST_MAX_FRAGMENTS	12
+
+// Fragment lengths, zero-length ones included, the sums cross page boundaries
+static const uint32_t ioTestNorWrite[] = { 0, 40, 0, 16, 300, 0, 1, 255, 0, 100, 0 };		//!< 712 bytes, 4 pages
+static const uint32_t ioTestNorRead[] = { 56, 0, 0, 256, 7, 393, 0 };
+static const uint32_t ioTestNandWrite[] = { 0, 500, 48, 0, 2000, 1, 0, 1547, 0 };			//!< 4096 bytes, 3 pages
+static const uint32_t ioTestNandRead[] = { 0, 548, 0, 2048, 3, 1497, 0 };
+
+static uint8_t ioTestData[IO_TEST_BUFFER];
+static uint8_t ioTestRead[IO_TEST_BUFFER];
+static uint8_t ioTestPeek[IO_TEST_BUFFER];
+static FlashIoVec ioTestIov[IO_TEST_MAX_FRAGMENTS];
+
+//! Fragments laid end to end over buffer, returns the total length
+static uint32_t IoTest_vector(uint8_t *buffer, const uint32_t *lengths, uint32_t count)
+{
+	uint32_t offset = 0;
+
+	for (uint32_t i = 0; i < count; i++) {
+		ioTestIov[i].base = &buffer[offset];
+		ioTestIov[i].length = lengths[i];
+		offset += lengths[i];
+	}
+
+	return offset;
+}
+
+//! Page boundaries a transfer of length at address crosses, plus one
+static uint32_t IoTest_pages(uint32_t address, uint32_t length, uint32_t pageSize)
+{
+	return ((address + length - 1u) / pageSize) - (address / pageSize) + 1u;
+}
+
+//! Zero-length fragments on either side of the data, two commands sharing one cursor
+static void IoTest_cursor(void)
+{
+	static const uint32_t lengths[] = { 0, 0, 10, 0, 30, 0, 24, 0 };
+	uint32_t length = IoTest_vector(ioTestRead, lengths, sizeof(lengths) / sizeof(lengths[0]));
+	FlashIoCursor cursor;
+	QSPI_CommandTypeDef cmd;
+
+	memset(ioTestRead, 0, sizeof(ioTestRead));
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.InstructionMode		= QSPI_INSTRUCTION_1_LINE;
+	cmd.Instruction			= 0x0B;
+	cmd.AddressMode			= QSPI_ADDRESS_1_LINE;
+	cmd.AddressSize			= QSPI_ADDRESS_24_BITS;
+	cmd.DataMode			= QSPI_DATA_1_LINE;
+	cmd.DummyCycles			= 8;
+
+	FlashIoCursor_init(&cursor, ioTestIov, sizeof(lengths) / sizeof(lengths[0]));
+	TEST_CHECK(cursor.index == 2);
+
+	// The first command ends inside the second fragment, the next one carries on from there
+	cmd.Address = IO_TEST_NOR;
+	cmd.NbData = 25;
+	TEST_CHECK(QuadSpiReceiveCursor(&testQspi, &cmd, &cursor));
+	TEST_CHECK((cursor.index == 4) && (cursor.offset == 15));
+
+	cmd.Address = IO_TEST_NOR + 25u;
+	cmd.NbData = length - 25u;
+	TEST_CHECK(QuadSpiReceiveCursor(&testQspi, &cmd, &cursor));
+	TEST_CHECK(FlashIoCursor_done(&cursor));
+	TEST_CHECK(memcmp(ioTestRead, ioTestData, length) == 0);
+
+	// Fewer bytes in the fragments than the command moves is refused, not overrun
+	FlashIoCursor_init(&cursor, ioTestIov, 2);
+	cmd.NbData = 4;
+	TEST_CHECK(!QuadSpiReceiveCursor(&testQspi, &cmd, &cursor));
+}
+
+static void IoTest_w25q(void)
+{
+	uint32_t count = sizeof(ioTestNorWrite) / sizeof(ioTestNorWrite[0]);
+	uint32_t length = IoTest_vector(ioTestData, ioTestNorWrite, count);
+
+	TEST_CHECK(Test_attach(&SimFlash_w25q128jvIm, TEST_NOR_FLASH_SIZE));
+	TEST_CHECK(W25q_init(&testQspi));
+	TEST_CHECK(W25q_sectorErase(IO_TEST_NOR));
+	TEST_CHECK(W25q_waitForReady());
+
+	// One page program per page touched, each fed from every fragment it spans
+	uint32_t programs = SimQspi_getStats()->opcodes[W25_INSTR_QUAD_INPUT_PAGE_PROGRAM];
+
+	TEST_CHECK(W25q_writeVector(IO_TEST_NOR, ioTestIov, count));
+	TEST_CHECK(W25q_waitForReady());
+	TEST_CHECK(SimQspi_getStats()->opcodes[W25_INSTR_QUAD_INPUT_PAGE_PROGRAM] - programs == IoTest_pages(IO_TEST_NOR, length, W25Q_PAGE_SIZE));
+	TEST_CHECK(SimFlash_peek(IO_TEST_NOR, ioTestPeek, length));
+	TEST_CHECK(memcmp(ioTestPeek, ioTestData, length) == 0);
+
+	// Read back with other fragment boundaries, one command for the whole vector
+	uint32_t transactions = (uint32_t)SimQspi_getStats()->transactions;
+
+	memset(ioTestRead, 0, sizeof(ioTestRead));
+	count = sizeof(ioTestNorRead) / sizeof(ioTestNorRead[0]);
+	TEST_CHECK(IoTest_vector(ioTestRead, ioTestNorRead, count) == length);
+	TEST_CHECK(W25q_readVector(IO_TEST_NOR, ioTestIov, count));
+	TEST_CHECK((uint32_t)SimQspi_getStats()->transactions - transactions == 1u);
+	TEST_CHECK(memcmp(ioTestRead, ioTestData, length) == 0);
+
+	IoTest_cursor();
+
+	// Only empty fragments, nothing goes out
+	static const uint32_t empty[] = { 0, 0, 0 };
+
+	transactions = (uint32_t)SimQspi_getStats()->transactions;
+	IoTest_vector(ioTestRead, empty, 3);
+	TEST_CHECK(W25q_writeVector(IO_TEST_NOR, ioTestIov, 3));
+	TEST_CHECK(W25q_readVector(IO_TEST_NOR, ioTestIov, 3));
+	TEST_CHECK(W25q_writeVector(IO_TEST_NOR, ioTestIov, 0));
+	TEST_CHECK((uint32_t)SimQspi_getStats()->transactions == transactions);
+
+	Test_checkProtocol();
+}
+
+static void IoTest_w25n01g(void)
+{
+	uint32_t count = sizeof(ioTestNandWrite) / sizeof(ioTestNandWrite[0]);
+	uint32_t length = IoTest_vector(ioTestData, ioTestNandWrite, count);
+	uint32_t pages = IoTest_pages(IO_TEST_NAND, length, W25N01G_PAGE_SIZE);
+
+	TEST_CHECK(Test_attach(&SimFlash_w25n01gv, TEST_NAND_FLASH_SIZE));
+	TEST_CHECK(W25n01g_init(&testQspi));
+	TEST_CHECK(W25n01g_blockErase(&testQspi, IO_TEST_NAND));
+	TEST_CHECK(W25n01g_waitForReady(&testQspi));
+
+	// Per page: one PROGRAM DATA LOAD, a RANDOM PROGRAM DATA LOAD for each further piece, one PROGRAM EXECUTE
+	const SimQspiStats *bus = SimQspi_getStats();
+	uint32_t loads = bus->opcodes[W25N01G_INSTR_PROGRAM_DATA_LOAD];
+	uint32_t randomLoads = bus->opcodes[W25N01G_INSTR_RANDOM_PROGRAM_DATA_LOAD];
+	uint32_t executes = bus->opcodes[W25N01G_INSTR_PROGRAM_EXECUTE];
+	uint32_t pieces = 0;
+	uint32_t address = IO_TEST_NAND;
+
+	for (uint32_t i = 0; i < count; i++) {
+		for (uint32_t done = 0; done < ioTestNandWrite[i]; ) {
+			uint32_t room = W25N01G_PAGE_SIZE - (address % W25N01G_PAGE_SIZE);
+			uint32_t step = ((ioTestNandWrite[i] - done) < room) ? (ioTestNandWrite[i] - done) : room;
+
+			pieces++;
+			done += step;
+			address += step;
+		}
+	}
+
+	TEST_CHECK(w25n01g_writeVector(&testQspi, IO_TEST_NAND, ioTestIov, count));
+	TEST_CHECK(bus->opcodes[W25N01G_INSTR_PROGRAM_DATA_LOAD] - loads == pages);
+	TEST_CHECK(bus->opcodes[W25N01G_INSTR_RANDOM_PROGRAM_DATA_LOAD] - randomLoads == pieces - pages);
+	TEST_CHECK(bus->opcodes[W25N01G_INSTR_PROGRAM_EXECUTE] - executes == pages);
+	TEST_CHECK(SimFlash_peek(IO_TEST_NAND, ioTestPeek, length));
+	TEST_CHECK(memcmp(ioTestPeek, ioTestData, length) == 0);
+
+	// The bytes in front of the first column stay erased, the load starts the buffer over
+	TEST_CHECK(SimFlash_peek(IO_TEST_NAND - 16u, ioTestPeek, 16));
+	TEST_CHECK((ioTestPeek[0] == 0xFF) && (ioTestPeek[15] == 0xFF));
+
+	memset(ioTestRead, 0, sizeof(ioTestRead));
+	count = sizeof(ioTestNandRead) / sizeof(ioTestNandRead[0]);
+	TEST_CHECK(IoTest_vector(ioTestRead, ioTestNandRead, count) == length);
+	TEST_CHECK(W25n01g_readVector(&testQspi, IO_TEST_NAND, ioTestIov, count));
+	TEST_CHECK(memcmp(ioTestRead, ioTestData, length) == 0);
+
+	Test_checkProtocol();
+}
+
+int main(void)
+{
+	Test_fill(ioTestData, sizeof(ioTestData), 32);
+
+	IoTest_w25q();
+	IoTest_w25n01g();
+
+	return Test_result("flashiotest");
+}
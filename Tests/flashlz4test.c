@@ -0,0 +1,230 @@
+/*
+ * This program is host test of the LZ4 codec and benchmark of the compressed region against raw storage.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testutil.h"
+#include "flashlz4.h"
+#include "compressedregion.h"
+#include "w25q.h"
+
+#define LZ4_TEST_ASSET_SIZE			(256u * 1024u + 1000u)
+#define LZ4_TEST_RAW_BASE			0x100000
+#define LZ4_TEST_REGION_BASE		0x200000
+#define LZ4_TEST_REGION_CAPACITY	(512u * 1024u)
+#define LZ4_TEST_MAX_FRAMES			((LZ4_TEST_ASSET_SIZE / COMPRESSED_REGION_FRAME_SIZE) + 1u)
+#define LZ4_TEST_RANDOM_READS		200
+#define LZ4_TEST_RANDOM_LENGTH		512
+
+static uint8_t lz4TestAsset[LZ4_TEST_ASSET_SIZE];
+static uint8_t lz4TestRead[LZ4_TEST_ASSET_SIZE];
+static uint8_t lz4TestCompressed[FLASH_LZ4_COMPRESS_BOUND(FLASH_LZ4_MAX_INPUT)];
+static uint8_t lz4TestDecompressed[FLASH_LZ4_MAX_INPUT];
+static uint32_t lz4TestIndex[LZ4_TEST_MAX_FRAMES + 1u];
+static CompressedRegion lz4TestRegion;
+
+//! Text-like asset: words from a small vocabulary, the way string tables and UI layouts compress
+static void Lz4Test_fillAsset(uint8_t *buffer, uint32_t length, uint32_t seed)
+{
+	static const char *const words[] = { "flash", "page", "sector", "quad", "read", "write", "erase", "status", "\n", "    " };
+	uint32_t position = 0;
+
+	while (position < length) {
+		seed = seed * 1103515245u + 12345u;
+
+		const char *word = words[(seed >> 16) % (sizeof(words) / sizeof(words[0]))];
+
+		for (uint32_t i = 0; (word[i] != '\0') && (position < length); i++) {
+			buffer[position++] = (uint8_t)word[i];
+		}
+		if (position < length) {
+			buffer[position++] = ' ';
+		}
+	}
+}
+
+static void Lz4Test_roundTrip(const uint8_t *data, uint32_t length)
+{
+	uint32_t decompressed = 0;
+	uint32_t compressed = FlashLz4_compress(data, length, lz4TestCompressed, FLASH_LZ4_COMPRESS_BOUND(length));
+
+	TEST_CHECK(compressed > 0);
+	TEST_CHECK(compressed <= FLASH_LZ4_COMPRESS_BOUND(length));
+	TEST_CHECK(FlashLz4_decompress(lz4TestCompressed, compressed, lz4TestDecompressed, length, &decompressed));
+	TEST_CHECK(decompressed == length);
+	TEST_CHECK(memcmp(lz4TestDecompressed, data, length) == 0);
+}
+
+static void Lz4Test_codec(void)
+{
+	uint8_t small[32];
+	uint32_t length = 0;
+
+	// Short inputs are literals only or end in a single short match
+	for (uint32_t n = 1; n <= sizeof(small); n++) {
+		Test_fill(small, n, n);
+		Lz4Test_roundTrip(small, n);
+	}
+
+	Lz4Test_roundTrip(lz4TestAsset, FLASH_LZ4_MAX_INPUT);
+	Test_fill(lz4TestRead, FLASH_LZ4_MAX_INPUT, 40);
+	Lz4Test_roundTrip(lz4TestRead, FLASH_LZ4_MAX_INPUT);
+	memset(lz4TestRead, 0, FLASH_LZ4_MAX_INPUT);
+	Lz4Test_roundTrip(lz4TestRead, FLASH_LZ4_MAX_INPUT);
+	TEST_CHECK(FlashLz4_compress(lz4TestRead, FLASH_LZ4_MAX_INPUT, lz4TestCompressed, sizeof(lz4TestCompressed)) < 300u);
+
+	// A block from another encoder: "abcd", a match 4 back for 8 bytes, then the last literals
+	static const uint8_t reference[] = { 0x44, 'a', 'b', 'c', 'd', 0x04, 0x00, 0x50, '1', '2', '3', '4', '5' };
+
+	TEST_CHECK(FlashLz4_decompress(reference, sizeof(reference), small, sizeof(small), &length));
+	TEST_CHECK((length == 17) && (memcmp(small, "abcdabcdabcd12345", 17) == 0));
+
+	// Too little room on either side, a truncated block and a match before the start are refused
+	uint32_t compressed = FlashLz4_compress(lz4TestAsset, 4096, lz4TestCompressed, sizeof(lz4TestCompressed));
+
+	TEST_CHECK(FlashLz4_compress(lz4TestAsset, 4096, lz4TestCompressed, compressed - 1u) == 0);
+	TEST_CHECK(!FlashLz4_decompress(lz4TestCompressed, compressed, lz4TestDecompressed, 4095, &length));
+	TEST_CHECK(!FlashLz4_decompress(lz4TestCompressed, compressed - 1u, lz4TestDecompressed, 4096, &length));
+
+	static const uint8_t badOffset[] = { 0x14, 'a', 0x08, 0x00, 0x50, '1', '2', '3', '4', '5' };
+	TEST_CHECK(!FlashLz4_decompress(badOffset, sizeof(badOffset), lz4TestDecompressed, 4096, &length));
+}
+
+static void Lz4Test_report(const char *layout, const char *operation, uint32_t bytes, uint64_t startNs, uint64_t startBus)
+{
+	uint64_t elapsedNs = SimQspi_nowNs() - startNs;
+
+	printf("%s,%s,%u,%llu,%.1f,%.3f\n", layout, operation, bytes, (unsigned long long)(SimQspi_getStats()->dataBytes - startBus),
+			(double)elapsedNs / 1e3, (elapsedNs > 0) ? ((double)bytes * 1e3 / (double)elapsedNs) : 0.0);
+}
+
+//! Writes and reads the asset raw and compressed, bus bytes and simulated time of each phase as CSV
+static void Lz4Test_benchmark(void)
+{
+	uint64_t rawNs[2];
+	uint64_t regionNs[2];
+	uint64_t start;
+	uint64_t bus;
+	uint32_t seed = 40;
+
+	TEST_CHECK(Test_attach(&SimFlash_w25q128jvIm, TEST_NOR_FLASH_SIZE));
+	TEST_CHECK(W25q_init(&testQspi));
+
+	printf("layout,operation,bytes,bus_bytes,sim_us,mb_per_s\n");
+
+	// Raw storage: erase, program, read all, read at random
+	start = SimQspi_nowNs();
+	bus = SimQspi_getStats()->dataBytes;
+	TEST_CHECK(W25q_eraseRange(LZ4_TEST_RAW_BASE, (LZ4_TEST_ASSET_SIZE + W25Q_SECTOR_SIZE - 1u) & ~(W25Q_SECTOR_SIZE - 1u)));
+	TEST_CHECK(W25q_writeBytes(LZ4_TEST_RAW_BASE, lz4TestAsset, LZ4_TEST_ASSET_SIZE));
+	W25q_waitForReady();
+	Lz4Test_report("raw", "write", LZ4_TEST_ASSET_SIZE, start, bus);
+	rawNs[0] = SimQspi_nowNs() - start;
+
+	start = SimQspi_nowNs();
+	bus = SimQspi_getStats()->dataBytes;
+	TEST_CHECK(W25q_readBytes(LZ4_TEST_RAW_BASE, lz4TestRead, LZ4_TEST_ASSET_SIZE));
+	TEST_CHECK(memcmp(lz4TestRead, lz4TestAsset, LZ4_TEST_ASSET_SIZE) == 0);
+	Lz4Test_report("raw", "read", LZ4_TEST_ASSET_SIZE, start, bus);
+	rawNs[1] = SimQspi_nowNs() - start;
+
+	start = SimQspi_nowNs();
+	bus = SimQspi_getStats()->dataBytes;
+	for (uint32_t i = 0; i < LZ4_TEST_RANDOM_READS; i++) {
+		seed = seed * 1103515245u + 12345u;
+		uint32_t offset = (seed >> 4) % (LZ4_TEST_ASSET_SIZE - LZ4_TEST_RANDOM_LENGTH);
+
+		TEST_CHECK(W25q_readBytes(LZ4_TEST_RAW_BASE + offset, lz4TestRead, LZ4_TEST_RANDOM_LENGTH));
+	}
+	Lz4Test_report("raw", "read_random", LZ4_TEST_RANDOM_READS * LZ4_TEST_RANDOM_LENGTH, start, bus);
+
+	// Compressed region, streamed in odd sized pieces
+	start = SimQspi_nowNs();
+	bus = SimQspi_getStats()->dataBytes;
+	TEST_CHECK(CompressedRegion_create(&lz4TestRegion, &CompressedRegion_w25qIo, LZ4_TEST_REGION_BASE, LZ4_TEST_REGION_CAPACITY, lz4TestIndex, LZ4_TEST_MAX_FRAMES));
+	for (uint32_t offset = 0; offset < LZ4_TEST_ASSET_SIZE; offset += 1000u) {
+		uint32_t take = ((LZ4_TEST_ASSET_SIZE - offset) < 1000u) ? (LZ4_TEST_ASSET_SIZE - offset) : 1000u;
+
+		TEST_CHECK(CompressedRegion_write(&lz4TestRegion, &lz4TestAsset[offset], take));
+	}
+	TEST_CHECK(CompressedRegion_finish(&lz4TestRegion));
+	W25q_waitForReady();
+	Lz4Test_report("lz4", "write", LZ4_TEST_ASSET_SIZE, start, bus);
+	regionNs[0] = SimQspi_nowNs() - start;
+
+	uint32_t ratio = CompressedRegion_ratioPermille(&lz4TestRegion);
+
+	start = SimQspi_nowNs();
+	bus = SimQspi_getStats()->dataBytes;
+	TEST_CHECK(CompressedRegion_open(&lz4TestRegion, &CompressedRegion_w25qIo, LZ4_TEST_REGION_BASE));
+	TEST_CHECK(lz4TestRegion.length == LZ4_TEST_ASSET_SIZE);
+	memset(lz4TestRead, 0, LZ4_TEST_ASSET_SIZE);
+	TEST_CHECK(CompressedRegion_read(&lz4TestRegion, 0, lz4TestRead, LZ4_TEST_ASSET_SIZE));
+	TEST_CHECK(memcmp(lz4TestRead, lz4TestAsset, LZ4_TEST_ASSET_SIZE) == 0);
+	Lz4Test_report("lz4", "read", LZ4_TEST_ASSET_SIZE, start, bus);
+	regionNs[1] = SimQspi_nowNs() - start;
+
+	// Each random read touches one or two frames and nothing else
+	seed = 40;
+	start = SimQspi_nowNs();
+	bus = SimQspi_getStats()->dataBytes;
+	for (uint32_t i = 0; i < LZ4_TEST_RANDOM_READS; i++) {
+		seed = seed * 1103515245u + 12345u;
+		uint32_t offset = (seed >> 4) % (LZ4_TEST_ASSET_SIZE - LZ4_TEST_RANDOM_LENGTH);
+		uint64_t before = SimQspi_getStats()->dataBytes;
+
+		TEST_CHECK(CompressedRegion_read(&lz4TestRegion, offset, lz4TestRead, LZ4_TEST_RANDOM_LENGTH));
+		TEST_CHECK(memcmp(lz4TestRead, &lz4TestAsset[offset], LZ4_TEST_RANDOM_LENGTH) == 0);
+		TEST_CHECK((SimQspi_getStats()->dataBytes - before) <= (2u * (COMPRESSED_REGION_FRAME_SIZE + 8u)));
+	}
+	Lz4Test_report("lz4", "read_random", LZ4_TEST_RANDOM_READS * LZ4_TEST_RANDOM_LENGTH, start, bus);
+
+	printf("ratio_permille,%u\n", ratio);
+
+	// Fewer stored bytes means fewer pages to program and to read; the M7 decompression time is not simulated
+	TEST_CHECK(ratio < 600u);
+	TEST_CHECK(regionNs[0] < rawNs[0]);
+	TEST_CHECK(regionNs[1] < rawNs[1]);
+	Test_checkProtocol();
+
+	// Incompressible data is stored raw and never costs more than raw storage
+	Test_fill(lz4TestRead, 64u * 1024u, 41);
+	TEST_CHECK(CompressedRegion_create(&lz4TestRegion, &CompressedRegion_w25qIo, LZ4_TEST_REGION_BASE, LZ4_TEST_REGION_CAPACITY, lz4TestIndex, LZ4_TEST_MAX_FRAMES));
+	TEST_CHECK(CompressedRegion_write(&lz4TestRegion, lz4TestRead, 64u * 1024u));
+
+	// Unfinished, the header is still erased
+	CompressedRegion unfinished;
+	TEST_CHECK(!CompressedRegion_open(&unfinished, &CompressedRegion_w25qIo, LZ4_TEST_REGION_BASE));
+
+	TEST_CHECK(CompressedRegion_finish(&lz4TestRegion));
+	TEST_CHECK(CompressedRegion_ratioPermille(&lz4TestRegion) == 1000u);
+	TEST_CHECK(CompressedRegion_open(&lz4TestRegion, &CompressedRegion_w25qIo, LZ4_TEST_REGION_BASE));
+	TEST_CHECK(CompressedRegion_read(&lz4TestRegion, 5000, lz4TestAsset, 10000));
+	TEST_CHECK(memcmp(lz4TestAsset, &lz4TestRead[5000], 10000) == 0);
+	TEST_CHECK(!CompressedRegion_read(&lz4TestRegion, 60000, lz4TestAsset, 10000));
+}
+
+int main(void)
+{
+	Lz4Test_fillAsset(lz4TestAsset, LZ4_TEST_ASSET_SIZE, 40);
+
+	Lz4Test_codec();
+	Lz4Test_benchmark();
+
+	return Test_result("flashlz4test");
+}
@@ -0,0 +1,151 @@
+/*
+ * This program is host test of the OTA ingest pipeline fed from a simulated transport.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testutil.h"
+#include "flashota.h"
+#include "flashverify.h"
+
+#define OTA_TEST_BASE			0x80000
+#define OTA_TEST_IMAGE_SIZE		(64u * 1024u + 100u)	//!< Ends in a partial page
+#define OTA_TEST_CAPACITY		(128u * 1024u)
+#define OTA_TEST_MAX_CHUNK		700u					//!< Up to three pages arrive in one piece
+#define OTA_TEST_IDLE_STEP_NS	20000u					//!< Link idle time between two polls
+
+static uint8_t otaTestImage[OTA_TEST_IMAGE_SIZE];
+static uint8_t otaTestRead[OTA_TEST_IMAGE_SIZE];
+static FlashOta otaTest;
+
+/*
+ * The transport hands over odd sized chunks of up to maxChunk bytes as they arrive at bytesPerSecond.
+ * While the next one is still on the wire the pipeline is polled, the way a receive loop would.
+ */
+static bool OtaTest_transfer(uint32_t bytesPerSecond, uint32_t maxChunk, uint64_t *elapsedNs)
+{
+	uint64_t start = SimQspi_nowNs();
+	uint32_t offset = 0;
+	uint32_t seed = 39;
+	bool success = FlashOta_begin(&otaTest, OTA_TEST_BASE, OTA_TEST_CAPACITY, true);
+
+	while (success && (offset < OTA_TEST_IMAGE_SIZE)) {
+		seed = seed * 1103515245u + 12345u;
+
+		uint32_t chunk = 1u + ((seed >> 16) % maxChunk);
+		if (chunk > (OTA_TEST_IMAGE_SIZE - offset)) {
+			chunk = OTA_TEST_IMAGE_SIZE - offset;
+		}
+
+		uint64_t arrival = start + ((uint64_t)(offset + chunk) * 1000000000u / bytesPerSecond);
+
+		while (success && (SimQspi_nowNs() < arrival)) {
+			uint64_t idle = arrival - SimQspi_nowNs();
+
+			success = FlashOta_poll(&otaTest);
+			SimQspi_advanceNs((idle < OTA_TEST_IDLE_STEP_NS) ? idle : OTA_TEST_IDLE_STEP_NS);
+		}
+
+		success = success && FlashOta_write(&otaTest, &otaTestImage[offset], chunk);
+		offset += chunk;
+	}
+
+	success = FlashOta_finish(&otaTest, FlashVerify_crc32Update(0, otaTestImage, OTA_TEST_IMAGE_SIZE)) && success;
+	*elapsedNs = SimQspi_nowNs() - start;
+
+	return success;
+}
+
+static void OtaTest_start(void)
+{
+	TEST_CHECK(Test_attach(&SimFlash_w25q128jvIm, TEST_NOR_FLASH_SIZE));
+	TEST_CHECK(W25q_init(&testQspi));
+}
+
+static void OtaTest_checkImage(void)
+{
+	TEST_CHECK(W25q_readBytes(OTA_TEST_BASE, otaTestRead, OTA_TEST_IMAGE_SIZE));
+	TEST_CHECK(memcmp(otaTestRead, otaTestImage, OTA_TEST_IMAGE_SIZE) == 0);
+	Test_checkProtocol();
+}
+
+int main(void)
+{
+	const SimFlashModel *model = &SimFlash_w25q128jvIm;
+	uint32_t pages = (OTA_TEST_IMAGE_SIZE + W25Q_PAGE_SIZE - 1u) / W25Q_PAGE_SIZE;
+	uint32_t sectors = (OTA_TEST_IMAGE_SIZE + W25Q_SECTOR_SIZE - 1u) / W25Q_SECTOR_SIZE;
+	uint64_t flashNs = ((uint64_t)pages * model->pageProgramUs + (uint64_t)sectors * model->sectorEraseUs) * 1000u;
+	uint64_t elapsedNs = 0;
+
+	Test_fill(otaTestImage, sizeof(otaTestImage), 39);
+	printf("link_bytes_per_s,link_us,flash_us,total_us,receiver_stalls\n");
+
+	// Link about as fast as the flash: the update takes the longer of the two, not their sum
+	uint32_t matched = (uint32_t)((uint64_t)OTA_TEST_IMAGE_SIZE * 1000000000u / flashNs);
+	uint64_t linkNs = (uint64_t)OTA_TEST_IMAGE_SIZE * 1000000000u / matched;
+
+	OtaTest_start();
+	TEST_CHECK(OtaTest_transfer(matched, OTA_TEST_MAX_CHUNK, &elapsedNs));
+	printf("%u,%.0f,%.0f,%.0f,%u\n", matched, linkNs / 1e3, flashNs / 1e3, elapsedNs / 1e3, otaTest.stats.receiverStalls);
+	TEST_CHECK(elapsedNs >= flashNs);
+	TEST_CHECK(elapsedNs < ((linkNs + flashNs) * 3u / 5u));
+	TEST_CHECK(otaTest.stats.pagesProgrammed == pages);
+	TEST_CHECK(otaTest.stats.sectorsErased == sectors);
+	TEST_CHECK(otaTest.stats.verifyFailures == 0);
+	TEST_CHECK(otaTest.stats.bytesReceived == OTA_TEST_IMAGE_SIZE);
+	OtaTest_checkImage();
+
+	// Less than a page arrives during a sector erase: the receiver never waits and the tail is the last page
+	uint32_t slow = matched / 16u;
+
+	linkNs = (uint64_t)OTA_TEST_IMAGE_SIZE * 1000000000u / slow;
+	OtaTest_start();
+	TEST_CHECK(OtaTest_transfer(slow, W25Q_PAGE_SIZE, &elapsedNs));
+	printf("%u,%.0f,%.0f,%.0f,%u\n", slow, linkNs / 1e3, flashNs / 1e3, elapsedNs / 1e3, otaTest.stats.receiverStalls);
+	TEST_CHECK(otaTest.stats.receiverStalls == 0);
+	TEST_CHECK(elapsedNs < (linkNs + (2u * model->pageProgramUs * 1000u) + OTA_TEST_IDLE_STEP_NS));
+	OtaTest_checkImage();
+
+	// Fast link: the flash sets the pace and write() holds the receiver back
+	uint32_t fast = matched * 100u;
+
+	linkNs = (uint64_t)OTA_TEST_IMAGE_SIZE * 1000000000u / fast;
+	OtaTest_start();
+	TEST_CHECK(OtaTest_transfer(fast, OTA_TEST_MAX_CHUNK, &elapsedNs));
+	printf("%u,%.0f,%.0f,%.0f,%u\n", fast, linkNs / 1e3, flashNs / 1e3, elapsedNs / 1e3, otaTest.stats.receiverStalls);
+	TEST_CHECK(otaTest.stats.receiverStalls > 0);
+	TEST_CHECK(elapsedNs < (flashNs + (flashNs / 10u)));
+	OtaTest_checkImage();
+
+	// A sector that silently failed to erase is caught by the page verify
+	uint8_t zeros[W25Q_PAGE_SIZE] = { 0 };
+
+	OtaTest_start();
+	TEST_CHECK(SimFlash_load(OTA_TEST_BASE + (2u * W25Q_SECTOR_SIZE), zeros, sizeof(zeros)));
+	SimFlash_failErase(OTA_TEST_BASE + (2u * W25Q_SECTOR_SIZE));
+	TEST_CHECK(!OtaTest_transfer(matched, OTA_TEST_MAX_CHUNK, &elapsedNs));
+	TEST_CHECK(otaTest.stats.verifyFailures == 1);
+	TEST_CHECK(otaTest.failed);
+
+	// More than the reserved space is refused
+	OtaTest_start();
+	TEST_CHECK(FlashOta_begin(&otaTest, OTA_TEST_BASE, W25Q_SECTOR_SIZE, false));
+	TEST_CHECK(!FlashOta_write(&otaTest, otaTestImage, W25Q_SECTOR_SIZE + 1u));
+	TEST_CHECK(!FlashOta_begin(&otaTest, OTA_TEST_BASE + 1u, W25Q_SECTOR_SIZE, false));
+
+	return Test_result("flashotatest");
+}
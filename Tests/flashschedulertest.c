@@ -0,0 +1,311 @@
+/*
+ * This program is host test of the flash request scheduler with pthreads standing in for the RTOS.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "testutil.h"
+#include "flashscheduler.h"
+#include "w25q.h"
+
+#define SCHEDULER_TEST_READ_BASE		0x000000	//!< Programmed once, only read by the clients
+#define SCHEDULER_TEST_READ_SIZE		(64u * 1024u)
+#define SCHEDULER_TEST_WRITE_BASE		0x100000	//!< Erased and programmed by the writer
+#define SCHEDULER_TEST_READS			300
+#define SCHEDULER_TEST_READ_LENGTH		256
+#define SCHEDULER_TEST_STREAM			8			//!< Adjacent reads submitted together
+#define SCHEDULER_TEST_STREAM_ROUNDS	40
+#define SCHEDULER_TEST_WRITES			12
+
+typedef struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	bool given;
+} SchedulerTestSignal;
+
+static pthread_mutex_t schedulerTestLock = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t schedulerTestData[SCHEDULER_TEST_READ_SIZE];
+static uint8_t schedulerTestWrite[W25Q_SECTOR_SIZE];
+static uint32_t schedulerTestBadReads = 0;		//!< Only the reader threads write these, each its own
+static uint32_t schedulerTestBadStreams = 0;
+
+static void *SchedulerTest_signalCreate(void)
+{
+	SchedulerTestSignal *signal = calloc(1, sizeof(SchedulerTestSignal));
+
+	if (signal != NULL) {
+		pthread_mutex_init(&signal->mutex, NULL);
+		pthread_cond_init(&signal->cond, NULL);
+	}
+
+	return signal;
+}
+
+static void SchedulerTest_signalGive(void *handle)
+{
+	SchedulerTestSignal *signal = handle;
+
+	pthread_mutex_lock(&signal->mutex);
+	signal->given = true;
+	pthread_cond_signal(&signal->cond);
+	pthread_mutex_unlock(&signal->mutex);
+}
+
+static void SchedulerTest_signalTake(void *handle)
+{
+	SchedulerTestSignal *signal = handle;
+
+	pthread_mutex_lock(&signal->mutex);
+	while (!signal->given) {
+		pthread_cond_wait(&signal->cond, &signal->mutex);
+	}
+	signal->given = false;
+	pthread_mutex_unlock(&signal->mutex);
+}
+
+static void SchedulerTest_lock(void)
+{
+	pthread_mutex_lock(&schedulerTestLock);
+}
+
+static void SchedulerTest_unlock(void)
+{
+	pthread_mutex_unlock(&schedulerTestLock);
+}
+
+//! Latencies are measured in simulated time, the bus moves it forward from the scheduler thread only
+static uint32_t SchedulerTest_nowUs(void)
+{
+	return SimQspi_nowUs();
+}
+
+static const FlashSchedulerOs schedulerTestOs = {
+	.signalCreate		= SchedulerTest_signalCreate,
+	.signalGive			= SchedulerTest_signalGive,
+	.signalTake			= SchedulerTest_signalTake,
+	.signalTakeTimeout	= NULL,
+	.lock				= SchedulerTest_lock,
+	.unlock				= SchedulerTest_unlock,
+	.nowUs				= SchedulerTest_nowUs,
+};
+
+static void SchedulerTest_yield(void)
+{
+	struct timespec pause = { 0, 20000 };
+
+	nanosleep(&pause, NULL);
+}
+
+static void *SchedulerTest_task(void *argument)
+{
+	FlashScheduler_task(argument);
+	return NULL;
+}
+
+//! Small random reads, one at a time, the way a file system lookup goes
+static void *SchedulerTest_reader(void *argument)
+{
+	uint8_t buffer[SCHEDULER_TEST_READ_LENGTH];
+	FlashRequest request;
+	uint32_t seed = 35;
+
+	(void)argument;
+	memset(&request, 0, sizeof(request));
+	request.signal = SchedulerTest_signalCreate();
+
+	for (uint32_t i = 0; i < SCHEDULER_TEST_READS; i++) {
+		seed = seed * 1103515245u + 12345u;
+
+		request.type = FLASH_REQUEST_READ;
+		request.priority = 1;
+		request.address = SCHEDULER_TEST_READ_BASE + ((seed >> 8) % (SCHEDULER_TEST_READ_SIZE - SCHEDULER_TEST_READ_LENGTH));
+		request.buffer = buffer;
+		request.length = SCHEDULER_TEST_READ_LENGTH;
+
+		if (!FlashScheduler_transfer(&request) || (memcmp(buffer, &schedulerTestData[request.address], SCHEDULER_TEST_READ_LENGTH) != 0)) {
+			schedulerTestBadReads++;
+		}
+
+		SchedulerTest_yield();
+	}
+
+	free(request.signal);
+	return NULL;
+}
+
+//! A streaming client queues a run of adjacent reads at once, the scheduler may serve them as one
+static void *SchedulerTest_streamer(void *argument)
+{
+	static uint8_t buffer[SCHEDULER_TEST_STREAM * SCHEDULER_TEST_READ_LENGTH];
+	FlashRequest requests[SCHEDULER_TEST_STREAM];
+
+	(void)argument;
+	memset(requests, 0, sizeof(requests));
+
+	for (uint32_t i = 0; i < SCHEDULER_TEST_STREAM; i++) {
+		requests[i].signal = SchedulerTest_signalCreate();
+	}
+
+	for (uint32_t round = 0; round < SCHEDULER_TEST_STREAM_ROUNDS; round++) {
+		uint32_t base = SCHEDULER_TEST_READ_BASE + ((round * sizeof(buffer)) % SCHEDULER_TEST_READ_SIZE);
+
+		for (uint32_t i = 0; i < SCHEDULER_TEST_STREAM; i++) {
+			requests[i].type = FLASH_REQUEST_READ;
+			requests[i].priority = 2;
+			requests[i].address = base + (i * SCHEDULER_TEST_READ_LENGTH);
+			requests[i].buffer = &buffer[i * SCHEDULER_TEST_READ_LENGTH];
+			requests[i].length = SCHEDULER_TEST_READ_LENGTH;
+		}
+
+		for (uint32_t i = 0; i < SCHEDULER_TEST_STREAM; i++) {
+			FlashScheduler_submit(&requests[i]);
+		}
+
+		for (uint32_t i = 0; i < SCHEDULER_TEST_STREAM; i++) {
+			SchedulerTest_signalTake(requests[i].signal);
+			schedulerTestBadStreams += requests[i].success ? 0u : 1u;
+		}
+
+		if (memcmp(buffer, &schedulerTestData[base - SCHEDULER_TEST_READ_BASE], sizeof(buffer)) != 0) {
+			schedulerTestBadStreams++;
+		}
+
+		SchedulerTest_yield();
+	}
+
+	for (uint32_t i = 0; i < SCHEDULER_TEST_STREAM; i++) {
+		free(requests[i].signal);
+	}
+
+	return NULL;
+}
+
+//! Background logging: erase a sector and fill it, over and over
+static void *SchedulerTest_writer(void *argument)
+{
+	FlashRequest request;
+	uint32_t *failures = argument;
+
+	memset(&request, 0, sizeof(request));
+	request.signal = SchedulerTest_signalCreate();
+
+	for (uint32_t i = 0; i < SCHEDULER_TEST_WRITES; i++) {
+		uint32_t address = SCHEDULER_TEST_WRITE_BASE + ((i % 4u) * W25Q_SECTOR_SIZE);
+
+		request.type = FLASH_REQUEST_ERASE;
+		request.priority = 1;
+		request.address = address;
+		request.buffer = NULL;
+		request.length = W25Q_SECTOR_SIZE;
+		*failures += FlashScheduler_transfer(&request) ? 0u : 1u;
+
+		request.type = FLASH_REQUEST_PROGRAM;
+		request.buffer = schedulerTestWrite;
+		*failures += FlashScheduler_transfer(&request) ? 0u : 1u;
+	}
+
+	free(request.signal);
+	return NULL;
+}
+
+static void SchedulerTest_report(const char *name, FlashRequestType type)
+{
+	const FlashSchedulerStats *stats = FlashScheduler_getStats();
+
+	printf("%s,%u,%u,%u,%u,%u\n", name, stats->completed[type],
+			FlashScheduler_latencyPercentileUs(type, 500),
+			FlashScheduler_latencyPercentileUs(type, 900),
+			FlashScheduler_latencyPercentileUs(type, 990),
+			stats->maxLatencyUs[type]);
+}
+
+int main(void)
+{
+	pthread_t task;
+	pthread_t reader;
+	pthread_t streamer;
+	pthread_t writer;
+	uint32_t writeFailures = 0;
+
+	Test_fill(schedulerTestData, sizeof(schedulerTestData), 35);
+	Test_fill(schedulerTestWrite, sizeof(schedulerTestWrite), 36);
+
+	TEST_CHECK(Test_attach(&SimFlash_w25q128jvIm, TEST_NOR_FLASH_SIZE));
+	TEST_CHECK(W25q_init(&testQspi));
+	TEST_CHECK(W25q_eraseRange(SCHEDULER_TEST_READ_BASE, SCHEDULER_TEST_READ_SIZE));
+	TEST_CHECK(W25q_writeBytes(SCHEDULER_TEST_READ_BASE, schedulerTestData, SCHEDULER_TEST_READ_SIZE));
+	W25q_waitForReady();
+
+	TEST_CHECK(FlashScheduler_init(&schedulerTestOs, &FlashScheduler_w25q));
+	SimQspi_resetStats();
+
+	// The scheduler task owns the bus until the process exits
+	TEST_CHECK(pthread_create(&task, NULL, SchedulerTest_task, NULL) == 0);
+	pthread_detach(task);
+
+	TEST_CHECK(pthread_create(&writer, NULL, SchedulerTest_writer, &writeFailures) == 0);
+	TEST_CHECK(pthread_create(&reader, NULL, SchedulerTest_reader, NULL) == 0);
+	TEST_CHECK(pthread_create(&streamer, NULL, SchedulerTest_streamer, NULL) == 0);
+
+	pthread_join(reader, NULL);
+	pthread_join(streamer, NULL);
+	pthread_join(writer, NULL);
+
+	const FlashSchedulerStats *stats = FlashScheduler_getStats();
+
+	printf("class,count,p50_us,p90_us,p99_us,max_us\n");
+	SchedulerTest_report("read", FLASH_REQUEST_READ);
+	SchedulerTest_report("program", FLASH_REQUEST_PROGRAM);
+	SchedulerTest_report("erase", FLASH_REQUEST_ERASE);
+	printf("merged_reads,%u\nmax_queue_depth,%u\n", stats->mergedReads, stats->maxQueueDepth);
+
+	// Every request finished, nothing corrupted the other clients' command sequences
+	TEST_CHECK(schedulerTestBadReads == 0);
+	TEST_CHECK(schedulerTestBadStreams == 0);
+	TEST_CHECK(writeFailures == 0);
+	TEST_CHECK(stats->completed[FLASH_REQUEST_READ] == (SCHEDULER_TEST_READS + (SCHEDULER_TEST_STREAM * SCHEDULER_TEST_STREAM_ROUNDS)));
+	TEST_CHECK(stats->completed[FLASH_REQUEST_PROGRAM] == SCHEDULER_TEST_WRITES);
+	TEST_CHECK(stats->completed[FLASH_REQUEST_ERASE] == SCHEDULER_TEST_WRITES);
+	TEST_CHECK(stats->failed[FLASH_REQUEST_READ] + stats->failed[FLASH_REQUEST_PROGRAM] + stats->failed[FLASH_REQUEST_ERASE] == 0);
+	TEST_CHECK(stats->mergedReads > 0);
+
+	// A read waits for at most the write in progress, never for the queue of writes behind it
+	TEST_CHECK(FlashScheduler_latencyPercentileUs(FLASH_REQUEST_READ, 500) <= FlashScheduler_latencyPercentileUs(FLASH_REQUEST_ERASE, 500));
+	TEST_CHECK(stats->maxLatencyUs[FLASH_REQUEST_READ] <= (2u * SimFlash_w25q128jvIm.sectorEraseUs));
+
+	// The last write went through after all reads were done, the sector must hold it
+	uint8_t readBack[W25Q_SECTOR_SIZE];
+	FlashRequest request = {
+		.type		= FLASH_REQUEST_READ,
+		.address	= SCHEDULER_TEST_WRITE_BASE + (((SCHEDULER_TEST_WRITES - 1u) % 4u) * W25Q_SECTOR_SIZE),
+		.buffer		= readBack,
+		.length		= sizeof(readBack),
+		.signal		= SchedulerTest_signalCreate(),
+	};
+
+	TEST_CHECK(FlashScheduler_transfer(&request));
+	TEST_CHECK(memcmp(readBack, schedulerTestWrite, sizeof(readBack)) == 0);
+	free(request.signal);
+
+	Test_checkProtocol();
+
+	return Test_result("flashschedulertest");
+}
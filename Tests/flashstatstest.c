@@ -0,0 +1,250 @@
+/*
+ * This program is host test of the flash operation instrumentation, driven by a fake clock.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testutil.h"
+#include "flashstats.h"
+#include "w25q.h"
+
+#define STATS_TEST_ADDRESS		0x20000
+#define STATS_TEST_PAGES		4
+#define STATS_TEST_CLOCK_HZ		1000000u		//!< Fake clock ticks in microseconds
+
+static uint32_t statsTestNow;
+static FlashStatsSnapshot statsTestSnapshot;
+static char statsTestCsv[2048];
+static uint8_t statsTestData[STATS_TEST_PAGES * W25Q_PAGE_SIZE];
+static uint8_t statsTestRead[sizeof(statsTestData)];
+
+static uint32_t StatsTest_clock(void)
+{
+	return statsTestNow;
+}
+
+//! One operation that takes exactly the given cycles on the fake clock
+static void StatsTest_op(uint8_t opcode, uint32_t bytes, uint32_t cycles, FlashStatsResult result)
+{
+	FlashStats_begin(opcode, bytes);
+	statsTestNow += cycles;
+	FlashStats_end(result);
+}
+
+//! Counts, cycles, histogram and failures of hand timed operations
+static void StatsTest_accounting(void)
+{
+	FlashStats_setClock(StatsTest_clock);
+	FlashStats_reset();
+	statsTestNow = 1000;
+
+	StatsTest_op(0x03, 256, 250, FLASH_STATS_OK);
+	StatsTest_op(0x03, 256, 100, FLASH_STATS_OK);
+	StatsTest_op(0x03, 16, 3000, FLASH_STATS_OK);
+	StatsTest_op(0x03, 0, 100, FLASH_STATS_TIMEOUT);
+	StatsTest_op(0x06, 0, 10, FLASH_STATS_ERROR);
+
+	FlashStats_snapshot(&statsTestSnapshot, false);
+
+	const FlashStatsOpcode *read = FlashStats_find(&statsTestSnapshot, 0x03);
+	const FlashStatsOpcode *enable = FlashStats_find(&statsTestSnapshot, 0x06);
+
+	TEST_CHECK(statsTestSnapshot.used == 2);
+	TEST_CHECK(statsTestSnapshot.droppedOps == 0);
+	TEST_CHECK(FlashStats_find(&statsTestSnapshot, 0x02) == NULL);
+	TEST_CHECK((read != NULL) && (enable != NULL));
+
+	if ((read == NULL) || (enable == NULL)) {
+		return;
+	}
+
+	TEST_CHECK(read->count == 4);
+	TEST_CHECK(read->bytes == 528);
+	TEST_CHECK(read->busCycles == 3450);
+	TEST_CHECK(read->maxCycles == 3000);
+	TEST_CHECK(read->timeouts == 1);
+	TEST_CHECK(read->errors == 0);
+	TEST_CHECK(enable->errors == 1);
+
+	// 100 cycles land in [64, 128), 250 in [128, 256), 3000 in [2048, 4096)
+	TEST_CHECK(read->histogram[7] == 2);
+	TEST_CHECK(read->histogram[8] == 1);
+	TEST_CHECK(read->histogram[12] == 1);
+	TEST_CHECK(FlashStats_percentileCycles(read, 500) == 127);
+	TEST_CHECK(FlashStats_percentileCycles(read, 750) == 255);
+	TEST_CHECK(FlashStats_percentileCycles(read, 990) == 4095);
+
+	// The last failure wins
+	TEST_CHECK(statsTestSnapshot.lastFailedOpcode == 0x06);
+	TEST_CHECK(statsTestSnapshot.lastFailure == FLASH_STATS_ERROR);
+}
+
+//! Busy-wait goes to the operation that made the part busy, not to the status reads polling it
+static void StatsTest_busyWait(void)
+{
+	FlashStats_reset();
+
+	// Nothing has run yet, there is nobody to charge
+	FlashStats_wait(statsTestNow, 1, false);
+	FlashStats_snapshot(&statsTestSnapshot, false);
+	TEST_CHECK(statsTestSnapshot.used == 0);
+
+	StatsTest_op(0x20, 0, 5, FLASH_STATS_OK);
+
+	uint32_t start = FlashStats_now();
+
+	for (uint32_t i = 0; i < 3; i++) {
+		StatsTest_op(0x05, 1, 20, FLASH_STATS_OK);
+		statsTestNow += 1000;
+	}
+
+	FlashStats_wait(start, 3, false);
+	FlashStats_wait(FlashStats_now(), 0, true);
+	FlashStats_snapshot(&statsTestSnapshot, false);
+
+	const FlashStatsOpcode *erase = FlashStats_find(&statsTestSnapshot, 0x20);
+	const FlashStatsOpcode *status = FlashStats_find(&statsTestSnapshot, 0x05);
+
+	TEST_CHECK((erase != NULL) && (status != NULL));
+
+	if ((erase == NULL) || (status == NULL)) {
+		return;
+	}
+
+	TEST_CHECK(erase->busyWaitCycles == 3060);
+	TEST_CHECK(erase->pollIterations == 3);
+	TEST_CHECK(erase->waitTimeouts == 1);
+	TEST_CHECK(status->count == 3);
+	TEST_CHECK(status->busCycles == 60);
+	TEST_CHECK(status->busyWaitCycles == 0);
+}
+
+//! A cycle counter that wraps mid operation still gives the right duration
+static void StatsTest_wrap(void)
+{
+	FlashStats_reset();
+	statsTestNow = UINT32_MAX - 49u;
+
+	StatsTest_op(0x0B, 8, 100, FLASH_STATS_OK);
+	FlashStats_snapshot(&statsTestSnapshot, false);
+	TEST_CHECK(statsTestSnapshot.opcodes[0].busCycles == 100);
+	TEST_CHECK(statsTestSnapshot.opcodes[0].maxCycles == 100);
+}
+
+//! A full table drops new opcodes but keeps counting the known ones, a resetting snapshot starts over
+static void StatsTest_overflowAndReset(void)
+{
+	FlashStats_reset();
+
+	for (uint32_t i = 0; i < (FLASH_STATS_MAX_OPCODES + 2u); i++) {
+		StatsTest_op((uint8_t)(0x40u + i), 1, 10, FLASH_STATS_OK);
+	}
+
+	StatsTest_op(0x40, 1, 10, FLASH_STATS_OK);
+	FlashStats_snapshot(&statsTestSnapshot, true);
+	TEST_CHECK(statsTestSnapshot.used == FLASH_STATS_MAX_OPCODES);
+	TEST_CHECK(statsTestSnapshot.droppedOps == 2);
+	TEST_CHECK(FlashStats_find(&statsTestSnapshot, 0x40)->count == 2);
+	TEST_CHECK(FlashStats_find(&statsTestSnapshot, (uint8_t)(0x40u + FLASH_STATS_MAX_OPCODES)) == NULL);
+
+	FlashStats_snapshot(&statsTestSnapshot, false);
+	TEST_CHECK(statsTestSnapshot.used == 0);
+	TEST_CHECK(statsTestSnapshot.droppedOps == 0);
+}
+
+//! The CSV converts cycles with the clock rate and never writes a partial line
+static void StatsTest_csv(void)
+{
+	FlashStats_reset();
+	StatsTest_op(0x32, 256, 500, FLASH_STATS_OK);
+	StatsTest_op(0x32, 256, 500, FLASH_STATS_OK);
+	FlashStats_snapshot(&statsTestSnapshot, false);
+
+	uint32_t length = FlashStats_formatCsv(&statsTestSnapshot, STATS_TEST_CLOCK_HZ, statsTestCsv, sizeof(statsTestCsv));
+
+	TEST_CHECK(length == strlen(statsTestCsv));
+	TEST_CHECK(strncmp(statsTestCsv, "opcode,count,bytes,", 19) == 0);
+
+	// 512 bytes in 1000 us, p50 and p99 are the [256, 512) bucket bound
+	TEST_CHECK(strstr(statsTestCsv, "\n0x32,2,512,0,0,1000,0,0,511,511,500,512000\n") != NULL);
+
+	char small[128];
+	uint32_t header = (uint32_t)(strchr(statsTestCsv, '\n') - statsTestCsv) + 1u;
+
+	TEST_CHECK(FlashStats_formatCsv(&statsTestSnapshot, STATS_TEST_CLOCK_HZ, small, header + 1u) == header);
+	TEST_CHECK(FlashStats_formatCsv(&statsTestSnapshot, STATS_TEST_CLOCK_HZ, small, 40u) == 0);
+}
+
+//! The driver hooks on the simulated part: erase and program wait show up where the datasheet puts them
+static void StatsTest_driver(void)
+{
+	const SimFlashModel *model = &SimFlash_w25q128jvIm;
+
+	TEST_CHECK(Test_attach(model, TEST_NOR_FLASH_SIZE));
+	TEST_CHECK(W25q_init(&testQspi));
+	FlashStats_setClock(SimQspi_clock);
+	FlashStats_reset();
+
+	TEST_CHECK(W25q_sectorErase(STATS_TEST_ADDRESS));
+	W25q_waitForReady();
+	TEST_CHECK(W25q_writeBytes(STATS_TEST_ADDRESS, statsTestData, sizeof(statsTestData)));
+	W25q_waitForReady();
+	TEST_CHECK(W25q_readBytes(STATS_TEST_ADDRESS, statsTestRead, sizeof(statsTestRead)));
+	TEST_CHECK(memcmp(statsTestRead, statsTestData, sizeof(statsTestData)) == 0);
+
+	FlashStats_snapshot(&statsTestSnapshot, false);
+	FlashStats_formatCsv(&statsTestSnapshot, 1000000000u, statsTestCsv, sizeof(statsTestCsv));
+	printf("%s", statsTestCsv);
+
+	const FlashStatsOpcode *erase = FlashStats_find(&statsTestSnapshot, W25Q_INSTR_SECTOR_ERASE);
+	const FlashStatsOpcode *program = FlashStats_find(&statsTestSnapshot, W25_INSTR_QUAD_INPUT_PAGE_PROGRAM);
+	const FlashStatsOpcode *read = FlashStats_find(&statsTestSnapshot, W25Q_INSTR_FAST_READ_QUAD_DTR);
+
+	TEST_CHECK((erase != NULL) && (program != NULL) && (read != NULL));
+
+	if ((erase == NULL) || (program == NULL) || (read == NULL)) {
+		return;
+	}
+
+	uint64_t eraseCycles = (uint64_t)model->sectorEraseUs * 1000u;
+	uint64_t programCycles = (uint64_t)STATS_TEST_PAGES * model->pageProgramUs * 1000u;
+
+	TEST_CHECK(erase->count == 1);
+	TEST_CHECK((erase->busCycles + erase->busyWaitCycles) >= eraseCycles);
+	TEST_CHECK((erase->busCycles + erase->busyWaitCycles) < (eraseCycles + (eraseCycles / 10u)));
+	TEST_CHECK(program->count == STATS_TEST_PAGES);
+	TEST_CHECK(program->bytes == sizeof(statsTestData));
+	TEST_CHECK((program->busCycles + program->busyWaitCycles) >= programCycles);
+	TEST_CHECK(read->bytes == sizeof(statsTestRead));
+	TEST_CHECK(read->errors == 0);
+	TEST_CHECK(statsTestSnapshot.droppedOps == 0);
+	Test_checkProtocol();
+}
+
+int main(void)
+{
+	Test_fill(statsTestData, sizeof(statsTestData), 41);
+
+	StatsTest_accounting();
+	StatsTest_busyWait();
+	StatsTest_wrap();
+	StatsTest_overflowAndReset();
+	StatsTest_csv();
+	StatsTest_driver();
+
+	return Test_result("flashstatstest");
+}
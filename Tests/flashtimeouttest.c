@@ -0,0 +1,136 @@
+/*
+ * This program is host test of the bounded ready wait, against a missing part and one stuck busy.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testutil.h"
+#include "w25q.h"
+#include "w25n01g.h"
+
+#define TIMEOUT_TEST_NOR		0x20000
+#define TIMEOUT_TEST_NAND		(8u * W25N01G_BLOCK_SIZE)
+#define TIMEOUT_TEST_LENGTH		64
+
+static uint8_t timeoutTestData[TIMEOUT_TEST_LENGTH];
+static uint8_t timeoutTestRead[TIMEOUT_TEST_LENGTH];
+
+//! Longest operation the config knows of, what the driver bounds a ready wait by
+static uint32_t TimeoutTest_norBoundMs(void)
+{
+	const W25qConfig *config = W25q_getConfig();
+	uint32_t boundMs = (config->pageProgramMaxUs / 1000u) + 1u;
+
+	for (uint32_t i = 0; i < SFDP_ERASE_TYPES; i++) {
+		if ((config->erase[i].size != 0) && (config->erase[i].maxMs > boundMs)) {
+			boundMs = config->erase[i].maxMs;
+		}
+	}
+
+	return boundMs;
+}
+
+//! Nothing answers on the bus, every status read comes back 0xFF with BUSY set
+static void TimeoutTest_missingPart(void)
+{
+	TEST_CHECK(Test_attach(&SimFlash_w25q128jvIm, TEST_NOR_FLASH_SIZE));
+	SimFlash_detach();
+
+	TEST_CHECK(!W25q_init(&testQspi));
+	TEST_CHECK(W25q_getDevice() == NULL);
+
+	// Without a device the calls return before the first status read
+	uint64_t start = SimQspi_nowNs();
+	uint64_t transactions = SimQspi_getStats()->transactions;
+
+	TEST_CHECK(!W25q_waitForReady());
+	TEST_CHECK(!W25q_readBytes(TIMEOUT_TEST_NOR, timeoutTestRead, sizeof(timeoutTestRead)));
+	TEST_CHECK(!W25q_writeBytes(TIMEOUT_TEST_NOR, timeoutTestData, sizeof(timeoutTestData)));
+	TEST_CHECK(!W25q_sectorErase(TIMEOUT_TEST_NOR));
+	TEST_CHECK(!W25q_memoryMappedModeEnable());
+
+	TEST_CHECK(SimQspi_getStats()->transactions == transactions);
+	TEST_CHECK((SimQspi_nowNs() - start) < 1000000u);
+	printf("missing_part,%.3f\n", (SimQspi_nowNs() - start) / 1e6);
+}
+
+//! An erase that never ends fails the next access once its maximum time is up, and only then
+static void TimeoutTest_stuckNor(void)
+{
+	TEST_CHECK(Test_attach(&SimFlash_w25q128jvIm, TEST_NOR_FLASH_SIZE));
+	TEST_CHECK(SimFlash_load(TIMEOUT_TEST_NOR, timeoutTestData, sizeof(timeoutTestData)));
+	TEST_CHECK(W25q_init(&testQspi));
+	TEST_CHECK(W25q_sectorErase(TIMEOUT_TEST_NOR + W25Q_SECTOR_SIZE));
+	SimFlash_hangBusy();
+
+	uint32_t boundMs = TimeoutTest_norBoundMs();
+	uint64_t start = SimQspi_nowNs();
+
+	TEST_CHECK(!W25q_readBytes(TIMEOUT_TEST_NOR, timeoutTestRead, sizeof(timeoutTestRead)));
+
+	double elapsedMs = (SimQspi_nowNs() - start) / 1e6;
+
+	printf("stuck_nor,%.3f,%u\n", elapsedMs, boundMs);
+	TEST_CHECK(elapsedMs >= boundMs);
+	TEST_CHECK(elapsedMs < (boundMs + 2u));
+
+	// A power cycle brings the part back, the driver picks it up without a new init
+	SimFlash_powerCycle();
+	TEST_CHECK(W25q_readBytes(TIMEOUT_TEST_NOR, timeoutTestRead, sizeof(timeoutTestRead)));
+	TEST_CHECK(memcmp(timeoutTestRead, timeoutTestData, sizeof(timeoutTestData)) == 0);
+	Test_checkProtocol();
+}
+
+static void TimeoutTest_stuckNand(void)
+{
+	TEST_CHECK(Test_attach(&SimFlash_w25n01gv, TEST_NAND_FLASH_SIZE));
+	TEST_CHECK(SimFlash_load(TIMEOUT_TEST_NAND, timeoutTestData, sizeof(timeoutTestData)));
+	TEST_CHECK(W25n01g_init(&testQspi));
+	TEST_CHECK(W25n01g_blockErase(&testQspi, TIMEOUT_TEST_NAND + W25N01G_BLOCK_SIZE));
+	SimFlash_hangBusy();
+
+	uint64_t start = SimQspi_nowNs();
+
+	TEST_CHECK(W25n01g_readBytes(&testQspi, TIMEOUT_TEST_NAND, timeoutTestRead, sizeof(timeoutTestRead), true) == 0);
+
+	double elapsedMs = (SimQspi_nowNs() - start) / 1e6;
+
+	printf("stuck_nand,%.3f,%u\n", elapsedMs, W25N01G_BUSY_TIMEOUT_MS);
+	TEST_CHECK(elapsedMs >= W25N01G_BUSY_TIMEOUT_MS);
+	TEST_CHECK(elapsedMs < (W25N01G_BUSY_TIMEOUT_MS + 2u));
+
+	// Every entry that waits gives up the same way
+	TEST_CHECK(!W25n01g_blockErase(&testQspi, TIMEOUT_TEST_NAND + W25N01G_BLOCK_SIZE));
+	TEST_CHECK(!w25n01g_pageProgram(&testQspi, TIMEOUT_TEST_NAND + W25N01G_BLOCK_SIZE, timeoutTestData, sizeof(timeoutTestData)));
+
+	SimFlash_powerCycle();
+	TEST_CHECK(W25n01g_readBytes(&testQspi, TIMEOUT_TEST_NAND, timeoutTestRead, sizeof(timeoutTestRead), true) == sizeof(timeoutTestRead));
+	TEST_CHECK(memcmp(timeoutTestRead, timeoutTestData, sizeof(timeoutTestData)) == 0);
+	Test_checkProtocol();
+}
+
+int main(void)
+{
+	Test_fill(timeoutTestData, sizeof(timeoutTestData), 51);
+
+	printf("case,sim_ms,bound_ms\n");
+	TimeoutTest_missingPart();
+	TimeoutTest_stuckNor();
+	TimeoutTest_stuckNand();
+
+	return Test_result("flashtimeouttest");
+}
@@ -0,0 +1,197 @@
+/*
+ * This program is host test of flash read-back verification: first mismatch, CRC32 and SHA-256 known answers.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testutil.h"
+#include "flashverify.h"
+#include "w25q.h"
+#include "w25n01g.h"
+
+#define VERIFY_TEST_NOR			0x100000
+#define VERIFY_TEST_NAND		((20u * W25N01G_BLOCK_SIZE) + 100u)	//!< Off the page start, reads cross pages
+#define VERIFY_TEST_LENGTH		((3u * FLASH_VERIFY_CHUNK_SIZE) + 5u)
+#define VERIFY_TEST_MILLION		1000000u
+#define VERIFY_TEST_CRC_CHECK	0xCBF43926u			//!< CRC-32 of "123456789"
+
+// FIPS 180-2 examples
+static const char verifyTestSha2Block[] = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+static const uint8_t verifyTestShaAbc[FLASH_VERIFY_SHA256_SIZE] = {
+	0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+	0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad,
+};
+static const uint8_t verifyTestSha2BlockDigest[FLASH_VERIFY_SHA256_SIZE] = {
+	0x24, 0x8d, 0x6a, 0x61, 0xd2, 0x06, 0x38, 0xb8, 0xe5, 0xc0, 0x26, 0x93, 0x0c, 0x3e, 0x60, 0x39,
+	0xa3, 0x3c, 0xe4, 0x59, 0x64, 0xff, 0x21, 0x67, 0xf6, 0xec, 0xed, 0xd4, 0x19, 0xdb, 0x06, 0xc1,
+};
+static const uint8_t verifyTestShaEmpty[FLASH_VERIFY_SHA256_SIZE] = {
+	0xe3, 0xb0, 0xc4, 0x42, 0x98, 0xfc, 0x1c, 0x14, 0x9a, 0xfb, 0xf4, 0xc8, 0x99, 0x6f, 0xb9, 0x24,
+	0x27, 0xae, 0x41, 0xe4, 0x64, 0x9b, 0x93, 0x4c, 0xa4, 0x95, 0x99, 0x1b, 0x78, 0x52, 0xb8, 0x55,
+};
+static const uint8_t verifyTestShaMillion[FLASH_VERIFY_SHA256_SIZE] = {
+	0xcd, 0xc7, 0x6e, 0x5c, 0x99, 0x14, 0xfb, 0x92, 0x81, 0xa1, 0xc7, 0xe2, 0x84, 0xd7, 0x3e, 0x67,
+	0xf1, 0x80, 0x9a, 0x48, 0xa4, 0x97, 0x20, 0x0e, 0x04, 0x6d, 0x39, 0xcc, 0xc7, 0x11, 0x2c, 0xd0,
+};
+
+static uint8_t verifyTestData[VERIFY_TEST_LENGTH];
+static uint8_t verifyTestSource[VERIFY_TEST_LENGTH];
+static uint8_t verifyTestMillion[VERIFY_TEST_MILLION];
+
+//! The W25Q read until the address context points at, then a failure
+static bool VerifyTest_failingRead(void *context, uint32_t address, uint8_t *buffer, uint32_t length)
+{
+	return (address < *(const uint32_t *)context) && FlashVerify_w25qRead(NULL, address, buffer, length);
+}
+
+//! The digests on their own, fed in pieces that straddle the 64-byte block
+static void VerifyTest_digests(void)
+{
+	FlashVerifySha256 sha;
+	uint8_t digest[FLASH_VERIFY_SHA256_SIZE];
+	const uint8_t *check = (const uint8_t *)"123456789";
+
+	TEST_CHECK(FlashVerify_crc32Update(0, check, 9) == VERIFY_TEST_CRC_CHECK);
+	TEST_CHECK(FlashVerify_crc32Update(FlashVerify_crc32Update(0, check, 4), &check[4], 5) == VERIFY_TEST_CRC_CHECK);
+	TEST_CHECK(FlashVerify_crc32Update(0, check, 0) == 0);
+
+	FlashVerify_sha256Init(&sha);
+	FlashVerify_sha256Update(&sha, (const uint8_t *)"abc", 3);
+	FlashVerify_sha256Final(&sha, digest);
+	TEST_CHECK(memcmp(digest, verifyTestShaAbc, sizeof(digest)) == 0);
+
+	FlashVerify_sha256Init(&sha);
+	FlashVerify_sha256Final(&sha, digest);
+	TEST_CHECK(memcmp(digest, verifyTestShaEmpty, sizeof(digest)) == 0);
+
+	// 56 bytes, the length no longer fits the block it ends in
+	FlashVerify_sha256Init(&sha);
+	FlashVerify_sha256Update(&sha, (const uint8_t *)verifyTestSha2Block, 1);
+	FlashVerify_sha256Update(&sha, (const uint8_t *)&verifyTestSha2Block[1], 54);
+	FlashVerify_sha256Update(&sha, (const uint8_t *)&verifyTestSha2Block[55], 1);
+	FlashVerify_sha256Final(&sha, digest);
+	TEST_CHECK(memcmp(digest, verifyTestSha2BlockDigest, sizeof(digest)) == 0);
+}
+
+//! One differing byte at offset, the result must name exactly that offset
+static void VerifyTest_mismatch(FlashVerifyRead read, void *context, uint32_t address, uint32_t offset)
+{
+	FlashVerifyResult result;
+
+	memcpy(verifyTestSource, verifyTestData, sizeof(verifyTestSource));
+	verifyTestSource[offset] ^= 0x10u;
+
+	TEST_CHECK(FlashVerify_compare(read, context, address, verifyTestSource, sizeof(verifyTestSource), &result));
+	TEST_CHECK(!result.match);
+	TEST_CHECK(result.mismatchOffset == offset);
+
+	// Reading stops with the chunk holding the difference
+	uint32_t chunkEnd = ((offset / FLASH_VERIFY_CHUNK_SIZE) + 1u) * FLASH_VERIFY_CHUNK_SIZE;
+
+	TEST_CHECK(result.bytesRead == ((chunkEnd < VERIFY_TEST_LENGTH) ? chunkEnd : VERIFY_TEST_LENGTH));
+}
+
+static void VerifyTest_compare(FlashVerifyRead read, void *context, uint32_t address)
+{
+	static const uint32_t offsets[] = {
+		0, 1, 3, 4, 7, FLASH_VERIFY_CHUNK_SIZE - 1u, FLASH_VERIFY_CHUNK_SIZE, FLASH_VERIFY_CHUNK_SIZE + 2u,
+		2u * FLASH_VERIFY_CHUNK_SIZE + 1000u, VERIFY_TEST_LENGTH - 5u, VERIFY_TEST_LENGTH - 1u,
+	};
+	FlashVerifyResult result;
+
+	TEST_CHECK(FlashVerify_compare(read, context, address, verifyTestData, sizeof(verifyTestData), &result));
+	TEST_CHECK(result.match);
+	TEST_CHECK(result.mismatchOffset == FLASH_VERIFY_NO_OFFSET);
+	TEST_CHECK(result.bytesRead == VERIFY_TEST_LENGTH);
+
+	for (uint32_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++) {
+		VerifyTest_mismatch(read, context, address, offsets[i]);
+	}
+
+	// CRC32 of the stored bytes against the one computed here in a single pass
+	uint32_t crc = FlashVerify_crc32Update(0, verifyTestData, sizeof(verifyTestData));
+
+	TEST_CHECK(FlashVerify_crc32(read, context, address, sizeof(verifyTestData), crc, &result));
+	TEST_CHECK(result.match && (result.bytesRead == VERIFY_TEST_LENGTH));
+	TEST_CHECK(FlashVerify_crc32(read, context, address, sizeof(verifyTestData), crc ^ 1u, &result));
+	TEST_CHECK(!result.match);
+}
+
+static void VerifyTest_w25q(void)
+{
+	FlashVerifyResult result;
+	uint8_t digest[FLASH_VERIFY_SHA256_SIZE];
+
+	TEST_CHECK(Test_attach(&SimFlash_w25q128jvIm, TEST_NOR_FLASH_SIZE));
+	TEST_CHECK(SimFlash_load(VERIFY_TEST_NOR, verifyTestData, sizeof(verifyTestData)));
+	TEST_CHECK(W25q_init(&testQspi));
+
+	VerifyTest_compare(FlashVerify_w25qRead, NULL, VERIFY_TEST_NOR);
+
+	// Reference check value and FIPS vectors stored on the part
+	TEST_CHECK(SimFlash_load(0, (const uint8_t *)"123456789", 9));
+	TEST_CHECK(FlashVerify_crc32(FlashVerify_w25qRead, NULL, 0, 9, VERIFY_TEST_CRC_CHECK, &result));
+	TEST_CHECK(result.match);
+
+	TEST_CHECK(SimFlash_load(W25Q_SECTOR_SIZE, (const uint8_t *)"abc", 3));
+	TEST_CHECK(FlashVerify_sha256(FlashVerify_w25qRead, NULL, W25Q_SECTOR_SIZE, 3, verifyTestShaAbc, &result));
+	TEST_CHECK(result.match);
+
+	// A million 'a' runs through many chunks and blocks
+	memset(verifyTestMillion, 'a', sizeof(verifyTestMillion));
+	TEST_CHECK(SimFlash_load(2u * VERIFY_TEST_NOR, verifyTestMillion, sizeof(verifyTestMillion)));
+	TEST_CHECK(FlashVerify_sha256(FlashVerify_w25qRead, NULL, 2u * VERIFY_TEST_NOR, sizeof(verifyTestMillion), verifyTestShaMillion, &result));
+	TEST_CHECK(result.match && (result.bytesRead == VERIFY_TEST_MILLION));
+
+	memcpy(digest, verifyTestShaMillion, sizeof(digest));
+	digest[31] ^= 1u;
+	TEST_CHECK(FlashVerify_sha256(FlashVerify_w25qRead, NULL, 2u * VERIFY_TEST_NOR, sizeof(verifyTestMillion), digest, &result));
+	TEST_CHECK(!result.match);
+
+	Test_checkProtocol();
+
+	// A read error part way through is an error and never a match
+	uint32_t failAt = VERIFY_TEST_NOR + FLASH_VERIFY_CHUNK_SIZE;
+
+	TEST_CHECK(!FlashVerify_compare(VerifyTest_failingRead, &failAt, VERIFY_TEST_NOR, verifyTestData, sizeof(verifyTestData), &result));
+	TEST_CHECK(!result.match && (result.bytesRead == FLASH_VERIFY_CHUNK_SIZE));
+	TEST_CHECK(!FlashVerify_crc32(VerifyTest_failingRead, &failAt, VERIFY_TEST_NOR, sizeof(verifyTestData), 0, &result));
+	TEST_CHECK(!result.match);
+	TEST_CHECK(!FlashVerify_sha256(VerifyTest_failingRead, &failAt, VERIFY_TEST_NOR, sizeof(verifyTestData), verifyTestShaEmpty, &result));
+	TEST_CHECK(!result.match);
+}
+
+static void VerifyTest_w25n01g(void)
+{
+	TEST_CHECK(Test_attach(&SimFlash_w25n01gv, TEST_NAND_FLASH_SIZE));
+	TEST_CHECK(SimFlash_load(VERIFY_TEST_NAND, verifyTestData, sizeof(verifyTestData)));
+	TEST_CHECK(W25n01g_init(&testQspi));
+
+	VerifyTest_compare(FlashVerify_w25n01gRead, &testQspi, VERIFY_TEST_NAND);
+	Test_checkProtocol();
+}
+
+int main(void)
+{
+	Test_fill(verifyTestData, sizeof(verifyTestData), 38);
+
+	VerifyTest_digests();
+	VerifyTest_w25q();
+	VerifyTest_w25n01g();
+
+	return Test_result("flashverifytest");
+}
@@ -0,0 +1,250 @@
+/*
+ * This program is host test of images from the image builder, read back through the drivers on a simulated part.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+
+#include "testutil.h"
+#include "w25q.h"
+#include "w25n01g.h"
+#include "compressedregion.h"
+#include "ringlog.h"
+
+#define IMAGE_TEST_NOR_SIZE			0x100000u
+#define IMAGE_TEST_NOR_RAW			0x1000u
+#define IMAGE_TEST_NOR_RAW_LENGTH	3000u			//!< Ends inside a page
+#define IMAGE_TEST_NOR_LZ4			0x20000u
+#define IMAGE_TEST_NOR_LZ4_CAPACITY	0x40000u
+#define IMAGE_TEST_NOR_LZ4_LENGTH	40000u
+
+#define IMAGE_TEST_NAND_BLOCKS		16
+#define IMAGE_TEST_NAND_PAGES		(IMAGE_TEST_NAND_BLOCKS * W25N01G_PAGES_PER_BLOCK)
+#define IMAGE_TEST_NAND_MAX_SPARE	128u			//!< W25N02KV
+#define IMAGE_TEST_NAND_RAW			10u				//!< Page
+#define IMAGE_TEST_NAND_RAW_LENGTH	5000u
+#define IMAGE_TEST_LOG_FIRST		8u
+#define IMAGE_TEST_LOG_BLOCKS		4u
+#define IMAGE_TEST_LOG_LENGTH		300000u			//!< Into the third block, a partial page last
+#define IMAGE_TEST_LOG_MORE			5000u			//!< Appended by the firmware after boot
+
+static uint8_t imageTestRaw[IMAGE_TEST_NAND_RAW_LENGTH];
+static uint8_t imageTestLog[IMAGE_TEST_LOG_LENGTH + IMAGE_TEST_LOG_MORE];
+static uint8_t imageTestRead[sizeof(imageTestLog)];
+static CompressedRegion imageTestRegion;
+static RingLog imageTestRingLog;
+
+static bool ImageTest_writeFile(const char *path, const uint8_t *data, uint32_t length)
+{
+	FILE *file = fopen(path, "wb");
+	bool success = (file != NULL) && (fwrite(data, 1, length, file) == length);
+
+	if (file != NULL) {
+		success = (fclose(file) == 0) && success;
+	}
+
+	return success;
+}
+
+//! Whole image, length bytes expected, NULL if the file is missing or another size
+static uint8_t *ImageTest_readImage(const char *path, uint32_t length)
+{
+	FILE *file = fopen(path, "rb");
+	uint8_t *data = malloc(length + 1u);
+	bool success = (file != NULL) && (data != NULL) && (fread(data, 1, length + 1u, file) == length);
+
+	if (file != NULL) {
+		fclose(file);
+	}
+
+	if (!success) {
+		free(data);
+		data = NULL;
+	}
+
+	return data;
+}
+
+static bool ImageTest_build(const char *arguments)
+{
+	char command[512];
+
+	snprintf(command, sizeof(command), "\"%s\" %s", IMAGE_BUILDER_PATH, arguments);
+	fflush(stdout);
+
+	return (system(command) == 0);
+}
+
+//! Raw bytes at their offset, an LZ4 region the firmware opens, erased everywhere else
+static void ImageTest_w25q(void)
+{
+	uint8_t *image;
+
+	TEST_CHECK(ImageTest_writeFile("imagebuildertest_raw.bin", imageTestRaw, IMAGE_TEST_NOR_RAW_LENGTH));
+	TEST_CHECK(ImageTest_writeFile("imagebuildertest_lz4.bin", imageTestLog, IMAGE_TEST_NOR_LZ4_LENGTH));
+	TEST_CHECK(ImageTest_build("nor imagebuildertest_nor.img 0x100000 raw 0x1000 imagebuildertest_raw.bin "
+			"lz4 0x20000 0x40000 imagebuildertest_lz4.bin"));
+
+	image = ImageTest_readImage("imagebuildertest_nor.img", IMAGE_TEST_NOR_SIZE);
+	TEST_CHECK(image != NULL);
+	if (image == NULL) {
+		return;
+	}
+
+	TEST_CHECK(Test_attach(&SimFlash_w25q128jvIm, TEST_NOR_FLASH_SIZE));
+	TEST_CHECK(SimFlash_load(0, image, IMAGE_TEST_NOR_SIZE));
+	TEST_CHECK(W25q_init(&testQspi));
+
+	memset(imageTestRead, 0, sizeof(imageTestRead));
+	TEST_CHECK(W25q_readBytes(IMAGE_TEST_NOR_RAW, imageTestRead, IMAGE_TEST_NOR_RAW_LENGTH + 1u));
+	TEST_CHECK(memcmp(imageTestRead, imageTestRaw, IMAGE_TEST_NOR_RAW_LENGTH) == 0);
+	TEST_CHECK(imageTestRead[IMAGE_TEST_NOR_RAW_LENGTH] == 0xFF);
+
+	TEST_CHECK(W25q_readBytes(0, imageTestRead, IMAGE_TEST_NOR_RAW));
+	TEST_CHECK((imageTestRead[0] == 0xFF) && (imageTestRead[IMAGE_TEST_NOR_RAW - 1u] == 0xFF));
+
+	memset(imageTestRead, 0, sizeof(imageTestRead));
+	TEST_CHECK(CompressedRegion_open(&imageTestRegion, &CompressedRegion_w25qIo, IMAGE_TEST_NOR_LZ4));
+	TEST_CHECK(imageTestRegion.length == IMAGE_TEST_NOR_LZ4_LENGTH);
+	TEST_CHECK(CompressedRegion_read(&imageTestRegion, 0, imageTestRead, IMAGE_TEST_NOR_LZ4_LENGTH));
+	TEST_CHECK(memcmp(imageTestRead, imageTestLog, IMAGE_TEST_NOR_LZ4_LENGTH) == 0);
+
+	// Nothing written past the region
+	TEST_CHECK(W25q_readBytes(IMAGE_TEST_NOR_LZ4 + IMAGE_TEST_NOR_LZ4_CAPACITY, imageTestRead, 16));
+	TEST_CHECK((imageTestRead[0] == 0xFF) && (imageTestRead[15] == 0xFF));
+
+	printf("nor,%lu,%lu\n", (unsigned long)IMAGE_TEST_NOR_LZ4_LENGTH, (unsigned long)imageTestRegion.storedBytes);
+	free(image);
+	Test_checkProtocol();
+}
+
+//! Spare of every page as the part holds it: markers good, tags rising one per page in the log
+static void ImageTest_spare(uint32_t spareSize)
+{
+	uint8_t spare[IMAGE_TEST_NAND_MAX_SPARE];
+	uint32_t logFirst = IMAGE_TEST_LOG_FIRST * W25N01G_PAGES_PER_BLOCK;
+	uint32_t logPages = (IMAGE_TEST_LOG_LENGTH + W25N01G_PAGE_SIZE - 1u) / W25N01G_PAGE_SIZE;
+	uint32_t badMarkers = 0;
+	uint32_t tagErrors = 0;
+
+	for (uint32_t page = 0; page < IMAGE_TEST_NAND_PAGES; page++) {
+		uint32_t sequence;
+		uint32_t lengthWord;
+
+		TEST_CHECK(SimFlash_peekSpare(page, 0, spare, spareSize));
+		RingLog_decodeTags(&spare[RING_LOG_SPARE_SEQUENCE], &sequence, &lengthWord);
+
+		if ((page % W25N01G_PAGES_PER_BLOCK) == 0) {
+			badMarkers += (spare[RING_LOG_SPARE_BAD_BLOCK] != 0xFF) ? 1u : 0u;
+		}
+
+		if ((page >= logFirst) && (page < (logFirst + logPages))) {
+			uint32_t length = ((page - logFirst) == (logPages - 1u)) ? (IMAGE_TEST_LOG_LENGTH % W25N01G_PAGE_SIZE) : W25N01G_PAGE_SIZE;
+
+			tagErrors += ((sequence == (page - logFirst)) && (lengthWord == RING_LOG_LENGTH_WORD(length))) ? 0u : 1u;
+		} else {
+			tagErrors += ((sequence == RING_LOG_ERASED) && (lengthWord == RING_LOG_ERASED)) ? 0u : 1u;
+		}
+	}
+
+	TEST_CHECK(badMarkers == 0);
+	TEST_CHECK(tagErrors == 0);
+
+	for (uint32_t block = 0; block < IMAGE_TEST_NAND_BLOCKS; block++) {
+		TEST_CHECK(!W25n01g_isBlockBad(&testQspi, block));
+	}
+}
+
+//! Raw pages and a ring log the firmware opens, exports and carries on appending to, spare is the tool option
+static void ImageTest_w25n(const SimFlashModel *model, const char *spare)
+{
+	uint32_t imageSize = IMAGE_TEST_NAND_PAGES * (W25N01G_PAGE_SIZE + model->spareSize);
+	char arguments[256];
+	RingLogIo io;
+	RingLogReader reader;
+	uint8_t *image;
+
+	TEST_CHECK(ImageTest_writeFile("imagebuildertest_page.bin", imageTestRaw, IMAGE_TEST_NAND_RAW_LENGTH));
+	TEST_CHECK(ImageTest_writeFile("imagebuildertest_log.bin", imageTestLog, IMAGE_TEST_LOG_LENGTH));
+	snprintf(arguments, sizeof(arguments), "nand imagebuildertest_nand.img 16 %s raw 10 imagebuildertest_page.bin "
+			"ringlog 8 4 imagebuildertest_log.bin", spare);
+	TEST_CHECK(ImageTest_build(arguments));
+
+	image = ImageTest_readImage("imagebuildertest_nand.img", imageSize);
+	TEST_CHECK(image != NULL);
+	if (image == NULL) {
+		return;
+	}
+
+	TEST_CHECK(Test_attach(model, TEST_NAND_FLASH_SIZE));
+	TEST_CHECK(SimFlash_loadPages(0, image, IMAGE_TEST_NAND_PAGES));
+	TEST_CHECK(W25n01g_init(&testQspi));
+
+	for (uint32_t done = 0; done < IMAGE_TEST_NAND_RAW_LENGTH; done += W25N01G_PAGE_SIZE) {
+		uint32_t chunk = ((IMAGE_TEST_NAND_RAW_LENGTH - done) < W25N01G_PAGE_SIZE) ? (IMAGE_TEST_NAND_RAW_LENGTH - done) : W25N01G_PAGE_SIZE;
+
+		TEST_CHECK(W25n01g_readPageData(&testQspi, IMAGE_TEST_NAND_RAW + (done / W25N01G_PAGE_SIZE), 0, &imageTestRead[done], chunk));
+	}
+	TEST_CHECK(memcmp(imageTestRead, imageTestRaw, IMAGE_TEST_NAND_RAW_LENGTH) == 0);
+
+	ImageTest_spare(model->spareSize);
+
+	// The firmware finds the head where the tool left it and the export is the file
+	RingLog_w25n01gIo(&io, &testQspi);
+	TEST_CHECK(RingLog_open(&imageTestRingLog, &io, IMAGE_TEST_LOG_FIRST, IMAGE_TEST_LOG_BLOCKS));
+	TEST_CHECK(!RingLog_isEmpty(&imageTestRingLog));
+
+	memset(imageTestRead, 0, sizeof(imageTestRead));
+	RingLog_readerInit(&imageTestRingLog, &reader);
+	TEST_CHECK(RingLog_read(&imageTestRingLog, &reader, imageTestRead, sizeof(imageTestRead)) == IMAGE_TEST_LOG_LENGTH);
+	TEST_CHECK(memcmp(imageTestRead, imageTestLog, IMAGE_TEST_LOG_LENGTH) == 0);
+	TEST_CHECK(reader.lostPages == 0);
+
+	TEST_CHECK(RingLog_append(&imageTestRingLog, &imageTestLog[IMAGE_TEST_LOG_LENGTH], IMAGE_TEST_LOG_MORE));
+	TEST_CHECK(RingLog_flush(&imageTestRingLog));
+
+	memset(imageTestRead, 0, sizeof(imageTestRead));
+	TEST_CHECK(RingLog_open(&imageTestRingLog, &io, IMAGE_TEST_LOG_FIRST, IMAGE_TEST_LOG_BLOCKS));
+	RingLog_readerInit(&imageTestRingLog, &reader);
+	TEST_CHECK(RingLog_read(&imageTestRingLog, &reader, imageTestRead, sizeof(imageTestRead)) == sizeof(imageTestLog));
+	TEST_CHECK(memcmp(imageTestRead, imageTestLog, sizeof(imageTestLog)) == 0);
+
+	printf("%s,%lu,%lu\n", model->name, (unsigned long)IMAGE_TEST_LOG_LENGTH, (unsigned long)imageTestRingLog.nextSequence);
+	free(image);
+	Test_checkProtocol();
+}
+
+int main(void)
+{
+	Test_fill(imageTestRaw, sizeof(imageTestRaw), 45);
+
+	// Records with a counter, compressible like a real log
+	for (uint32_t i = 0; i < sizeof(imageTestLog); i++) {
+		imageTestLog[i] = ((i % 16u) < 4u) ? (uint8_t)(i >> (8u * (i % 4u))) : (uint8_t)"sensor,ok,"[i % 10u];
+	}
+
+	printf("image,input_bytes,result\n");
+	ImageTest_w25q();
+	ImageTest_w25n(&SimFlash_w25n01gv, "");
+	ImageTest_w25n(&SimFlash_w25n02kv, "spare 128");
+
+	// Tags do not fit a spare that small
+	TEST_CHECK(!ImageTest_build("nand imagebuildertest_nand.img 16 spare 8"));
+
+	return Test_result("imagebuildertest");
+}
@@ -0,0 +1,170 @@
+/*
+ * This program is host test of the QUADSPI timing calibration against a simulated lossy link.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testutil.h"
+#include "quadspicalib.h"
+#include "w25q.h"
+
+#define CALIB_TEST_PATTERN_ADDRESS	0x10000
+#define CALIB_TEST_CHECK_READS		200
+
+static uint8_t calibTestPattern[QUADSPI_CALIB_MAX_PATTERN];
+static const uint8_t calibTestDummyCycles[] = { W25Q_DUMMY_CYCLES_FAST_READ_QUAD_DTR, 6, 10 };
+static QuadSpiCalibration calibTestStored;
+static bool calibTestHasStored = false;
+
+static bool CalibTest_writePattern(uint32_t address, const uint8_t *pattern, uint32_t length)
+{
+	bool success = W25q_sectorErase(address) && W25q_writeBytes(address, pattern, length);
+
+	W25q_waitForReady();
+
+	return success;
+}
+
+static bool CalibTest_load(QuadSpiCalibration *calibration)
+{
+	*calibration = calibTestStored;
+	return calibTestHasStored;
+}
+
+static bool CalibTest_store(const QuadSpiCalibration *calibration)
+{
+	calibTestStored = *calibration;
+	calibTestHasStored = true;
+	return true;
+}
+
+static QuadSpiCalibConfig CalibTest_config(void)
+{
+	QuadSpiCalibConfig config = {
+		.hqspi				= &testQspi,
+		.flashSize			= TEST_NOR_FLASH_SIZE,
+		.chipSelectHighTime	= QSPI_CS_HIGH_TIME_2_CYCLE,
+		.fastestPrescaler	= 0,
+		.slowestPrescaler	= 7,
+		.marginSteps		= 1,
+		.repetitions		= 16,
+		.dummyCycles		= calibTestDummyCycles,
+		.dummyCount			= sizeof(calibTestDummyCycles),
+		.patternAddress		= CALIB_TEST_PATTERN_ADDRESS,
+		.pattern			= calibTestPattern,
+		.patternLength		= sizeof(calibTestPattern),
+		.readPattern		= W25q_readBytesWithDummyCycles,
+		.setDummyCycles		= W25q_setReadDummyCycles,
+		.writePattern		= CalibTest_writePattern,
+		.load				= NULL,
+		.store				= NULL,
+	};
+
+	return config;
+}
+
+//! Reads with the locked in setting must come back clean every time
+static void CalibTest_checkLocked(void)
+{
+	uint8_t buffer[sizeof(calibTestPattern)];
+	uint32_t corrupted = SimQspi_getStats()->corruptedBytes;
+	uint32_t mismatches = 0;
+
+	for (uint32_t i = 0; i < CALIB_TEST_CHECK_READS; i++) {
+		TEST_CHECK(W25q_readBytes(CALIB_TEST_PATTERN_ADDRESS, buffer, sizeof(buffer)));
+		mismatches += (memcmp(buffer, calibTestPattern, sizeof(buffer)) != 0) ? 1u : 0u;
+	}
+
+	TEST_CHECK(mismatches == 0);
+	TEST_CHECK(SimQspi_getStats()->corruptedBytes == corrupted);
+}
+
+static void CalibTest_start(const SimQspiLink *link)
+{
+	TEST_CHECK(Test_attach(&SimFlash_w25q128jvIm, TEST_NOR_FLASH_SIZE));
+	TEST_CHECK(W25q_init(&testQspi));
+	SimQspi_setLink(link);
+}
+
+int main(void)
+{
+	QuadSpiCalibConfig config = CalibTest_config();
+	QuadSpiCalibration result;
+
+	Test_fill(calibTestPattern, sizeof(calibTestPattern), 31);
+
+	// Ideal link: the fastest clock passes, the margin step is still added
+	CalibTest_start(NULL);
+	TEST_CHECK(QuadSpiCalib_run(&config, &result));
+	TEST_CHECK(QuadSpiCalib_isValid(&result));
+	TEST_CHECK(result.timing.clockPrescaler == (config.fastestPrescaler + config.marginSteps));
+	TEST_CHECK(result.dummyCycles == W25Q_DUMMY_CYCLES_FAST_READ_QUAD_DTR);
+	TEST_CHECK(SimQspi_busClockHz() == (SIM_QSPI_KERNEL_CLOCK_HZ / (result.timing.clockPrescaler + 1u)));
+	CalibTest_checkLocked();
+
+	// 7 ns of output delay: 100 MHz only works when sampling a full clock late, 200 MHz never
+	SimQspiLink slow = { .outputDelayPs = 7000, .marginPs = 500, .seed = 31 };
+
+	CalibTest_start(&slow);
+	TEST_CHECK(QuadSpiCalib_run(&config, &result));
+	TEST_CHECK(SimQspi_getStats()->corruptedBytes > 0);
+	TEST_CHECK(result.timing.clockPrescaler == 2);
+	CalibTest_checkLocked();
+	Test_checkProtocol();
+
+	// Marginal link: 100 MHz with sample shifting is inside the error margin, one transfer in
+	// eight picks up a bit error. The repetitions and the margin step keep it out of the result.
+	SimQspiLink marginal = { .outputDelayPs = 8000, .marginPs = 3000, .seed = 7 };
+
+	CalibTest_start(&marginal);
+	config.store = CalibTest_store;
+	TEST_CHECK(QuadSpiCalib_run(&config, &result));
+	TEST_CHECK(result.timing.clockPrescaler >= 2);
+	TEST_CHECK(calibTestHasStored);
+	CalibTest_checkLocked();
+
+	// The next boot keeps the part and its pattern, the stored result is confirmed with a single read
+	TEST_CHECK(QuadSpi_Init(&testQspi, TEST_NOR_FLASH_SIZE));
+	config.load = CalibTest_load;
+	QuadSpiCalibration reloaded;
+	uint64_t start = SimQspi_nowNs();
+	uint64_t reads = SimQspi_getStats()->transactions;
+
+	TEST_CHECK(QuadSpiCalib_run(&config, &reloaded));
+	TEST_CHECK(memcmp(&reloaded, &calibTestStored, sizeof(reloaded)) == 0);
+	TEST_CHECK((SimQspi_getStats()->transactions - reads) < 4u);
+	TEST_CHECK((SimQspi_nowNs() - start) < 1000000u);
+
+	// A stored result the link no longer supports falls back to a full sweep
+	SimQspiLink worse = { .outputDelayPs = 16000, .marginPs = 500, .seed = 9 };
+
+	SimQspi_setLink(&worse);
+	TEST_CHECK(QuadSpi_Init(&testQspi, TEST_NOR_FLASH_SIZE));
+	TEST_CHECK(QuadSpiCalib_run(&config, &result));
+	TEST_CHECK(result.timing.clockPrescaler > reloaded.timing.clockPrescaler);
+	CalibTest_checkLocked();
+
+	// Nothing passes at all: default timing is restored and the call fails
+	SimQspiLink broken = { .outputDelayPs = 50000, .marginPs = 0, .seed = 3 };
+
+	CalibTest_start(&broken);
+	config.load = NULL;
+	TEST_CHECK(!QuadSpiCalib_run(&config, &result));
+	TEST_CHECK(SimQspi_busClockHz() == (SIM_QSPI_KERNEL_CLOCK_HZ / (QuadSpi_defaultTiming.clockPrescaler + 1u)));
+
+	return Test_result("quadspicalibtest");
+}
@@ -0,0 +1,188 @@
+/*
+ * This program is host test of the cache-aware QUADSPI DMA paths against a D-cache line model.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testutil.h"
+#include "quadspidma.h"
+#include "w25q.h"
+
+#define DMA_TEST_FLASH_ADDRESS	0x20000
+#define DMA_TEST_LENGTH			4096
+#define DMA_TEST_HEAD			5						//!< Buffer offset into its first cache line
+#define DMA_TEST_READ_LENGTH	(DMA_TEST_LENGTH - 40u)	//!< Ends part way into a line as well
+
+static uint8_t dmaTestData[DMA_TEST_LENGTH];
+static uint8_t dmaTestBuffer[DMA_TEST_LENGTH + 2 * QUADSPI_DMA_CACHE_LINE] __ALIGNED(32);
+static uint8_t dmaTestExpected[sizeof(dmaTestBuffer)];
+static uint8_t dmaTestChannel;
+static uint32_t dmaTestDone;
+static bool dmaTestSuccess;
+
+static void DmaTest_done(void *context, bool success)
+{
+	(void)context;
+	dmaTestDone++;
+	dmaTestSuccess = success;
+}
+
+//! The application has been using the whole buffer, every line of it is dirty in the cache
+static void DmaTest_dirtyBuffer(void)
+{
+	memset(dmaTestBuffer, 0xA5, sizeof(dmaTestBuffer));
+	SimCache_cpuWrite(dmaTestBuffer, sizeof(dmaTestBuffer));
+	memcpy(dmaTestExpected, dmaTestBuffer, sizeof(dmaTestExpected));
+}
+
+static void DmaTest_start(void)
+{
+	TEST_CHECK(Test_attach(&SimFlash_w25q128jvIm, TEST_NOR_FLASH_SIZE));
+	testQspi.hmdma = &dmaTestChannel;
+	TEST_CHECK(W25q_init(&testQspi));
+	SimCache_enable(true);
+	dmaTestDone = 0;
+}
+
+static void DmaTest_unalignedRead(void)
+{
+	uint32_t head = QUADSPI_DMA_CACHE_LINE - DMA_TEST_HEAD;
+	uint32_t tail = (DMA_TEST_HEAD + DMA_TEST_READ_LENGTH) % QUADSPI_DMA_CACHE_LINE;
+
+	DmaTest_start();
+	TEST_CHECK(W25q_writeBytes(DMA_TEST_FLASH_ADDRESS, dmaTestData, DMA_TEST_LENGTH));
+	W25q_waitForReady();
+	DmaTest_dirtyBuffer();
+	QuadSpiDma_resetStats();
+
+	TEST_CHECK(W25q_readBytesAsync(DMA_TEST_FLASH_ADDRESS, &dmaTestBuffer[DMA_TEST_HEAD], DMA_TEST_READ_LENGTH, DmaTest_done, NULL));
+
+	// The aligned middle is still in flight, the ends were read by the CPU
+	TEST_CHECK(QuadSpiDma_isBusy());
+	TEST_CHECK(SimQspi_interruptPending());
+	TEST_CHECK(dmaTestDone == 0);
+	TEST_CHECK(SimQspi_runInterrupts() == 1);
+	TEST_CHECK(dmaTestDone == 1);
+	TEST_CHECK(dmaTestSuccess);
+	TEST_CHECK(!QuadSpiDma_isBusy());
+
+	const QuadSpiDmaStats *stats = QuadSpiDma_getStats();
+
+	TEST_CHECK(stats->transfers == 1);
+	TEST_CHECK(stats->slowPathBytes == (head + tail));
+	TEST_CHECK(stats->dmaBytes == (DMA_TEST_READ_LENGTH - head - tail));
+	TEST_CHECK(stats->invalidatedLines == (2u * (stats->dmaBytes / QUADSPI_DMA_CACHE_LINE)));
+
+	// Data in place, the neighbours sharing the end lines untouched
+	memcpy(&dmaTestExpected[DMA_TEST_HEAD], dmaTestData, DMA_TEST_READ_LENGTH);
+	TEST_CHECK(memcmp(dmaTestBuffer, dmaTestExpected, sizeof(dmaTestBuffer)) == 0);
+
+	// Nothing dirty under the DMA, no neighbour bytes dropped, no stale line seen by the CPU
+	SimCache_cpuRead(dmaTestBuffer, sizeof(dmaTestBuffer));
+
+	const SimCacheStats *cache = SimCache_getStats();
+
+	TEST_CHECK(cache->dirtyUnderDma == 0);
+	TEST_CHECK(cache->discardedBytes == 0);
+	TEST_CHECK(cache->staleReads == 0);
+	Test_checkProtocol();
+}
+
+static void DmaTest_shortRead(void)
+{
+	DmaTest_start();
+	TEST_CHECK(W25q_writeBytes(DMA_TEST_FLASH_ADDRESS, dmaTestData, DMA_TEST_LENGTH));
+	W25q_waitForReady();
+	DmaTest_dirtyBuffer();
+	QuadSpiDma_resetStats();
+
+	// Below the DMA threshold the read is polled and done before the call returns
+	TEST_CHECK(W25q_readBytesAsync(DMA_TEST_FLASH_ADDRESS, dmaTestBuffer, QUADSPI_DMA_MIN_LENGTH - 1u, DmaTest_done, NULL));
+	TEST_CHECK(dmaTestDone == 1);
+	TEST_CHECK(!SimQspi_interruptPending());
+	TEST_CHECK(QuadSpiDma_getStats()->dmaBytes == 0);
+	TEST_CHECK(QuadSpiDma_getStats()->slowPathBytes == (QUADSPI_DMA_MIN_LENGTH - 1u));
+	TEST_CHECK(memcmp(dmaTestBuffer, dmaTestData, QUADSPI_DMA_MIN_LENGTH - 1u) == 0);
+	TEST_CHECK(SimCache_getStats()->maintenanceCalls == 0);
+}
+
+static void DmaTest_program(void)
+{
+	DmaTest_start();
+	TEST_CHECK(W25q_sectorErase(DMA_TEST_FLASH_ADDRESS));
+	W25q_waitForReady();
+
+	// The page is built by the CPU, its lines are dirty when the transmit starts
+	memcpy(&dmaTestBuffer[DMA_TEST_HEAD], dmaTestData, W25Q_PAGE_SIZE);
+	SimCache_cpuWrite(&dmaTestBuffer[DMA_TEST_HEAD], W25Q_PAGE_SIZE);
+	QuadSpiDma_resetStats();
+
+	TEST_CHECK(W25q_quadPageProgramAsync(DMA_TEST_FLASH_ADDRESS, &dmaTestBuffer[DMA_TEST_HEAD], W25Q_PAGE_SIZE, DmaTest_done, NULL));
+	TEST_CHECK(SimQspi_runInterrupts() == 1);
+	TEST_CHECK(dmaTestDone == 1);
+	TEST_CHECK(dmaTestSuccess);
+	W25q_waitForReady();
+
+	TEST_CHECK(QuadSpiDma_getStats()->dmaBytes == W25Q_PAGE_SIZE);
+	TEST_CHECK(QuadSpiDma_getStats()->cleanedLines == ((W25Q_PAGE_SIZE / QUADSPI_DMA_CACHE_LINE) + 1u));
+	TEST_CHECK(SimCache_getStats()->uncleanedTx == 0);
+
+	memset(dmaTestBuffer, 0, sizeof(dmaTestBuffer));
+	TEST_CHECK(W25q_readBytes(DMA_TEST_FLASH_ADDRESS, dmaTestBuffer, W25Q_PAGE_SIZE));
+	TEST_CHECK(memcmp(dmaTestBuffer, dmaTestData, W25Q_PAGE_SIZE) == 0);
+	Test_checkProtocol();
+}
+
+//! A DMA receive with no maintenance at all, the model has to catch it
+static void DmaTest_modelDetects(void)
+{
+	QSPI_CommandTypeDef cmd;
+
+	DmaTest_start();
+	DmaTest_dirtyBuffer();
+	SimCache_cpuRead(dmaTestBuffer, sizeof(dmaTestBuffer));
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.InstructionMode	= QSPI_INSTRUCTION_1_LINE;
+	cmd.Instruction		= 0x03;
+	cmd.AddressMode		= QSPI_ADDRESS_1_LINE;
+	cmd.AddressSize		= QSPI_ADDRESS_24_BITS;
+	cmd.Address			= DMA_TEST_FLASH_ADDRESS;
+	cmd.DataMode		= QSPI_DATA_1_LINE;
+	cmd.NbData			= DMA_TEST_LENGTH;
+
+	TEST_CHECK(HAL_QSPI_Command(&testQspi, &cmd, 100) == HAL_OK);
+	TEST_CHECK(HAL_QSPI_Receive_DMA(&testQspi, dmaTestBuffer) == HAL_OK);
+	TEST_CHECK(SimQspi_runInterrupts() == 1);
+	SimCache_cpuRead(dmaTestBuffer, DMA_TEST_LENGTH);
+
+	TEST_CHECK(SimCache_getStats()->dirtyUnderDma == (DMA_TEST_LENGTH / QUADSPI_DMA_CACHE_LINE));
+	TEST_CHECK(SimCache_getStats()->staleReads == (DMA_TEST_LENGTH / QUADSPI_DMA_CACHE_LINE));
+	TEST_CHECK(dmaTestDone == 0);
+}
+
+int main(void)
+{
+	Test_fill(dmaTestData, sizeof(dmaTestData), 33);
+
+	DmaTest_unalignedRead();
+	DmaTest_shortRead();
+	DmaTest_program();
+	DmaTest_modelDetects();
+
+	return Test_result("quadspidmatest");
+}
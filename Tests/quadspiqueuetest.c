@@ -0,0 +1,285 @@
+/*
+ * This program is host test of the interrupt-driven QUADSPI command queue.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testutil.h"
+#include "quadspiqueue.h"
+#include "quadspidma.h"
+#include "w25q.h"
+#include "w25n01g.h"
+
+#define QUEUE_TEST_ADDRESS		0x30000
+#define QUEUE_TEST_PAGES_A		4
+#define QUEUE_TEST_PAGES_B		2
+#define QUEUE_TEST_MAX_OPS		(1 + (QUEUE_TEST_PAGES_A * W25Q_PROGRAM_OPS_PER_PAGE))
+#define QUEUE_TEST_DMA_LENGTH	1024
+#define QUEUE_TEST_NAND_PAGE	(20u * W25N01G_PAGES_PER_BLOCK)
+
+static uint8_t queueTestData[(QUEUE_TEST_PAGES_A + QUEUE_TEST_PAGES_B) * W25Q_PAGE_SIZE];
+static uint8_t queueTestRead[sizeof(queueTestData)];
+static QuadSpiOp queueTestOpsA[QUEUE_TEST_MAX_OPS];
+static QuadSpiOp queueTestOpsB[QUEUE_TEST_MAX_OPS];
+static uintptr_t queueTestOrder[4];
+static uint8_t queueTestDmaBuffer[QUEUE_TEST_DMA_LENGTH] __ALIGNED(32);
+static uint8_t queueTestChannel;
+static uint32_t queueTestDone;
+static uint32_t queueTestFailed;
+static uint32_t queueTestDmaDone;
+static bool queueTestDmaSuccess;
+
+static void QueueTest_done(void *context, bool success)
+{
+	if (queueTestDone < (sizeof(queueTestOrder) / sizeof(queueTestOrder[0]))) {
+		queueTestOrder[queueTestDone] = (uintptr_t)context;
+	}
+
+	queueTestDone++;
+	queueTestFailed += success ? 0u : 1u;
+}
+
+static void QueueTest_dmaDone(void *context, bool success)
+{
+	(void)context;
+	queueTestDmaDone++;
+	queueTestDmaSuccess = success;
+}
+
+static void QueueTest_start(void)
+{
+	TEST_CHECK(Test_attach(&SimFlash_w25q128jvIm, TEST_NOR_FLASH_SIZE));
+	testQspi.hmdma = &queueTestChannel;
+	TEST_CHECK(W25q_init(&testQspi));
+	TEST_CHECK(W25q_sectorErase(QUEUE_TEST_ADDRESS));
+	W25q_waitForReady();
+
+	QuadSpiQueue_init(&testQspi);
+	queueTestDone = 0;
+	queueTestFailed = 0;
+}
+
+//! Two multi-page programs queued back to back, the interrupts carry both to the end
+static void QueueTest_program(void)
+{
+	uint32_t lengthA = QUEUE_TEST_PAGES_A * W25Q_PAGE_SIZE;
+	uint32_t lengthB = QUEUE_TEST_PAGES_B * W25Q_PAGE_SIZE;
+
+	QueueTest_start();
+
+	uint32_t countA = W25q_fillProgramOps(queueTestOpsA, QUEUE_TEST_MAX_OPS, QUEUE_TEST_ADDRESS, queueTestData, lengthA);
+	uint32_t countB = W25q_fillProgramOps(queueTestOpsB, QUEUE_TEST_MAX_OPS, QUEUE_TEST_ADDRESS + lengthA, &queueTestData[lengthA], lengthB);
+
+	TEST_CHECK(countA == QUEUE_TEST_MAX_OPS);
+	TEST_CHECK(countB == (1 + (QUEUE_TEST_PAGES_B * W25Q_PROGRAM_OPS_PER_PAGE)));
+	TEST_CHECK(W25q_fillProgramOps(queueTestOpsA, QUEUE_TEST_MAX_OPS - 1u, QUEUE_TEST_ADDRESS, queueTestData, lengthA) == 0);
+
+	QuadSpiChain chainA = { .ops = queueTestOpsA, .count = countA, .done = QueueTest_done, .context = (void *)1 };
+	QuadSpiChain chainB = { .ops = queueTestOpsB, .count = countB, .done = QueueTest_done, .context = (void *)2 };
+	uint64_t start = SimQspi_nowNs();
+
+	TEST_CHECK(QuadSpiQueue_submit(&chainA));
+	TEST_CHECK(QuadSpiQueue_submit(&chainB));
+
+	// Nothing completes from thread context, the first op is waiting on the peripheral
+	TEST_CHECK(!QuadSpiQueue_isIdle());
+	TEST_CHECK(QuadSpiQueue_getStats()->depth == 2);
+	TEST_CHECK(QuadSpiQueue_getStats()->maxDepth == 2);
+	TEST_CHECK(SimQspi_interruptPending());
+	TEST_CHECK(queueTestDone == 0);
+
+	uint32_t halCalls = (uint32_t)SimQspi_getStats()->halCalls;
+	uint32_t interrupts = SimQspi_runInterrupts();
+
+	// Every op takes one interrupt, write enables too, so the handler never waits on the bus
+	const QuadSpiQueueStats *stats = QuadSpiQueue_getStats();
+
+	TEST_CHECK(interrupts == (countA + countB));
+	TEST_CHECK(stats->interrupts == (countA + countB));
+	TEST_CHECK(stats->opsCompleted == (countA + countB));
+	TEST_CHECK(stats->chainsCompleted == 2);
+	TEST_CHECK(stats->chainsFailed == 0);
+	TEST_CHECK(stats->depth == 0);
+	TEST_CHECK(QuadSpiQueue_isIdle());
+
+	TEST_CHECK(queueTestDone == 2);
+	TEST_CHECK(queueTestFailed == 0);
+	TEST_CHECK((queueTestOrder[0] == 1) && (queueTestOrder[1] == 2));
+
+	// A handful of HAL calls per op, all of them made from the interrupts
+	TEST_CHECK(((uint32_t)SimQspi_getStats()->halCalls - halCalls) <= (3u * (countA + countB)));
+
+	// The chains run at the speed of the part, back to back
+	uint64_t elapsedNs = SimQspi_nowNs() - start;
+	uint64_t programNs = (uint64_t)(QUEUE_TEST_PAGES_A + QUEUE_TEST_PAGES_B) * SimFlash_w25q128jvIm.pageProgramUs * 1000u;
+
+	TEST_CHECK(elapsedNs >= programNs);
+	TEST_CHECK(elapsedNs < (programNs + (programNs / 4u)));
+
+	TEST_CHECK(W25q_readBytes(QUEUE_TEST_ADDRESS, queueTestRead, sizeof(queueTestRead)));
+	TEST_CHECK(memcmp(queueTestRead, queueTestData, sizeof(queueTestData)) == 0);
+	Test_checkProtocol();
+}
+
+//! A chain the HAL refuses ends at once with a single failed completion, the next one still runs
+static void QueueTest_refused(void)
+{
+	QueueTest_start();
+
+	uint32_t count = W25q_fillProgramOps(queueTestOpsA, QUEUE_TEST_MAX_OPS, QUEUE_TEST_ADDRESS, queueTestData, W25Q_PAGE_SIZE);
+	QuadSpiChain chain = { .ops = queueTestOpsA, .count = count, .done = QueueTest_done, .context = (void *)1 };
+
+	TEST_CHECK(W25q_memoryMappedModeEnable());
+	TEST_CHECK(QuadSpiQueue_submit(&chain));
+	TEST_CHECK(queueTestDone == 1);
+	TEST_CHECK(queueTestFailed == 1);
+	TEST_CHECK(QuadSpiQueue_isIdle());
+	TEST_CHECK(QuadSpiQueue_getStats()->chainsFailed == 1);
+	TEST_CHECK(QuadSpiQueue_getStats()->depth == 0);
+	TEST_CHECK(W25q_memoryMappedModeDisable());
+
+	// Done chains belong to the caller again
+	TEST_CHECK(QuadSpiQueue_submit(&chain));
+	SimQspi_runInterrupts();
+	TEST_CHECK(queueTestDone == 2);
+	TEST_CHECK(queueTestFailed == 1);
+	TEST_CHECK(QuadSpiQueue_getStats()->chainsCompleted == 1);
+
+	TEST_CHECK(W25q_readBytes(QUEUE_TEST_ADDRESS, queueTestRead, W25Q_PAGE_SIZE));
+	TEST_CHECK(memcmp(queueTestRead, queueTestData, W25Q_PAGE_SIZE) == 0);
+
+	chain.count = 0;
+	TEST_CHECK(!QuadSpiQueue_submit(&chain));
+	Test_checkProtocol();
+}
+
+//! A DMA read and a chain share the peripheral, each gets its own completions
+static void QueueTest_dma(void)
+{
+	QSPI_CommandTypeDef cmd;
+
+	QueueTest_start();
+	TEST_CHECK(W25q_writeBytes(QUEUE_TEST_ADDRESS, queueTestData, QUEUE_TEST_DMA_LENGTH));
+	W25q_waitForReady();
+	TEST_CHECK(W25q_sectorErase(QUEUE_TEST_ADDRESS + W25Q_SECTOR_SIZE));
+	W25q_waitForReady();
+	queueTestDmaDone = 0;
+
+	uint32_t count = W25q_fillProgramOps(queueTestOpsA, QUEUE_TEST_MAX_OPS, QUEUE_TEST_ADDRESS + W25Q_SECTOR_SIZE, queueTestData, W25Q_PAGE_SIZE);
+	QuadSpiChain chain = { .ops = queueTestOpsA, .count = count, .done = QueueTest_done, .context = (void *)1 };
+
+	// The chain submitted under a running DMA transfer waits for it, then runs from its completion
+	TEST_CHECK(W25q_readBytesAsync(QUEUE_TEST_ADDRESS, queueTestDmaBuffer, QUEUE_TEST_DMA_LENGTH, QueueTest_dmaDone, NULL));
+	TEST_CHECK(QuadSpiDma_isBusy());
+
+	uint64_t transactions = SimQspi_getStats()->transactions;
+
+	TEST_CHECK(QuadSpiQueue_submit(&chain));
+	TEST_CHECK(SimQspi_getStats()->transactions == transactions);
+	TEST_CHECK(!QuadSpiQueue_isIdle());
+
+	uint32_t interrupts = SimQspi_runInterrupts();
+
+	TEST_CHECK((queueTestDmaDone == 1) && queueTestDmaSuccess);
+	TEST_CHECK((queueTestDone == 1) && (queueTestFailed == 0));
+	TEST_CHECK(interrupts == (1u + count));
+	TEST_CHECK(QuadSpiQueue_getStats()->interrupts == count);
+	TEST_CHECK(memcmp(queueTestDmaBuffer, queueTestData, QUEUE_TEST_DMA_LENGTH) == 0);
+
+	// A DMA transfer asked for while the chain runs is refused before it touches the bus
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.InstructionMode		= QSPI_INSTRUCTION_1_LINE;
+	cmd.Instruction			= 0x0B;
+	cmd.AddressMode			= QSPI_ADDRESS_1_LINE;
+	cmd.AddressSize			= QSPI_ADDRESS_24_BITS;
+	cmd.Address				= QUEUE_TEST_ADDRESS;
+	cmd.DataMode			= QSPI_DATA_1_LINE;
+	cmd.DummyCycles			= 8;
+	cmd.NbData				= QUEUE_TEST_DMA_LENGTH;
+
+	count = W25q_fillProgramOps(queueTestOpsA, QUEUE_TEST_MAX_OPS, QUEUE_TEST_ADDRESS + W25Q_SECTOR_SIZE + W25Q_PAGE_SIZE, &queueTestData[W25Q_PAGE_SIZE], W25Q_PAGE_SIZE);
+	chain.count = count;
+	TEST_CHECK(QuadSpiQueue_submit(&chain));
+	transactions = SimQspi_getStats()->transactions;
+	TEST_CHECK(!QuadSpiDma_receive(&cmd, queueTestDmaBuffer, QueueTest_dmaDone, NULL));
+	TEST_CHECK(SimQspi_getStats()->transactions == transactions);
+
+	TEST_CHECK(SimQspi_runInterrupts() == count);
+	TEST_CHECK((queueTestDone == 2) && (queueTestFailed == 0));
+	TEST_CHECK(queueTestDmaDone == 1);
+
+	// Idle again, the DMA layer gets the peripheral back
+	TEST_CHECK(QuadSpiDma_receive(&cmd, queueTestDmaBuffer, QueueTest_dmaDone, NULL));
+	SimQspi_runInterrupts();
+	TEST_CHECK((queueTestDmaDone == 2) && queueTestDmaSuccess);
+
+	TEST_CHECK(W25q_readBytes(QUEUE_TEST_ADDRESS + W25Q_SECTOR_SIZE, queueTestRead, 2u * W25Q_PAGE_SIZE));
+	TEST_CHECK(memcmp(queueTestRead, queueTestData, 2u * W25Q_PAGE_SIZE) == 0);
+	Test_checkProtocol();
+}
+
+//! A queued NAND erase changes what the data buffer would have to hold, the driver reads the page again
+static void QueueTest_nand(void)
+{
+	QuadSpiOp ops[3];
+
+	TEST_CHECK(Test_attach(&SimFlash_w25n01gv, TEST_NAND_FLASH_SIZE));
+	TEST_CHECK(SimFlash_load(QUEUE_TEST_NAND_PAGE * W25N01G_PAGE_SIZE, queueTestData, W25N01G_PAGE_SIZE));
+	TEST_CHECK(W25n01g_init(&testQspi));
+	QuadSpiQueue_init(&testQspi);
+	queueTestDone = 0;
+	queueTestFailed = 0;
+
+	TEST_CHECK(W25n01g_readPageData(&testQspi, QUEUE_TEST_NAND_PAGE, 0, queueTestRead, 16));
+	TEST_CHECK(memcmp(queueTestRead, queueTestData, 16) == 0);
+
+	QuadSpiQueue_commandOp(&ops[0], W25N01G_INSTR_WRITE_ENABLE);
+	QuadSpiQueue_commandOp(&ops[1], W25N01G_INSTR_BLOCK_ERASE);
+	ops[1].cmd.AddressMode	= QSPI_ADDRESS_1_LINE;
+	ops[1].cmd.AddressSize	= QSPI_ADDRESS_24_BITS;
+	ops[1].cmd.Address		= QUEUE_TEST_NAND_PAGE;
+	QuadSpiQueue_pollOp(&ops[2], W25N01G_INSTR_READ_STATUS_REG, W25N01G_STATUS_FLAG_BUSY, 0);
+	ops[2].cmd.AddressMode	= QSPI_ADDRESS_1_LINE;
+	ops[2].cmd.AddressSize	= QSPI_ADDRESS_8_BITS;
+	ops[2].cmd.Address		= W25N01G_STAT_REG;
+
+	QuadSpiChain chain = { .ops = ops, .count = 3, .done = QueueTest_done, .context = (void *)1 };
+
+	TEST_CHECK(QuadSpiQueue_submit(&chain));
+	SimQspi_runInterrupts();
+	TEST_CHECK((queueTestDone == 1) && (queueTestFailed == 0));
+
+	// The buffer still holds the old page, only a new PAGE DATA READ shows the erase
+	uint32_t pageReads = SimFlash_getStats()->pageReads;
+
+	TEST_CHECK(W25n01g_readPageData(&testQspi, QUEUE_TEST_NAND_PAGE, 0, queueTestRead, 16));
+	TEST_CHECK(SimFlash_getStats()->pageReads == pageReads + 1u);
+	TEST_CHECK((queueTestRead[0] == 0xFF) && (queueTestRead[15] == 0xFF));
+	Test_checkProtocol();
+}
+
+int main(void)
+{
+	Test_fill(queueTestData, sizeof(queueTestData), 34);
+
+	QueueTest_program();
+	QueueTest_refused();
+	QueueTest_dma();
+	QueueTest_nand();
+
+	return Test_result("quadspiqueuetest");
+}
@@ -0,0 +1,152 @@
+/*
+ * This program is host test of the QUADSPI command trace recorder, analysis and replay.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testutil.h"
+#include "quadspitrace.h"
+#include "w25n01g.h"
+
+#define TRACE_TEST_RECORDS		4096
+#define TRACE_TEST_BLOCK		4
+
+static QuadSpiTraceRecord traceTestRing[TRACE_TEST_RECORDS];
+static QuadSpiTraceRecord traceTestRecorded[TRACE_TEST_RECORDS];
+static QuadSpiTraceRecord traceTestReplayed[TRACE_TEST_RECORDS];
+static uint8_t traceTestData[2 * W25N01G_PAGE_SIZE];
+static uint8_t traceTestScratch[2 * W25N01G_PAGE_SIZE];
+
+static const QuadSpiTraceOpcode *TraceTest_opcode(const QuadSpiTraceReport *report, uint8_t opcode)
+{
+	const QuadSpiTraceOpcode *entry = NULL;
+
+	for (uint32_t i = 0; i < report->opcodeCount; i++) {
+		if (report->opcodes[i].opcode == opcode) {
+			entry = &report->opcodes[i];
+		}
+	}
+
+	return entry;
+}
+
+//! Driver traffic with one redundant PAGE_DATA_READ, and two WRITE_ENABLEs the erase did not need
+static uint32_t TraceTest_record(void)
+{
+	uint32_t address = TRACE_TEST_BLOCK * W25N01G_BLOCK_SIZE;
+	uint16_t page = (uint16_t)(address / W25N01G_PAGE_SIZE);
+
+	QuadSpiTrace_start(traceTestRing, TRACE_TEST_RECORDS, SimQspi_clock);
+
+	TEST_CHECK(W25n01g_blockErase(&testQspi, address));
+	TEST_CHECK(w25n01g_writeFlash(&testQspi, address, traceTestData, sizeof(traceTestData)));
+	TEST_CHECK(W25n01g_readBytes(&testQspi, address, traceTestScratch, W25N01G_PAGE_SIZE, true) == W25N01G_PAGE_SIZE);
+
+	// The same page loaded twice in a row, as a careless caller would, the driver did not see it go busy
+	for (uint32_t i = 0; i < 2; i++) {
+		TEST_CHECK(QuadSpiInstructionWithAddress1LINE(&testQspi, W25N01G_INSTR_PAGE_DATA_READ, 0, page + 1u, W25N01G_STATUS_PAGE_ADDRESS_SIZE));
+		FlashDevice_invalidateShadow(FLASH_DEVICE_TYPE_NAND);
+		W25n01g_waitForReady(&testQspi);
+	}
+
+	TEST_CHECK(W25n01g_writeEnable(&testQspi));
+	TEST_CHECK(W25n01g_writeEnable(&testQspi));
+	TEST_CHECK(W25n01g_blockErase(&testQspi, address));
+
+	QuadSpiTrace_stop();
+
+	TEST_CHECK(QuadSpiTrace_overwritten() == 0);
+
+	return QuadSpiTrace_copy(traceTestRecorded, TRACE_TEST_RECORDS);
+}
+
+int main(void)
+{
+	QuadSpiTraceReport recorded;
+	QuadSpiTraceReport replayed;
+
+	Test_fill(traceTestData, sizeof(traceTestData), 43);
+
+	TEST_CHECK(Test_attach(&SimFlash_w25n01gv, TEST_NAND_FLASH_SIZE));
+	TEST_CHECK(W25n01g_init(&testQspi));
+
+	uint32_t count = TraceTest_record();
+
+	TEST_CHECK(count > 0);
+	Test_checkProtocol();
+
+	// Data loads are marked as writes so a replay sends rather than receives
+	uint32_t loads = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		if (traceTestRecorded[i].instruction == W25N01G_INSTR_PROGRAM_DATA_LOAD) {
+			TEST_CHECK(traceTestRecorded[i].modes & QUADSPI_TRACE_MODE_WRITE);
+			loads++;
+		} else if (traceTestRecorded[i].instruction == W25N01G_INSTR_FAST_READ_QUAD) {
+			TEST_CHECK(!(traceTestRecorded[i].modes & QUADSPI_TRACE_MODE_WRITE));
+		}
+	}
+	TEST_CHECK(loads == 2);
+
+	QuadSpiTrace_analyze(traceTestRecorded, count, &recorded);
+
+	TEST_CHECK(recorded.records == count);
+	TEST_CHECK(recorded.failures == 0);
+	TEST_CHECK(recorded.redundantPageReads == 1);
+	TEST_CHECK(recorded.redundantWriteEnables == 2);
+	TEST_CHECK(recorded.wastedPolls > 0);
+	TEST_CHECK(TraceTest_opcode(&recorded, W25N01G_INSTR_BLOCK_ERASE)->count == 2);
+	TEST_CHECK(TraceTest_opcode(&recorded, W25N01G_INSTR_PROGRAM_EXECUTE)->count == 2);
+
+	// Replay on a fresh part of the same kind, nothing may reach it while busy
+	TEST_CHECK(Test_attach(&SimFlash_w25n01gv, TEST_NAND_FLASH_SIZE));
+
+	uint32_t replayCount = QuadSpiTrace_replay(&testQspi, traceTestRecorded, count, traceTestScratch, sizeof(traceTestScratch), traceTestReplayed, SimQspi_clock);
+
+	TEST_CHECK(replayCount == count);
+	TEST_CHECK(!QuadSpiTrace_isRecording());
+	Test_checkProtocol();
+	TEST_CHECK(SimFlash_getStats()->programs == 2);
+	TEST_CHECK(SimFlash_getStats()->erases == 2);
+
+	QuadSpiTrace_analyze(traceTestReplayed, replayCount, &replayed);
+
+	TEST_CHECK(replayed.failures == 0);
+	TEST_CHECK(replayed.redundantPageReads == recorded.redundantPageReads);
+	TEST_CHECK(replayed.redundantWriteEnables == recorded.redundantWriteEnables);
+	TEST_CHECK(replayed.opcodeCount == recorded.opcodeCount);
+
+	// Same part model, the replay takes about as long as the original run
+	TEST_CHECK((replayed.duration * 2u) > recorded.duration);
+	TEST_CHECK(replayed.duration < (recorded.duration * 2u));
+
+	// The busy time of the first erase lands on the status reads, the trace ends before the second one is done
+	const QuadSpiTraceOpcode *erase = TraceTest_opcode(&replayed, W25N01G_INSTR_BLOCK_ERASE);
+	const QuadSpiTraceOpcode *status = TraceTest_opcode(&replayed, W25N01G_INSTR_READ_STATUS_REG);
+
+	TEST_CHECK((erase != NULL) && (status != NULL));
+	if ((erase != NULL) && (status != NULL)) {
+		TEST_CHECK(status->duration > (SimFlash_w25n01gv.sectorEraseUs * 1000u));
+		TEST_CHECK(erase->duration < status->duration);
+	}
+
+	// Records longer than the scratch buffer are left out
+	TEST_CHECK(Test_attach(&SimFlash_w25n01gv, TEST_NAND_FLASH_SIZE));
+	replayCount = QuadSpiTrace_replay(&testQspi, traceTestRecorded, count, traceTestScratch, W25N01G_PAGE_SIZE - 1u, traceTestReplayed, SimQspi_clock);
+	TEST_CHECK(replayCount == (count - 3u));
+
+	return Test_result("quadspitracetest");
+}
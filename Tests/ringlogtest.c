@@ -0,0 +1,271 @@
+/*
+ * This program is host test and ingest benchmark of the W25N01G ring log on a simulated NAND.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testutil.h"
+#include "ringlog.h"
+#include "w25n01g.h"
+
+#define RING_LOG_TEST_FIRST_BLOCK	32
+#define RING_LOG_TEST_BLOCKS		8
+#define RING_LOG_TEST_BAD_BLOCK		2			//!< Factory marked, relative to the first block
+#define RING_LOG_TEST_RECORD		100			//!< Sensor record, does not divide the page
+#define RING_LOG_TEST_BYTES			(3u * 1024u * 1024u)	//!< About four times around the region
+#define RING_LOG_TEST_MAX_TAG_READS	24			//!< Open may not scan, 8 blocks of 64 pages would take 512
+#define RING_LOG_TEST_DIE_BLOCKS	1024		//!< Blocks per die of the 1Gbit dies and the W25N02KV half
+
+static RingLog ringLogTest;
+static RingLog ringLogTestReopened;
+static RingLogIo ringLogTestIo;
+static RingLogIo ringLogTestCountingIo;
+static uint32_t ringLogTestTagReads;
+static uint32_t ringLogTestWritten;
+static uint32_t ringLogTestFirstBlock;
+
+//! Byte at a position of the logged stream
+static uint8_t RingLogTest_byte(uint32_t position)
+{
+	return (uint8_t)((position * 31u) ^ (position >> 11));
+}
+
+static bool RingLogTest_countTags(void *context, uint32_t page, uint32_t *sequence, uint32_t *lengthWord)
+{
+	ringLogTestTagReads++;
+
+	return ringLogTestIo.readTags(context, page, sequence, lengthWord);
+}
+
+static bool RingLogTest_append(RingLog *log, uint32_t bytes)
+{
+	uint8_t record[RING_LOG_TEST_RECORD];
+	bool success = true;
+
+	while (success && (bytes > 0)) {
+		uint32_t length = (bytes < sizeof(record)) ? bytes : sizeof(record);
+
+		for (uint32_t i = 0; i < length; i++) {
+			record[i] = RingLogTest_byte(ringLogTestWritten + i);
+		}
+
+		success = RingLog_append(log, record, length);
+		ringLogTestWritten += length;
+		bytes -= length;
+	}
+
+	return success;
+}
+
+//! Exports everything still in the log and checks it is one unbroken tail of the stream
+static void RingLogTest_export(RingLog *log, uint32_t retired)
+{
+	RingLogReader reader;
+	uint8_t buffer[1000];
+	uint32_t copied;
+	uint32_t mismatches = 0;
+
+	RingLog_readerInit(log, &reader);
+
+	uint32_t position = reader.sequence * W25N01G_PAGE_SIZE;
+	uint32_t start = position;
+
+	while ((copied = RingLog_read(log, &reader, buffer, sizeof(buffer))) > 0) {
+		for (uint32_t i = 0; i < copied; i++) {
+			mismatches += (buffer[i] == RingLogTest_byte(position + i)) ? 0u : 1u;
+		}
+
+		position += copied;
+	}
+
+	TEST_CHECK(mismatches == 0);
+	TEST_CHECK(position == ringLogTestWritten);
+	TEST_CHECK(reader.lostPages == 0);
+
+	// What is left is the good blocks minus the one kept erased, the head block only partly filled
+	uint32_t retained = ringLogTestWritten - start;
+	uint32_t goodBlocks = RING_LOG_TEST_BLOCKS - 1u - retired;
+
+	TEST_CHECK(retained >= ((goodBlocks - 2u) * W25N01G_PAGES_PER_BLOCK * W25N01G_PAGE_SIZE));
+	TEST_CHECK(retained <= ((goodBlocks - 1u) * W25N01G_PAGES_PER_BLOCK * W25N01G_PAGE_SIZE));
+}
+
+//! Opening the log again finds the same head and tail with a handful of spare area reads
+static void RingLogTest_reopen(const RingLog *log)
+{
+	ringLogTestCountingIo = ringLogTestIo;
+	ringLogTestCountingIo.readTags = RingLogTest_countTags;
+	ringLogTestTagReads = 0;
+
+	TEST_CHECK(RingLog_open(&ringLogTestReopened, &ringLogTestCountingIo, ringLogTestFirstBlock, RING_LOG_TEST_BLOCKS));
+	TEST_CHECK(ringLogTestTagReads <= RING_LOG_TEST_MAX_TAG_READS);
+	// A head that just moved into the erased block holds nothing yet, open reports the full block before it
+	bool sameHead = (ringLogTestReopened.headBlock == log->headBlock) && (ringLogTestReopened.headPage == log->headPage);
+	bool movedHead = (log->headPage == 0) && (ringLogTestReopened.headPage == W25N01G_PAGES_PER_BLOCK);
+
+	TEST_CHECK(sameHead || movedHead);
+	TEST_CHECK(ringLogTestReopened.tailBlock == log->tailBlock);
+	TEST_CHECK(ringLogTestReopened.nextSequence == log->nextSequence);
+
+	printf("open_tag_reads,%u\n", ringLogTestTagReads);
+}
+
+//! Appends as fast as the caller can produce, the log has to keep up with the part
+static void RingLogTest_ingest(void)
+{
+	const SimFlashModel *model = &SimFlash_w25n01gv;
+
+	TEST_CHECK(Test_attach(model, TEST_NAND_FLASH_SIZE));
+	SimFlash_markBadBlock(RING_LOG_TEST_FIRST_BLOCK + RING_LOG_TEST_BAD_BLOCK);
+	TEST_CHECK(W25n01g_init(&testQspi));
+
+	RingLog_w25n01gIo(&ringLogTestIo, &testQspi);
+	ringLogTestWritten = 0;
+	ringLogTestFirstBlock = RING_LOG_TEST_FIRST_BLOCK;
+
+	TEST_CHECK(RingLog_open(&ringLogTest, &ringLogTestIo, RING_LOG_TEST_FIRST_BLOCK, RING_LOG_TEST_BLOCKS));
+	TEST_CHECK(RingLog_isEmpty(&ringLogTest));
+
+	uint64_t start = SimQspi_nowNs();
+
+	TEST_CHECK(RingLogTest_append(&ringLogTest, RING_LOG_TEST_BYTES));
+	TEST_CHECK(RingLog_flush(&ringLogTest));
+
+	uint64_t elapsedNs = SimQspi_nowNs() - start;
+	const RingLogStats *stats = &ringLogTest.stats;
+	double mbPerSecond = (double)RING_LOG_TEST_BYTES * 1e3 / (double)elapsedNs;
+
+	// The bound is the part: a quad page load and a page program per page, a block erase every 64 pages
+	uint32_t pages = RING_LOG_TEST_BYTES / W25N01G_PAGE_SIZE;
+	double loadUs = (2.0 * W25N01G_PAGE_SIZE * 1e6) / SimQspi_busClockHz();
+	double chipMbPerSecond = (double)W25N01G_PAGE_SIZE * W25N01G_PAGES_PER_BLOCK /
+			((double)W25N01G_PAGES_PER_BLOCK * (model->pageProgramUs + loadUs) + model->sectorEraseUs);
+
+	printf("ingest,%u,%.0f,%.2f,%.2f\n", RING_LOG_TEST_BYTES, elapsedNs / 1e3, mbPerSecond, chipMbPerSecond);
+	printf("ring_log_ram_bytes,%u\n", (uint32_t)sizeof(RingLog));
+
+	TEST_CHECK(stats->bytesAppended == RING_LOG_TEST_BYTES);
+	TEST_CHECK(stats->pagesProgrammed == pages);
+	TEST_CHECK(stats->partialPages == 0);
+	TEST_CHECK(stats->blocksOverwritten > 0);
+	TEST_CHECK(stats->blocksRetired == 0);
+	TEST_CHECK(stats->appendStalls > 0);
+	TEST_CHECK(mbPerSecond > (chipMbPerSecond * 0.9));
+	TEST_CHECK(!RingLog_isEmpty(&ringLogTest));
+
+	// The factory bad block was never touched
+	TEST_CHECK(SimFlash_eraseCount((RING_LOG_TEST_FIRST_BLOCK + RING_LOG_TEST_BAD_BLOCK) * W25N01G_BLOCK_SIZE) == 0);
+
+	RingLogTest_reopen(&ringLogTest);
+	RingLogTest_export(&ringLogTestReopened, 0);
+	Test_checkProtocol();
+}
+
+//! A block that fails to erase is retired and the log carries on around it
+static void RingLogTest_retire(void)
+{
+	uint32_t next = (ringLogTest.headBlock + 2u) % RING_LOG_TEST_BLOCKS;
+
+	if (next == RING_LOG_TEST_BAD_BLOCK) {
+		next = (next + 1u) % RING_LOG_TEST_BLOCKS;
+	}
+
+	SimFlash_failErase((RING_LOG_TEST_FIRST_BLOCK + next) * W25N01G_BLOCK_SIZE);
+
+	TEST_CHECK(RingLogTest_append(&ringLogTest, RING_LOG_TEST_BYTES / 4u));
+	TEST_CHECK(RingLogTest_append(&ringLogTest, RING_LOG_TEST_RECORD / 2u));
+	TEST_CHECK(RingLog_flush(&ringLogTest));
+	TEST_CHECK(ringLogTest.stats.blocksRetired == 1);
+	TEST_CHECK(ringLogTest.stats.partialPages == 1);
+	TEST_CHECK(W25n01g_isBlockBad(&testQspi, RING_LOG_TEST_FIRST_BLOCK + next));
+
+	RingLogTest_reopen(&ringLogTest);
+	RingLogTest_export(&ringLogTestReopened, 1);
+	Test_checkProtocol();
+}
+
+//! Regions past the end of the part or a page the buffers cannot hold are refused
+static void RingLogTest_reject(void)
+{
+	TEST_CHECK(Test_attach(&SimFlash_w25n01gv, TEST_NAND_FLASH_SIZE));
+	TEST_CHECK(W25n01g_init(&testQspi));
+	RingLog_w25n01gIo(&ringLogTestIo, &testQspi);
+
+	TEST_CHECK(ringLogTestIo.pageSize == W25N01G_PAGE_SIZE);
+	TEST_CHECK(ringLogTestIo.pagesPerBlock == W25N01G_PAGES_PER_BLOCK);
+	TEST_CHECK(ringLogTestIo.totalBlocks == RING_LOG_TEST_DIE_BLOCKS);
+
+	TEST_CHECK(!RingLog_open(&ringLogTest, &ringLogTestIo, RING_LOG_TEST_DIE_BLOCKS - 4u, RING_LOG_TEST_BLOCKS));
+	TEST_CHECK(!RingLog_open(&ringLogTest, &ringLogTestIo, RING_LOG_TEST_DIE_BLOCKS, 2));
+	TEST_CHECK(!RingLog_open(&ringLogTest, &ringLogTestIo, 0, 1));
+	TEST_CHECK(RingLog_open(&ringLogTest, &ringLogTestIo, RING_LOG_TEST_DIE_BLOCKS - RING_LOG_TEST_BLOCKS, RING_LOG_TEST_BLOCKS));
+
+	ringLogTestCountingIo = ringLogTestIo;
+	ringLogTestCountingIo.pageSize = 2u * RING_LOG_MAX_PAGE_SIZE;
+	TEST_CHECK(!RingLog_open(&ringLogTest, &ringLogTestCountingIo, RING_LOG_TEST_FIRST_BLOCK, RING_LOG_TEST_BLOCKS));
+
+	ringLogTestCountingIo = ringLogTestIo;
+	ringLogTestCountingIo.pagesPerBlock = 0;
+	TEST_CHECK(!RingLog_open(&ringLogTest, &ringLogTestCountingIo, RING_LOG_TEST_FIRST_BLOCK, RING_LOG_TEST_BLOCKS));
+	Test_checkProtocol();
+}
+
+//! A region at firstBlock of a larger part, around the ring more than once and read back after a reopen
+static void RingLogTest_region(const SimFlashModel *model, uint32_t firstBlock)
+{
+	uint32_t lastBlock = firstBlock + RING_LOG_TEST_BLOCKS - 1u;
+
+	TEST_CHECK(Test_attach(model, TEST_NAND_FLASH_SIZE));
+	TEST_CHECK(W25n01g_init(&testQspi));
+	RingLog_w25n01gIo(&ringLogTestIo, &testQspi);
+	TEST_CHECK(ringLogTestIo.totalBlocks == (FlashDevice_totalBlocks(W25n01g_getDevice())));
+
+	ringLogTestWritten = 0;
+	ringLogTestFirstBlock = firstBlock;
+
+	TEST_CHECK(RingLog_open(&ringLogTest, &ringLogTestIo, firstBlock, RING_LOG_TEST_BLOCKS));
+	TEST_CHECK(RingLogTest_append(&ringLogTest, RING_LOG_TEST_BYTES / 2u));
+	TEST_CHECK(RingLog_flush(&ringLogTest));
+	TEST_CHECK(ringLogTest.stats.blocksOverwritten > 0);
+
+	// Both ends of the region were erased where they are, nothing landed on the blocks either side
+	TEST_CHECK(SimFlash_eraseCount(firstBlock * W25N01G_BLOCK_SIZE) > 0);
+	TEST_CHECK(SimFlash_eraseCount(lastBlock * W25N01G_BLOCK_SIZE) > 0);
+	TEST_CHECK(SimFlash_eraseCount((firstBlock - 1u) * W25N01G_BLOCK_SIZE) == 0);
+	TEST_CHECK(SimFlash_eraseCount((lastBlock + 1u) * W25N01G_BLOCK_SIZE) == 0);
+
+	RingLogTest_reopen(&ringLogTest);
+	RingLogTest_export(&ringLogTestReopened, 0);
+
+	printf("region,%s,%u,%u\n", model->name, firstBlock, ringLogTest.stats.pagesProgrammed);
+	Test_checkProtocol();
+}
+
+int main(void)
+{
+	printf("phase,bytes,sim_us,mb_per_s,chip_mb_per_s\n");
+	RingLogTest_ingest();
+	RingLogTest_retire();
+	RingLogTest_reject();
+
+	printf("region,part,first_block,pages\n");
+	// Across the die boundary of the stacked part, and the half of the W25N02KV past 16 bit page numbers
+	RingLogTest_region(&SimFlash_w25m02gv, RING_LOG_TEST_DIE_BLOCKS - (RING_LOG_TEST_BLOCKS / 2u));
+	RingLogTest_region(&SimFlash_w25n02kv, (2u * RING_LOG_TEST_DIE_BLOCKS) - RING_LOG_TEST_BLOCKS - 1u);
+
+	return Test_result("ringlogtest");
+}
@@ -0,0 +1,161 @@
+/*
+ * This program is host test of the commands each driver operation puts on the bus, built once per check level.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testutil.h"
+#include "w25q.h"
+#include "w25n01g.h"
+
+#ifdef FLASH_DEVICE_STRICT_CHECKS
+#define ROUND_TRIP_TEST_BUILD	"strict"
+#else
+#define ROUND_TRIP_TEST_BUILD	"default"
+#endif
+
+#define ROUND_TRIP_TEST_NOR		0x30000
+#define ROUND_TRIP_TEST_NAND	(40u * W25N01G_BLOCK_SIZE)
+#define ROUND_TRIP_TEST_SMALL	16
+
+static uint8_t roundTripTestData[2u * W25Q_PAGE_SIZE];
+static uint8_t roundTripTestRead[sizeof(roundTripTestData)];
+static uint64_t roundTripTestStart;
+static uint32_t roundTripTestBusyStart;
+
+//! Counting starts on an idle part, the caller's own completion wait is not part of the operation
+static void RoundTripTest_begin(void)
+{
+	roundTripTestStart = SimQspi_getStats()->transactions;
+	roundTripTestBusyStart = SimFlash_getStats()->busyStatusReads;
+}
+
+//! Round trips only, a poll that finds the part busy is the operation taking its time
+static uint32_t RoundTripTest_end(const char *operation)
+{
+	uint32_t busyPolls = SimFlash_getStats()->busyStatusReads - roundTripTestBusyStart;
+	uint32_t commands = (uint32_t)(SimQspi_getStats()->transactions - roundTripTestStart) - busyPolls;
+
+	printf("%s,%s,%u\n", operation, ROUND_TRIP_TEST_BUILD, commands);
+
+	return commands;
+}
+
+/*
+ * Expected counts, default build / strict build. Strict keeps every wait and the WEL read-back:
+ * a write is ready wait, write enable, WEL read, ready wait and the program for each page.
+ */
+#ifdef FLASH_DEVICE_STRICT_CHECKS
+#define ROUND_TRIP_TEST_EXPECT(fast, strict)	(strict)
+#else
+#define ROUND_TRIP_TEST_EXPECT(fast, strict)	(fast)
+#endif
+
+static void RoundTripTest_w25q(void)
+{
+	TEST_CHECK(Test_attach(&SimFlash_w25q128jvIm, TEST_NOR_FLASH_SIZE));
+	TEST_CHECK(W25q_init(&testQspi));
+	TEST_CHECK(W25q_sectorErase(ROUND_TRIP_TEST_NOR));
+	W25q_waitForReady();
+
+	RoundTripTest_begin();
+	TEST_CHECK(W25q_writeBytes(ROUND_TRIP_TEST_NOR, roundTripTestData, ROUND_TRIP_TEST_SMALL));
+	TEST_CHECK(RoundTripTest_end("nor_write_16") == ROUND_TRIP_TEST_EXPECT(2u, 5u));
+	W25q_waitForReady();
+
+	RoundTripTest_begin();
+	TEST_CHECK(W25q_writeBytes(ROUND_TRIP_TEST_NOR + W25Q_PAGE_SIZE, &roundTripTestData[W25Q_PAGE_SIZE], W25Q_PAGE_SIZE));
+	TEST_CHECK(RoundTripTest_end("nor_write_page") == ROUND_TRIP_TEST_EXPECT(2u, 5u));
+	W25q_waitForReady();
+
+	// The first read may still have to wait, the one after it finds the part idle
+	TEST_CHECK(W25q_readBytes(ROUND_TRIP_TEST_NOR, roundTripTestRead, ROUND_TRIP_TEST_SMALL));
+	RoundTripTest_begin();
+	TEST_CHECK(W25q_readBytes(ROUND_TRIP_TEST_NOR + W25Q_PAGE_SIZE, &roundTripTestRead[W25Q_PAGE_SIZE], W25Q_PAGE_SIZE));
+	TEST_CHECK(RoundTripTest_end("nor_read_after_read") == ROUND_TRIP_TEST_EXPECT(1u, 2u));
+	TEST_CHECK(memcmp(roundTripTestRead, roundTripTestData, ROUND_TRIP_TEST_SMALL) == 0);
+	TEST_CHECK(memcmp(&roundTripTestRead[W25Q_PAGE_SIZE], &roundTripTestData[W25Q_PAGE_SIZE], W25Q_PAGE_SIZE) == 0);
+
+	// The first call writes and checks QE, the second already knows it is set
+	TEST_CHECK(W25q_quadEnable());
+	W25q_waitForReady();
+	RoundTripTest_begin();
+	TEST_CHECK(W25q_quadEnable());
+	TEST_CHECK(RoundTripTest_end("nor_quad_enable_again") == ROUND_TRIP_TEST_EXPECT(0u, 5u));
+	W25q_waitForReady();
+
+	RoundTripTest_begin();
+	TEST_CHECK(W25q_sectorErase(ROUND_TRIP_TEST_NOR));
+	TEST_CHECK(RoundTripTest_end("nor_sector_erase") == ROUND_TRIP_TEST_EXPECT(2u, 5u));
+	W25q_waitForReady();
+
+	// The shadow never lets a command reach a busy part or one without WEL
+	TEST_CHECK(W25q_readBytes(ROUND_TRIP_TEST_NOR, roundTripTestRead, ROUND_TRIP_TEST_SMALL));
+	TEST_CHECK(roundTripTestRead[0] == 0xFF);
+	Test_checkProtocol();
+}
+
+static void RoundTripTest_w25n01g(void)
+{
+	uint32_t page = ROUND_TRIP_TEST_NAND / W25N01G_PAGE_SIZE;
+
+	TEST_CHECK(Test_attach(&SimFlash_w25n01gv, TEST_NAND_FLASH_SIZE));
+	TEST_CHECK(SimFlash_load(ROUND_TRIP_TEST_NAND, roundTripTestData, sizeof(roundTripTestData)));
+	TEST_CHECK(W25n01g_init(&testQspi));
+	W25n01g_waitForReady(&testQspi);
+
+	RoundTripTest_begin();
+	TEST_CHECK(W25n01g_readBytes(&testQspi, ROUND_TRIP_TEST_NAND, roundTripTestRead, ROUND_TRIP_TEST_SMALL, true) == ROUND_TRIP_TEST_SMALL);
+	uint32_t firstRead = RoundTripTest_end("nand_read_16");
+
+	TEST_CHECK(firstRead == ROUND_TRIP_TEST_EXPECT(3u, 4u));
+
+	RoundTripTest_begin();
+	TEST_CHECK(W25n01g_readBytes(&testQspi, ROUND_TRIP_TEST_NAND + ROUND_TRIP_TEST_SMALL, &roundTripTestRead[ROUND_TRIP_TEST_SMALL],
+			ROUND_TRIP_TEST_SMALL, true) == ROUND_TRIP_TEST_SMALL);
+	TEST_CHECK(RoundTripTest_end("nand_read_same_page") == ROUND_TRIP_TEST_EXPECT(1u, firstRead));
+	TEST_CHECK(memcmp(roundTripTestRead, roundTripTestData, 2u * ROUND_TRIP_TEST_SMALL) == 0);
+
+	RoundTripTest_begin();
+	TEST_CHECK(W25n01g_blockErase(&testQspi, ROUND_TRIP_TEST_NAND));
+	TEST_CHECK(RoundTripTest_end("nand_block_erase") == ROUND_TRIP_TEST_EXPECT(2u, 5u));
+	W25n01g_waitForReady(&testQspi);
+
+	RoundTripTest_begin();
+	TEST_CHECK(w25n01g_pageProgram(&testQspi, ROUND_TRIP_TEST_NAND, roundTripTestData, ROUND_TRIP_TEST_SMALL));
+	TEST_CHECK(RoundTripTest_end("nand_program_16") == ROUND_TRIP_TEST_EXPECT(6u, 9u));
+	W25n01g_waitForReady(&testQspi);
+
+	// A program leaves another page in the buffer than the array holds, the read must load it again
+	RoundTripTest_begin();
+	TEST_CHECK(W25n01g_readPageData(&testQspi, (uint16_t)page, 0, roundTripTestRead, ROUND_TRIP_TEST_SMALL));
+	TEST_CHECK(RoundTripTest_end("nand_read_after_program") == firstRead);
+	TEST_CHECK(memcmp(roundTripTestRead, roundTripTestData, ROUND_TRIP_TEST_SMALL) == 0);
+
+	Test_checkProtocol();
+}
+
+int main(void)
+{
+	Test_fill(roundTripTestData, sizeof(roundTripTestData), 50);
+
+	printf("operation,build,commands\n");
+	RoundTripTest_w25q();
+	RoundTripTest_w25n01g();
+
+	return Test_result("roundtriptest_" ROUND_TRIP_TEST_BUILD);
+}
@@ -0,0 +1,265 @@
+/*
+ * This program is host test of the W25Q configuration taken from SFDP tables fed to the simulated part.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testutil.h"
+#include "w25q.h"
+
+#define SFDP_TEST_DWORDS		16
+#define SFDP_TEST_ADDRESS		0x10000
+#define SFDP_TEST_LENGTH		512
+
+#define SFDP_TEST_1_1_4			(1u << 22)		//!< DWORD 1 fast read support bits
+#define SFDP_TEST_1_4_4			(1u << 21)
+#define SFDP_TEST_DTR			(1u << 19)
+#define SFDP_TEST_4_4_4			(1u << 4)		//!< DWORD 5
+
+// Erase 30/128/256ms typical, times 8 for the maximum
+#define SFDP_TEST_DWORD10		(3u | (29u << 4) | ((7u | (1u << 5)) << 11) | ((1u | (2u << 5)) << 18))
+// Page 256, program 384us typical times 6, chip erase 40s typical
+#define SFDP_TEST_DWORD11		(2u | (8u << 4) | (5u << 8) | (1u << 13) | ((9u | (2u << 5)) << 24))
+
+//! Another vendor's 16MB part, unknown to the device table, described by its SFDP alone
+static const SimFlashModel sfdpTestSecondSource = {
+	"GD25Q127C", SIM_FLASH_NOR, { 0xC8, 0x40, 0x18 }, 1, 3, false,
+	16u << 20, 256, 0, 0, 0x02, 400, 45000, 120000, 150000, 40000, 0
+};
+
+static uint32_t sfdpTestTable[SFDP_TEST_DWORDS];
+static uint8_t sfdpTestData[SFDP_TEST_LENGTH];
+static uint8_t sfdpTestRead[SFDP_TEST_LENGTH];
+
+static uint32_t SfdpTest_get32(const uint8_t *data)
+{
+	return ((uint32_t)data[0]) | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static void SfdpTest_put32(uint8_t *out, uint32_t value)
+{
+	out[0] = (uint8_t)value;
+	out[1] = (uint8_t)(value >> 8);
+	out[2] = (uint8_t)(value >> 16);
+	out[3] = (uint8_t)(value >> 24);
+}
+
+//! Fresh part with its own table loaded into sfdpTestTable for the case to change
+static void SfdpTest_attach(const SimFlashModel *model)
+{
+	TEST_CHECK(Test_attach(model, TEST_NOR_FLASH_SIZE));
+	TEST_CHECK(SimFlash_load(SFDP_TEST_ADDRESS, sfdpTestData, sizeof(sfdpTestData)));
+
+	for (uint32_t i = 0; i < SFDP_TEST_DWORDS; i++) {
+		sfdpTestTable[i] = SfdpTest_get32(&SimFlash_sfdp()[SIM_FLASH_SFDP_ADDRESS + (i * 4u)]);
+	}
+}
+
+//! Header, one basic parameter header and the first count DWORDs of sfdpTestTable
+static void SfdpTest_feed(uint32_t count, bool validSignature)
+{
+	uint8_t image[SIM_FLASH_SFDP_ADDRESS + (SFDP_TEST_DWORDS * 4u)];
+	uint8_t minor = (count > 9u) ? 0x06 : 0x00;
+	const uint8_t header[16] = {
+		'S', 'F', 'D', validSignature ? 'P' : 'Q', minor, 0x01, 0x00, 0xFF,
+		0x00, minor, 0x01, (uint8_t)count, SIM_FLASH_SFDP_ADDRESS, 0x00, 0x00, 0xFF
+	};
+
+	memset(image, 0xFF, sizeof(image));
+	memcpy(image, header, sizeof(header));
+
+	for (uint32_t i = 0; i < count; i++) {
+		SfdpTest_put32(&image[SIM_FLASH_SFDP_ADDRESS + (i * 4u)], sfdpTestTable[i]);
+	}
+
+	TEST_CHECK(SimFlash_setSfdp(image, SIM_FLASH_SFDP_ADDRESS + (count * 4u)));
+}
+
+static void SfdpTest_checkRead(const char *name, uint8_t instruction, uint8_t dummyCycles, uint32_t addressMode, uint32_t dataMode, bool ddr)
+{
+	const W25qReadConfig *read = &W25q_getConfig()->read;
+
+	printf("%s,0x%02X,%u,%s\n", name, read->instruction, read->dummyCycles, read->ddr ? "dtr" : "sdr");
+
+	TEST_CHECK(read->instruction == instruction);
+	TEST_CHECK(read->dummyCycles == dummyCycles);
+	TEST_CHECK(read->addressMode == addressMode);
+	TEST_CHECK(read->dataMode == dataMode);
+	TEST_CHECK(read->ddr == ddr);
+
+	// The part takes the chosen read as it is, a wrong dummy count would shift the data
+	memset(sfdpTestRead, 0, sizeof(sfdpTestRead));
+	TEST_CHECK(W25q_readBytes(SFDP_TEST_ADDRESS, sfdpTestRead, sizeof(sfdpTestRead)));
+	TEST_CHECK(memcmp(sfdpTestRead, sfdpTestData, sizeof(sfdpTestData)) == 0);
+	TEST_CHECK(SimFlash_getStats()->dummyMismatches == 0);
+	Test_checkProtocol();
+}
+
+static void SfdpTest_checkErase(uint32_t index, uint32_t size, uint8_t instruction, uint32_t typicalMs, uint32_t maxMs)
+{
+	const SfdpEraseType *erase = &W25q_getConfig()->erase[index];
+
+	TEST_CHECK(erase->size == size);
+	TEST_CHECK(erase->instruction == instruction);
+	TEST_CHECK(erase->typicalMs == typicalMs);
+	TEST_CHECK(erase->maxMs == maxMs);
+}
+
+static void SfdpTest_quadOutputOnly(void)
+{
+	SfdpTest_attach(&SimFlash_w25q128jvIm);
+	sfdpTestTable[0] = (sfdpTestTable[0] & ~(SFDP_TEST_1_4_4 | SFDP_TEST_DTR)) | SFDP_TEST_1_1_4;
+	SfdpTest_feed(SFDP_TEST_DWORDS, true);
+
+	TEST_CHECK(W25q_init(&testQspi));
+	TEST_CHECK(W25q_getConfig()->sfdpValid);
+	TEST_CHECK(!W25q_getConfig()->dtrSupported);
+	SfdpTest_checkRead("1-1-4", W25Q_INSTR_FAST_READ_QUAD_OUTPUT, 8, QSPI_ADDRESS_1_LINE, QSPI_DATA_4_LINES, false);
+}
+
+static void SfdpTest_quadIo(void)
+{
+	SfdpTest_attach(&SimFlash_w25q128jvIm);
+	sfdpTestTable[0] = (sfdpTestTable[0] & ~SFDP_TEST_DTR) | SFDP_TEST_1_1_4 | SFDP_TEST_1_4_4;
+	sfdpTestTable[9] = SFDP_TEST_DWORD10;
+	sfdpTestTable[10] = SFDP_TEST_DWORD11;
+	SfdpTest_feed(SFDP_TEST_DWORDS, true);
+
+	TEST_CHECK(W25q_init(&testQspi));
+	SfdpTest_checkRead("1-4-4", W25Q_INSTR_FAST_READ_QUAD, 6, QSPI_ADDRESS_4_LINES, QSPI_DATA_4_LINES, false);
+
+	// Times decoded from DWORDs 10 and 11, the erase types in size order
+	SfdpTest_checkErase(0, 4096, 0x20, 30, 240);
+	SfdpTest_checkErase(1, 32768, 0x52, 128, 1024);
+	SfdpTest_checkErase(2, 65536, 0xD8, 256, 2048);
+	TEST_CHECK(W25q_getConfig()->erase[3].size == 0);
+	TEST_CHECK(W25q_getConfig()->pageProgramMaxUs == (384u * 6u));
+	TEST_CHECK(W25q_getConfig()->chipEraseTypicalMs == 40000u);
+	TEST_CHECK(W25q_getConfig()->chipEraseMaxMs == (40000u * 8u));
+	TEST_CHECK(FlashDevice_pageSize(W25q_getDevice()) == 256);
+}
+
+//! QPI needs the whole part switched over, the driver stays in SPI mode and reads single line
+static void SfdpTest_qpiOnly(void)
+{
+	SfdpTest_attach(&SimFlash_w25q128jvIm);
+	sfdpTestTable[0] &= ~(SFDP_TEST_1_1_4 | SFDP_TEST_1_4_4 | SFDP_TEST_DTR);
+	sfdpTestTable[4] |= SFDP_TEST_4_4_4;
+	sfdpTestTable[6] = (sfdpTestTable[6] & 0xFFFFu) | (0xEB22u << 16);
+	SfdpTest_feed(SFDP_TEST_DWORDS, true);
+
+	TEST_CHECK(W25q_init(&testQspi));
+	SfdpTest_checkRead("4-4-4", SFDP_INSTR_FAST_READ, SFDP_DUMMY_CYCLES_FAST_READ, QSPI_ADDRESS_1_LINE, QSPI_DATA_1_LINE, false);
+}
+
+static void SfdpTest_dtr(void)
+{
+	SfdpTest_attach(&SimFlash_w25q128jvIm);
+	sfdpTestTable[0] |= SFDP_TEST_1_1_4 | SFDP_TEST_1_4_4 | SFDP_TEST_DTR;
+	SfdpTest_feed(SFDP_TEST_DWORDS, true);
+
+	TEST_CHECK(W25q_init(&testQspi));
+	TEST_CHECK(W25q_getConfig()->dtrSupported);
+	SfdpTest_checkRead("dtr", W25Q_INSTR_FAST_READ_QUAD_DTR, W25Q_DUMMY_CYCLES_FAST_READ_QUAD_DTR, QSPI_ADDRESS_4_LINES, QSPI_DATA_4_LINES, true);
+	TEST_CHECK(W25q_getConfig()->sdrRead.instruction == W25Q_INSTR_FAST_READ_QUAD);
+}
+
+//! JESD216 before revision A stops at DWORD 9, no times and no page size
+static void SfdpTest_nineDwords(void)
+{
+	SfdpTest_attach(&SimFlash_w25q128jvIm);
+	sfdpTestTable[0] &= ~SFDP_TEST_DTR;
+	SfdpTest_feed(9, true);
+
+	TEST_CHECK(W25q_init(&testQspi));
+	TEST_CHECK(W25q_getConfig()->sfdpValid);
+	SfdpTest_checkRead("jesd216", W25Q_INSTR_FAST_READ_QUAD, 6, QSPI_ADDRESS_4_LINES, QSPI_DATA_4_LINES, false);
+
+	// The sizes come from the table, the times from the datasheet values the driver keeps
+	SfdpTest_checkErase(0, 4096, 0x20, 45, 400);
+	SfdpTest_checkErase(1, 32768, 0x52, 120, 1600);
+	SfdpTest_checkErase(2, 65536, 0xD8, 150, 2000);
+	TEST_CHECK(W25q_getConfig()->pageProgramMaxUs == W25Q_PAGE_PROGRAM_MAX_US);
+	TEST_CHECK(W25q_getConfig()->chipEraseMaxMs == W25Q_CHIP_ERASE_MAX_MS);
+}
+
+static void SfdpTest_secondSource(void)
+{
+	SfdpTest_attach(&sfdpTestSecondSource);
+	sfdpTestTable[9] = SFDP_TEST_DWORD10;
+	sfdpTestTable[10] = SFDP_TEST_DWORD11;
+	SfdpTest_feed(SFDP_TEST_DWORDS, true);
+
+	TEST_CHECK(W25q_init(&testQspi));
+
+	const FlashDevice *device = W25q_getDevice();
+
+	TEST_CHECK(device != NULL);
+	TEST_CHECK((device != NULL) && (FlashDevice_identify(sfdpTestSecondSource.jedecId) == NULL));
+	TEST_CHECK((device != NULL) && (FlashDevice_totalCapacity(device) == (16u << 20)));
+	TEST_CHECK((device != NULL) && (FlashDevice_pageSize(device) == 256));
+	TEST_CHECK((device != NULL) && (FlashDevice_sectorSize(device) == 4096));
+	TEST_CHECK((device != NULL) && (FlashDevice_blockSize(device) == 65536));
+	TEST_CHECK((device != NULL) && (device->addressBytes == 3) && !(device->features & FLASH_DEVICE_FEATURE_DTR));
+	SfdpTest_checkErase(0, 4096, 0x20, 30, 240);
+	SfdpTest_checkRead("second_source", W25Q_INSTR_FAST_READ_QUAD, 6, QSPI_ADDRESS_4_LINES, QSPI_DATA_4_LINES, false);
+
+	// Programs go by the page size the table gave
+	TEST_CHECK(W25q_sectorErase(SFDP_TEST_ADDRESS));
+	TEST_CHECK(W25q_writeBytes(SFDP_TEST_ADDRESS + 100u, sfdpTestData, sizeof(sfdpTestData) - 100u));
+	TEST_CHECK(W25q_readBytes(SFDP_TEST_ADDRESS + 100u, sfdpTestRead, sizeof(sfdpTestData) - 100u));
+	TEST_CHECK(memcmp(sfdpTestRead, sfdpTestData, sizeof(sfdpTestData) - 100u) == 0);
+	Test_checkProtocol();
+}
+
+static void SfdpTest_corruptSignature(void)
+{
+	// A known part falls back to the table entry and the datasheet defaults
+	SfdpTest_attach(&SimFlash_w25q128jvIm);
+	sfdpTestTable[9] = SFDP_TEST_DWORD10;
+	SfdpTest_feed(SFDP_TEST_DWORDS, false);
+
+	TEST_CHECK(W25q_init(&testQspi));
+	TEST_CHECK(!W25q_getConfig()->sfdpValid);
+	TEST_CHECK(W25q_getConfig()->dtrSupported);
+	SfdpTest_checkErase(0, 4096, 0x20, 45, 400);
+	SfdpTest_checkErase(2, 65536, 0xD8, 150, 2000);
+	SfdpTest_checkRead("bad_signature", W25Q_INSTR_FAST_READ_QUAD_DTR, W25Q_DUMMY_CYCLES_FAST_READ_QUAD_DTR, QSPI_ADDRESS_4_LINES, QSPI_DATA_4_LINES, true);
+
+	// An unknown one has nothing left to go by
+	SfdpTest_attach(&sfdpTestSecondSource);
+	SfdpTest_feed(SFDP_TEST_DWORDS, false);
+
+	TEST_CHECK(!W25q_init(&testQspi));
+	TEST_CHECK(W25q_getDevice() == NULL);
+}
+
+int main(void)
+{
+	Test_fill(sfdpTestData, sizeof(sfdpTestData), 28);
+
+	printf("table,instruction,dummy_cycles,rate\n");
+	SfdpTest_quadOutputOnly();
+	SfdpTest_quadIo();
+	SfdpTest_qpiOnly();
+	SfdpTest_dtr();
+	SfdpTest_nineDwords();
+	SfdpTest_secondSource();
+	SfdpTest_corruptSignature();
+
+	return Test_result("sfdptest");
+}
@@ -0,0 +1,293 @@
+/*
+ * This program is host test of per-die overlap on a simulated two-die W25M02GV, reporting aggregate throughput.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testutil.h"
+#include "flashscheduler.h"
+#include "w25n01g.h"
+#include "w25q.h"
+
+#define STACKED_TEST_DIE_SIZE		(128u * 1024u * 1024u)
+#define STACKED_TEST_WRITE_BASE		(64u * W25N01G_BLOCK_SIZE)		//!< Same offset on each die
+#define STACKED_TEST_READ_BASE		(16u * W25N01G_BLOCK_SIZE)
+#define STACKED_TEST_PAGES			128
+#define STACKED_TEST_READ_STRIDE	2							//!< Every other page, so no two reads merge
+#define STACKED_TEST_REQUESTS		(2u + (2u * STACKED_TEST_PAGES))
+#define STACKED_TEST_NOR_DIE_SIZE	(32u * 1024u * 1024u)
+#define STACKED_TEST_NOR_ERASE		(STACKED_TEST_NOR_DIE_SIZE + 0x10000u)	//!< One 64KB block and one 4KB sector on die 1
+#define STACKED_TEST_NOR_LENGTH		(0x10000u + 0x1000u)
+
+typedef enum {
+	STACKED_TEST_DIE0_WRITES,		//!< Die 0 programs, die 1 serves reads
+	STACKED_TEST_SPLIT_WRITES,		//!< Pages alternate between the dies, reads as well
+	STACKED_TEST_ONE_DIE,			//!< Everything on die 0, nothing to overlap
+} StackedTestLayout;
+
+static FlashRequest stackedTestRequests[STACKED_TEST_REQUESTS];
+static uint8_t stackedTestWrite[STACKED_TEST_PAGES * W25N01G_PAGE_SIZE];
+static uint8_t stackedTestStored[STACKED_TEST_READ_STRIDE * STACKED_TEST_PAGES * W25N01G_PAGE_SIZE];
+static uint8_t stackedTestRead[STACKED_TEST_PAGES * W25N01G_PAGE_SIZE];
+static uint32_t stackedTestCount;
+static int stackedTestSignal;
+
+// One thread submits everything and then runs the scheduler itself, so the OS layer has nothing to do
+static void *StackedTest_signalCreate(void)
+{
+	return &stackedTestSignal;
+}
+
+static void StackedTest_signal(void *signal)
+{
+	(void)signal;
+}
+
+static void StackedTest_nothing(void)
+{
+}
+
+static uint32_t StackedTest_nowUs(void)
+{
+	return SimQspi_nowUs();
+}
+
+static const FlashSchedulerOs stackedTestOs = {
+	.signalCreate		= StackedTest_signalCreate,
+	.signalGive			= StackedTest_signal,
+	.signalTake			= StackedTest_signal,
+	.signalTakeTimeout	= NULL,
+	.lock				= StackedTest_nothing,
+	.unlock				= StackedTest_nothing,
+	.nowUs				= StackedTest_nowUs,
+};
+
+static void StackedTest_start(void)
+{
+	TEST_CHECK(Test_attach(&SimFlash_w25m02gv, TEST_NAND_FLASH_SIZE));
+	TEST_CHECK(W25n01g_init(&testQspi));
+	TEST_CHECK(FlashDevice_totalCapacity(W25n01g_getDevice()) == (2u * STACKED_TEST_DIE_SIZE));
+
+	// The data to be read sits on both dies already
+	TEST_CHECK(SimFlash_load(STACKED_TEST_READ_BASE, stackedTestStored, sizeof(stackedTestStored)));
+	TEST_CHECK(SimFlash_load(STACKED_TEST_DIE_SIZE + STACKED_TEST_READ_BASE, stackedTestStored, sizeof(stackedTestStored)));
+	SimFlash_resetStats();
+	stackedTestCount = 0;
+}
+
+static void StackedTest_add(FlashRequestType type, uint32_t address, uint8_t *buffer, uint32_t length)
+{
+	FlashRequest *request = &stackedTestRequests[stackedTestCount++];
+
+	memset(request, 0, sizeof(*request));
+	request->type = type;
+	request->priority = 1;
+	request->address = address;
+	request->buffer = buffer;
+	request->length = length;
+}
+
+static uint32_t StackedTest_writeAddress(StackedTestLayout layout, uint32_t page)
+{
+	uint32_t address = STACKED_TEST_WRITE_BASE + (page * W25N01G_PAGE_SIZE);
+
+	if (layout == STACKED_TEST_SPLIT_WRITES) {
+		address = ((page % 2u) * STACKED_TEST_DIE_SIZE) + STACKED_TEST_WRITE_BASE + ((page / 2u) * W25N01G_PAGE_SIZE);
+	}
+
+	return address;
+}
+
+static uint32_t StackedTest_readAddress(StackedTestLayout layout, uint32_t page)
+{
+	uint32_t offset = STACKED_TEST_READ_BASE + (page * STACKED_TEST_READ_STRIDE * W25N01G_PAGE_SIZE);
+	uint32_t die = 0;
+
+	if (layout == STACKED_TEST_DIE0_WRITES) {
+		die = 1;
+	} else if (layout == STACKED_TEST_SPLIT_WRITES) {
+		die = page % 2u;
+	}
+
+	return (die * STACKED_TEST_DIE_SIZE) + offset;
+}
+
+//! Erases and page programs, page reads, all queued up front in submission order
+static void StackedTest_queue(StackedTestLayout layout)
+{
+	StackedTest_add(FLASH_REQUEST_ERASE, STACKED_TEST_WRITE_BASE, NULL, 2u * W25N01G_BLOCK_SIZE);
+
+	if (layout == STACKED_TEST_SPLIT_WRITES) {
+		stackedTestRequests[0].length = W25N01G_BLOCK_SIZE;
+		StackedTest_add(FLASH_REQUEST_ERASE, STACKED_TEST_DIE_SIZE + STACKED_TEST_WRITE_BASE, NULL, W25N01G_BLOCK_SIZE);
+	}
+
+	for (uint32_t page = 0; page < STACKED_TEST_PAGES; page++) {
+		uint32_t offset = page * W25N01G_PAGE_SIZE;
+
+		StackedTest_add(FLASH_REQUEST_PROGRAM, StackedTest_writeAddress(layout, page), &stackedTestWrite[offset], W25N01G_PAGE_SIZE);
+		StackedTest_add(FLASH_REQUEST_READ, StackedTest_readAddress(layout, page), &stackedTestRead[offset], W25N01G_PAGE_SIZE);
+	}
+}
+
+//! Runs the queue dry and returns the aggregate MB/s
+static double StackedTest_run(const char *workload, const FlashSchedulerDevice *device)
+{
+	uint64_t bytes = 0;
+	uint32_t failed = 0;
+
+	TEST_CHECK(FlashScheduler_init(&stackedTestOs, device));
+	FlashScheduler_resetStats();
+	memset(stackedTestRead, 0, sizeof(stackedTestRead));
+
+	uint64_t start = SimQspi_nowNs();
+
+	for (uint32_t i = 0; i < stackedTestCount; i++) {
+		FlashScheduler_submit(&stackedTestRequests[i]);
+	}
+
+	while (FlashScheduler_serviceOnce()) {
+	}
+
+	uint64_t elapsedNs = SimQspi_nowNs() - start;
+
+	for (uint32_t i = 0; i < stackedTestCount; i++) {
+		failed += (stackedTestRequests[i].done && stackedTestRequests[i].success) ? 0u : 1u;
+		bytes += (stackedTestRequests[i].type == FLASH_REQUEST_ERASE) ? 0u : stackedTestRequests[i].length;
+	}
+
+	double mbPerSecond = (double)bytes * 1e3 / (double)elapsedNs;
+
+	printf("%s,%s,%u,%.0f,%.2f,%u\n", workload, (device->dieCount > 1) ? "overlapped" : "serialized", (uint32_t)bytes,
+			elapsedNs / 1e3, mbPerSecond, FlashScheduler_getStats()->overlappedOps);
+
+	uint32_t mismatches = 0;
+
+	for (uint32_t page = 0; page < STACKED_TEST_PAGES; page++) {
+		mismatches += (memcmp(&stackedTestRead[page * W25N01G_PAGE_SIZE],
+				&stackedTestStored[page * STACKED_TEST_READ_STRIDE * W25N01G_PAGE_SIZE], W25N01G_PAGE_SIZE) == 0) ? 0u : 1u;
+	}
+
+	TEST_CHECK(failed == 0);
+	TEST_CHECK(mismatches == 0);
+
+	return mbPerSecond;
+}
+
+//! What the programs left on the part, read back through the driver's linear addressing
+static void StackedTest_checkWritten(StackedTestLayout layout)
+{
+	uint32_t mismatches = 0;
+
+	for (uint32_t page = 0; page < STACKED_TEST_PAGES; page++) {
+		TEST_CHECK(W25n01g_readBytes(&testQspi, StackedTest_writeAddress(layout, page), stackedTestRead, W25N01G_PAGE_SIZE, true) == W25N01G_PAGE_SIZE);
+		mismatches += (memcmp(stackedTestRead, &stackedTestWrite[page * W25N01G_PAGE_SIZE], W25N01G_PAGE_SIZE) == 0) ? 0u : 1u;
+	}
+
+	TEST_CHECK(mismatches == 0);
+}
+
+static double StackedTest_workload(const char *workload, StackedTestLayout layout, bool overlap)
+{
+	FlashSchedulerDevice device;
+
+	StackedTest_start();
+	FlashScheduler_w25n01gDevice(&device, &testQspi);
+	TEST_CHECK(device.dieCount == 2);
+
+	// Without the die fields every operation waits for the one before it
+	if (!overlap) {
+		device.dieCount = 1;
+	}
+
+	StackedTest_queue(layout);
+
+	double mbPerSecond = StackedTest_run(workload, &device);
+
+	StackedTest_checkWritten(layout);
+	TEST_CHECK(overlap || (FlashScheduler_getStats()->overlappedOps == 0));
+	Test_checkProtocol();
+
+	return mbPerSecond;
+}
+
+//! An erase request on a stacked NOR part goes out as the largest units that fit, not as 4KB sectors
+static void StackedTest_norErase(void)
+{
+	FlashSchedulerDevice device;
+	uint8_t edge[2];
+	uint8_t inside[2];
+
+	TEST_CHECK(Test_attach(&SimFlash_w25m512jv, TEST_NOR_FLASH_SIZE));
+	TEST_CHECK(W25q_init(&testQspi));
+	TEST_CHECK(SimFlash_load(STACKED_TEST_NOR_ERASE - 1u, stackedTestStored, STACKED_TEST_NOR_LENGTH + 2u));
+
+	FlashScheduler_w25qDevice(&device);
+	TEST_CHECK(device.dieCount == 2);
+	TEST_CHECK(FlashScheduler_init(&stackedTestOs, &device));
+
+	stackedTestCount = 0;
+	StackedTest_add(FLASH_REQUEST_ERASE, STACKED_TEST_NOR_ERASE, NULL, STACKED_TEST_NOR_LENGTH);
+	FlashScheduler_submit(&stackedTestRequests[0]);
+
+	while (FlashScheduler_serviceOnce()) {
+	}
+
+	TEST_CHECK(stackedTestRequests[0].done && stackedTestRequests[0].success);
+	TEST_CHECK(SimFlash_getStats()->erases == 2u);
+
+	TEST_CHECK(SimFlash_peek(STACKED_TEST_NOR_ERASE, inside, 1));
+	TEST_CHECK(SimFlash_peek(STACKED_TEST_NOR_ERASE + STACKED_TEST_NOR_LENGTH - 1u, &inside[1], 1));
+	TEST_CHECK((inside[0] == 0xFF) && (inside[1] == 0xFF));
+	TEST_CHECK(SimFlash_peek(STACKED_TEST_NOR_ERASE - 1u, edge, 1));
+	TEST_CHECK(SimFlash_peek(STACKED_TEST_NOR_ERASE + STACKED_TEST_NOR_LENGTH, &edge[1], 1));
+	TEST_CHECK((edge[0] == stackedTestStored[0]) && (edge[1] == stackedTestStored[STACKED_TEST_NOR_LENGTH + 1u]));
+
+	printf("nor_erase_bytes,erases\n%u,%u\n", (unsigned)STACKED_TEST_NOR_LENGTH, (unsigned)SimFlash_getStats()->erases);
+	Test_checkProtocol();
+}
+
+int main(void)
+{
+	Test_fill(stackedTestWrite, sizeof(stackedTestWrite), 48);
+	Test_fill(stackedTestStored, sizeof(stackedTestStored), 480);
+
+	printf("workload,mode,bytes,sim_us,mb_per_s,overlapped_ops\n");
+
+	// Reads on the idle die fill the program time of the busy one
+	double serialized = StackedTest_workload("die0_writes", STACKED_TEST_DIE0_WRITES, false);
+	double overlapped = StackedTest_workload("die0_writes", STACKED_TEST_DIE0_WRITES, true);
+
+	TEST_CHECK(overlapped > (serialized * 1.2));
+	TEST_CHECK(FlashScheduler_getStats()->overlappedOps >= (STACKED_TEST_PAGES / 2u));
+
+	// Both dies program at once
+	serialized = StackedTest_workload("split_writes", STACKED_TEST_SPLIT_WRITES, false);
+	overlapped = StackedTest_workload("split_writes", STACKED_TEST_SPLIT_WRITES, true);
+
+	TEST_CHECK(overlapped > (serialized * 1.5));
+
+	// A single die gains nothing but must not lose either
+	serialized = StackedTest_workload("one_die", STACKED_TEST_ONE_DIE, false);
+	overlapped = StackedTest_workload("one_die", STACKED_TEST_ONE_DIE, true);
+
+	TEST_CHECK(overlapped > (serialized * 0.95));
+
+	StackedTest_norErase();
+
+	return Test_result("stackeddietest");
+}
@@ -0,0 +1,83 @@
+/*
+ * This program is shared checks and set up for the host tests of the Winbond drivers.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TESTUTIL_H
+#define __TESTUTIL_H
+
+#include <stdio.h>
+#include <string.h>
+
+#include "simflash.h"
+#include "simqspi.h"
+#include "quadspi.h"
+
+#define TEST_NOR_FLASH_SIZE		23			//!< 2^(23 + 1) = 16MB
+#define TEST_NAND_FLASH_SIZE	26
+
+static int testFailures = 0;
+static QSPI_HandleTypeDef testQspi;
+
+#define TEST_CHECK(condition) do { \
+		if (!(condition)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+			testFailures++; \
+		} \
+	} while (0)
+
+//! Fresh simulated bus and part, QUADSPI initialised, the driver is left to the test
+static inline bool Test_attach(const SimFlashModel *model, uint8_t flashSize)
+{
+	SimQspi_reset();
+	SimFlash_attach(model);
+	memset(&testQspi, 0, sizeof(testQspi));
+
+	return QuadSpi_Init(&testQspi, flashSize);
+}
+
+//! The driver must never send the part a command it would ignore
+static inline void Test_checkProtocol(void)
+{
+	const SimFlashStats *flash = SimFlash_getStats();
+
+	TEST_CHECK(flash->protocolErrors == 0);
+	TEST_CHECK(flash->busyViolations == 0);
+	TEST_CHECK(flash->welViolations == 0);
+}
+
+static inline void Test_fill(uint8_t *buffer, uint32_t length, uint32_t seed)
+{
+	for (uint32_t i = 0; i < length; i++) {
+		seed = seed * 1103515245u + 12345u;
+		buffer[i] = (uint8_t)(seed >> 16);
+	}
+}
+
+static inline int Test_result(const char *name)
+{
+	if (testFailures == 0) {
+		printf("%s: passed\n", name);
+	} else {
+		printf("%s: %d checks failed\n", name, testFailures);
+	}
+
+	return (testFailures == 0) ? 0 : 1;
+}
+
+#endif /* __TESTUTIL_H */
@@ -0,0 +1,163 @@
+/*
+ * This program is host test of a 64MB W25Q512JV past the 16MB and 32MB lines, in both 4-byte address modes.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testutil.h"
+#include "w25q.h"
+
+#define LARGE_TEST_FLASH_SIZE	25			//!< 2^(25 + 1) = 64MB, the whole part in the mapped window
+#define LARGE_TEST_CAPACITY		(64u << 20)
+#define LARGE_TEST_OFFSET		100u		//!< Writes start inside a page and cross into the next ones
+#define LARGE_TEST_LENGTH		600u
+
+static const uint32_t largeTestBlocks[] = {
+	0x00010000,			//!< Below 16MB, the control
+	0x01000000,			//!< First block past 16MB
+	0x01230000,
+	0x02000000,			//!< First block past 32MB
+	0x03FF0000,			//!< Last block of the part
+};
+
+static uint8_t largeTestBlock[W25Q_64K_BLOCK_SIZE];
+static uint8_t largeTestData[LARGE_TEST_LENGTH];
+static uint8_t largeTestRead[W25Q_64K_BLOCK_SIZE];
+static uint8_t largeTestAliases[3][W25Q_64K_BLOCK_SIZE];
+
+//! True when length bytes at address all read back as erased on the part itself
+static bool LargeTest_erased(uint32_t address, uint32_t length)
+{
+	TEST_CHECK(SimFlash_peek(address, largeTestRead, length));
+
+	for (uint32_t i = 0; i < length; i++) {
+		if (largeTestRead[i] != 0xFF) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+//! Erases and programs must land where the address says, not on its aliases 16MB or 32MB lower
+static void LargeTest_aliases(uint32_t block, bool check)
+{
+	uint32_t i = 0;
+
+	for (uint32_t alias = block & 0x00FFFFFFu; alias < block; alias += 0x01000000u, i++) {
+		if (check) {
+			TEST_CHECK(SimFlash_peek(alias, largeTestRead, W25Q_64K_BLOCK_SIZE));
+			TEST_CHECK(memcmp(largeTestRead, largeTestAliases[i], W25Q_64K_BLOCK_SIZE) == 0);
+		} else {
+			TEST_CHECK(SimFlash_peek(alias, largeTestAliases[i], W25Q_64K_BLOCK_SIZE));
+		}
+	}
+}
+
+static void LargeTest_block(uint32_t block)
+{
+	uint32_t eraseCount = SimFlash_eraseCount(block);
+
+	LargeTest_aliases(block, false);
+	TEST_CHECK(SimFlash_load(block, largeTestBlock, sizeof(largeTestBlock)));
+
+	// Indirect read straight after the load, the whole block in one command
+	TEST_CHECK(W25q_readBytes(block, largeTestRead, sizeof(largeTestRead)));
+	TEST_CHECK(memcmp(largeTestRead, largeTestBlock, sizeof(largeTestBlock)) == 0);
+
+	// 4KB, then 32KB in the upper half, then the whole 64KB block
+	TEST_CHECK(W25q_sectorErase(block));
+	TEST_CHECK(W25q_waitForReady());
+	TEST_CHECK(LargeTest_erased(block, W25Q_SECTOR_SIZE));
+	TEST_CHECK(!LargeTest_erased(block + W25Q_SECTOR_SIZE, W25Q_SECTOR_SIZE));
+	TEST_CHECK(SimFlash_eraseCount(block) == (eraseCount + 1u));
+
+	TEST_CHECK(W25q_blockErase32k(block + W25Q_32K_BLOCK_SIZE));
+	TEST_CHECK(W25q_waitForReady());
+	TEST_CHECK(LargeTest_erased(block + W25Q_32K_BLOCK_SIZE, W25Q_32K_BLOCK_SIZE));
+	TEST_CHECK(!LargeTest_erased(block + W25Q_SECTOR_SIZE, W25Q_SECTOR_SIZE));
+
+	TEST_CHECK(W25q_blockErase64k(block));
+	TEST_CHECK(W25q_waitForReady());
+	TEST_CHECK(LargeTest_erased(block, W25Q_64K_BLOCK_SIZE));
+
+	// Program across page boundaries and read it back both ways
+	TEST_CHECK(W25q_writeBytes(block + LARGE_TEST_OFFSET, largeTestData, sizeof(largeTestData)));
+	TEST_CHECK(W25q_waitForReady());
+	TEST_CHECK(SimFlash_peek(block + LARGE_TEST_OFFSET, largeTestRead, sizeof(largeTestData)));
+	TEST_CHECK(memcmp(largeTestRead, largeTestData, sizeof(largeTestData)) == 0);
+
+	memset(largeTestRead, 0, sizeof(largeTestData));
+	TEST_CHECK(W25q_readBytes(block + LARGE_TEST_OFFSET, largeTestRead, sizeof(largeTestData)));
+	TEST_CHECK(memcmp(largeTestRead, largeTestData, sizeof(largeTestData)) == 0);
+
+	LargeTest_aliases(block, true);
+}
+
+//! Every block through the one mapping, the window has to reach the last byte of the part
+static void LargeTest_mapped(void)
+{
+	uint64_t outOfWindow = SimQspi_getStats()->mappedOutOfWindow;
+
+	TEST_CHECK(W25q_memoryMappedModeEnable());
+
+	for (uint32_t i = 0; i < sizeof(largeTestBlocks) / sizeof(largeTestBlocks[0]); i++) {
+		uint32_t address = largeTestBlocks[i] + LARGE_TEST_OFFSET;
+
+		SimQspi_mappedFetch(address, sizeof(largeTestData));
+		TEST_CHECK(memcmp((const uint8_t *)QSPI_BASE + address, largeTestData, sizeof(largeTestData)) == 0);
+	}
+
+	SimQspi_mappedFetch(LARGE_TEST_CAPACITY - SIM_QSPI_MAPPED_LINE, SIM_QSPI_MAPPED_LINE);
+	TEST_CHECK(SimQspi_getStats()->mappedOutOfWindow == outOfWindow);
+	TEST_CHECK(W25q_memoryMappedModeDisable());
+}
+
+static void LargeTest_mode(W25qAddressMode mode, const char *name)
+{
+	TEST_CHECK(Test_attach(&SimFlash_w25q512jvIq, LARGE_TEST_FLASH_SIZE));
+	TEST_CHECK(W25q_init(&testQspi));
+	TEST_CHECK(FlashDevice_totalCapacity(W25q_getDevice()) == LARGE_TEST_CAPACITY);
+	TEST_CHECK(W25q_setAddressMode(mode));
+	TEST_CHECK(W25q_getConfig()->addressMode == mode);
+
+	for (uint32_t i = 0; i < sizeof(largeTestBlocks) / sizeof(largeTestBlocks[0]); i++) {
+		LargeTest_block(largeTestBlocks[i]);
+	}
+
+	LargeTest_mapped();
+
+	// Nothing outside the blocks under test was touched
+	TEST_CHECK(LargeTest_erased(0x00FF0000u, W25Q_64K_BLOCK_SIZE));
+	TEST_CHECK(LargeTest_erased(0x01FF0000u, W25Q_64K_BLOCK_SIZE));
+	Test_checkProtocol();
+
+	printf("%s,%u,%llu\n", name, (unsigned)(sizeof(largeTestBlocks) / sizeof(largeTestBlocks[0])),
+			(unsigned long long)SimQspi_getStats()->mappedFetches);
+}
+
+int main(void)
+{
+	Test_fill(largeTestBlock, sizeof(largeTestBlock), 29);
+	Test_fill(largeTestData, sizeof(largeTestData), 290);
+
+	printf("mode,blocks,mapped_fetches\n");
+	LargeTest_mode(W25Q_ADDRESS_MODE_4B_OPCODES, "4b_opcodes");
+	LargeTest_mode(W25Q_ADDRESS_MODE_4B_ENTERED, "4b_entered");
+
+	return Test_result("w25q512test");
+}
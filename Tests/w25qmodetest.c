@@ -0,0 +1,162 @@
+/*
+ * This program is host test of the W25Q memory-mapped/indirect mode manager, counting mode switches per workload.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testutil.h"
+#include "w25qmode.h"
+
+#define MODE_TEST_ADDRESS		0x40000
+#define MODE_TEST_RECORD		64			//!< Bytes per logged record
+#define MODE_TEST_READS			1000
+#define MODE_TEST_WRITE_EVERY	100			//!< Reads between two records in the read-mostly workload
+#define MODE_TEST_BATCH			16
+
+static uint8_t modeTestData[MODE_TEST_BATCH * MODE_TEST_RECORD];
+
+static void ModeTest_start(bool lazyRemap)
+{
+	TEST_CHECK(Test_attach(&SimFlash_w25q128jvIm, TEST_NOR_FLASH_SIZE));
+	TEST_CHECK(W25q_init(&testQspi));
+	TEST_CHECK(W25qMode_init(lazyRemap));
+	TEST_CHECK(W25q_isMemoryMapped());
+}
+
+static void ModeTest_report(const char *workload, uint32_t epochs)
+{
+	const W25qModeStats *stats = W25qMode_getStats();
+
+	printf("%s,%u,%u,%u,%u,%u\n", workload, stats->updates, stats->unmaps, stats->remaps, stats->failedRemaps, epochs);
+}
+
+//! XIP reads with a record written now and then, every write pays one switch pair
+static void ModeTest_readMostly(void)
+{
+	uint32_t epoch;
+	uint32_t records = 0;
+
+	ModeTest_start(false);
+	epoch = W25qMode_epoch();
+	TEST_CHECK(W25qMode_eraseRange(MODE_TEST_ADDRESS, W25Q_SECTOR_SIZE));
+
+	for (uint32_t i = 0; i < MODE_TEST_READS; i++) {
+		uint32_t offset = (i % MODE_TEST_BATCH) * MODE_TEST_RECORD;
+		const uint8_t *mapped = W25qMode_map(MODE_TEST_ADDRESS + offset);
+
+		TEST_CHECK(mapped != NULL);
+
+		if ((i % MODE_TEST_WRITE_EVERY) == 0) {
+			TEST_CHECK(W25qMode_writeBytes(MODE_TEST_ADDRESS + (records * MODE_TEST_RECORD), &modeTestData[records * MODE_TEST_RECORD], MODE_TEST_RECORD));
+			records++;
+		}
+	}
+
+	const W25qModeStats *stats = W25qMode_getStats();
+
+	TEST_CHECK(stats->updates == (records + 1u));
+	TEST_CHECK(stats->unmaps == stats->updates);
+	TEST_CHECK(stats->remaps == (stats->updates + 1u));
+	TEST_CHECK(W25qMode_epoch() == (epoch + stats->updates));
+	TEST_CHECK(W25q_isMemoryMapped());
+
+	// What was written is visible through the mapping
+	TEST_CHECK(memcmp(W25qMode_map(MODE_TEST_ADDRESS), modeTestData, records * MODE_TEST_RECORD) == 0);
+
+	ModeTest_report("read_mostly", W25qMode_epoch() - epoch);
+	Test_checkProtocol();
+}
+
+//! The same records written inside one update, a single switch pair and a single epoch change
+static void ModeTest_batched(void)
+{
+	uint8_t buffer[MODE_TEST_RECORD];
+	uint32_t epoch;
+
+	ModeTest_start(false);
+	epoch = W25qMode_epoch();
+
+	TEST_CHECK(W25qMode_beginUpdate());
+	TEST_CHECK(!W25q_isMemoryMapped());
+	TEST_CHECK(W25qMode_map(MODE_TEST_ADDRESS) == NULL);
+	TEST_CHECK(W25qMode_eraseRange(MODE_TEST_ADDRESS, W25Q_SECTOR_SIZE));
+
+	for (uint32_t i = 0; i < MODE_TEST_BATCH; i++) {
+		TEST_CHECK(W25qMode_writeBytes(MODE_TEST_ADDRESS + (i * MODE_TEST_RECORD), &modeTestData[i * MODE_TEST_RECORD], MODE_TEST_RECORD));
+	}
+
+	// Reads inside the update go indirect rather than switching back
+	TEST_CHECK(W25qMode_readBytes(MODE_TEST_ADDRESS, buffer, sizeof(buffer)));
+	TEST_CHECK(memcmp(buffer, modeTestData, sizeof(buffer)) == 0);
+	TEST_CHECK(W25qMode_epoch() == epoch);
+	TEST_CHECK(W25qMode_endUpdate());
+	TEST_CHECK(!W25qMode_endUpdate());
+
+	const W25qModeStats *stats = W25qMode_getStats();
+
+	TEST_CHECK(stats->updates == (MODE_TEST_BATCH + 1u));
+	TEST_CHECK(stats->unmaps == 1);
+	TEST_CHECK(stats->remaps == 2);
+	TEST_CHECK(W25qMode_epoch() == (epoch + 1u));
+	TEST_CHECK(W25q_isMemoryMapped());
+	TEST_CHECK(memcmp(W25qMode_map(MODE_TEST_ADDRESS), modeTestData, sizeof(modeTestData)) == 0);
+
+	ModeTest_report("batched", W25qMode_epoch() - epoch);
+	Test_checkProtocol();
+}
+
+//! Lazy remap: back to back writes stay indirect, the next mapped read pays the one remap
+static void ModeTest_lazy(void)
+{
+	uint8_t buffer[MODE_TEST_RECORD];
+	uint32_t epoch;
+
+	ModeTest_start(true);
+	epoch = W25qMode_epoch();
+	TEST_CHECK(W25qMode_eraseRange(MODE_TEST_ADDRESS, W25Q_SECTOR_SIZE));
+
+	for (uint32_t i = 0; i < MODE_TEST_BATCH; i++) {
+		TEST_CHECK(W25qMode_writeBytes(MODE_TEST_ADDRESS + (i * MODE_TEST_RECORD), &modeTestData[i * MODE_TEST_RECORD], MODE_TEST_RECORD));
+	}
+
+	TEST_CHECK(!W25q_isMemoryMapped());
+	TEST_CHECK(W25qMode_getStats()->unmaps == 1);
+	TEST_CHECK(W25qMode_getStats()->remaps == 1);
+
+	TEST_CHECK(W25qMode_readBytes(MODE_TEST_ADDRESS + MODE_TEST_RECORD, buffer, sizeof(buffer)));
+	TEST_CHECK(memcmp(buffer, &modeTestData[MODE_TEST_RECORD], sizeof(buffer)) == 0);
+	TEST_CHECK(W25q_isMemoryMapped());
+	TEST_CHECK(W25qMode_getStats()->remaps == 2);
+
+	// Every update still moves the epoch, a mapped reader cannot tell a batch from single writes
+	TEST_CHECK(W25qMode_epoch() == (epoch + MODE_TEST_BATCH + 1u));
+
+	ModeTest_report("lazy_burst", W25qMode_epoch() - epoch);
+	Test_checkProtocol();
+}
+
+int main(void)
+{
+	Test_fill(modeTestData, sizeof(modeTestData), 36);
+
+	printf("workload,updates,unmaps,remaps,failed_remaps,epochs\n");
+	ModeTest_readMostly();
+	ModeTest_batched();
+	ModeTest_lazy();
+
+	return Test_result("w25qmodetest");
+}
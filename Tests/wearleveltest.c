@@ -0,0 +1,254 @@
+/*
+ * This program is host simulation of W25Q sector wear leveling under a long hot/cold workload.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testutil.h"
+#include "wearlevel.h"
+#include "w25q.h"
+
+#define WEAR_TEST_BASE			0x100000
+#define WEAR_TEST_PHYSICAL		32
+#define WEAR_TEST_LOGICAL		24
+#define WEAR_TEST_HOT			4			//!< Counters and logs, erased over and over
+#define WEAR_TEST_CYCLES		20000		//!< Logical erases of the hot sectors in the long run
+#define WEAR_TEST_PART_CYCLES	40			//!< The same on the simulated part, where every erase is polled out
+#define WEAR_TEST_RECORD		64
+
+static WearLevel wearTest;
+static WearLevel wearTestRemounted;
+static WearLevelIo wearTestIo;
+static uint32_t wearTestReads;
+static uint8_t wearTestCold[WEAR_TEST_LOGICAL][WEAR_TEST_RECORD];
+static uint8_t wearTestRecord[WEAR_TEST_RECORD];
+
+// Long runs go to a RAM array with NOR rules and the part's datasheet times
+static uint8_t wearTestArray[WEAR_TEST_PHYSICAL * WEAR_LEVEL_SECTOR_SIZE];
+static uint32_t wearTestArrayErases[WEAR_TEST_PHYSICAL];
+static uint32_t wearTestArrayViolations;
+static uint64_t wearTestArrayNs;
+
+static bool WearTest_arrayRead(void *context, uint32_t address, uint8_t *buffer, uint32_t length)
+{
+	(void)context;
+	wearTestReads++;
+	memcpy(buffer, &wearTestArray[address - WEAR_TEST_BASE], length);
+	wearTestArrayNs += (uint64_t)length * 20u;					//!< Quad read at 100MHz
+
+	return true;
+}
+
+static bool WearTest_arrayProgram(void *context, uint32_t address, const uint8_t *buffer, uint32_t length)
+{
+	uint32_t offset = address - WEAR_TEST_BASE;
+	uint32_t pages = ((offset + length - 1u) / W25Q_PAGE_SIZE) - (offset / W25Q_PAGE_SIZE) + 1u;
+
+	(void)context;
+
+	for (uint32_t i = 0; i < length; i++) {
+		wearTestArrayViolations += ((buffer[i] & ~wearTestArray[offset + i]) != 0) ? 1u : 0u;
+		wearTestArray[offset + i] &= buffer[i];
+	}
+
+	wearTestArrayNs += (uint64_t)pages * SimFlash_w25q128jvIm.pageProgramUs * 1000u;
+
+	return true;
+}
+
+static bool WearTest_arrayErase(void *context, uint32_t address)
+{
+	uint32_t sector = (address - WEAR_TEST_BASE) / WEAR_LEVEL_SECTOR_SIZE;
+
+	(void)context;
+	memset(&wearTestArray[sector * WEAR_LEVEL_SECTOR_SIZE], 0xFF, WEAR_LEVEL_SECTOR_SIZE);
+	wearTestArrayErases[sector]++;
+	wearTestArrayNs += (uint64_t)SimFlash_w25q128jvIm.sectorEraseUs * 1000u;
+
+	return true;
+}
+
+static const WearLevelIo wearTestArrayIo = {
+	.read			= WearTest_arrayRead,
+	.program		= WearTest_arrayProgram,
+	.eraseSector	= WearTest_arrayErase,
+	.context		= NULL,
+};
+
+static void WearTest_arrayStart(void)
+{
+	memset(wearTestArray, 0xFF, sizeof(wearTestArray));
+	memset(wearTestArrayErases, 0, sizeof(wearTestArrayErases));
+	wearTestArrayViolations = 0;
+	wearTestArrayNs = 0;
+}
+
+static uint32_t WearTest_arrayErasesTotal(uint32_t *minCount, uint32_t *maxCount)
+{
+	uint32_t total = 0;
+
+	*minCount = UINT32_MAX;
+	*maxCount = 0;
+
+	for (uint32_t p = 0; p < WEAR_TEST_PHYSICAL; p++) {
+		total += wearTestArrayErases[p];
+		*minCount = (wearTestArrayErases[p] < *minCount) ? wearTestArrayErases[p] : *minCount;
+		*maxCount = (wearTestArrayErases[p] > *maxCount) ? wearTestArrayErases[p] : *maxCount;
+	}
+
+	return total;
+}
+
+static void WearTest_report(const char *layer, uint32_t cycles, uint64_t elapsedNs)
+{
+	uint32_t minCount;
+	uint32_t maxCount;
+	uint32_t erases = WearTest_arrayErasesTotal(&minCount, &maxCount);
+
+	printf("%s,%u,%u,%u,%u,%.0f\n", layer, cycles, erases, minCount, maxCount, elapsedNs / (1e3 * cycles));
+}
+
+//! The workload erasing sectors in place: the hot ones take every erase
+static uint64_t WearTest_inPlace(void)
+{
+	WearTest_arrayStart();
+
+	for (uint32_t i = 0; i < WEAR_TEST_CYCLES; i++) {
+		uint32_t address = WEAR_TEST_BASE + ((i % WEAR_TEST_HOT) * WEAR_LEVEL_SECTOR_SIZE);
+
+		WearTest_arrayErase(NULL, address);
+		WearTest_arrayProgram(NULL, address, wearTestRecord, sizeof(wearTestRecord));
+	}
+
+	WearTest_report("in_place", WEAR_TEST_CYCLES, wearTestArrayNs);
+	return wearTestArrayNs;
+}
+
+//! Cold data written once, then the hot sectors erased and rewritten over and over
+static void WearTest_workload(const WearLevelIo *io, uint32_t cycles)
+{
+	TEST_CHECK(WearLevel_mount(&wearTest, io, WEAR_TEST_BASE, WEAR_TEST_PHYSICAL, WEAR_TEST_LOGICAL));
+	TEST_CHECK(wearTest.stats.recovered == WEAR_TEST_PHYSICAL);
+
+	for (uint32_t logical = WEAR_TEST_HOT; logical < WEAR_TEST_LOGICAL; logical++) {
+		TEST_CHECK(WearLevel_program(&wearTest, logical, 0, wearTestCold[logical], WEAR_TEST_RECORD));
+	}
+
+	for (uint32_t i = 0; i < cycles; i++) {
+		uint32_t logical = i % WEAR_TEST_HOT;
+
+		TEST_CHECK(WearLevel_erase(&wearTest, logical));
+		TEST_CHECK(WearLevel_program(&wearTest, logical, 0, wearTestRecord, sizeof(wearTestRecord)));
+	}
+}
+
+//! Lookups come from RAM, reads cost one flash access and data survives migration and remount
+static void WearTest_persist(const WearLevelIo *io)
+{
+	uint8_t buffer[WEAR_TEST_RECORD];
+	uint32_t mismatches = 0;
+
+	for (uint32_t logical = WEAR_TEST_HOT; logical < WEAR_TEST_LOGICAL; logical++) {
+		wearTestReads = 0;
+		TEST_CHECK(WearLevel_read(&wearTest, logical, 0, buffer, sizeof(buffer)));
+		TEST_CHECK(wearTestReads == 1);
+		mismatches += (memcmp(buffer, wearTestCold[logical], sizeof(buffer)) == 0) ? 0u : 1u;
+	}
+
+	TEST_CHECK(mismatches == 0);
+
+	TEST_CHECK(WearLevel_mount(&wearTestRemounted, io, WEAR_TEST_BASE, WEAR_TEST_PHYSICAL, WEAR_TEST_LOGICAL));
+	TEST_CHECK(wearTestRemounted.stats.recovered == 0);
+	TEST_CHECK(memcmp(wearTestRemounted.map, wearTest.map, sizeof(wearTest.map)) == 0);
+	TEST_CHECK(memcmp(wearTestRemounted.eraseCount, wearTest.eraseCount, sizeof(wearTest.eraseCount)) == 0);
+
+	TEST_CHECK(WearLevel_read(&wearTestRemounted, 0, 0, buffer, sizeof(buffer)));
+	TEST_CHECK(memcmp(buffer, wearTestRecord, sizeof(buffer)) == 0);
+}
+
+static uint64_t WearTest_leveled(void)
+{
+	uint32_t minCount;
+	uint32_t maxCount;
+
+	WearTest_arrayStart();
+	WearTest_workload(&wearTestArrayIo, WEAR_TEST_CYCLES);
+	WearTest_report("leveled", WEAR_TEST_CYCLES, wearTestArrayNs);
+
+	// The spread stays inside the bound and the layer's counters are the array's
+	WearLevel_eraseSpread(&wearTest, &minCount, &maxCount);
+	TEST_CHECK((maxCount - minCount) <= (WEAR_LEVEL_MAX_SPREAD + 1u));
+	TEST_CHECK(memcmp(wearTest.eraseCount, wearTestArrayErases, sizeof(wearTestArrayErases)) == 0);
+	TEST_CHECK(wearTestArrayViolations == 0);
+
+	// Migrations are the only extra erases, a small share of the workload
+	uint32_t erases = WearTest_arrayErasesTotal(&minCount, &maxCount);
+
+	TEST_CHECK(wearTest.stats.migrations > 0);
+	TEST_CHECK(wearTest.stats.migrations < (WEAR_TEST_CYCLES / 20u));
+	TEST_CHECK(erases == (WEAR_TEST_PHYSICAL + WEAR_TEST_CYCLES - WEAR_TEST_HOT + wearTest.stats.migrations));
+
+	WearTest_persist(&wearTestArrayIo);
+	return wearTestArrayNs;
+}
+
+static bool WearTest_partRead(void *context, uint32_t address, uint8_t *buffer, uint32_t length)
+{
+	wearTestReads++;
+
+	return WearLevel_w25qIo.read(context, address, buffer, length);
+}
+
+//! A short run through the W25Q driver: the headers carry what the part really saw
+static void WearTest_part(void)
+{
+	TEST_CHECK(Test_attach(&SimFlash_w25q128jvIm, TEST_NOR_FLASH_SIZE));
+	TEST_CHECK(W25q_init(&testQspi));
+
+	wearTestIo = WearLevel_w25qIo;
+	wearTestIo.read = WearTest_partRead;
+	WearTest_workload(&wearTestIo, WEAR_TEST_PART_CYCLES);
+	W25q_waitForReady();
+
+	uint32_t mismatches = 0;
+
+	for (uint32_t p = 0; p < WEAR_TEST_PHYSICAL; p++) {
+		mismatches += (wearTest.eraseCount[p] == SimFlash_eraseCount(WEAR_TEST_BASE + (p * W25Q_SECTOR_SIZE))) ? 0u : 1u;
+	}
+
+	TEST_CHECK(mismatches == 0);
+	WearTest_persist(&wearTestIo);
+	Test_checkProtocol();
+}
+
+int main(void)
+{
+	Test_fill(&wearTestCold[0][0], sizeof(wearTestCold), 47);
+	Test_fill(wearTestRecord, sizeof(wearTestRecord), 470);
+
+	printf("layer,cycles,physical_erases,min_count,max_count,us_per_cycle\n");
+
+	uint64_t inPlaceNs = WearTest_inPlace();
+	uint64_t leveledNs = WearTest_leveled();
+
+	// Each cycle still costs one sector erase, the headers and the odd migration add little
+	TEST_CHECK(leveledNs < (inPlaceNs + (inPlaceNs / 10u)));
+
+	WearTest_part();
+
+	return Test_result("wearleveltest");
+}
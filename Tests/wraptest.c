@@ -0,0 +1,122 @@
+/*
+ * This program is host test of W25Q burst with wrap reads, indirect and memory-mapped, on a simulated bus.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "testutil.h"
+#include "w25q.h"
+
+#define WRAP_TEST_BASE		0x40000
+#define WRAP_TEST_LINES		8
+#define WRAP_TEST_MISSES	(WRAP_TEST_LINES / 2u)	//!< Every other line, so none streams on from the one before
+
+static uint8_t wrapTestData[WRAP_TEST_LINES * W25Q_WRAP_CACHE_LINE];
+static uint8_t wrapTestRead[sizeof(wrapTestData)];
+
+//! The W25Q256JV uses the 4-byte opcode of each read
+static uint32_t WrapTest_count(uint8_t instruction, uint8_t instruction4b)
+{
+	return SimQspi_getStats()->opcodes[instruction] + SimQspi_getStats()->opcodes[instruction4b];
+}
+
+//! Every offset of a line, short reads inside it and whole lines from the missed byte
+static void WrapTest_indirect(void)
+{
+	uint32_t mismatches = 0;
+	uint32_t linearBefore = WrapTest_count(W25Q_INSTR_FAST_READ_QUAD_OUTPUT, W25Q_INSTR_FAST_READ_QUAD_OUTPUT_4B);
+	uint32_t wrapBefore = WrapTest_count(W25Q_INSTR_FAST_READ_QUAD, W25Q_INSTR_FAST_READ_QUAD_4B);
+
+	for (uint32_t offset = 0; offset < W25Q_WRAP_CACHE_LINE; offset++) {
+		uint32_t address = WRAP_TEST_BASE + W25Q_WRAP_CACHE_LINE + offset;
+		uint32_t length = W25Q_WRAP_CACHE_LINE - offset;
+
+		memset(wrapTestRead, 0, sizeof(wrapTestRead));
+		TEST_CHECK(W25q_readBytes(address, wrapTestRead, length));
+		mismatches += (memcmp(wrapTestRead, &wrapTestData[W25Q_WRAP_CACHE_LINE + offset], length) == 0) ? 0u : 1u;
+
+		memset(wrapTestRead, 0, sizeof(wrapTestRead));
+		TEST_CHECK(W25q_readWrapped(address, wrapTestRead));
+		mismatches += (memcmp(wrapTestRead, &wrapTestData[W25Q_WRAP_CACHE_LINE], W25Q_WRAP_CACHE_LINE) == 0) ? 0u : 1u;
+	}
+
+	TEST_CHECK(mismatches == 0);
+	TEST_CHECK(WrapTest_count(W25Q_INSTR_FAST_READ_QUAD, W25Q_INSTR_FAST_READ_QUAD_4B) - wrapBefore == (2u * W25Q_WRAP_CACHE_LINE));
+	TEST_CHECK(WrapTest_count(W25Q_INSTR_FAST_READ_QUAD_OUTPUT, W25Q_INSTR_FAST_READ_QUAD_OUTPUT_4B) == linearBefore);
+
+	// Across a line the part would wrap back, that read stays linear
+	TEST_CHECK(W25q_readBytes(WRAP_TEST_BASE + 8u, wrapTestRead, 2u * W25Q_WRAP_CACHE_LINE));
+	TEST_CHECK(memcmp(wrapTestRead, &wrapTestData[8], 2u * W25Q_WRAP_CACHE_LINE) == 0);
+	TEST_CHECK(WrapTest_count(W25Q_INSTR_FAST_READ_QUAD_OUTPUT, W25Q_INSTR_FAST_READ_QUAD_OUTPUT_4B) == linearBefore + 1u);
+}
+
+//! Time the CPU waits for the word it missed on, summed over the misses
+static uint64_t WrapTest_mapped(uint32_t offset)
+{
+	const uint8_t *window = (const uint8_t *)QSPI_BASE;
+	uint64_t before = SimQspi_getStats()->mappedCriticalNs;
+
+	TEST_CHECK(W25q_memoryMappedModeEnable());
+
+	for (uint32_t line = 0; line < WRAP_TEST_LINES; line += 2u) {
+		uint32_t address = WRAP_TEST_BASE + (line * W25Q_WRAP_CACHE_LINE) + offset;
+
+		SimQspi_mappedFetch(address, 4);
+		TEST_CHECK(memcmp(window + address, &wrapTestData[(line * W25Q_WRAP_CACHE_LINE) + offset], 4) == 0);
+	}
+
+	TEST_CHECK(W25q_memoryMappedModeDisable());
+
+	return SimQspi_getStats()->mappedCriticalNs - before;
+}
+
+int main(void)
+{
+	Test_fill(wrapTestData, sizeof(wrapTestData), 37);
+
+	TEST_CHECK(Test_attach(&SimFlash_w25q256jvIq, TEST_NOR_FLASH_SIZE));
+	TEST_CHECK(SimFlash_load(WRAP_TEST_BASE, wrapTestData, sizeof(wrapTestData)));
+	TEST_CHECK(W25q_init(&testQspi));
+
+	uint64_t linearNs = WrapTest_mapped(W25Q_WRAP_CACHE_LINE - 4u);
+	uint64_t linearStartNs = WrapTest_mapped(0);
+
+	TEST_CHECK(W25q_setWrapRead(W25Q_WRAP_CACHE_LINE));
+	WrapTest_indirect();
+
+	// Each line fill is a wrapped read from the missed word, no matter where in the line it is
+	uint32_t wrapBefore = WrapTest_count(W25Q_INSTR_FAST_READ_QUAD, W25Q_INSTR_FAST_READ_QUAD_4B);
+	uint64_t wrapNs = WrapTest_mapped(W25Q_WRAP_CACHE_LINE - 4u);
+	uint64_t wrapStartNs = WrapTest_mapped(0);
+
+	TEST_CHECK(WrapTest_count(W25Q_INSTR_FAST_READ_QUAD, W25Q_INSTR_FAST_READ_QUAD_4B) - wrapBefore == (2u * WRAP_TEST_MISSES));
+
+	printf("mapped_miss,linear_ns,wrap_ns\n");
+	printf("line_start,%llu,%llu\n", (unsigned long long)linearStartNs, (unsigned long long)wrapStartNs);
+	printf("line_end,%llu,%llu\n", (unsigned long long)linearNs, (unsigned long long)wrapNs);
+
+	TEST_CHECK(wrapNs == wrapStartNs);
+	TEST_CHECK(wrapNs < linearNs);
+
+	// Off again, the read the part was set up with comes back
+	TEST_CHECK(W25q_setWrapRead(0));
+	TEST_CHECK(W25q_readBytes(WRAP_TEST_BASE + 8u, wrapTestRead, 4));
+	TEST_CHECK(memcmp(wrapTestRead, &wrapTestData[8], 4) == 0);
+	Test_checkProtocol();
+
+	return Test_result("wraptest");
+}
@@ -0,0 +1,682 @@
+/*
+ * This program is host benchmark of the W25Q and W25N01G drivers on the simulated QUADSPI bus.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Runs the unmodified drivers against the simulated part and prints one CSV row per case:
+ *
+ *   flashbench [--quick] [output.csv]
+ *
+ * MB/s and ops/s come from simulated time, which covers bus clocks, HAL call overhead and the
+ * part's busy times. bus_cycles is what the QUADSPI clock did, cpu_us the host time the driver
+ * and the model took, critical_us how long memory-mapped line fills kept the CPU waiting for the
+ * byte it missed on, copied_bytes what the CPU moved through a staging buffer. --quick shrinks the
+ * counts for a smoke run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "simflash.h"
+#include "simqspi.h"
+#include "quadspi.h"
+#include "w25q.h"
+#include "w25n01g.h"
+#include "flashverify.h"
+
+#define BENCHMARK_MAX_READ			(1024u * 1024u)
+#define BENCHMARK_NOR_FLASH_SIZE	23			//!< 2^(23 + 1) = 16MB
+#define BENCHMARK_NAND_FLASH_SIZE	26
+#define BENCHMARK_MISS_SIZE			4			//!< The word a CPU load missed on
+#define BENCHMARK_VECTOR_SIZE		4096		//!< One record, header, payload and trailer fragments
+
+typedef struct {
+	const char *part;
+	const char *operation;
+	uint32_t size;
+	uint32_t count;
+	uint32_t failures;
+	uint64_t copied;
+	uint64_t startNs;
+	uint64_t startCpuNs;
+	SimQspiStats startBus;
+} BenchmarkCase;
+
+static QSPI_HandleTypeDef benchmarkQspi;
+static FILE *benchmarkOut;
+static bool benchmarkQuick = false;
+static uint8_t *benchmarkBuffer;
+static uint8_t *benchmarkPattern;
+static uint32_t benchmarkRandom = 0x2545F491u;
+static uint32_t benchmarkFailures = 0;
+
+// Header, payload split around a descriptor, trailer, laid out over the pattern
+static const uint32_t benchmarkVectorFragments[] = { 16, 1000, 8, 3056, 16 };
+
+// Every simulated geometry, --quick included: capacity, address width, spare and die layout differ between them
+static const SimFlashModel *const benchmarkNorParts[] = {
+	&SimFlash_w25q128jvIm, &SimFlash_w25q256jvIq, &SimFlash_w25q512jvIq, &SimFlash_w25m512jv,
+};
+static const SimFlashModel *const benchmarkNandParts[] = {
+	&SimFlash_w25n01gv, &SimFlash_w25n02kv, &SimFlash_w25m02gv,
+};
+
+static const uint32_t benchmarkReadSizes[] = {
+	4, 16, 64, 256, 1024, 4096, 16384, 65536, 262144, 1048576,
+};
+
+static uint64_t Benchmark_cpuNs(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+
+	return ((uint64_t)now.tv_sec * 1000000000u) + (uint64_t)now.tv_nsec;
+}
+
+static uint32_t Benchmark_random(void)
+{
+	benchmarkRandom ^= benchmarkRandom << 13;
+	benchmarkRandom ^= benchmarkRandom >> 17;
+	benchmarkRandom ^= benchmarkRandom << 5;
+	return benchmarkRandom;
+}
+
+static void Benchmark_begin(BenchmarkCase *bench, const char *operation, uint32_t size)
+{
+	bench->operation = operation;
+	bench->size = size;
+	bench->count = 0;
+	bench->failures = 0;
+	bench->copied = 0;
+	bench->startBus = *SimQspi_getStats();
+	bench->startNs = SimQspi_nowNs();
+	bench->startCpuNs = Benchmark_cpuNs();
+}
+
+static void Benchmark_count(BenchmarkCase *bench, bool success)
+{
+	bench->count++;
+
+	if (!success) {
+		bench->failures++;
+	}
+}
+
+static void Benchmark_end(BenchmarkCase *bench)
+{
+	uint64_t cpuNs = Benchmark_cpuNs() - bench->startCpuNs;
+	uint64_t simNs = SimQspi_nowNs() - bench->startNs;
+	const SimQspiStats *bus = SimQspi_getStats();
+	double seconds = (double)simNs / 1e9;
+	double bytes = (double)bench->size * bench->count;
+
+	fprintf(benchmarkOut, "%s,%s,%u,%u,%u,%.3f,%.3f,%.1f,%llu,%.3f,%.3f,%llu,%llu,%.3f,%llu\n",
+			bench->part, bench->operation, bench->size, bench->count, bench->failures,
+			(double)simNs / 1e3,
+			(seconds > 0) ? (bytes / seconds / 1e6) : 0.0,
+			(seconds > 0) ? (bench->count / seconds) : 0.0,
+			(unsigned long long)(bus->busCycles - bench->startBus.busCycles),
+			(double)(bus->busNs - bench->startBus.busNs) / 1e3,
+			(double)cpuNs / 1e3,
+			(unsigned long long)(bus->halCalls - bench->startBus.halCalls),
+			(unsigned long long)(bus->transactions - bench->startBus.transactions),
+			(double)(bus->mappedCriticalNs - bench->startBus.mappedCriticalNs) / 1e3,
+			(unsigned long long)bench->copied);
+
+	benchmarkFailures += bench->failures;
+}
+
+//! The driver must never send the part something it ignores, that would make the numbers meaningless
+static void Benchmark_checkPart(const SimFlashModel *model)
+{
+	const SimFlashStats *flash = SimFlash_getStats();
+
+	if ((flash->protocolErrors != 0) || (flash->busyViolations != 0) || (flash->welViolations != 0)) {
+		fprintf(stderr, "%s: protocol errors %u, busy violations %u, WEL violations %u\n",
+				model->name, flash->protocolErrors, flash->busyViolations, flash->welViolations);
+		benchmarkFailures++;
+	}
+}
+
+static uint32_t Benchmark_readCount(uint32_t size)
+{
+	uint32_t total = benchmarkQuick ? (64u * 1024u) : (4u * 1024u * 1024u);
+	uint32_t count = total / size;
+
+	if (count > (benchmarkQuick ? 16u : 1024u)) {
+		count = benchmarkQuick ? 16u : 1024u;
+	}
+
+	return (count == 0) ? 1u : count;
+}
+
+static bool Benchmark_startNor(const SimFlashModel *model)
+{
+	SimQspi_reset();
+	SimFlash_attach(model);
+	memset(&benchmarkQspi, 0, sizeof(benchmarkQspi));
+
+	return QuadSpi_Init(&benchmarkQspi, BENCHMARK_NOR_FLASH_SIZE) && W25q_init(&benchmarkQspi);
+}
+
+static void Benchmark_nor(const SimFlashModel *model)
+{
+	BenchmarkCase bench = { .part = model->name };
+	uint32_t capacity = model->dieCapacity * model->dieCount;
+
+	if (!Benchmark_startNor(model)) {
+		fprintf(stderr, "%s: init failed\n", model->name);
+		return;
+	}
+
+	// Reads run on a filled part so the data path moves real bytes
+	SimFlash_load(0, benchmarkPattern, BENCHMARK_MAX_READ);
+
+	for (uint32_t i = 0; i < sizeof(benchmarkReadSizes) / sizeof(benchmarkReadSizes[0]); i++) {
+		uint32_t size = benchmarkReadSizes[i];
+		uint32_t count = Benchmark_readCount(size);
+		uint32_t address = 0;
+
+		Benchmark_begin(&bench, "read_seq", size);
+		for (uint32_t n = 0; n < count; n++) {
+			Benchmark_count(&bench, W25q_readBytes(address, benchmarkBuffer, size));
+			address = (address + size) % capacity;
+		}
+		Benchmark_end(&bench);
+
+		Benchmark_begin(&bench, "read_random", size);
+		for (uint32_t n = 0; n < count; n++) {
+			address = (Benchmark_random() % (capacity / size)) * size;
+			Benchmark_count(&bench, W25q_readBytes(address, benchmarkBuffer, size));
+		}
+		Benchmark_end(&bench);
+	}
+
+	// Read-back verification of what was just read, digests included, against the pattern it was loaded from
+	uint32_t verifySize = benchmarkQuick ? (64u * 1024u) : BENCHMARK_MAX_READ;
+	uint32_t crc = FlashVerify_crc32Update(0, benchmarkPattern, verifySize);
+	uint8_t digest[FLASH_VERIFY_SHA256_SIZE];
+	FlashVerifySha256 sha;
+	FlashVerifyResult result;
+
+	FlashVerify_sha256Init(&sha);
+	FlashVerify_sha256Update(&sha, benchmarkPattern, verifySize);
+	FlashVerify_sha256Final(&sha, digest);
+
+	Benchmark_begin(&bench, "verify_compare", verifySize);
+	Benchmark_count(&bench, FlashVerify_compare(FlashVerify_w25qRead, NULL, 0, benchmarkPattern, verifySize, &result) && result.match);
+	Benchmark_end(&bench);
+
+	Benchmark_begin(&bench, "verify_crc32", verifySize);
+	Benchmark_count(&bench, FlashVerify_crc32(FlashVerify_w25qRead, NULL, 0, verifySize, crc, &result) && result.match);
+	Benchmark_end(&bench);
+
+	Benchmark_begin(&bench, "verify_sha256", verifySize);
+	Benchmark_count(&bench, FlashVerify_sha256(FlashVerify_w25qRead, NULL, 0, verifySize, digest, &result) && result.match);
+	Benchmark_end(&bench);
+
+	uint32_t pages = benchmarkQuick ? 16u : 256u;
+
+	Benchmark_begin(&bench, "page_program", W25Q_PAGE_SIZE);
+	for (uint32_t n = 0; n < pages; n++) {
+		Benchmark_count(&bench, W25q_writeBytes(capacity / 2u + n * W25Q_PAGE_SIZE, benchmarkPattern + n * W25Q_PAGE_SIZE, W25Q_PAGE_SIZE));
+	}
+	Benchmark_end(&bench);
+
+	uint32_t erases = benchmarkQuick ? 2u : 16u;
+
+	Benchmark_begin(&bench, "erase_4k", W25Q_SECTOR_SIZE);
+	for (uint32_t n = 0; n < erases; n++) {
+		Benchmark_count(&bench, W25q_sectorErase(n * W25Q_SECTOR_SIZE));
+	}
+	Benchmark_end(&bench);
+
+	Benchmark_begin(&bench, "erase_32k", W25Q_32K_BLOCK_SIZE);
+	for (uint32_t n = 0; n < erases; n++) {
+		Benchmark_count(&bench, W25q_blockErase32k(n * W25Q_32K_BLOCK_SIZE));
+	}
+	Benchmark_end(&bench);
+
+	Benchmark_begin(&bench, "erase_64k", W25Q_64K_BLOCK_SIZE);
+	for (uint32_t n = 0; n < erases; n++) {
+		Benchmark_count(&bench, W25q_blockErase64k(n * W25Q_64K_BLOCK_SIZE));
+	}
+	Benchmark_end(&bench);
+
+	Benchmark_begin(&bench, "erase_chip", capacity);
+	Benchmark_count(&bench, W25q_chipErase() && W25q_waitForChipErase());
+	Benchmark_end(&bench);
+
+	// Memory-mapped fetches through the window, the CPU side is a plain copy
+	SimFlash_load(0, benchmarkPattern, BENCHMARK_MAX_READ);
+
+	if (W25q_memoryMappedModeEnable()) {
+		const uint8_t *window = (const uint8_t *)QSPI_BASE;
+
+		for (uint32_t i = 0; i < sizeof(benchmarkReadSizes) / sizeof(benchmarkReadSizes[0]); i++) {
+			uint32_t size = benchmarkReadSizes[i];
+			uint32_t count = Benchmark_readCount(size);
+			uint32_t address = 0;
+
+			Benchmark_begin(&bench, "mapped_fetch", size);
+			for (uint32_t n = 0; n < count; n++) {
+				SimQspi_mappedFetch(address, size);
+				memcpy(benchmarkBuffer, window + address, size);
+				Benchmark_count(&bench, true);
+				address = (address + size) % capacity;
+			}
+			Benchmark_end(&bench);
+		}
+
+		W25q_memoryMappedModeDisable();
+	}
+
+	Benchmark_checkPart(model);
+}
+
+static uint32_t Benchmark_vector(FlashIoVec *iov, uint8_t *buffer)
+{
+	uint32_t count = sizeof(benchmarkVectorFragments) / sizeof(benchmarkVectorFragments[0]);
+	uint32_t offset = 0;
+
+	// Spread out so no two fragments touch, as separate objects would be
+	for (uint32_t i = 0; i < count; i++) {
+		iov[i].base = buffer + offset + (i * 64u);
+		iov[i].length = benchmarkVectorFragments[i];
+		offset += benchmarkVectorFragments[i];
+	}
+
+	return count;
+}
+
+//! Gathers the fragments into staging the way a caller without the vector API has to
+static uint32_t Benchmark_gather(uint8_t *staging, const FlashIoVec *iov, uint32_t count)
+{
+	uint32_t offset = 0;
+
+	for (uint32_t i = 0; i < count; i++) {
+		memcpy(staging + offset, iov[i].base, iov[i].length);
+		offset += iov[i].length;
+	}
+
+	return offset;
+}
+
+static uint32_t Benchmark_scatter(const uint8_t *staging, const FlashIoVec *iov, uint32_t count)
+{
+	uint32_t offset = 0;
+
+	for (uint32_t i = 0; i < count; i++) {
+		memcpy(iov[i].base, staging + offset, iov[i].length);
+		offset += iov[i].length;
+	}
+
+	return offset;
+}
+
+//! Fragmented records written and read with the vector calls and through a staging buffer
+static void Benchmark_vectorNor(const SimFlashModel *model)
+{
+	BenchmarkCase bench = { .part = model->name };
+	static uint8_t staging[BENCHMARK_VECTOR_SIZE];
+	FlashIoVec writeIov[sizeof(benchmarkVectorFragments) / sizeof(benchmarkVectorFragments[0])];
+	FlashIoVec readIov[sizeof(writeIov) / sizeof(writeIov[0])];
+	uint32_t count = Benchmark_vector(writeIov, benchmarkPattern);
+	uint32_t records = benchmarkQuick ? 4u : 64u;
+
+	Benchmark_vector(readIov, benchmarkBuffer);
+
+	if (!Benchmark_startNor(model)) {
+		fprintf(stderr, "%s: init failed\n", model->name);
+		return;
+	}
+
+	for (uint32_t vector = 0; vector < 2u; vector++) {
+		uint32_t base = vector * records * BENCHMARK_VECTOR_SIZE;
+
+		for (uint32_t n = 0; n < records; n++) {
+			W25q_sectorErase(base + (n * BENCHMARK_VECTOR_SIZE));
+		}
+		W25q_waitForReady();
+
+		Benchmark_begin(&bench, vector ? "write_vector" : "write_staged", BENCHMARK_VECTOR_SIZE);
+		for (uint32_t n = 0; n < records; n++) {
+			uint32_t address = base + (n * BENCHMARK_VECTOR_SIZE);
+
+			if (vector) {
+				Benchmark_count(&bench, W25q_writeVector(address, writeIov, count));
+			} else {
+				bench.copied += Benchmark_gather(staging, writeIov, count);
+				Benchmark_count(&bench, W25q_writeBytes(address, staging, BENCHMARK_VECTOR_SIZE));
+			}
+		}
+		Benchmark_end(&bench);
+
+		W25q_waitForReady();
+		Benchmark_begin(&bench, vector ? "read_vector" : "read_staged", BENCHMARK_VECTOR_SIZE);
+		for (uint32_t n = 0; n < records; n++) {
+			uint32_t address = base + (n * BENCHMARK_VECTOR_SIZE);
+			bool success;
+
+			if (vector) {
+				success = W25q_readVector(address, readIov, count);
+			} else {
+				success = W25q_readBytes(address, staging, BENCHMARK_VECTOR_SIZE);
+				bench.copied += Benchmark_scatter(staging, readIov, count);
+			}
+
+			for (uint32_t i = 0; i < count; i++) {
+				success = success && (memcmp(readIov[i].base, writeIov[i].base, readIov[i].length) == 0);
+			}
+
+			Benchmark_count(&bench, success);
+		}
+		Benchmark_end(&bench);
+	}
+
+	Benchmark_checkPart(model);
+}
+
+//! The same reads with DTR and with the SDR read the part falls back to, on the same bus clock
+static void Benchmark_dtr(const SimFlashModel *model)
+{
+	BenchmarkCase bench = { .part = model->name };
+	static const uint32_t sizes[] = { 256, 4096, 65536 };
+
+	if (!Benchmark_startNor(model)) {
+		fprintf(stderr, "%s: init failed\n", model->name);
+		return;
+	}
+
+	SimFlash_load(0, benchmarkPattern, BENCHMARK_MAX_READ);
+
+	for (uint32_t dtr = 0; dtr < 2u; dtr++) {
+		if (!W25q_setDtrRead(dtr != 0) || (W25q_getConfig()->read.ddr != (dtr != 0))) {
+			fprintf(stderr, "%s: DTR %u failed\n", model->name, dtr);
+			benchmarkFailures++;
+			continue;
+		}
+
+		for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+			uint32_t size = sizes[i];
+			uint32_t count = Benchmark_readCount(size);
+			uint32_t address = 0;
+
+			Benchmark_begin(&bench, dtr ? "read_dtr" : "read_sdr", size);
+			for (uint32_t n = 0; n < count; n++) {
+				Benchmark_count(&bench, W25q_readBytes(address, benchmarkBuffer, size) &&
+						(memcmp(benchmarkBuffer, benchmarkPattern + address, size) == 0));
+				address = (address + size) % BENCHMARK_MAX_READ;
+			}
+			Benchmark_end(&bench);
+		}
+
+		if (W25q_memoryMappedModeEnable()) {
+			const uint8_t *window = (const uint8_t *)QSPI_BASE;
+
+			for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+				uint32_t size = sizes[i];
+				uint32_t count = Benchmark_readCount(size);
+				uint32_t address = 0;
+
+				Benchmark_begin(&bench, dtr ? "mapped_dtr" : "mapped_sdr", size);
+				for (uint32_t n = 0; n < count; n++) {
+					SimQspi_mappedFetch(address, size);
+					memcpy(benchmarkBuffer, window + address, size);
+					Benchmark_count(&bench, true);
+					address = (address + size) % BENCHMARK_MAX_READ;
+				}
+				Benchmark_end(&bench);
+			}
+
+			W25q_memoryMappedModeDisable();
+		}
+	}
+
+	Benchmark_checkPart(model);
+}
+
+//! Cache line misses at random words, linear reads against the burst wrap that sends the missed word first
+static void Benchmark_wrap(const SimFlashModel *model)
+{
+	BenchmarkCase bench = { .part = model->name };
+	static const uint8_t wrapSizes[] = { 0, W25Q_WRAP_CACHE_LINE };
+	uint32_t count = benchmarkQuick ? 64u : 4096u;
+	uint32_t seed = benchmarkRandom;
+	uint8_t line[W25Q_WRAP_CACHE_LINE];
+
+	if (!Benchmark_startNor(model)) {
+		fprintf(stderr, "%s: init failed\n", model->name);
+		return;
+	}
+
+	SimFlash_load(0, benchmarkPattern, BENCHMARK_MAX_READ);
+
+	for (uint32_t i = 0; i < sizeof(wrapSizes) / sizeof(wrapSizes[0]); i++) {
+		bool wrap = (wrapSizes[i] != 0);
+
+		if (!W25q_setWrapRead(wrapSizes[i])) {
+			fprintf(stderr, "%s: wrap %u failed\n", model->name, wrapSizes[i]);
+			benchmarkFailures++;
+			continue;
+		}
+
+		// Both settings miss on the same words
+		benchmarkRandom = seed;
+		Benchmark_begin(&bench, wrap ? "miss_word_wrap" : "miss_word_linear", BENCHMARK_MISS_SIZE);
+		for (uint32_t n = 0; n < count; n++) {
+			uint32_t address = (Benchmark_random() % BENCHMARK_MAX_READ) & ~(BENCHMARK_MISS_SIZE - 1u);
+
+			Benchmark_count(&bench, W25q_readBytes(address, benchmarkBuffer, BENCHMARK_MISS_SIZE) &&
+					(memcmp(benchmarkBuffer, benchmarkPattern + address, BENCHMARK_MISS_SIZE) == 0));
+		}
+		Benchmark_end(&bench);
+
+		benchmarkRandom = seed;
+		Benchmark_begin(&bench, wrap ? "line_fill_wrap" : "line_fill_linear", sizeof(line));
+		for (uint32_t n = 0; n < count; n++) {
+			uint32_t address = (Benchmark_random() % BENCHMARK_MAX_READ) & ~(BENCHMARK_MISS_SIZE - 1u);
+			uint32_t base = address & ~(uint32_t)(sizeof(line) - 1u);
+			bool success = wrap ? W25q_readWrapped(address, line) : W25q_readBytes(base, line, sizeof(line));
+
+			Benchmark_count(&bench, success && (memcmp(line, benchmarkPattern + base, sizeof(line)) == 0));
+		}
+		Benchmark_end(&bench);
+
+		if (W25q_memoryMappedModeEnable()) {
+			const uint8_t *window = (const uint8_t *)QSPI_BASE;
+
+			benchmarkRandom = seed;
+			Benchmark_begin(&bench, wrap ? "mapped_miss_wrap" : "mapped_miss_linear", BENCHMARK_MISS_SIZE);
+			for (uint32_t n = 0; n < count; n++) {
+				uint32_t address = (Benchmark_random() % BENCHMARK_MAX_READ) & ~(BENCHMARK_MISS_SIZE - 1u);
+
+				SimQspi_mappedFetch(address, BENCHMARK_MISS_SIZE);
+				memcpy(benchmarkBuffer, window + address, BENCHMARK_MISS_SIZE);
+				Benchmark_count(&bench, true);
+			}
+			Benchmark_end(&bench);
+
+			W25q_memoryMappedModeDisable();
+		}
+	}
+
+	Benchmark_checkPart(model);
+}
+
+static void Benchmark_nand(const SimFlashModel *model)
+{
+	BenchmarkCase bench = { .part = model->name };
+	uint32_t blockSize = model->pageSize * model->pagesPerBlock;
+	static const uint32_t pageCounts[] = { 1, 4, 16, 64 };
+
+	SimQspi_reset();
+	SimFlash_attach(model);
+	memset(&benchmarkQspi, 0, sizeof(benchmarkQspi));
+
+	if (!QuadSpi_Init(&benchmarkQspi, BENCHMARK_NAND_FLASH_SIZE) || !W25n01g_init(&benchmarkQspi)) {
+		fprintf(stderr, "%s: init failed\n", model->name);
+		return;
+	}
+
+	uint32_t blocks = benchmarkQuick ? 2u : 16u;
+
+	Benchmark_begin(&bench, "erase_block", blockSize);
+	for (uint32_t n = 0; n < blocks; n++) {
+		Benchmark_count(&bench, W25n01g_blockErase(&benchmarkQspi, n * blockSize));
+	}
+	Benchmark_end(&bench);
+
+	for (uint32_t i = 0; i < sizeof(pageCounts) / sizeof(pageCounts[0]); i++) {
+		uint32_t size = pageCounts[i] * model->pageSize;
+		uint32_t count = benchmarkQuick ? 1u : 4u;
+
+		// Every run writes erased pages, a block is erased ahead when the next write reaches it
+		Benchmark_begin(&bench, "multi_page_write", size);
+		for (uint32_t n = 0; n < count; n++) {
+			uint32_t address = (64u + (i * 4u) + n) * blockSize;
+
+			Benchmark_count(&bench, w25n01g_writeFlash(&benchmarkQspi, address, benchmarkPattern, size));
+		}
+		Benchmark_end(&bench);
+
+		Benchmark_begin(&bench, "multi_page_read", size);
+		for (uint32_t n = 0; n < count; n++) {
+			uint32_t address = (64u + (i * 4u) + n) * blockSize;
+			bool success = true;
+
+			for (uint32_t offset = 0; success && (offset < size); ) {
+				uint32_t read = W25n01g_readBytes(&benchmarkQspi, address + offset, benchmarkBuffer + offset, size - offset, true);
+
+				success = (read > 0);
+				offset += read;
+			}
+
+			Benchmark_count(&bench, success);
+		}
+		Benchmark_end(&bench);
+	}
+
+	// Fragmented records gathered in the page buffer against a staged copy
+	static uint8_t staging[BENCHMARK_VECTOR_SIZE];
+	FlashIoVec writeIov[sizeof(benchmarkVectorFragments) / sizeof(benchmarkVectorFragments[0])];
+	FlashIoVec readIov[sizeof(writeIov) / sizeof(writeIov[0])];
+	uint32_t fragments = Benchmark_vector(writeIov, benchmarkPattern);
+	uint32_t records = benchmarkQuick ? 2u : 16u;
+
+	Benchmark_vector(readIov, benchmarkBuffer);
+
+	for (uint32_t vector = 0; vector < 2u; vector++) {
+		uint32_t base = (96u + vector) * blockSize;
+
+		W25n01g_blockErase(&benchmarkQspi, base);
+		W25n01g_waitForReady(&benchmarkQspi);
+
+		Benchmark_begin(&bench, vector ? "write_vector" : "write_staged", BENCHMARK_VECTOR_SIZE);
+		for (uint32_t n = 0; n < records; n++) {
+			uint32_t address = base + (n * BENCHMARK_VECTOR_SIZE);
+
+			if (vector) {
+				Benchmark_count(&bench, w25n01g_writeVector(&benchmarkQspi, address, writeIov, fragments));
+			} else {
+				bench.copied += Benchmark_gather(staging, writeIov, fragments);
+				Benchmark_count(&bench, w25n01g_writeFlash(&benchmarkQspi, address, staging, BENCHMARK_VECTOR_SIZE));
+			}
+		}
+		Benchmark_end(&bench);
+
+		Benchmark_begin(&bench, vector ? "read_vector" : "read_staged", BENCHMARK_VECTOR_SIZE);
+		for (uint32_t n = 0; n < records; n++) {
+			uint32_t address = base + (n * BENCHMARK_VECTOR_SIZE);
+			bool success = true;
+
+			if (vector) {
+				success = W25n01g_readVector(&benchmarkQspi, address, readIov, fragments);
+			} else {
+				for (uint32_t offset = 0; success && (offset < BENCHMARK_VECTOR_SIZE); ) {
+					uint32_t read = W25n01g_readBytes(&benchmarkQspi, address + offset, staging + offset, BENCHMARK_VECTOR_SIZE - offset, true);
+
+					success = (read > 0);
+					offset += read;
+				}
+				bench.copied += Benchmark_scatter(staging, readIov, fragments);
+			}
+
+			for (uint32_t i = 0; i < fragments; i++) {
+				success = success && (memcmp(readIov[i].base, writeIov[i].base, readIov[i].length) == 0);
+			}
+
+			Benchmark_count(&bench, success);
+		}
+		Benchmark_end(&bench);
+	}
+
+	Benchmark_checkPart(model);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *path = NULL;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--quick") == 0) {
+			benchmarkQuick = true;
+		} else {
+			path = argv[i];
+		}
+	}
+
+	benchmarkOut = (path != NULL) ? fopen(path, "w") : stdout;
+	benchmarkBuffer = malloc(BENCHMARK_MAX_READ);
+	benchmarkPattern = malloc(BENCHMARK_MAX_READ);
+
+	if ((benchmarkOut == NULL) || (benchmarkBuffer == NULL) || (benchmarkPattern == NULL)) {
+		fprintf(stderr, "cannot set up the benchmark\n");
+		return 1;
+	}
+
+	for (uint32_t i = 0; i < BENCHMARK_MAX_READ; i++) {
+		benchmarkPattern[i] = (uint8_t)Benchmark_random();
+	}
+
+	fprintf(benchmarkOut, "part,operation,size,count,failures,sim_us,mb_per_s,ops_per_s,bus_cycles,bus_us,cpu_us,hal_calls,transactions,critical_us,copied_bytes\n");
+
+	for (uint32_t i = 0; i < sizeof(benchmarkNorParts) / sizeof(benchmarkNorParts[0]); i++) {
+		Benchmark_nor(benchmarkNorParts[i]);
+	}
+	Benchmark_dtr(&SimFlash_w25q128jvIm);
+	Benchmark_vectorNor(&SimFlash_w25q128jvIm);
+	Benchmark_wrap(&SimFlash_w25q256jvIq);
+	for (uint32_t i = 0; i < sizeof(benchmarkNandParts) / sizeof(benchmarkNandParts[0]); i++) {
+		Benchmark_nand(benchmarkNandParts[i]);
+	}
+
+	if (benchmarkOut != stdout) {
+		fclose(benchmarkOut);
+	}
+
+	free(benchmarkBuffer);
+	free(benchmarkPattern);
+
+	return (benchmarkFailures == 0) ? 0 : 1;
+}
@@ -0,0 +1,120 @@
+/*
+ * This program is simulated W25Q/W25N flash device for host builds of the Winbond drivers.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SIMFLASH_H
+#define __SIMFLASH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "stm32h7xx_hal.h"
+
+#define SIM_FLASH_MAX_DIES			4
+#define SIM_FLASH_SFDP_SIZE			0x100u
+#define SIM_FLASH_SFDP_ADDRESS		0x80		//!< Basic parameter table
+#define SIM_FLASH_SFDP_DWORDS		16
+
+typedef enum {
+	SIM_FLASH_NOR,
+	SIM_FLASH_NAND,
+} SimFlashType;
+
+//! One part number, times are datasheet typicals and are also what the SFDP table reports
+typedef struct {
+	const char *name;
+	SimFlashType type;
+	uint8_t jedecId[3];
+	uint8_t dieCount;
+	uint8_t addressBytes;			//!< NOR, 4 adds the 4-byte opcodes and 0xB7/0xE9, the part powers up in 3-byte mode
+	bool dtr;						//!< NOR, answers the 0xED/0xEE DTR reads
+	uint32_t dieCapacity;			//!< Main array bytes per die
+	uint32_t pageSize;
+	uint32_t spareSize;				//!< NAND, bytes after each page
+	uint32_t pagesPerBlock;			//!< NAND
+	uint8_t status2;				//!< NOR status register 2 at power up
+	uint32_t pageProgramUs;
+	uint32_t sectorEraseUs;			//!< NOR 4KB, NAND block
+	uint32_t block32EraseUs;
+	uint32_t block64EraseUs;
+	uint32_t chipEraseMs;
+	uint32_t pageReadUs;			//!< NAND array to data buffer
+} SimFlashModel;
+
+extern const SimFlashModel SimFlash_w25q128jvIm;
+extern const SimFlashModel SimFlash_w25q256jvIq;
+extern const SimFlashModel SimFlash_w25q512jvIq;
+extern const SimFlashModel SimFlash_w25m512jv;
+extern const SimFlashModel SimFlash_w25n01gv;
+extern const SimFlashModel SimFlash_w25n02kv;
+extern const SimFlashModel SimFlash_w25m02gv;
+
+typedef struct {
+	uint32_t programs;				//!< NOR page programs, NAND program executes
+	uint32_t programmedBytes;
+	uint32_t erases;
+	uint32_t chipErases;
+	uint32_t pageReads;				//!< NAND array to buffer loads
+	uint32_t statusReads;
+	uint32_t busyStatusReads;		//!< Status reads answered with BUSY set, the wait itself rather than a round trip
+	uint32_t writeEnables;
+	uint32_t dieSelects;
+	uint32_t busyViolations;		//!< Commands other than status reads sent to a busy die, ignored like the real part does
+	uint32_t welViolations;			//!< Program/erase/status writes without WEL, ignored
+	uint32_t protocolErrors;		//!< Unknown opcodes, wrong address size or line modes, QE clear for a quad command
+	uint32_t dummyMismatches;		//!< Reads clocked with other dummy cycles than the part needs, the data arrives shifted
+	uint32_t programFailures;		//!< Injected P-FAIL/E-FAIL and bad block hits
+	uint32_t eraseFailures;
+} SimFlashStats;
+
+// The part on the simulated bus, replaces whatever was attached before. Power-up state, array erased
+bool SimFlash_attach(const SimFlashModel *model);
+void SimFlash_detach(void);
+const SimFlashModel *SimFlash_model(void);
+void SimFlash_powerCycle(void);						//!< Volatile state back to power-up, the array is kept
+
+// Bus side, driven by simqspi.c
+bool SimFlash_begin(const QSPI_CommandTypeDef *cmd);	//!< False for an unsupported command, the transfer still runs
+uint8_t SimFlash_readByte(uint32_t index);				//!< index counts from the first data byte, dummy cycles already applied
+void SimFlash_writeByte(uint8_t value);
+void SimFlash_end(bool aborted);						//!< Chip select high, programs and erases start here
+uint8_t SimFlash_peekStatus(const QSPI_CommandTypeDef *cmd);	//!< What a status read would return now, without side effects
+uint64_t SimFlash_readyAtNs(void);						//!< When the selected die finishes its operation
+const uint8_t *SimFlash_mappedArray(void);				//!< NOR array of the selected die, NULL for NAND
+uint32_t SimFlash_wrapLength(const QSPI_CommandTypeDef *cmd);	//!< Line a read command wraps inside on the selected die, 0 if linear
+
+// Test side, linear addresses run across the dies, NAND addresses cover the main array only
+bool SimFlash_load(uint32_t address, const uint8_t *data, uint32_t length);	//!< Stores bytes as if programmed on an erased part
+bool SimFlash_peek(uint32_t address, uint8_t *data, uint32_t length);
+bool SimFlash_peekSpare(uint32_t page, uint32_t column, uint8_t *data, uint32_t length);	//!< NAND page spare area
+bool SimFlash_loadPages(uint32_t page, const uint8_t *data, uint32_t count);	//!< NAND, pageSize + spareSize bytes per page as a programmer writes them
+void SimFlash_markBadBlock(uint32_t block);			//!< NAND factory marker, program and erase fail there
+void SimFlash_failErase(uint32_t address);			//!< Next erase of the unit holding address reports failure
+void SimFlash_injectEcc(uint8_t ecc);					//!< NAND ECC-1:0 the next page read reports, the ones after report 00
+void SimFlash_hangBusy(void);						//!< Selected die reports BUSY until a reset or power cycle
+uint32_t SimFlash_eraseCount(uint32_t address);		//!< Erases seen by the 4KB sector (NOR) or block (NAND)
+bool SimFlash_setSfdp(const uint8_t *image, uint32_t length);	//!< Replaces the model's SFDP space until the next attach, the rest reads 0xFF
+const uint8_t *SimFlash_sfdp(void);					//!< SIM_FLASH_SFDP_SIZE bytes as the part answers 0x5A
+uint8_t SimFlash_selectedDie(void);
+bool SimFlash_isBusy(uint8_t die);
+
+const SimFlashStats *SimFlash_getStats(void);
+void SimFlash_resetStats(void);
+
+#endif /* __SIMFLASH_H */
@@ -0,0 +1,99 @@
+/*
+ * This program is simulated QUADSPI peripheral and bus timing for host builds of the Winbond drivers.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SIMQSPI_H
+#define __SIMQSPI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "stm32h7xx_hal.h"
+
+#define SIM_QSPI_KERNEL_CLOCK_HZ		200000000u	//!< QUADSPI kernel clock, the bus runs at this / (prescaler + 1)
+#define SIM_QSPI_HAL_OVERHEAD_NS		300u		//!< CPU time of one HAL call, charged to simulated time
+#define SIM_QSPI_CACHE_LINE				32u
+#define SIM_QSPI_MAPPED_LINE			32u			//!< Memory-mapped fetches fill whole lines
+
+typedef struct {
+	uint64_t transactions;			//!< Chip select cycles, auto-polling reads included
+	uint64_t busCycles;				//!< Modeled QUADSPI clocks, chip select high time included
+	uint64_t busNs;					//!< busCycles at the clock they ran at
+	uint64_t dataBytes;
+	uint64_t autoPollReads;			//!< Status reads repeated by the controller
+	uint64_t halCalls;
+	uint64_t halBusy;				//!< Calls refused because a transfer or memory-mapped mode was active
+	uint64_t mappedFetches;
+	uint64_t mappedBytes;
+	uint64_t mappedOutOfWindow;		//!< Lines past what FlashSize and the mapped read's address size reach, the CPU would see other data
+	uint64_t mappedCriticalNs;		//!< Sum over line fills of the time until the byte the CPU missed on arrived
+	uint32_t interrupts;
+	uint32_t corruptedBytes;		//!< Received bytes damaged by the link model
+	uint32_t opcodes[256];			//!< Transactions by instruction
+} SimQspiStats;
+
+/*
+ * Sampling window of the read path. The part drives data tOutput after the falling edge, the
+ * controller samples half a clock later, or a full clock with sample shifting. Inside the margin
+ * of the edge roughly one transfer in eight picks up a bit error, closer than that every byte does.
+ */
+typedef struct {
+	uint32_t outputDelayPs;			//!< tCLQV plus board delay
+	uint32_t marginPs;
+	uint32_t seed;
+} SimQspiLink;
+
+typedef struct {
+	uint32_t maintenanceCalls;
+	uint32_t dirtyUnderDma;			//!< Dirty lines inside a DMA receive, an eviction would overwrite the data
+	uint32_t uncleanedTx;			//!< Dirty lines a DMA transmit read stale RAM behind
+	uint32_t staleReads;			//!< CPU reads of lines cached before a DMA receive and never invalidated
+	uint32_t discardedBytes;		//!< Dirty bytes outside the buffer lost to an invalidate
+} SimCacheStats;
+
+// Simulated time starts at zero and only moves with bus traffic, HAL_Delay and interrupts
+void SimQspi_reset(void);							//!< Time, statistics, pending interrupts, link and cache
+uint64_t SimQspi_nowNs(void);
+uint32_t SimQspi_nowUs(void);
+void SimQspi_advanceNs(uint64_t ns);
+uint32_t SimQspi_clock(void);						//!< 1 GHz free running counter for FlashStats_setClock/QuadSpiTrace_start
+uint32_t SimQspi_busClockHz(void);
+void SimQspi_setHalOverheadNs(uint32_t ns);
+
+const SimQspiStats *SimQspi_getStats(void);
+void SimQspi_resetStats(void);
+
+// Interrupt and DMA completions are queued with the time the transfer ends
+bool SimQspi_interruptPending(void);
+bool SimQspi_runInterrupt(void);					//!< Sleeps until the oldest completion and runs its callback, false if none or masked
+uint32_t SimQspi_runInterrupts(void);				//!< Until nothing is pending, returns the number run
+void SimQspi_setInterruptHook(void (*hook)(void));	//!< Called before each queued completion fires
+
+// Charge a CPU read through the memory-mapped window, sequential lines stream without a new command
+// unless the timeout counter releases chip select after each line
+void SimQspi_mappedFetch(uint32_t address, uint32_t length);
+
+void SimQspi_setLink(const SimQspiLink *link);		//!< NULL for an ideal link
+
+void SimCache_enable(bool enable);					//!< Sets SCB->CCR DC, the model starts empty
+void SimCache_cpuRead(const void *address, uint32_t length);
+void SimCache_cpuWrite(const void *address, uint32_t length);
+const SimCacheStats *SimCache_getStats(void);
+
+#endif /* __SIMQSPI_H */
@@ -0,0 +1,283 @@
+/*
+ * This program is simulated STM32H7 HAL subset for host builds of the Winbond drivers.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Only what the drivers use, with the register values of the real HAL. The QUADSPI calls,
+ * SysTick, the D-cache maintenance and PRIMASK are implemented by simqspi.c on top of the
+ * device model in simflash.c.
+ */
+
+#ifndef __STM32H7XX_HAL_H
+#define __STM32H7XX_HAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define __IO	volatile
+
+typedef enum {
+	HAL_OK			= 0x00,
+	HAL_ERROR		= 0x01,
+	HAL_BUSY		= 0x02,
+	HAL_TIMEOUT		= 0x03,
+} HAL_StatusTypeDef;
+
+typedef enum {
+	HAL_QSPI_STATE_RESET			= 0x00,
+	HAL_QSPI_STATE_READY			= 0x01,
+	HAL_QSPI_STATE_BUSY				= 0x02,
+	HAL_QSPI_STATE_BUSY_INDIRECT_TX	= 0x12,
+	HAL_QSPI_STATE_BUSY_INDIRECT_RX	= 0x22,
+	HAL_QSPI_STATE_BUSY_AUTO_POLLING	= 0x42,
+	HAL_QSPI_STATE_BUSY_MEM_MAPPED	= 0x82,
+	HAL_QSPI_STATE_ERROR			= 0x04,
+} HAL_QSPI_StateTypeDef;
+
+typedef struct {
+	__IO uint32_t CR;
+	__IO uint32_t DCR;
+	__IO uint32_t SR;
+	__IO uint32_t FCR;
+	__IO uint32_t DLR;
+	__IO uint32_t CCR;
+	__IO uint32_t AR;
+	__IO uint32_t ABR;
+	__IO uint32_t DR;
+	__IO uint32_t PSMKR;
+	__IO uint32_t PSMAR;
+	__IO uint32_t PIR;
+	__IO uint32_t LPTR;
+} QUADSPI_TypeDef;
+
+extern QUADSPI_TypeDef SimQspi_registers;
+#define QUADSPI		(&SimQspi_registers)
+
+typedef struct {
+	uint32_t ClockPrescaler;
+	uint32_t FifoThreshold;
+	uint32_t SampleShifting;
+	uint32_t FlashSize;
+	uint32_t ChipSelectHighTime;
+	uint32_t ClockMode;
+	uint32_t FlashID;
+	uint32_t DualFlash;
+} QSPI_InitTypeDef;
+
+typedef struct __QSPI_HandleTypeDef {
+	QUADSPI_TypeDef *Instance;
+	QSPI_InitTypeDef Init;
+	uint8_t *pTxBuffPtr;
+	__IO uint32_t TxXferSize;
+	__IO uint32_t TxXferCount;
+	uint8_t *pRxBuffPtr;
+	__IO uint32_t RxXferSize;
+	__IO uint32_t RxXferCount;
+	void *hmdma;						//!< Any non-NULL value enables the simulated MDMA channel
+	__IO HAL_QSPI_StateTypeDef State;
+	__IO uint32_t ErrorCode;
+	uint32_t Timeout;
+} QSPI_HandleTypeDef;
+
+typedef struct {
+	uint32_t Instruction;
+	uint32_t Address;
+	uint32_t AlternateBytes;
+	uint32_t AddressSize;
+	uint32_t AlternateBytesSize;
+	uint32_t DummyCycles;
+	uint32_t InstructionMode;
+	uint32_t AddressMode;
+	uint32_t AlternateByteMode;
+	uint32_t DataMode;
+	uint32_t NbData;
+	uint32_t DdrMode;
+	uint32_t DdrHoldHalfCycle;
+	uint32_t SIOOMode;
+} QSPI_CommandTypeDef;
+
+typedef struct {
+	uint32_t Match;
+	uint32_t Mask;
+	uint32_t Interval;
+	uint32_t StatusBytesSize;
+	uint32_t MatchMode;
+	uint32_t AutomaticStop;
+} QSPI_AutoPollingTypeDef;
+
+typedef struct {
+	uint32_t TimeOutActivation;
+	uint32_t TimeOutPeriod;
+} QSPI_MemoryMappedTypeDef;
+
+#define QSPI_SAMPLE_SHIFTING_NONE			0x00000000u
+#define QSPI_SAMPLE_SHIFTING_HALFCYCLE		0x00000010u
+
+#define QSPI_CS_HIGH_TIME_1_CYCLE			0x00000000u
+#define QSPI_CS_HIGH_TIME_2_CYCLE			0x00000100u
+#define QSPI_CS_HIGH_TIME_3_CYCLE			0x00000200u
+#define QSPI_CS_HIGH_TIME_4_CYCLE			0x00000300u
+
+#define QSPI_CLOCK_MODE_0					0x00000000u
+#define QSPI_CLOCK_MODE_3					0x00000001u
+#define QSPI_FLASH_ID_1						0x00000000u
+#define QSPI_FLASH_ID_2						0x00000080u
+#define QSPI_DUALFLASH_DISABLE				0x00000000u
+#define QSPI_DUALFLASH_ENABLE				0x00000040u
+
+#define QSPI_INSTRUCTION_NONE				0x00000000u
+#define QSPI_INSTRUCTION_1_LINE				0x00000100u
+#define QSPI_INSTRUCTION_2_LINES			0x00000200u
+#define QSPI_INSTRUCTION_4_LINES			0x00000300u
+
+#define QSPI_ADDRESS_NONE					0x00000000u
+#define QSPI_ADDRESS_1_LINE					0x00000400u
+#define QSPI_ADDRESS_2_LINES				0x00000800u
+#define QSPI_ADDRESS_4_LINES				0x00000C00u
+
+#define QSPI_ADDRESS_8_BITS					0x00000000u
+#define QSPI_ADDRESS_16_BITS				0x00001000u
+#define QSPI_ADDRESS_24_BITS				0x00002000u
+#define QSPI_ADDRESS_32_BITS				0x00003000u
+
+#define QSPI_ALTERNATE_BYTES_NONE			0x00000000u
+#define QSPI_ALTERNATE_BYTES_1_LINE			0x00004000u
+#define QSPI_ALTERNATE_BYTES_2_LINES		0x00008000u
+#define QSPI_ALTERNATE_BYTES_4_LINES		0x0000C000u
+
+#define QSPI_ALTERNATE_BYTES_8_BITS			0x00000000u
+#define QSPI_ALTERNATE_BYTES_16_BITS		0x00010000u
+#define QSPI_ALTERNATE_BYTES_24_BITS		0x00020000u
+#define QSPI_ALTERNATE_BYTES_32_BITS		0x00030000u
+
+#define QSPI_DATA_NONE						0x00000000u
+#define QSPI_DATA_1_LINE					0x01000000u
+#define QSPI_DATA_2_LINES					0x02000000u
+#define QSPI_DATA_4_LINES					0x03000000u
+
+#define QSPI_DDR_MODE_DISABLE				0x00000000u
+#define QSPI_DDR_MODE_ENABLE				0x80000000u
+#define QSPI_DDR_HHC_ANALOG_DELAY			0x00000000u
+#define QSPI_DDR_HHC_HALF_CLK_DELAY			0x40000000u
+#define QSPI_SIOO_INST_EVERY_CMD			0x00000000u
+#define QSPI_SIOO_INST_ONLY_FIRST_CMD		0x10000000u
+
+#define QSPI_TIMEOUT_COUNTER_DISABLE		0x00000000u
+#define QSPI_TIMEOUT_COUNTER_ENABLE			0x00000008u
+
+#define QSPI_MATCH_MODE_AND					0x00000000u
+#define QSPI_MATCH_MODE_OR					0x00400000u
+#define QSPI_AUTOMATIC_STOP_DISABLE			0x00000000u
+#define QSPI_AUTOMATIC_STOP_ENABLE			0x00400000u
+
+#define QSPI_FLAG_BUSY						0x00000020u
+#define QSPI_FLAG_TO						0x00000010u
+#define QSPI_FLAG_SM						0x00000008u
+#define QSPI_FLAG_FT						0x00000004u
+#define QSPI_FLAG_TC						0x00000002u
+#define QSPI_FLAG_TE						0x00000001u
+
+#define QUADSPI_CCR_IMODE					0x00000300u
+#define QUADSPI_CCR_ADMODE					0x00000C00u
+#define QUADSPI_CCR_ADSIZE					0x00003000u
+#define QUADSPI_CCR_ABMODE					0x0000C000u
+#define QUADSPI_CCR_DMODE					0x03000000u
+#define QUADSPI_CCR_FMODE					0x0C000000u
+#define QUADSPI_CCR_FMODE_0					0x04000000u
+#define QUADSPI_CCR_FMODE_1					0x08000000u
+#define QUADSPI_SR_FLEVEL					0x00003F00u
+#define QUADSPI_SR_FLEVEL_Pos				8u
+
+#define HAL_QSPI_ERROR_NONE					0x00000000u
+#define HAL_QSPI_ERROR_TIMEOUT				0x00000001u
+#define HAL_QSPI_ERROR_TRANSFER				0x00000002u
+
+#define READ_REG(reg)						((reg))
+#define WRITE_REG(reg, value)				((reg) = (value))
+#define SET_BIT(reg, bit)					((reg) |= (bit))
+#define CLEAR_BIT(reg, bit)					((reg) &= ~(bit))
+#define MODIFY_REG(reg, clear, set)			WRITE_REG((reg), (((READ_REG(reg)) & (~(clear))) | (set)))
+
+// FIFO flags are where the simulated peripheral moves bytes between the data register and the device
+bool SimQspi_getFlag(QSPI_HandleTypeDef *hqspi, uint32_t flag);
+void SimQspi_clearFlag(QSPI_HandleTypeDef *hqspi, uint32_t flag);
+#define __HAL_QSPI_GET_FLAG(handle, flag)	SimQspi_getFlag((handle), (flag))
+#define __HAL_QSPI_CLEAR_FLAG(handle, flag)	SimQspi_clearFlag((handle), (flag))
+
+// Memory-mapped window, backed by the selected die of the simulated part
+const uint8_t *SimQspi_mappedBase(void);
+#define QSPI_BASE		((uintptr_t)SimQspi_mappedBase())
+#define FLASH_SIZE		0x200000u		//!< Internal flash, 2MB
+
+HAL_StatusTypeDef HAL_QSPI_Init(QSPI_HandleTypeDef *hqspi);
+HAL_StatusTypeDef HAL_QSPI_DeInit(QSPI_HandleTypeDef *hqspi);
+HAL_StatusTypeDef HAL_QSPI_Command(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd, uint32_t Timeout);
+HAL_StatusTypeDef HAL_QSPI_Command_IT(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd);
+HAL_StatusTypeDef HAL_QSPI_Transmit(QSPI_HandleTypeDef *hqspi, uint8_t *pData, uint32_t Timeout);
+HAL_StatusTypeDef HAL_QSPI_Receive(QSPI_HandleTypeDef *hqspi, uint8_t *pData, uint32_t Timeout);
+HAL_StatusTypeDef HAL_QSPI_Transmit_IT(QSPI_HandleTypeDef *hqspi, uint8_t *pData);
+HAL_StatusTypeDef HAL_QSPI_Receive_IT(QSPI_HandleTypeDef *hqspi, uint8_t *pData);
+HAL_StatusTypeDef HAL_QSPI_Transmit_DMA(QSPI_HandleTypeDef *hqspi, uint8_t *pData);
+HAL_StatusTypeDef HAL_QSPI_Receive_DMA(QSPI_HandleTypeDef *hqspi, uint8_t *pData);
+HAL_StatusTypeDef HAL_QSPI_AutoPolling(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd, QSPI_AutoPollingTypeDef *cfg, uint32_t Timeout);
+HAL_StatusTypeDef HAL_QSPI_AutoPolling_IT(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd, QSPI_AutoPollingTypeDef *cfg);
+HAL_StatusTypeDef HAL_QSPI_MemoryMapped(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd, QSPI_MemoryMappedTypeDef *cfg);
+HAL_StatusTypeDef HAL_QSPI_Abort(QSPI_HandleTypeDef *hqspi);
+HAL_StatusTypeDef HAL_QSPI_Abort_IT(QSPI_HandleTypeDef *hqspi);
+HAL_QSPI_StateTypeDef HAL_QSPI_GetState(QSPI_HandleTypeDef *hqspi);
+uint32_t HAL_QSPI_GetError(QSPI_HandleTypeDef *hqspi);
+void HAL_QSPI_SetTimeout(QSPI_HandleTypeDef *hqspi, uint32_t Timeout);
+
+void HAL_QSPI_RxCpltCallback(QSPI_HandleTypeDef *hqspi);
+void HAL_QSPI_TxCpltCallback(QSPI_HandleTypeDef *hqspi);
+void HAL_QSPI_CmdCpltCallback(QSPI_HandleTypeDef *hqspi);
+void HAL_QSPI_StatusMatchCallback(QSPI_HandleTypeDef *hqspi);
+void HAL_QSPI_TimeOutCallback(QSPI_HandleTypeDef *hqspi);
+void HAL_QSPI_ErrorCallback(QSPI_HandleTypeDef *hqspi);
+
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t Delay);
+
+// Cortex-M7 core, the D-cache calls feed the coherence model in simqspi.c
+#define __DCACHE_PRESENT		1U
+#define __SCB_DCACHE_LINE_SIZE	32U
+
+typedef struct {
+	__IO uint32_t CCR;
+} SCB_Type;
+
+extern SCB_Type SimQspi_scb;
+#define SCB				(&SimQspi_scb)
+#define SCB_CCR_DC_Msk	(1UL << 16)
+#define SCB_CCR_IC_Msk	(1UL << 17)
+
+void SCB_CleanDCache_by_Addr(void *addr, int32_t dsize);
+void SCB_InvalidateDCache_by_Addr(void *addr, int32_t dsize);
+void SCB_CleanInvalidateDCache_by_Addr(void *addr, int32_t dsize);
+void SCB_InvalidateICache(void);
+
+uint32_t __get_PRIMASK(void);
+void __disable_irq(void);
+void __enable_irq(void);
+
+#define __ALIGNED(x)	__attribute__((aligned(x)))
+#define __weak			__attribute__((weak))
+
+#endif /* __STM32H7XX_HAL_H */
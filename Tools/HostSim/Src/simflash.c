@@ -0,0 +1,1249 @@
+/*
+ * This program is simulated W25Q/W25N flash device for host builds of the Winbond drivers.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "simflash.h"
+#include "simqspi.h"
+
+#define SIM_FLASH_NOR_SECTOR		4096u
+#define SIM_FLASH_NOR_RESET_US		30u
+
+// NOR status bits, NAND status register C0 uses the same BUSY/WEL positions
+#define SIM_FLASH_BUSY				(1u << 0)
+#define SIM_FLASH_WEL				(1u << 1)
+#define SIM_FLASH_SR2_QE			(1u << 1)
+#define SIM_FLASH_SR3_ADS			(1u << 0)
+#define SIM_FLASH_SR3_ADP			(1u << 1)
+#define SIM_FLASH_NAND_E_FAIL		(1u << 2)
+#define SIM_FLASH_NAND_P_FAIL		(1u << 3)
+#define SIM_FLASH_NAND_ECC_POS		4
+#define SIM_FLASH_NAND_ECC			(3u << SIM_FLASH_NAND_ECC_POS)
+#define SIM_FLASH_NAND_BUF			(1u << 3)	//!< Configuration register, buffer read mode
+#define SIM_FLASH_NAND_PROT			0xA0
+#define SIM_FLASH_NAND_CONF			0xB0
+#define SIM_FLASH_NAND_STAT			0xC0
+
+const SimFlashModel SimFlash_w25q128jvIm = {
+	"W25Q128JV-IM", SIM_FLASH_NOR, { 0xEF, 0x70, 0x18 }, 1, 3, true,
+	16u << 20, 256, 0, 0, SIM_FLASH_SR2_QE, 400, 45000, 120000, 150000, 40000, 0
+};
+
+const SimFlashModel SimFlash_w25q256jvIq = {
+	"W25Q256JV-IQ", SIM_FLASH_NOR, { 0xEF, 0x40, 0x19 }, 1, 4, false,
+	32u << 20, 256, 0, 0, SIM_FLASH_SR2_QE, 400, 45000, 120000, 150000, 80000, 0
+};
+
+const SimFlashModel SimFlash_w25q512jvIq = {
+	"W25Q512JV-IQ", SIM_FLASH_NOR, { 0xEF, 0x40, 0x20 }, 1, 4, false,
+	64u << 20, 256, 0, 0, SIM_FLASH_SR2_QE, 400, 45000, 120000, 150000, 150000, 0
+};
+
+const SimFlashModel SimFlash_w25m512jv = {
+	"W25M512JV-IQ", SIM_FLASH_NOR, { 0xEF, 0x71, 0x19 }, 2, 4, false,
+	32u << 20, 256, 0, 0, SIM_FLASH_SR2_QE, 400, 45000, 120000, 150000, 80000, 0
+};
+
+const SimFlashModel SimFlash_w25n01gv = {
+	"W25N01GV", SIM_FLASH_NAND, { 0xEF, 0xAA, 0x21 }, 1, 2, false,
+	128u << 20, 2048, 64, 64, 0, 250, 2000, 0, 0, 0, 60
+};
+
+const SimFlashModel SimFlash_w25n02kv = {
+	"W25N02KV", SIM_FLASH_NAND, { 0xEF, 0xAA, 0x22 }, 1, 2, false,
+	256u << 20, 2048, 128, 64, 0, 250, 2000, 0, 0, 0, 60
+};
+
+const SimFlashModel SimFlash_w25m02gv = {
+	"W25M02GV", SIM_FLASH_NAND, { 0xEF, 0xAB, 0x21 }, 2, 2, false,
+	128u << 20, 2048, 64, 64, 0, 250, 2000, 0, 0, 0, 60
+};
+
+typedef enum {
+	SIM_OP_READ_ARRAY,		//!< NOR array, wraps inside the burst line for quad I/O reads
+	SIM_OP_READ_BUFFER,		//!< NAND data buffer from the column
+	SIM_OP_READ_STATUS,
+	SIM_OP_READ_ID,
+	SIM_OP_READ_SFDP,
+	SIM_OP_PROGRAM,			//!< NOR page program
+	SIM_OP_LOAD,			//!< NAND program data load, clears the buffer first
+	SIM_OP_LOAD_RANDOM,
+	SIM_OP_EXECUTE,
+	SIM_OP_PAGE_READ,
+	SIM_OP_ERASE,
+	SIM_OP_CHIP_ERASE,
+	SIM_OP_WRITE_STATUS,
+	SIM_OP_WRITE_ENABLE,
+	SIM_OP_WRITE_DISABLE,
+	SIM_OP_WRAP,
+	SIM_OP_ENTER_4B,
+	SIM_OP_EXIT_4B,
+	SIM_OP_DIE_SELECT,
+	SIM_OP_RESET_ENABLE,
+	SIM_OP_RESET,
+	SIM_OP_NOP,
+} SimFlashOp;
+
+typedef enum {
+	SIM_ADDR_NONE,
+	SIM_ADDR_8,
+	SIM_ADDR_16,
+	SIM_ADDR_24,
+	SIM_ADDR_ARRAY,			//!< 24 or 32 bits depending on the die address mode
+	SIM_ADDR_32,
+} SimFlashAddr;
+
+typedef struct {
+	uint8_t opcode;
+	SimFlashOp op;
+	SimFlashAddr address;
+	uint8_t addressLines;
+	uint8_t dataLines;		//!< 0 for no data phase
+	uint8_t dummyCycles;
+	uint8_t flags;
+	uint32_t unit;			//!< Erase size, wrap-capable reads
+} SimFlashCommand;
+
+#define SIM_CMD_QUAD			(1u << 0)	//!< Needs QE on NOR
+#define SIM_CMD_4B				(1u << 1)	//!< Only on parts with 4-byte addressing
+#define SIM_CMD_WRAP			(1u << 2)	//!< Follows Set Burst with Wrap
+#define SIM_CMD_DTR				(1u << 3)
+#define SIM_CMD_BUSY_OK			(1u << 4)	//!< Accepted while the die is busy
+
+static const SimFlashCommand simFlashNorCommands[] = {
+	{ 0x03, SIM_OP_READ_ARRAY,		SIM_ADDR_ARRAY,	1, 1, 0, 0, 0 },
+	{ 0x0B, SIM_OP_READ_ARRAY,		SIM_ADDR_ARRAY,	1, 1, 8, 0, 0 },
+	{ 0x6B, SIM_OP_READ_ARRAY,		SIM_ADDR_ARRAY,	1, 4, 8, SIM_CMD_QUAD, 0 },
+	{ 0xEB, SIM_OP_READ_ARRAY,		SIM_ADDR_ARRAY,	4, 4, 6, SIM_CMD_QUAD | SIM_CMD_WRAP, 0 },
+	{ 0xED, SIM_OP_READ_ARRAY,		SIM_ADDR_ARRAY,	4, 4, 8, SIM_CMD_QUAD | SIM_CMD_DTR, 0 },
+	{ 0x0C, SIM_OP_READ_ARRAY,		SIM_ADDR_32,	1, 1, 8, SIM_CMD_4B, 0 },
+	{ 0x6C, SIM_OP_READ_ARRAY,		SIM_ADDR_32,	1, 4, 8, SIM_CMD_4B | SIM_CMD_QUAD, 0 },
+	{ 0xEC, SIM_OP_READ_ARRAY,		SIM_ADDR_32,	4, 4, 6, SIM_CMD_4B | SIM_CMD_QUAD | SIM_CMD_WRAP, 0 },
+	{ 0xEE, SIM_OP_READ_ARRAY,		SIM_ADDR_32,	4, 4, 8, SIM_CMD_4B | SIM_CMD_QUAD | SIM_CMD_DTR, 0 },
+	{ 0x02, SIM_OP_PROGRAM,			SIM_ADDR_ARRAY,	1, 1, 0, 0, 0 },
+	{ 0x32, SIM_OP_PROGRAM,			SIM_ADDR_ARRAY,	1, 4, 0, SIM_CMD_QUAD, 0 },
+	{ 0x12, SIM_OP_PROGRAM,			SIM_ADDR_32,	1, 1, 0, SIM_CMD_4B, 0 },
+	{ 0x34, SIM_OP_PROGRAM,			SIM_ADDR_32,	1, 4, 0, SIM_CMD_4B | SIM_CMD_QUAD, 0 },
+	{ 0x20, SIM_OP_ERASE,			SIM_ADDR_ARRAY,	1, 0, 0, 0, 4096 },
+	{ 0x21, SIM_OP_ERASE,			SIM_ADDR_32,	1, 0, 0, SIM_CMD_4B, 4096 },
+	{ 0x52, SIM_OP_ERASE,			SIM_ADDR_ARRAY,	1, 0, 0, 0, 32768 },
+	{ 0xD8, SIM_OP_ERASE,			SIM_ADDR_ARRAY,	1, 0, 0, 0, 65536 },
+	{ 0xDC, SIM_OP_ERASE,			SIM_ADDR_32,	1, 0, 0, SIM_CMD_4B, 65536 },
+	{ 0xC7, SIM_OP_CHIP_ERASE,		SIM_ADDR_NONE,	0, 0, 0, 0, 0 },
+	{ 0x60, SIM_OP_CHIP_ERASE,		SIM_ADDR_NONE,	0, 0, 0, 0, 0 },
+	{ 0x05, SIM_OP_READ_STATUS,		SIM_ADDR_NONE,	0, 1, 0, SIM_CMD_BUSY_OK, 0 },
+	{ 0x35, SIM_OP_READ_STATUS,		SIM_ADDR_NONE,	0, 1, 0, SIM_CMD_BUSY_OK, 1 },
+	{ 0x15, SIM_OP_READ_STATUS,		SIM_ADDR_NONE,	0, 1, 0, SIM_CMD_BUSY_OK, 2 },
+	{ 0x01, SIM_OP_WRITE_STATUS,	SIM_ADDR_NONE,	0, 1, 0, 0, 0 },
+	{ 0x31, SIM_OP_WRITE_STATUS,	SIM_ADDR_NONE,	0, 1, 0, 0, 1 },
+	{ 0x11, SIM_OP_WRITE_STATUS,	SIM_ADDR_NONE,	0, 1, 0, 0, 2 },
+	{ 0x06, SIM_OP_WRITE_ENABLE,	SIM_ADDR_NONE,	0, 0, 0, 0, 0 },
+	{ 0x04, SIM_OP_WRITE_DISABLE,	SIM_ADDR_NONE,	0, 0, 0, 0, 0 },
+	{ 0x9F, SIM_OP_READ_ID,			SIM_ADDR_NONE,	0, 1, 0, 0, 0 },
+	{ 0x5A, SIM_OP_READ_SFDP,		SIM_ADDR_24,	1, 1, 8, 0, 0 },
+	{ 0x77, SIM_OP_WRAP,			SIM_ADDR_NONE,	0, 4, 0, SIM_CMD_QUAD, 0 },
+	{ 0xB7, SIM_OP_ENTER_4B,		SIM_ADDR_NONE,	0, 0, 0, SIM_CMD_4B, 0 },
+	{ 0xE9, SIM_OP_EXIT_4B,			SIM_ADDR_NONE,	0, 0, 0, SIM_CMD_4B, 0 },
+	{ 0xC2, SIM_OP_DIE_SELECT,		SIM_ADDR_NONE,	0, 1, 0, SIM_CMD_BUSY_OK, 0 },
+	{ 0x66, SIM_OP_RESET_ENABLE,	SIM_ADDR_NONE,	0, 0, 0, SIM_CMD_BUSY_OK, 0 },
+	{ 0x99, SIM_OP_RESET,			SIM_ADDR_NONE,	0, 0, 0, SIM_CMD_BUSY_OK, 0 },
+	{ 0xFF, SIM_OP_NOP,				SIM_ADDR_NONE,	0, 0, 0, 0, 0 },
+};
+
+static const SimFlashCommand simFlashNandCommands[] = {
+	{ 0x9F, SIM_OP_READ_ID,			SIM_ADDR_NONE,	0, 1, 8, 0, 0 },
+	{ 0x05, SIM_OP_READ_STATUS,		SIM_ADDR_8,		1, 1, 0, SIM_CMD_BUSY_OK, 0 },
+	{ 0x0F, SIM_OP_READ_STATUS,		SIM_ADDR_8,		1, 1, 0, SIM_CMD_BUSY_OK, 0 },
+	{ 0x01, SIM_OP_WRITE_STATUS,	SIM_ADDR_8,		1, 1, 0, 0, 0 },
+	{ 0x1F, SIM_OP_WRITE_STATUS,	SIM_ADDR_8,		1, 1, 0, 0, 0 },
+	{ 0x06, SIM_OP_WRITE_ENABLE,	SIM_ADDR_NONE,	0, 0, 0, 0, 0 },
+	{ 0x04, SIM_OP_WRITE_DISABLE,	SIM_ADDR_NONE,	0, 0, 0, 0, 0 },
+	{ 0xD8, SIM_OP_ERASE,			SIM_ADDR_24,	1, 0, 0, 0, 0 },
+	{ 0x02, SIM_OP_LOAD,			SIM_ADDR_16,	1, 1, 0, 0, 0 },
+	{ 0x32, SIM_OP_LOAD,			SIM_ADDR_16,	1, 4, 0, 0, 0 },
+	{ 0x84, SIM_OP_LOAD_RANDOM,		SIM_ADDR_16,	1, 1, 0, 0, 0 },
+	{ 0x34, SIM_OP_LOAD_RANDOM,		SIM_ADDR_16,	1, 4, 0, 0, 0 },
+	{ 0x10, SIM_OP_EXECUTE,			SIM_ADDR_24,	1, 0, 0, 0, 0 },
+	{ 0x13, SIM_OP_PAGE_READ,		SIM_ADDR_24,	1, 0, 0, 0, 0 },
+	{ 0x03, SIM_OP_READ_BUFFER,		SIM_ADDR_16,	1, 1, 8, 0, 0 },
+	{ 0x0B, SIM_OP_READ_BUFFER,		SIM_ADDR_16,	1, 1, 8, 0, 0 },
+	{ 0x6B, SIM_OP_READ_BUFFER,		SIM_ADDR_16,	1, 4, 8, 0, 0 },
+	{ 0xEB, SIM_OP_READ_BUFFER,		SIM_ADDR_16,	4, 4, 4, 0, 0 },
+	{ 0xC2, SIM_OP_DIE_SELECT,		SIM_ADDR_NONE,	0, 1, 0, SIM_CMD_BUSY_OK, 0 },
+	{ 0xFF, SIM_OP_RESET,			SIM_ADDR_NONE,	0, 0, 0, SIM_CMD_BUSY_OK, 0 },
+};
+
+typedef struct {
+	uint8_t *array;				//!< NOR main array
+	uint8_t **pages;			//!< NAND pages with spare, allocated on first program
+	uint8_t *buffer;			//!< NAND data buffer
+	uint32_t *eraseCounts;
+	uint8_t *eraseFail;
+	uint8_t *badBlocks;
+	uint64_t busyUntil;
+	bool busy;
+	bool wel;
+	bool fourByte;
+	uint8_t status[3];			//!< NOR SR1-SR3 without BUSY/WEL/ADS, NAND A0/B0/C0
+	uint8_t wrap;
+	uint32_t bufferPage;
+} SimFlashDie;
+
+typedef struct {
+	const SimFlashCommand *command;
+	bool active;
+	bool ignored;
+	uint32_t address;
+	uint32_t addressMask;
+	int32_t shiftBits;			//!< Dummy cycle mismatch, positive when the host samples late
+	uint32_t count;
+	uint8_t latch[256];			//!< NOR page program data, NAND register writes
+	uint8_t value[3];
+} SimFlashTransfer;
+
+static const SimFlashModel *simFlashModel = NULL;
+static SimFlashDie simFlashDies[SIM_FLASH_MAX_DIES];
+static uint8_t simFlashSelected = 0;
+static bool simFlashResetEnabled = false;
+static SimFlashTransfer simFlashXfer;
+static SimFlashStats simFlashStats;
+static uint8_t simFlashSfdp[SIM_FLASH_SFDP_SIZE];
+static uint8_t simFlashEcc = 0;
+
+static uint32_t SimFlash_pagesPerDie(void)
+{
+	return simFlashModel->dieCapacity / simFlashModel->pageSize;
+}
+
+static uint32_t SimFlash_pageBytes(void)
+{
+	return simFlashModel->pageSize + simFlashModel->spareSize;
+}
+
+static uint32_t SimFlash_eraseUnits(void)
+{
+	if (simFlashModel->type == SIM_FLASH_NAND) {
+		return SimFlash_pagesPerDie() / simFlashModel->pagesPerBlock;
+	}
+
+	return simFlashModel->dieCapacity / SIM_FLASH_NOR_SECTOR;
+}
+
+static uint32_t SimFlash_log2(uint32_t value)
+{
+	uint32_t shift = 0;
+
+	while ((value >> shift) > 1u) {
+		shift++;
+	}
+
+	return shift;
+}
+
+static uint32_t SimFlash_timeField(uint32_t value, const uint32_t *units, uint32_t unitCount)
+{
+	uint32_t unit = 0;
+
+	// Smallest unit whose 5-bit count still reaches the value, rounded up like a datasheet typical
+	while ((unit + 1u < unitCount) && (((value + units[unit] - 1u) / units[unit]) > 32u)) {
+		unit++;
+	}
+
+	uint32_t count = (value + units[unit] - 1u) / units[unit];
+	if (count == 0) {
+		count = 1;
+	}
+
+	return (count - 1u) | (unit << 5);
+}
+
+static void SimFlash_put32(uint8_t *out, uint32_t value)
+{
+	out[0] = (uint8_t)value;
+	out[1] = (uint8_t)(value >> 8);
+	out[2] = (uint8_t)(value >> 16);
+	out[3] = (uint8_t)(value >> 24);
+}
+
+//! JESD216B basic parameter table matching the model, the timing DWORDs come from the typicals
+static void SimFlash_buildSfdp(void)
+{
+	static const uint32_t eraseUnits[] = { 1, 16, 128, 1000 };
+	static const uint32_t chipUnits[] = { 16, 256, 4000, 64000 };
+	static const uint32_t programUnits[] = { 8, 64 };
+	static const uint8_t header[16] = { 'S', 'F', 'D', 'P', 0x06, 0x01, 0x00, 0xFF, 0x00, 0x06, 0x01, SIM_FLASH_SFDP_DWORDS, SIM_FLASH_SFDP_ADDRESS, 0x00, 0x00, 0xFF };
+	const SimFlashModel *m = simFlashModel;
+	uint32_t dwords[SIM_FLASH_SFDP_DWORDS];
+	uint32_t addressBytes = (m->addressBytes > 3) ? 1u : 0u;
+
+	memset(simFlashSfdp, 0xFF, sizeof(simFlashSfdp));
+	memcpy(simFlashSfdp, header, sizeof(header));
+
+	dwords[0] = 0xFF800000u | (1u << 22) | (1u << 21) | (1u << 20) | ((m->dtr ? 1u : 0u) << 19) | (addressBytes << 17) | (1u << 16) | 0x20E5u;
+	dwords[1] = (m->dieCapacity * 8u) - 1u;
+	dwords[2] = 0x6B08EB44u;
+	dwords[3] = 0xBB423B08u;
+	dwords[4] = 0xFFFFFFEEu;
+	dwords[5] = 0x0000FFFFu;
+	dwords[6] = 0x0000FFFFu;
+	dwords[7] = 0x520F200Cu;
+	dwords[8] = 0x0000D810u;
+
+	// Maximum is 2 * (3 + 1) = 8 times the typical for erase and program
+	dwords[9] = 3u |
+			(SimFlash_timeField(m->sectorEraseUs / 1000u, eraseUnits, 4) << 4) |
+			(SimFlash_timeField(m->block32EraseUs / 1000u, eraseUnits, 4) << 11) |
+			(SimFlash_timeField(m->block64EraseUs / 1000u, eraseUnits, 4) << 18);
+	dwords[10] = 3u | (SimFlash_log2(m->pageSize) << 4) |
+			(SimFlash_timeField(m->pageProgramUs, programUnits, 2) << 8) |
+			(SimFlash_timeField(m->chipEraseMs, chipUnits, 4) << 24);
+	dwords[11] = 0x337663E9u;
+	dwords[12] = 0x757A757Au;
+	dwords[13] = 0x5CD5A2F7u;
+	dwords[14] = 0xFF4DF719u;
+	dwords[15] = 0x80F830E9u;
+
+	for (uint32_t i = 0; i < SIM_FLASH_SFDP_DWORDS; i++) {
+		SimFlash_put32(&simFlashSfdp[SIM_FLASH_SFDP_ADDRESS + (i * 4u)], dwords[i]);
+	}
+}
+
+static void SimFlash_freeDie(SimFlashDie *die)
+{
+	if (die->pages != NULL) {
+		for (uint32_t i = 0; i < SimFlash_pagesPerDie(); i++) {
+			free(die->pages[i]);
+		}
+	}
+
+	free(die->array);
+	free(die->pages);
+	free(die->buffer);
+	free(die->eraseCounts);
+	free(die->eraseFail);
+	free(die->badBlocks);
+	memset(die, 0, sizeof(*die));
+}
+
+void SimFlash_detach(void)
+{
+	if (simFlashModel != NULL) {
+		for (uint32_t i = 0; i < simFlashModel->dieCount; i++) {
+			SimFlash_freeDie(&simFlashDies[i]);
+		}
+	}
+
+	simFlashModel = NULL;
+	simFlashEcc = 0;
+}
+
+bool SimFlash_attach(const SimFlashModel *model)
+{
+	bool success = (model != NULL) && (model->dieCount > 0) && (model->dieCount <= SIM_FLASH_MAX_DIES);
+
+	SimFlash_detach();
+
+	if (!success) {
+		return false;
+	}
+
+	simFlashModel = model;
+
+	for (uint32_t i = 0; success && (i < model->dieCount); i++) {
+		SimFlashDie *die = &simFlashDies[i];
+		uint32_t units = SimFlash_eraseUnits();
+
+		die->eraseCounts = calloc(units, sizeof(uint32_t));
+		die->eraseFail = calloc(units, 1);
+		success = (die->eraseCounts != NULL) && (die->eraseFail != NULL);
+
+		if (success && (model->type == SIM_FLASH_NOR)) {
+			die->array = malloc(model->dieCapacity);
+			success = (die->array != NULL);
+			if (success) {
+				memset(die->array, 0xFF, model->dieCapacity);
+			}
+		} else if (success) {
+			die->pages = calloc(SimFlash_pagesPerDie(), sizeof(uint8_t *));
+			die->buffer = malloc(SimFlash_pageBytes());
+			die->badBlocks = calloc(units, 1);
+			success = (die->pages != NULL) && (die->buffer != NULL) && (die->badBlocks != NULL);
+		}
+
+		if (success) {
+			die->status[1] = model->status2;
+		}
+	}
+
+	if (!success) {
+		SimFlash_detach();
+		return false;
+	}
+
+	if (model->type == SIM_FLASH_NOR) {
+		SimFlash_buildSfdp();
+	}
+
+	SimFlash_powerCycle();
+	SimFlash_resetStats();
+
+	return true;
+}
+
+const SimFlashModel *SimFlash_model(void)
+{
+	return simFlashModel;
+}
+
+//! Page contents of a NAND page, NULL while it is still erased
+static const uint8_t *SimFlash_nandPage(SimFlashDie *die, uint32_t page)
+{
+	return (page < SimFlash_pagesPerDie()) ? die->pages[page] : NULL;
+}
+
+static void SimFlash_loadBuffer(SimFlashDie *die, uint32_t page)
+{
+	const uint8_t *data = SimFlash_nandPage(die, page);
+
+	if (data != NULL) {
+		memcpy(die->buffer, data, SimFlash_pageBytes());
+	} else {
+		memset(die->buffer, 0xFF, SimFlash_pageBytes());
+	}
+
+	die->bufferPage = page;
+}
+
+void SimFlash_powerCycle(void)
+{
+	if (simFlashModel == NULL) {
+		return;
+	}
+
+	for (uint32_t i = 0; i < simFlashModel->dieCount; i++) {
+		SimFlashDie *die = &simFlashDies[i];
+
+		die->busy = false;
+		die->busyUntil = 0;
+		die->wel = false;
+		die->wrap = 0;
+
+		if (simFlashModel->type == SIM_FLASH_NAND) {
+			die->status[0] = 0x00;
+			die->status[1] = 0x18;
+			die->status[2] = 0x00;
+
+			// The part reads page 0 into the buffer on its own at power up
+			SimFlash_loadBuffer(die, 0);
+		} else {
+			die->fourByte = (die->status[2] & SIM_FLASH_SR3_ADP) != 0;
+		}
+	}
+
+	simFlashSelected = 0;
+	simFlashResetEnabled = false;
+	memset(&simFlashXfer, 0, sizeof(simFlashXfer));
+}
+
+static SimFlashDie *SimFlash_die(void)
+{
+	SimFlashDie *die = &simFlashDies[simFlashSelected];
+
+	if (die->busy && (SimQspi_nowNs() >= die->busyUntil)) {
+		die->busy = false;
+		die->wel = false;
+	}
+
+	return die;
+}
+
+static void SimFlash_startBusy(SimFlashDie *die, uint64_t us)
+{
+	die->busy = true;
+	die->busyUntil = SimQspi_nowNs() + (us * 1000u);
+}
+
+static uint8_t SimFlash_statusValue(SimFlashDie *die, uint32_t reg)
+{
+	uint8_t value = 0;
+
+	if (simFlashModel->type == SIM_FLASH_NAND) {
+		if (reg == SIM_FLASH_NAND_PROT) {
+			value = die->status[0];
+		} else if (reg == SIM_FLASH_NAND_CONF) {
+			value = die->status[1];
+		} else if (reg == SIM_FLASH_NAND_STAT) {
+			value = (uint8_t)(die->status[2] | (die->wel ? SIM_FLASH_WEL : 0u) | (die->busy ? SIM_FLASH_BUSY : 0u));
+		} else {
+			value = 0xFF;
+		}
+	} else if (reg == 0) {
+		value = (uint8_t)((die->status[0] & 0xFCu) | (die->wel ? SIM_FLASH_WEL : 0u) | (die->busy ? SIM_FLASH_BUSY : 0u));
+	} else if (reg == 1) {
+		value = (uint8_t)(die->status[1] & 0x7Fu);
+	} else {
+		value = (uint8_t)((die->status[2] & 0xFEu) | (die->fourByte ? SIM_FLASH_SR3_ADS : 0u));
+	}
+
+	return value;
+}
+
+static const SimFlashCommand *SimFlash_findCommand(uint8_t opcode)
+{
+	const SimFlashCommand *table = simFlashNorCommands;
+	uint32_t count = sizeof(simFlashNorCommands) / sizeof(simFlashNorCommands[0]);
+
+	if (simFlashModel->type == SIM_FLASH_NAND) {
+		table = simFlashNandCommands;
+		count = sizeof(simFlashNandCommands) / sizeof(simFlashNandCommands[0]);
+	}
+
+	for (uint32_t i = 0; i < count; i++) {
+		if (table[i].opcode == opcode) {
+			return &table[i];
+		}
+	}
+
+	return NULL;
+}
+
+static uint32_t SimFlash_lines(uint32_t mode, uint32_t one, uint32_t two, uint32_t four)
+{
+	uint32_t lines = 0;
+
+	if (mode == one) {
+		lines = 1;
+	} else if (mode == two) {
+		lines = 2;
+	} else if (mode == four) {
+		lines = 4;
+	}
+
+	return lines;
+}
+
+static uint32_t SimFlash_addressBits(const QSPI_CommandTypeDef *cmd)
+{
+	return 8u * ((cmd->AddressSize >> 12) + 1u);
+}
+
+//! Address, line and mode checks, a mismatch means the part would decode garbage
+static bool SimFlash_checkCommand(const SimFlashCommand *command, const QSPI_CommandTypeDef *cmd, SimFlashDie *die)
+{
+	static const uint32_t addressBits[] = { 0, 8, 16, 24, 24, 32 };
+	uint32_t expectedBits = addressBits[command->address];
+	uint32_t addressLines = SimFlash_lines(cmd->AddressMode, QSPI_ADDRESS_1_LINE, QSPI_ADDRESS_2_LINES, QSPI_ADDRESS_4_LINES);
+	uint32_t dataLines = SimFlash_lines(cmd->DataMode, QSPI_DATA_1_LINE, QSPI_DATA_2_LINES, QSPI_DATA_4_LINES);
+	bool ok = (cmd->InstructionMode == QSPI_INSTRUCTION_1_LINE);
+
+	if ((command->address == SIM_ADDR_ARRAY) && die->fourByte) {
+		expectedBits = 32;
+	}
+
+	if (command->address == SIM_ADDR_NONE) {
+		ok = ok && (addressLines == 0);
+	} else {
+		ok = ok && (addressLines == command->addressLines) && (SimFlash_addressBits(cmd) == expectedBits);
+	}
+
+	// Status reads and the die select may be clocked for more or fewer bytes, the phase just has to exist
+	ok = ok && (dataLines == command->dataLines);
+	ok = ok && (((command->flags & SIM_CMD_DTR) != 0) == (cmd->DdrMode == QSPI_DDR_MODE_ENABLE));
+
+	if ((command->flags & SIM_CMD_4B) && (simFlashModel->addressBytes < 4)) {
+		ok = false;
+	}
+	if ((command->flags & SIM_CMD_DTR) && !simFlashModel->dtr) {
+		ok = false;
+	}
+	if ((simFlashModel->type == SIM_FLASH_NOR) && (command->flags & SIM_CMD_QUAD) && !(die->status[1] & SIM_FLASH_SR2_QE)) {
+		ok = false;
+	}
+
+	return ok;
+}
+
+static uint8_t SimFlash_expectedDummy(const SimFlashCommand *command, SimFlashDie *die)
+{
+	// Continuous read mode on the NAND adds the column bytes the part no longer decodes
+	if ((simFlashModel->type == SIM_FLASH_NAND) && (command->op == SIM_OP_READ_BUFFER) && !(die->status[1] & SIM_FLASH_NAND_BUF)) {
+		return (uint8_t)(command->dummyCycles + 8u);
+	}
+
+	return command->dummyCycles;
+}
+
+bool SimFlash_begin(const QSPI_CommandTypeDef *cmd)
+{
+	SimFlashTransfer *xfer = &simFlashXfer;
+
+	memset(xfer, 0, sizeof(*xfer));
+
+	if (simFlashModel == NULL) {
+		xfer->ignored = true;
+		return false;
+	}
+
+	SimFlashDie *die = SimFlash_die();
+	const SimFlashCommand *command = SimFlash_findCommand((uint8_t)cmd->Instruction);
+
+	xfer->active = true;
+	xfer->command = command;
+	xfer->address = cmd->Address;
+
+	if ((command == NULL) || !SimFlash_checkCommand(command, cmd, die)) {
+		simFlashStats.protocolErrors++;
+		xfer->ignored = true;
+		return false;
+	}
+
+	if (die->busy && !(command->flags & SIM_CMD_BUSY_OK)) {
+		simFlashStats.busyViolations++;
+		xfer->ignored = true;
+		return true;
+	}
+
+	if (command->dataLines != 0) {
+		uint32_t lines = command->dataLines * ((cmd->DdrMode == QSPI_DDR_MODE_ENABLE) ? 2u : 1u);
+		int32_t expected = SimFlash_expectedDummy(command, die);
+
+		xfer->shiftBits = ((int32_t)cmd->DummyCycles - expected) * (int32_t)lines;
+
+		if (xfer->shiftBits != 0) {
+			simFlashStats.dummyMismatches++;
+		}
+	}
+
+	if (simFlashModel->type == SIM_FLASH_NOR) {
+		xfer->addressMask = simFlashModel->dieCapacity - 1u;
+	} else {
+		xfer->addressMask = 0xFFFFu;
+	}
+
+	switch (command->op) {
+	case SIM_OP_READ_STATUS:
+		simFlashStats.statusReads++;
+		simFlashStats.busyStatusReads += die->busy ? 1u : 0u;
+		xfer->value[0] = SimFlash_statusValue(die, (simFlashModel->type == SIM_FLASH_NAND) ? cmd->Address : command->unit);
+		break;
+	case SIM_OP_READ_ID:
+		memcpy(xfer->value, simFlashModel->jedecId, sizeof(xfer->value));
+		break;
+	case SIM_OP_PROGRAM:
+		memset(xfer->latch, 0xFF, sizeof(xfer->latch));
+		/* fall through */
+	case SIM_OP_LOAD:
+	case SIM_OP_LOAD_RANDOM:
+	case SIM_OP_ERASE:
+	case SIM_OP_CHIP_ERASE:
+	case SIM_OP_EXECUTE:
+		if (!die->wel) {
+			simFlashStats.welViolations++;
+			xfer->ignored = true;
+		} else if (command->op == SIM_OP_LOAD) {
+			memset(die->buffer, 0xFF, SimFlash_pageBytes());
+		}
+		break;
+	case SIM_OP_WRITE_STATUS:
+		if ((simFlashModel->type == SIM_FLASH_NOR) && !die->wel) {
+			simFlashStats.welViolations++;
+			xfer->ignored = true;
+		}
+		break;
+	default:
+		break;
+	}
+
+	return true;
+}
+
+//! Byte the part drives at position index of its data phase
+static uint8_t SimFlash_deviceByte(uint32_t index)
+{
+	const SimFlashTransfer *xfer = &simFlashXfer;
+	SimFlashDie *die = &simFlashDies[simFlashSelected];
+	uint8_t value = 0xFF;
+
+	switch (xfer->command->op) {
+	case SIM_OP_READ_ARRAY: {
+		uint32_t address = xfer->address + index;
+
+		if ((die->wrap != 0) && (xfer->command->flags & SIM_CMD_WRAP)) {
+			uint32_t mask = die->wrap - 1u;
+			address = (xfer->address & ~mask) | ((xfer->address + index) & mask);
+		}
+		value = die->array[address & xfer->addressMask];
+		break;
+	}
+	case SIM_OP_READ_BUFFER:
+		if (!(die->status[1] & SIM_FLASH_NAND_BUF)) {
+			// Continuous read streams the main array from the loaded page on
+			uint32_t page = die->bufferPage + (index / simFlashModel->pageSize);
+			const uint8_t *data = SimFlash_nandPage(die, page);
+			value = (data != NULL) ? data[index % simFlashModel->pageSize] : 0xFF;
+		} else if ((xfer->address + index) < SimFlash_pageBytes()) {
+			value = die->buffer[xfer->address + index];
+		}
+		break;
+	case SIM_OP_READ_STATUS:
+		value = xfer->value[0];
+		break;
+	case SIM_OP_READ_ID:
+		value = (index < sizeof(xfer->value)) ? xfer->value[index] : 0x00;
+		break;
+	case SIM_OP_READ_SFDP:
+		if ((xfer->address + index) < SIM_FLASH_SFDP_SIZE) {
+			value = simFlashSfdp[xfer->address + index];
+		}
+		break;
+	default:
+		break;
+	}
+
+	return value;
+}
+
+uint8_t SimFlash_readByte(uint32_t index)
+{
+	const SimFlashTransfer *xfer = &simFlashXfer;
+
+	if (!xfer->active || xfer->ignored) {
+		return 0xFF;
+	}
+
+	if (xfer->shiftBits == 0) {
+		return SimFlash_deviceByte(index);
+	}
+
+	// Sampling too early reads the idle high lines, too late skips the first bits
+	uint8_t value = 0;
+	int64_t bit = ((int64_t)index * 8) + xfer->shiftBits;
+
+	for (uint32_t i = 0; i < 8; i++, bit++) {
+		uint8_t level = 1;
+
+		if (bit >= 0) {
+			level = (uint8_t)((SimFlash_deviceByte((uint32_t)(bit / 8)) >> (7 - (bit % 8))) & 1u);
+		}
+		value = (uint8_t)((value << 1) | level);
+	}
+
+	return value;
+}
+
+void SimFlash_writeByte(uint8_t value)
+{
+	SimFlashTransfer *xfer = &simFlashXfer;
+	SimFlashDie *die = &simFlashDies[simFlashSelected];
+
+	if (!xfer->active || xfer->ignored) {
+		return;
+	}
+
+	switch (xfer->command->op) {
+	case SIM_OP_PROGRAM:
+		// Bytes past the end of the page wrap to its start, as on the real part
+		xfer->latch[(xfer->address + xfer->count) & 0xFFu] &= value;
+		break;
+	case SIM_OP_LOAD:
+	case SIM_OP_LOAD_RANDOM: {
+		uint32_t column = xfer->address + xfer->count;
+		if (column < SimFlash_pageBytes()) {
+			die->buffer[column] = value;
+		}
+		break;
+	}
+	default:
+		if (xfer->count < sizeof(xfer->latch)) {
+			xfer->latch[xfer->count] = value;
+		}
+		break;
+	}
+
+	xfer->count++;
+}
+
+static void SimFlash_eraseNor(SimFlashDie *die, uint32_t address, uint32_t size, uint32_t us)
+{
+	uint32_t start = (address & (simFlashModel->dieCapacity - 1u)) & ~(size - 1u);
+	uint32_t first = start / SIM_FLASH_NOR_SECTOR;
+	uint32_t sectors = size / SIM_FLASH_NOR_SECTOR;
+	bool fail = false;
+
+	for (uint32_t i = 0; i < sectors; i++) {
+		fail = fail || (die->eraseFail[first + i] != 0);
+	}
+
+	// A failing unit keeps its data, the NOR parts have no erase fail status to report it
+	if (fail) {
+		simFlashStats.eraseFailures++;
+		memset(&die->eraseFail[first], 0, sectors);
+	} else {
+		memset(&die->array[start], 0xFF, size);
+	}
+
+	for (uint32_t i = 0; i < sectors; i++) {
+		die->eraseCounts[first + i]++;
+	}
+
+	SimFlash_startBusy(die, us);
+}
+
+static void SimFlash_endNor(SimFlashDie *die)
+{
+	SimFlashTransfer *xfer = &simFlashXfer;
+	const SimFlashModel *m = simFlashModel;
+
+	switch (xfer->command->op) {
+	case SIM_OP_PROGRAM: {
+		uint32_t page = (xfer->address & xfer->addressMask) & ~0xFFu;
+
+		for (uint32_t i = 0; i < 256u; i++) {
+			die->array[page + i] &= xfer->latch[i];
+		}
+		simFlashStats.programs++;
+		simFlashStats.programmedBytes += (xfer->count < 256u) ? xfer->count : 256u;
+		SimFlash_startBusy(die, m->pageProgramUs);
+		break;
+	}
+	case SIM_OP_ERASE:
+		simFlashStats.erases++;
+		if (xfer->command->unit == 4096u) {
+			SimFlash_eraseNor(die, xfer->address, 4096u, m->sectorEraseUs);
+		} else if (xfer->command->unit == 32768u) {
+			SimFlash_eraseNor(die, xfer->address, 32768u, m->block32EraseUs);
+		} else {
+			SimFlash_eraseNor(die, xfer->address, 65536u, m->block64EraseUs);
+		}
+		break;
+	case SIM_OP_CHIP_ERASE:
+		simFlashStats.chipErases++;
+		SimFlash_eraseNor(die, 0, m->dieCapacity, (uint64_t)m->chipEraseMs * 1000u);
+		break;
+	case SIM_OP_WRITE_STATUS:
+		if (xfer->count > 0) {
+			die->status[xfer->command->unit] = xfer->latch[0];
+		}
+		die->wel = false;
+		break;
+	case SIM_OP_WRAP:
+		if (xfer->count >= 4) {
+			die->wrap = (xfer->latch[3] & 0x10u) ? 0 : (uint8_t)(8u << ((xfer->latch[3] >> 5) & 3u));
+		}
+		break;
+	case SIM_OP_ENTER_4B:
+		die->fourByte = true;
+		break;
+	case SIM_OP_EXIT_4B:
+		die->fourByte = false;
+		break;
+	case SIM_OP_RESET:
+		if (simFlashResetEnabled) {
+			die->busy = false;
+			die->wel = false;
+			die->wrap = 0;
+			die->fourByte = (die->status[2] & SIM_FLASH_SR3_ADP) != 0;
+			SimFlash_startBusy(die, SIM_FLASH_NOR_RESET_US);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+static void SimFlash_endNand(SimFlashDie *die)
+{
+	SimFlashTransfer *xfer = &simFlashXfer;
+	const SimFlashModel *m = simFlashModel;
+	uint32_t page = xfer->address & (SimFlash_pagesPerDie() - 1u);	// Row address bits above the die are ignored
+	uint32_t block = page / m->pagesPerBlock;
+
+	switch (xfer->command->op) {
+	case SIM_OP_EXECUTE:
+		simFlashStats.programs++;
+		die->status[2] &= (uint8_t)~SIM_FLASH_NAND_P_FAIL;
+
+		if (die->badBlocks[block] != 0) {
+			simFlashStats.programFailures++;
+			die->status[2] |= SIM_FLASH_NAND_P_FAIL;
+		} else {
+			if (die->pages[page] == NULL) {
+				die->pages[page] = malloc(SimFlash_pageBytes());
+				memset(die->pages[page], 0xFF, SimFlash_pageBytes());
+			}
+			for (uint32_t i = 0; i < SimFlash_pageBytes(); i++) {
+				die->pages[page][i] &= die->buffer[i];
+			}
+			simFlashStats.programmedBytes += m->pageSize;
+		}
+		SimFlash_startBusy(die, m->pageProgramUs);
+		break;
+	case SIM_OP_PAGE_READ:
+		simFlashStats.pageReads++;
+		SimFlash_loadBuffer(die, page);
+		die->status[2] = (uint8_t)((die->status[2] & ~SIM_FLASH_NAND_ECC) | (simFlashEcc << SIM_FLASH_NAND_ECC_POS));
+		simFlashEcc = 0;
+		SimFlash_startBusy(die, m->pageReadUs);
+		break;
+	case SIM_OP_ERASE:
+		simFlashStats.erases++;
+		die->status[2] &= (uint8_t)~SIM_FLASH_NAND_E_FAIL;
+		die->eraseCounts[block]++;
+
+		if ((die->badBlocks[block] != 0) || (die->eraseFail[block] != 0)) {
+			simFlashStats.eraseFailures++;
+			die->status[2] |= SIM_FLASH_NAND_E_FAIL;
+			die->eraseFail[block] = 0;
+		} else {
+			for (uint32_t i = 0; i < m->pagesPerBlock; i++) {
+				free(die->pages[(block * m->pagesPerBlock) + i]);
+				die->pages[(block * m->pagesPerBlock) + i] = NULL;
+			}
+		}
+		SimFlash_startBusy(die, m->sectorEraseUs);
+		break;
+	case SIM_OP_WRITE_STATUS:
+		if ((xfer->count > 0) && (xfer->address == SIM_FLASH_NAND_PROT)) {
+			die->status[0] = xfer->latch[0];
+		} else if ((xfer->count > 0) && (xfer->address == SIM_FLASH_NAND_CONF)) {
+			die->status[1] = xfer->latch[0];
+		}
+		break;
+	case SIM_OP_RESET:
+		die->busy = false;
+		die->wel = false;
+		die->status[2] = 0;
+		break;
+	default:
+		break;
+	}
+}
+
+void SimFlash_end(bool aborted)
+{
+	SimFlashTransfer *xfer = &simFlashXfer;
+
+	if (!xfer->active) {
+		return;
+	}
+
+	xfer->active = false;
+
+	if (xfer->ignored || aborted) {
+		return;
+	}
+
+	SimFlashDie *die = &simFlashDies[simFlashSelected];
+	SimFlashOp op = xfer->command->op;
+
+	// Common to both types, the rest only happens once chip select goes high
+	if (op == SIM_OP_WRITE_ENABLE) {
+		simFlashStats.writeEnables++;
+		die->wel = true;
+	} else if (op == SIM_OP_WRITE_DISABLE) {
+		die->wel = false;
+	} else if (op == SIM_OP_DIE_SELECT) {
+		if ((xfer->count > 0) && (xfer->latch[0] < simFlashModel->dieCount)) {
+			simFlashSelected = xfer->latch[0];
+			simFlashStats.dieSelects++;
+		} else {
+			simFlashStats.protocolErrors++;
+		}
+	} else if (simFlashModel->type == SIM_FLASH_NOR) {
+		SimFlash_endNor(die);
+	} else {
+		SimFlash_endNand(die);
+	}
+
+	simFlashResetEnabled = (op == SIM_OP_RESET_ENABLE);
+}
+
+uint8_t SimFlash_peekStatus(const QSPI_CommandTypeDef *cmd)
+{
+	if (simFlashModel == NULL) {
+		return 0xFF;
+	}
+
+	SimFlashDie *die = SimFlash_die();
+	const SimFlashCommand *command = SimFlash_findCommand((uint8_t)cmd->Instruction);
+
+	if ((command == NULL) || (command->op != SIM_OP_READ_STATUS)) {
+		return 0xFF;
+	}
+
+	return SimFlash_statusValue(die, (simFlashModel->type == SIM_FLASH_NAND) ? cmd->Address : command->unit);
+}
+
+uint32_t SimFlash_wrapLength(const QSPI_CommandTypeDef *cmd)
+{
+	if (simFlashModel == NULL) {
+		return 0;
+	}
+
+	const SimFlashCommand *command = SimFlash_findCommand((uint8_t)cmd->Instruction);
+
+	if ((command == NULL) || !(command->flags & SIM_CMD_WRAP)) {
+		return 0;
+	}
+
+	return SimFlash_die()->wrap;
+}
+
+uint64_t SimFlash_readyAtNs(void)
+{
+	if (simFlashModel == NULL) {
+		return SimQspi_nowNs();
+	}
+
+	SimFlashDie *die = SimFlash_die();
+
+	return die->busy ? die->busyUntil : SimQspi_nowNs();
+}
+
+const uint8_t *SimFlash_mappedArray(void)
+{
+	if ((simFlashModel == NULL) || (simFlashModel->type != SIM_FLASH_NOR)) {
+		return NULL;
+	}
+
+	return simFlashDies[simFlashSelected].array;
+}
+
+//! Walks a linear range die by die and page by page, NOR ranges stay in one piece per die
+static bool SimFlash_access(uint32_t address, uint8_t *data, const uint8_t *source, uint32_t length)
+{
+	const SimFlashModel *m = simFlashModel;
+
+	if ((m == NULL) || (((uint64_t)address + length) > ((uint64_t)m->dieCapacity * m->dieCount))) {
+		return false;
+	}
+
+	while (length > 0) {
+		SimFlashDie *die = &simFlashDies[address / m->dieCapacity];
+		uint32_t offset = address % m->dieCapacity;
+		uint32_t chunk = (m->type == SIM_FLASH_NOR) ? (m->dieCapacity - offset) : (m->pageSize - (offset % m->pageSize));
+		uint8_t *target;
+
+		if (chunk > length) {
+			chunk = length;
+		}
+
+		if (m->type == SIM_FLASH_NOR) {
+			target = &die->array[offset];
+		} else {
+			uint32_t page = offset / m->pageSize;
+
+			if ((die->pages[page] == NULL) && (source != NULL)) {
+				die->pages[page] = malloc(SimFlash_pageBytes());
+				memset(die->pages[page], 0xFF, SimFlash_pageBytes());
+			}
+			target = (die->pages[page] != NULL) ? &die->pages[page][offset % m->pageSize] : NULL;
+		}
+
+		if (source != NULL) {
+			for (uint32_t i = 0; i < chunk; i++) {
+				target[i] &= source[i];
+			}
+			source += chunk;
+		} else if (target != NULL) {
+			memcpy(data, target, chunk);
+			data += chunk;
+		} else {
+			memset(data, 0xFF, chunk);
+			data += chunk;
+		}
+
+		address += chunk;
+		length -= chunk;
+	}
+
+	return true;
+}
+
+bool SimFlash_load(uint32_t address, const uint8_t *data, uint32_t length)
+{
+	return SimFlash_access(address, NULL, data, length);
+}
+
+bool SimFlash_peek(uint32_t address, uint8_t *data, uint32_t length)
+{
+	return SimFlash_access(address, data, NULL, length);
+}
+
+bool SimFlash_peekSpare(uint32_t page, uint32_t column, uint8_t *data, uint32_t length)
+{
+	const SimFlashModel *m = simFlashModel;
+
+	if ((m == NULL) || (m->type != SIM_FLASH_NAND) || ((column + length) > m->spareSize)) {
+		return false;
+	}
+
+	SimFlashDie *die = &simFlashDies[page / SimFlash_pagesPerDie()];
+	const uint8_t *source = die->pages[page % SimFlash_pagesPerDie()];
+
+	if (source != NULL) {
+		memcpy(data, &source[m->pageSize + column], length);
+	} else {
+		memset(data, 0xFF, length);
+	}
+
+	return true;
+}
+
+bool SimFlash_loadPages(uint32_t page, const uint8_t *data, uint32_t count)
+{
+	const SimFlashModel *m = simFlashModel;
+
+	if ((m == NULL) || (m->type != SIM_FLASH_NAND) || ((page + count) > (SimFlash_pagesPerDie() * m->dieCount))) {
+		return false;
+	}
+
+	for (uint32_t i = 0; i < count; i++, data += SimFlash_pageBytes()) {
+		SimFlashDie *die = &simFlashDies[(page + i) / SimFlash_pagesPerDie()];
+		uint32_t index = (page + i) % SimFlash_pagesPerDie();
+
+		if (die->pages[index] == NULL) {
+			die->pages[index] = malloc(SimFlash_pageBytes());
+			memset(die->pages[index], 0xFF, SimFlash_pageBytes());
+		}
+
+		for (uint32_t b = 0; b < SimFlash_pageBytes(); b++) {
+			die->pages[index][b] &= data[b];
+		}
+	}
+
+	return true;
+}
+
+void SimFlash_markBadBlock(uint32_t block)
+{
+	const SimFlashModel *m = simFlashModel;
+
+	if ((m == NULL) || (m->type != SIM_FLASH_NAND)) {
+		return;
+	}
+
+	uint32_t blocksPerDie = SimFlash_eraseUnits();
+	SimFlashDie *die = &simFlashDies[(block / blocksPerDie) % m->dieCount];
+	uint32_t page = (block % blocksPerDie) * m->pagesPerBlock;
+
+	die->badBlocks[block % blocksPerDie] = 1;
+
+	// Factory marker, first spare byte of the first page
+	if (die->pages[page] == NULL) {
+		die->pages[page] = malloc(SimFlash_pageBytes());
+		memset(die->pages[page], 0xFF, SimFlash_pageBytes());
+	}
+	die->pages[page][m->pageSize] = 0x00;
+}
+
+static uint32_t SimFlash_unitOf(uint32_t address, SimFlashDie **die)
+{
+	const SimFlashModel *m = simFlashModel;
+	uint32_t offset = address % m->dieCapacity;
+
+	*die = &simFlashDies[(address / m->dieCapacity) % m->dieCount];
+
+	if (m->type == SIM_FLASH_NAND) {
+		return offset / (m->pageSize * m->pagesPerBlock);
+	}
+
+	return offset / SIM_FLASH_NOR_SECTOR;
+}
+
+void SimFlash_failErase(uint32_t address)
+{
+	SimFlashDie *die;
+
+	if (simFlashModel != NULL) {
+		uint32_t unit = SimFlash_unitOf(address, &die);
+		die->eraseFail[unit] = 1;
+	}
+}
+
+void SimFlash_injectEcc(uint8_t ecc)
+{
+	simFlashEcc = (uint8_t)(ecc & 3u);
+}
+
+void SimFlash_hangBusy(void)
+{
+	if (simFlashModel != NULL) {
+		SimFlashDie *die = SimFlash_die();
+
+		die->busy = true;
+		die->busyUntil = (uint64_t)INT64_MAX;
+	}
+}
+
+uint32_t SimFlash_eraseCount(uint32_t address)
+{
+	SimFlashDie *die;
+
+	if (simFlashModel == NULL) {
+		return 0;
+	}
+
+	uint32_t unit = SimFlash_unitOf(address, &die);
+
+	return die->eraseCounts[unit];
+}
+
+bool SimFlash_setSfdp(const uint8_t *image, uint32_t length)
+{
+	if ((simFlashModel == NULL) || (length > SIM_FLASH_SFDP_SIZE)) {
+		return false;
+	}
+
+	memset(simFlashSfdp, 0xFF, sizeof(simFlashSfdp));
+	memcpy(simFlashSfdp, image, length);
+
+	return true;
+}
+
+const uint8_t *SimFlash_sfdp(void)
+{
+	return simFlashSfdp;
+}
+
+uint8_t SimFlash_selectedDie(void)
+{
+	return simFlashSelected;
+}
+
+bool SimFlash_isBusy(uint8_t die)
+{
+	if ((simFlashModel == NULL) || (die >= simFlashModel->dieCount)) {
+		return false;
+	}
+
+	return simFlashDies[die].busy && (SimQspi_nowNs() < simFlashDies[die].busyUntil);
+}
+
+const SimFlashStats *SimFlash_getStats(void)
+{
+	return &simFlashStats;
+}
+
+void SimFlash_resetStats(void)
+{
+	memset(&simFlashStats, 0, sizeof(simFlashStats));
+}
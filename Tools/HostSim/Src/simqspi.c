@@ -0,0 +1,1132 @@
+/*
+ * This program is simulated QUADSPI peripheral and bus timing for host builds of the Winbond drivers.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <string.h>
+
+#include "simqspi.h"
+#include "simflash.h"
+
+#define SIM_QSPI_INIT_NS			2000u		//!< Peripheral reset and configuration
+#define SIM_QSPI_IDLE_POLL_NS		1000u		//!< Time a FIFO flag poll takes when nothing is ready, lets driver timeouts expire
+#define SIM_QSPI_POLL_LIMIT_NS		1000000000u	//!< Auto-polling that can never match reports an error after this
+#define SIM_QSPI_CACHE_ENTRIES		16384u
+
+typedef enum {
+	SIM_QSPI_PENDING_NONE,
+	SIM_QSPI_PENDING_RX,
+	SIM_QSPI_PENDING_TX,
+	SIM_QSPI_PENDING_POLL,
+	SIM_QSPI_PENDING_CMD,
+} SimQspiPendingType;
+
+typedef struct {
+	SimQspiPendingType type;
+	QSPI_HandleTypeDef *hqspi;
+	uint64_t due;
+	uint8_t *data;
+	uint32_t length;
+	bool dma;
+	uint64_t pollStart;
+	QSPI_AutoPollingTypeDef poll;
+} SimQspiPending;
+
+typedef struct {
+	uintptr_t line;
+	uint8_t state;			//!< 0 invalid, 1 clean, 2 dirty
+	bool stale;
+	uint32_t dirtyMask;
+} SimCacheLine;
+
+QUADSPI_TypeDef SimQspi_registers;
+SCB_Type SimQspi_scb;
+
+static uint64_t simQspiNowNs = 0;
+static SimQspiStats simQspiStats;
+static uint32_t simQspiHalOverheadNs = SIM_QSPI_HAL_OVERHEAD_NS;
+static uint32_t simQspiPrescaler = 1;
+static uint32_t simQspiSampleShifting = QSPI_SAMPLE_SHIFTING_HALFCYCLE;
+static uint32_t simQspiCsHighCycles = 1;
+static HAL_QSPI_StateTypeDef simQspiState = HAL_QSPI_STATE_RESET;
+
+static bool simQspiArmed = false;			//!< Command with a data phase issued, waiting for the data call or FIFO traffic
+static QSPI_CommandTypeDef simQspiCmd;
+static uint32_t simQspiIndex = 0;
+static uint32_t simQspiRemaining = 0;
+static bool simQspiTxSlot = false;
+static bool simQspiGlitch = false;
+
+static SimQspiPending simQspiPending;
+static void (*simQspiInterruptHook)(void) = NULL;
+
+static bool simQspiMapped = false;
+static QSPI_CommandTypeDef simQspiMappedCmd;
+static uint32_t simQspiMappedNext = UINT32_MAX;
+static uint64_t simQspiMappedWindow = 0;			//!< Bytes the mapping reaches from QSPI_BASE
+static bool simQspiMappedRelease = false;			//!< Timeout counter on, every line is a new command
+static uint32_t simQspiMappedWrap = 0;				//!< Line the mapped read wraps inside, it then starts at the missed byte
+
+static bool simQspiLinkEnabled = false;
+static SimQspiLink simQspiLink;
+static uint32_t simQspiRandom = 1;
+
+static SimCacheLine simCacheLines[SIM_QSPI_CACHE_ENTRIES];
+static SimCacheStats simCacheStats;
+
+// PRIMASK per thread, masking takes a process wide lock so host threads exclude each other like an ISR would
+static pthread_mutex_t simQspiIrqLock = PTHREAD_MUTEX_INITIALIZER;
+static __thread uint32_t simQspiPrimask = 0;
+
+uint64_t SimQspi_nowNs(void)
+{
+	return __atomic_load_n(&simQspiNowNs, __ATOMIC_SEQ_CST);
+}
+
+uint32_t SimQspi_nowUs(void)
+{
+	return (uint32_t)(SimQspi_nowNs() / 1000u);
+}
+
+void SimQspi_advanceNs(uint64_t ns)
+{
+	__atomic_add_fetch(&simQspiNowNs, ns, __ATOMIC_SEQ_CST);
+}
+
+uint32_t SimQspi_clock(void)
+{
+	return (uint32_t)SimQspi_nowNs();
+}
+
+uint32_t SimQspi_busClockHz(void)
+{
+	return SIM_QSPI_KERNEL_CLOCK_HZ / (simQspiPrescaler + 1u);
+}
+
+void SimQspi_setHalOverheadNs(uint32_t ns)
+{
+	simQspiHalOverheadNs = ns;
+}
+
+const SimQspiStats *SimQspi_getStats(void)
+{
+	return &simQspiStats;
+}
+
+void SimQspi_resetStats(void)
+{
+	memset(&simQspiStats, 0, sizeof(simQspiStats));
+}
+
+void SimQspi_setInterruptHook(void (*hook)(void))
+{
+	simQspiInterruptHook = hook;
+}
+
+static uint32_t SimQspi_random(void)
+{
+	// xorshift32, the same seed gives the same error pattern on every run
+	simQspiRandom ^= simQspiRandom << 13;
+	simQspiRandom ^= simQspiRandom >> 17;
+	simQspiRandom ^= simQspiRandom << 5;
+	return simQspiRandom;
+}
+
+void SimQspi_setLink(const SimQspiLink *link)
+{
+	simQspiLinkEnabled = (link != NULL);
+
+	if (link != NULL) {
+		simQspiLink = *link;
+		simQspiRandom = (link->seed != 0) ? link->seed : 1u;
+	}
+}
+
+static uint32_t SimQspi_periodPs(void)
+{
+	return 5000u * (simQspiPrescaler + 1u);
+}
+
+static uint32_t SimQspi_lines(uint32_t mode, uint32_t one, uint32_t two, uint32_t four)
+{
+	uint32_t lines = 0;
+
+	if (mode == one) {
+		lines = 1;
+	} else if (mode == two) {
+		lines = 2;
+	} else if (mode == four) {
+		lines = 4;
+	}
+
+	return lines;
+}
+
+static uint64_t SimQspi_phaseCycles(uint64_t bits, uint32_t lines, bool ddr)
+{
+	uint64_t perCycle = lines * (ddr ? 2u : 1u);
+
+	return (lines == 0) ? 0 : ((bits + perCycle - 1u) / perCycle);
+}
+
+//! Clocks of one chip select cycle, chip select high time included
+static uint64_t SimQspi_cycles(const QSPI_CommandTypeDef *cmd, uint32_t dataBytes)
+{
+	bool ddr = (cmd->DdrMode == QSPI_DDR_MODE_ENABLE);
+	uint64_t cycles = simQspiCsHighCycles + cmd->DummyCycles;
+
+	cycles += SimQspi_phaseCycles(8, SimQspi_lines(cmd->InstructionMode, QSPI_INSTRUCTION_1_LINE, QSPI_INSTRUCTION_2_LINES, QSPI_INSTRUCTION_4_LINES), false);
+	cycles += SimQspi_phaseCycles(8u * ((cmd->AddressSize >> 12) + 1u),
+			SimQspi_lines(cmd->AddressMode, QSPI_ADDRESS_1_LINE, QSPI_ADDRESS_2_LINES, QSPI_ADDRESS_4_LINES), ddr);
+	cycles += SimQspi_phaseCycles(8u * ((cmd->AlternateBytesSize >> 16) + 1u),
+			SimQspi_lines(cmd->AlternateByteMode, QSPI_ALTERNATE_BYTES_1_LINE, QSPI_ALTERNATE_BYTES_2_LINES, QSPI_ALTERNATE_BYTES_4_LINES), ddr);
+	cycles += SimQspi_phaseCycles(8u * (uint64_t)dataBytes, SimQspi_lines(cmd->DataMode, QSPI_DATA_1_LINE, QSPI_DATA_2_LINES, QSPI_DATA_4_LINES), ddr);
+
+	return cycles;
+}
+
+static uint64_t SimQspi_cyclesToNs(uint64_t cycles)
+{
+	return (cycles * SimQspi_periodPs()) / 1000u;
+}
+
+static void SimQspi_countTransaction(const QSPI_CommandTypeDef *cmd, uint64_t cycles, uint64_t count)
+{
+	simQspiStats.transactions += count;
+	simQspiStats.busCycles += cycles * count;
+	simQspiStats.busNs += SimQspi_cyclesToNs(cycles) * count;
+	simQspiStats.opcodes[cmd->Instruction & 0xFFu] += (uint32_t)count;
+}
+
+static void SimQspi_halCall(void)
+{
+	simQspiStats.halCalls++;
+	SimQspi_advanceNs(simQspiHalOverheadNs);
+}
+
+static bool SimQspi_ready(QSPI_HandleTypeDef *hqspi)
+{
+	bool ready = (simQspiState == HAL_QSPI_STATE_READY);
+
+	if (!ready) {
+		simQspiStats.halBusy++;
+	}
+
+	hqspi->State = simQspiState;
+
+	return ready;
+}
+
+static void SimQspi_setState(QSPI_HandleTypeDef *hqspi, HAL_QSPI_StateTypeDef state)
+{
+	simQspiState = state;
+
+	if (hqspi != NULL) {
+		hqspi->State = state;
+	}
+}
+
+static void SimQspi_startCommand(const QSPI_CommandTypeDef *cmd)
+{
+	simQspiCmd = *cmd;
+	simQspiIndex = 0;
+	simQspiRemaining = (cmd->DataMode == QSPI_DATA_NONE) ? 0 : cmd->NbData;
+	simQspiTxSlot = false;
+	simQspiGlitch = false;
+
+	SimFlash_begin(cmd);
+
+	// Quad data phases carry the board skew the link model describes
+	if (simQspiLinkEnabled && (cmd->DataMode == QSPI_DATA_4_LINES)) {
+		int64_t samplePs = (simQspiSampleShifting == QSPI_SAMPLE_SHIFTING_HALFCYCLE) ? SimQspi_periodPs() : (SimQspi_periodPs() / 2u);
+		int64_t slackPs = samplePs - (int64_t)simQspiLink.outputDelayPs;
+
+		if (slackPs < 0) {
+			simQspiGlitch = true;
+		} else if (slackPs < (int64_t)simQspiLink.marginPs) {
+			simQspiGlitch = ((SimQspi_random() & 7u) == 0);
+		}
+	}
+}
+
+//! Ends the chip select cycle started by SimQspi_startCommand, bus time is charged before the part sees it
+static void SimQspi_finishCommand(bool aborted, bool chargeTime)
+{
+	uint32_t transferred = simQspiIndex;
+	uint64_t cycles = SimQspi_cycles(&simQspiCmd, transferred);
+
+	SimQspi_countTransaction(&simQspiCmd, cycles, 1);
+	simQspiStats.dataBytes += transferred;
+
+	if (chargeTime) {
+		SimQspi_advanceNs(SimQspi_cyclesToNs(cycles));
+	}
+
+	SimFlash_end(aborted);
+	simQspiArmed = false;
+	simQspiRemaining = 0;
+}
+
+static uint8_t SimQspi_receiveByte(void)
+{
+	uint8_t value = SimFlash_readByte(simQspiIndex);
+	bool corrupt = simQspiGlitch;
+
+	// Outside the window every byte is wrong, in the margin one byte of an unlucky transfer
+	if (corrupt && (simQspiLink.outputDelayPs <= ((simQspiSampleShifting == QSPI_SAMPLE_SHIFTING_HALFCYCLE) ? SimQspi_periodPs() : (SimQspi_periodPs() / 2u)))) {
+		corrupt = (simQspiIndex == 0);
+	}
+
+	if (corrupt) {
+		value ^= (uint8_t)((SimQspi_random() % 255u) + 1u);
+		simQspiStats.corruptedBytes++;
+	}
+
+	simQspiIndex++;
+	if (simQspiRemaining > 0) {
+		simQspiRemaining--;
+	}
+
+	return value;
+}
+
+static void SimQspi_transmitByte(uint8_t value)
+{
+	SimFlash_writeByte(value);
+	simQspiIndex++;
+	if (simQspiRemaining > 0) {
+		simQspiRemaining--;
+	}
+}
+
+/*
+ * Cache model
+ */
+static bool SimCache_enabled(void)
+{
+	return (SimQspi_scb.CCR & SCB_CCR_DC_Msk) != 0u;
+}
+
+static SimCacheLine *SimCache_find(uintptr_t line, bool create)
+{
+	uint32_t slot = (uint32_t)((line / SIM_QSPI_CACHE_LINE) * 2654435761u) % SIM_QSPI_CACHE_ENTRIES;
+
+	for (uint32_t probe = 0; probe < SIM_QSPI_CACHE_ENTRIES; probe++) {
+		SimCacheLine *entry = &simCacheLines[(slot + probe) % SIM_QSPI_CACHE_ENTRIES];
+
+		if (entry->line == line) {
+			return entry;
+		}
+
+		if (entry->line == 0) {
+			if (create) {
+				entry->line = line;
+				return entry;
+			}
+			return NULL;
+		}
+	}
+
+	return NULL;
+}
+
+static uint32_t SimCache_mask(uintptr_t line, uintptr_t start, uintptr_t end)
+{
+	uint32_t mask = 0;
+
+	for (uint32_t i = 0; i < SIM_QSPI_CACHE_LINE; i++) {
+		if (((line + i) >= start) && ((line + i) < end)) {
+			mask |= (1u << i);
+		}
+	}
+
+	return mask;
+}
+
+static uint32_t SimCache_popcount(uint32_t value)
+{
+	uint32_t count = 0;
+
+	for (; value != 0; value &= value - 1u) {
+		count++;
+	}
+
+	return count;
+}
+
+typedef enum {
+	SIM_CACHE_CPU_READ,
+	SIM_CACHE_CPU_WRITE,
+	SIM_CACHE_CLEAN,
+	SIM_CACHE_INVALIDATE,
+	SIM_CACHE_DMA_WRITE,
+	SIM_CACHE_DMA_READ,
+} SimCacheAccess;
+
+static void SimCache_access(const void *address, uint32_t length, SimCacheAccess access)
+{
+	uintptr_t start = (uintptr_t)address;
+	uintptr_t end = start + length;
+
+	if (!SimCache_enabled() || (length == 0)) {
+		return;
+	}
+
+	for (uintptr_t line = start & ~(uintptr_t)(SIM_QSPI_CACHE_LINE - 1u); line < end; line += SIM_QSPI_CACHE_LINE) {
+		bool create = (access == SIM_CACHE_CPU_READ) || (access == SIM_CACHE_CPU_WRITE);
+		SimCacheLine *entry = SimCache_find(line, create);
+
+		if ((entry == NULL) || ((entry->state == 0) && !create)) {
+			continue;
+		}
+
+		switch (access) {
+		case SIM_CACHE_CPU_READ:
+			if (entry->stale) {
+				simCacheStats.staleReads++;
+				entry->stale = false;
+			}
+			if (entry->state == 0) {
+				entry->state = 1;
+			}
+			break;
+		case SIM_CACHE_CPU_WRITE:
+			entry->state = 2;
+			entry->dirtyMask |= SimCache_mask(line, start, end);
+			break;
+		case SIM_CACHE_CLEAN:
+			if (entry->state == 2) {
+				entry->state = 1;
+				entry->dirtyMask = 0;
+			}
+			break;
+		case SIM_CACHE_INVALIDATE:
+			if (entry->state == 2) {
+				simCacheStats.discardedBytes += SimCache_popcount(entry->dirtyMask & ~SimCache_mask(line, start, end));
+			}
+			entry->state = 0;
+			entry->stale = false;
+			entry->dirtyMask = 0;
+			break;
+		case SIM_CACHE_DMA_WRITE:
+			if (entry->state == 2) {
+				simCacheStats.dirtyUnderDma++;
+			}
+			entry->stale = true;
+			break;
+		case SIM_CACHE_DMA_READ:
+			if (entry->state == 2) {
+				simCacheStats.uncleanedTx++;
+			}
+			break;
+		}
+	}
+}
+
+void SimCache_enable(bool enable)
+{
+	memset(simCacheLines, 0, sizeof(simCacheLines));
+	memset(&simCacheStats, 0, sizeof(simCacheStats));
+
+	if (enable) {
+		SimQspi_scb.CCR |= SCB_CCR_DC_Msk;
+	} else {
+		SimQspi_scb.CCR &= ~SCB_CCR_DC_Msk;
+	}
+}
+
+void SimCache_cpuRead(const void *address, uint32_t length)
+{
+	SimCache_access(address, length, SIM_CACHE_CPU_READ);
+}
+
+void SimCache_cpuWrite(const void *address, uint32_t length)
+{
+	SimCache_access(address, length, SIM_CACHE_CPU_WRITE);
+}
+
+const SimCacheStats *SimCache_getStats(void)
+{
+	return &simCacheStats;
+}
+
+void SCB_CleanDCache_by_Addr(void *addr, int32_t dsize)
+{
+	simCacheStats.maintenanceCalls++;
+	SimCache_access(addr, (uint32_t)dsize, SIM_CACHE_CLEAN);
+}
+
+void SCB_InvalidateDCache_by_Addr(void *addr, int32_t dsize)
+{
+	simCacheStats.maintenanceCalls++;
+	SimCache_access(addr, (uint32_t)dsize, SIM_CACHE_INVALIDATE);
+}
+
+void SCB_CleanInvalidateDCache_by_Addr(void *addr, int32_t dsize)
+{
+	simCacheStats.maintenanceCalls++;
+	SimCache_access(addr, (uint32_t)dsize, SIM_CACHE_CLEAN);
+	SimCache_access(addr, (uint32_t)dsize, SIM_CACHE_INVALIDATE);
+}
+
+void SCB_InvalidateICache(void)
+{
+	simCacheStats.maintenanceCalls++;
+}
+
+uint32_t __get_PRIMASK(void)
+{
+	return simQspiPrimask;
+}
+
+void __disable_irq(void)
+{
+	if (simQspiPrimask == 0u) {
+		pthread_mutex_lock(&simQspiIrqLock);
+		simQspiPrimask = 1u;
+	}
+}
+
+void __enable_irq(void)
+{
+	if (simQspiPrimask != 0u) {
+		simQspiPrimask = 0u;
+		pthread_mutex_unlock(&simQspiIrqLock);
+	}
+}
+
+/*
+ * Time and reset
+ */
+uint32_t HAL_GetTick(void)
+{
+	return (uint32_t)(SimQspi_nowNs() / 1000000u);
+}
+
+void HAL_Delay(uint32_t Delay)
+{
+	SimQspi_advanceNs((uint64_t)Delay * 1000000u);
+}
+
+void SimQspi_reset(void)
+{
+	__atomic_store_n(&simQspiNowNs, 0, __ATOMIC_SEQ_CST);
+	SimQspi_resetStats();
+	memset(&simQspiPending, 0, sizeof(simQspiPending));
+	memset(&SimQspi_registers, 0, sizeof(SimQspi_registers));
+	simQspiHalOverheadNs = SIM_QSPI_HAL_OVERHEAD_NS;
+	simQspiState = HAL_QSPI_STATE_READY;
+	simQspiArmed = false;
+	simQspiMapped = false;
+	simQspiMappedNext = UINT32_MAX;
+	simQspiLinkEnabled = false;
+	simQspiInterruptHook = NULL;
+	SimCache_enable(false);
+}
+
+/*
+ * HAL QUADSPI
+ */
+HAL_StatusTypeDef HAL_QSPI_Init(QSPI_HandleTypeDef *hqspi)
+{
+	if (hqspi->Instance == NULL) {
+		hqspi->Instance = QUADSPI;
+	}
+
+	simQspiPrescaler = hqspi->Init.ClockPrescaler & 0xFFu;
+	simQspiSampleShifting = hqspi->Init.SampleShifting;
+	simQspiCsHighCycles = (hqspi->Init.ChipSelectHighTime >> 8) + 1u;
+	simQspiArmed = false;
+	simQspiMapped = false;
+	memset(&simQspiPending, 0, sizeof(simQspiPending));
+
+	SimQspi_halCall();
+	SimQspi_advanceNs(SIM_QSPI_INIT_NS);
+	SimQspi_setState(hqspi, HAL_QSPI_STATE_READY);
+	hqspi->ErrorCode = HAL_QSPI_ERROR_NONE;
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_QSPI_DeInit(QSPI_HandleTypeDef *hqspi)
+{
+	SimQspi_setState(hqspi, HAL_QSPI_STATE_RESET);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_QSPI_Command(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd, uint32_t Timeout)
+{
+	(void)Timeout;
+	SimQspi_halCall();
+
+	if (!SimQspi_ready(hqspi)) {
+		return HAL_BUSY;
+	}
+
+	// A command left armed by a caller that never sent its data is dropped like the real FIFO flush
+	if (simQspiArmed) {
+		SimQspi_finishCommand(true, false);
+	}
+
+	SimQspi_startCommand(cmd);
+
+	if (cmd->DataMode == QSPI_DATA_NONE) {
+		SimQspi_finishCommand(false, true);
+	} else {
+		simQspiArmed = true;
+		hqspi->Instance->CCR = 0;
+		hqspi->Instance->AR = cmd->Address;
+		hqspi->Instance->DLR = cmd->NbData - 1u;
+	}
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_QSPI_Receive(QSPI_HandleTypeDef *hqspi, uint8_t *pData, uint32_t Timeout)
+{
+	(void)Timeout;
+	SimQspi_halCall();
+
+	if (!SimQspi_ready(hqspi)) {
+		return HAL_BUSY;
+	}
+
+	if (!simQspiArmed) {
+		return HAL_ERROR;
+	}
+
+	uint32_t length = simQspiRemaining;
+
+	for (uint32_t i = 0; i < length; i++) {
+		pData[i] = SimQspi_receiveByte();
+	}
+
+	SimCache_cpuWrite(pData, length);
+	SimQspi_finishCommand(false, true);
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_QSPI_Transmit(QSPI_HandleTypeDef *hqspi, uint8_t *pData, uint32_t Timeout)
+{
+	(void)Timeout;
+	SimQspi_halCall();
+
+	if (!SimQspi_ready(hqspi)) {
+		return HAL_BUSY;
+	}
+
+	if (!simQspiArmed) {
+		return HAL_ERROR;
+	}
+
+	uint32_t length = simQspiRemaining;
+
+	SimCache_cpuRead(pData, length);
+	for (uint32_t i = 0; i < length; i++) {
+		SimQspi_transmitByte(pData[i]);
+	}
+
+	SimQspi_finishCommand(false, true);
+
+	return HAL_OK;
+}
+
+bool SimQspi_getFlag(QSPI_HandleTypeDef *hqspi, uint32_t flag)
+{
+	bool set = false;
+
+	if (!simQspiArmed) {
+		return (flag & QSPI_FLAG_TC) != 0u;
+	}
+
+	if ((hqspi->Instance->CCR & QUADSPI_CCR_FMODE) == QUADSPI_CCR_FMODE_0) {
+		if ((flag & QSPI_FLAG_FT) && (simQspiRemaining > 0)) {
+			hqspi->Instance->DR = SimQspi_receiveByte();
+			set = true;
+		} else if ((flag & QSPI_FLAG_TC) && (simQspiRemaining == 0)) {
+			SimQspi_finishCommand(false, true);
+			set = true;
+		}
+	} else {
+		// The byte written after the previous FT is taken from the data register now
+		if (simQspiTxSlot) {
+			SimQspi_transmitByte((uint8_t)hqspi->Instance->DR);
+			simQspiTxSlot = false;
+		}
+
+		if ((flag & QSPI_FLAG_FT) && (simQspiRemaining > 0)) {
+			simQspiTxSlot = true;
+			set = true;
+		} else if ((flag & QSPI_FLAG_TC) && (simQspiRemaining == 0)) {
+			SimQspi_finishCommand(false, true);
+			set = true;
+		}
+	}
+
+	if (!set) {
+		SimQspi_advanceNs(SIM_QSPI_IDLE_POLL_NS);
+	}
+
+	return set;
+}
+
+void SimQspi_clearFlag(QSPI_HandleTypeDef *hqspi, uint32_t flag)
+{
+	(void)hqspi;
+	(void)flag;
+}
+
+static HAL_StatusTypeDef SimQspi_startTransfer(QSPI_HandleTypeDef *hqspi, uint8_t *pData, SimQspiPendingType type, bool dma)
+{
+	SimQspi_halCall();
+
+	if (!SimQspi_ready(hqspi)) {
+		return HAL_BUSY;
+	}
+
+	if (!simQspiArmed || (dma && (hqspi->hmdma == NULL))) {
+		return HAL_ERROR;
+	}
+
+	simQspiPending.type = type;
+	simQspiPending.hqspi = hqspi;
+	simQspiPending.data = pData;
+	simQspiPending.length = simQspiRemaining;
+	simQspiPending.dma = dma;
+	simQspiPending.due = SimQspi_nowNs() + SimQspi_cyclesToNs(SimQspi_cycles(&simQspiCmd, simQspiRemaining));
+
+	// The MDMA starts filling the FIFO from RAM right away, anything still dirty in the cache is missed
+	if (dma && (type == SIM_QSPI_PENDING_TX)) {
+		SimCache_access(pData, simQspiRemaining, SIM_CACHE_DMA_READ);
+	}
+
+	SimQspi_setState(hqspi, (type == SIM_QSPI_PENDING_RX) ? HAL_QSPI_STATE_BUSY_INDIRECT_RX : HAL_QSPI_STATE_BUSY_INDIRECT_TX);
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_QSPI_Transmit_IT(QSPI_HandleTypeDef *hqspi, uint8_t *pData)
+{
+	return SimQspi_startTransfer(hqspi, pData, SIM_QSPI_PENDING_TX, false);
+}
+
+HAL_StatusTypeDef HAL_QSPI_Receive_IT(QSPI_HandleTypeDef *hqspi, uint8_t *pData)
+{
+	return SimQspi_startTransfer(hqspi, pData, SIM_QSPI_PENDING_RX, false);
+}
+
+HAL_StatusTypeDef HAL_QSPI_Transmit_DMA(QSPI_HandleTypeDef *hqspi, uint8_t *pData)
+{
+	return SimQspi_startTransfer(hqspi, pData, SIM_QSPI_PENDING_TX, true);
+}
+
+HAL_StatusTypeDef HAL_QSPI_Receive_DMA(QSPI_HandleTypeDef *hqspi, uint8_t *pData)
+{
+	return SimQspi_startTransfer(hqspi, pData, SIM_QSPI_PENDING_RX, true);
+}
+
+HAL_StatusTypeDef HAL_QSPI_Command_IT(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd)
+{
+	if (cmd->DataMode != QSPI_DATA_NONE) {
+		return HAL_QSPI_Command(hqspi, cmd, 0);
+	}
+
+	SimQspi_halCall();
+
+	if (!SimQspi_ready(hqspi)) {
+		return HAL_BUSY;
+	}
+
+	SimQspi_startCommand(cmd);
+	simQspiArmed = true;
+	simQspiPending.type = SIM_QSPI_PENDING_CMD;
+	simQspiPending.hqspi = hqspi;
+	simQspiPending.due = SimQspi_nowNs() + SimQspi_cyclesToNs(SimQspi_cycles(cmd, 0));
+	SimQspi_setState(hqspi, HAL_QSPI_STATE_BUSY);
+
+	return HAL_OK;
+}
+
+//! One status read as the controller does it, returns true on a match
+static bool SimQspi_pollOnce(const QSPI_CommandTypeDef *cmd, const QSPI_AutoPollingTypeDef *cfg, bool chargeTime)
+{
+	SimQspi_startCommand(cmd);
+	uint8_t status = SimQspi_receiveByte();
+	SimQspi_finishCommand(false, chargeTime);
+	simQspiStats.autoPollReads++;
+
+	return ((status & cfg->Mask) == (cfg->Match & cfg->Mask));
+}
+
+//! Status reads the controller makes while the part is busy, counted without running each one
+static uint64_t SimQspi_pollsUntil(const QSPI_CommandTypeDef *cmd, uint64_t from, uint64_t until, uint64_t periodNs)
+{
+	uint64_t polls = 0;
+
+	if (until > from) {
+		polls = (until - from + periodNs - 1u) / periodNs;
+		SimQspi_countTransaction(cmd, SimQspi_cycles(cmd, 1), polls);
+		simQspiStats.autoPollReads += polls;
+		simQspiStats.dataBytes += polls;
+	}
+
+	return polls;
+}
+
+HAL_StatusTypeDef HAL_QSPI_AutoPolling(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd, QSPI_AutoPollingTypeDef *cfg, uint32_t Timeout)
+{
+	SimQspi_halCall();
+
+	if (!SimQspi_ready(hqspi)) {
+		return HAL_BUSY;
+	}
+
+	uint64_t start = SimQspi_nowNs();
+	uint64_t limit = start + ((uint64_t)Timeout * 1000000u);
+	uint64_t periodNs = SimQspi_cyclesToNs(SimQspi_cycles(cmd, 1) + cfg->Interval);
+	HAL_StatusTypeDef status = HAL_OK;
+
+	while (!SimQspi_pollOnce(cmd, cfg, true)) {
+		uint64_t now = SimQspi_nowNs();
+		uint64_t ready = SimFlash_readyAtNs();
+
+		if (now >= limit) {
+			status = HAL_TIMEOUT;
+			break;
+		}
+
+		// Jump over the reads that would all see BUSY, the last one lands just after the part is done
+		if (ready > now) {
+			uint64_t until = (ready < limit) ? ready : limit;
+			uint64_t polls = SimQspi_pollsUntil(cmd, now, until, periodNs);
+
+			SimQspi_advanceNs(polls * periodNs);
+		} else if (ready == now) {
+			SimQspi_advanceNs(SimQspi_cyclesToNs(cfg->Interval));
+		} else {
+			// Nothing will change on its own, run the reads out to the timeout
+			SimQspi_pollsUntil(cmd, now, limit, periodNs);
+			__atomic_store_n(&simQspiNowNs, limit, __ATOMIC_SEQ_CST);
+		}
+	}
+
+	SimQspi_setState(hqspi, HAL_QSPI_STATE_READY);
+
+	return status;
+}
+
+HAL_StatusTypeDef HAL_QSPI_AutoPolling_IT(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd, QSPI_AutoPollingTypeDef *cfg)
+{
+	SimQspi_halCall();
+
+	if (!SimQspi_ready(hqspi)) {
+		return HAL_BUSY;
+	}
+
+	uint64_t now = SimQspi_nowNs();
+	uint64_t periodNs = SimQspi_cyclesToNs(SimQspi_cycles(cmd, 1) + cfg->Interval);
+	uint64_t ready = SimFlash_readyAtNs();
+
+	simQspiCmd = *cmd;
+	simQspiPending.type = SIM_QSPI_PENDING_POLL;
+	simQspiPending.hqspi = hqspi;
+	simQspiPending.poll = *cfg;
+	simQspiPending.pollStart = now;
+	simQspiPending.due = now + periodNs;
+
+	if (ready > now) {
+		simQspiPending.due = now + (((ready - now + periodNs - 1u) / periodNs) * periodNs);
+	}
+
+	SimQspi_setState(hqspi, HAL_QSPI_STATE_BUSY_AUTO_POLLING);
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_QSPI_MemoryMapped(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd, QSPI_MemoryMappedTypeDef *cfg)
+{
+	SimQspi_halCall();
+
+	if (!SimQspi_ready(hqspi)) {
+		return HAL_BUSY;
+	}
+
+	// Nothing goes out until the first access, the check just makes a bad read command count
+	QSPI_CommandTypeDef probe = *cmd;
+	probe.NbData = 1;
+	SimFlash_begin(&probe);
+	SimFlash_end(true);
+
+	simQspiMapped = true;
+	simQspiMappedCmd = *cmd;
+	simQspiMappedNext = UINT32_MAX;
+	simQspiMappedWindow = 1ull << (hqspi->Init.FlashSize + 1u);
+	simQspiMappedRelease = (cfg->TimeOutActivation == QSPI_TIMEOUT_COUNTER_ENABLE);
+	simQspiMappedWrap = SimFlash_wrapLength(cmd);
+
+	if ((cmd->AddressSize != QSPI_ADDRESS_32_BITS) && (simQspiMappedWindow > (1ull << 24))) {
+		simQspiMappedWindow = 1ull << 24;
+	}
+	SimQspi_setState(hqspi, HAL_QSPI_STATE_BUSY_MEM_MAPPED);
+
+	return HAL_OK;
+}
+
+const uint8_t *SimQspi_mappedBase(void)
+{
+	return SimFlash_mappedArray();
+}
+
+void SimQspi_mappedFetch(uint32_t address, uint32_t length)
+{
+	if (!simQspiMapped || (length == 0)) {
+		return;
+	}
+
+	uint32_t first = address & ~(SIM_QSPI_MAPPED_LINE - 1u);
+	uint32_t end = address + length;
+
+	for (uint32_t line = first; line < end; line += SIM_QSPI_MAPPED_LINE) {
+		uint32_t missed = ((line < address) ? address : line) - line;
+		uint64_t cycles;
+		uint64_t criticalCycles;
+
+		if ((line + SIM_QSPI_MAPPED_LINE) > simQspiMappedWindow) {
+			simQspiStats.mappedOutOfWindow++;
+		}
+
+		// The line just fetched is still in the prefetch buffer
+		if ((line + SIM_QSPI_MAPPED_LINE) == simQspiMappedNext) {
+			continue;
+		}
+
+		uint32_t dataLines = SimQspi_lines(simQspiMappedCmd.DataMode, QSPI_DATA_1_LINE, QSPI_DATA_2_LINES, QSPI_DATA_4_LINES);
+		bool ddr = (simQspiMappedCmd.DdrMode == QSPI_DDR_MODE_ENABLE);
+
+		// The controller keeps chip select low after a line and streams the next one if it is asked for in time
+		if ((line == simQspiMappedNext) && !simQspiMappedRelease) {
+			cycles = SimQspi_phaseCycles(8u * SIM_QSPI_MAPPED_LINE, dataLines, ddr);
+			criticalCycles = SimQspi_phaseCycles(8u * (missed + 1u), dataLines, ddr);
+		} else {
+			// A wrapping read is sent for the missed byte, the rest of the line follows it
+			cycles = SimQspi_cycles(&simQspiMappedCmd, SIM_QSPI_MAPPED_LINE);
+			criticalCycles = SimQspi_cycles(&simQspiMappedCmd, (simQspiMappedWrap == SIM_QSPI_MAPPED_LINE) ? 1u : (missed + 1u));
+			simQspiStats.transactions++;
+			simQspiStats.opcodes[simQspiMappedCmd.Instruction & 0xFFu]++;
+		}
+
+		simQspiStats.busCycles += cycles;
+		simQspiStats.busNs += SimQspi_cyclesToNs(cycles);
+		simQspiStats.mappedFetches++;
+		simQspiStats.mappedBytes += SIM_QSPI_MAPPED_LINE;
+		simQspiStats.mappedCriticalNs += SimQspi_cyclesToNs(criticalCycles);
+		SimQspi_advanceNs(SimQspi_cyclesToNs(cycles));
+		simQspiMappedNext = line + SIM_QSPI_MAPPED_LINE;
+	}
+}
+
+HAL_StatusTypeDef HAL_QSPI_Abort(QSPI_HandleTypeDef *hqspi)
+{
+	SimQspi_halCall();
+
+	if (simQspiArmed) {
+		SimQspi_finishCommand(true, false);
+	}
+
+	simQspiMapped = false;
+	memset(&simQspiPending, 0, sizeof(simQspiPending));
+	SimQspi_setState(hqspi, HAL_QSPI_STATE_READY);
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_QSPI_Abort_IT(QSPI_HandleTypeDef *hqspi)
+{
+	return HAL_QSPI_Abort(hqspi);
+}
+
+HAL_QSPI_StateTypeDef HAL_QSPI_GetState(QSPI_HandleTypeDef *hqspi)
+{
+	(void)hqspi;
+	return simQspiState;
+}
+
+uint32_t HAL_QSPI_GetError(QSPI_HandleTypeDef *hqspi)
+{
+	return hqspi->ErrorCode;
+}
+
+void HAL_QSPI_SetTimeout(QSPI_HandleTypeDef *hqspi, uint32_t Timeout)
+{
+	hqspi->Timeout = Timeout;
+}
+
+// Like the HAL, empty unless the application or quadspi.c with QUADSPI_HAL_CALLBACKS provides them
+__weak void HAL_QSPI_RxCpltCallback(QSPI_HandleTypeDef *hqspi)
+{
+	(void)hqspi;
+}
+
+__weak void HAL_QSPI_TxCpltCallback(QSPI_HandleTypeDef *hqspi)
+{
+	(void)hqspi;
+}
+
+__weak void HAL_QSPI_CmdCpltCallback(QSPI_HandleTypeDef *hqspi)
+{
+	(void)hqspi;
+}
+
+__weak void HAL_QSPI_StatusMatchCallback(QSPI_HandleTypeDef *hqspi)
+{
+	(void)hqspi;
+}
+
+__weak void HAL_QSPI_TimeOutCallback(QSPI_HandleTypeDef *hqspi)
+{
+	(void)hqspi;
+}
+
+__weak void HAL_QSPI_ErrorCallback(QSPI_HandleTypeDef *hqspi)
+{
+	(void)hqspi;
+}
+
+/*
+ * Interrupts
+ */
+bool SimQspi_interruptPending(void)
+{
+	return (simQspiPending.type != SIM_QSPI_PENDING_NONE);
+}
+
+//! Completes the pending transfer, returns the callback to run once the peripheral is idle again
+static void (*SimQspi_complete(void))(QSPI_HandleTypeDef *)
+{
+	SimQspiPending *pending = &simQspiPending;
+	void (*callback)(QSPI_HandleTypeDef *) = NULL;
+
+	switch (pending->type) {
+	case SIM_QSPI_PENDING_RX:
+		for (uint32_t i = 0; i < pending->length; i++) {
+			pending->data[i] = SimQspi_receiveByte();
+		}
+		SimCache_access(pending->data, pending->length, pending->dma ? SIM_CACHE_DMA_WRITE : SIM_CACHE_CPU_WRITE);
+		SimQspi_finishCommand(false, false);
+		callback = HAL_QSPI_RxCpltCallback;
+		break;
+	case SIM_QSPI_PENDING_TX:
+		for (uint32_t i = 0; i < pending->length; i++) {
+			SimQspi_transmitByte(pending->data[i]);
+		}
+		SimQspi_finishCommand(false, false);
+		callback = HAL_QSPI_TxCpltCallback;
+		break;
+	case SIM_QSPI_PENDING_CMD:
+		SimQspi_finishCommand(false, false);
+		callback = HAL_QSPI_CmdCpltCallback;
+		break;
+	case SIM_QSPI_PENDING_POLL: {
+		uint64_t periodNs = SimQspi_cyclesToNs(SimQspi_cycles(&simQspiCmd, 1) + pending->poll.Interval);
+		uint64_t polls = (pending->due - pending->pollStart) / periodNs;
+
+		// The reads before this one all saw BUSY
+		if (polls > 1) {
+			SimQspi_countTransaction(&simQspiCmd, SimQspi_cycles(&simQspiCmd, 1), polls - 1u);
+			simQspiStats.autoPollReads += polls - 1u;
+		}
+
+		if (SimQspi_pollOnce(&simQspiCmd, &pending->poll, false)) {
+			callback = HAL_QSPI_StatusMatchCallback;
+		} else {
+			uint64_t now = SimQspi_nowNs();
+			uint64_t ready = SimFlash_readyAtNs();
+
+			if ((ready > now) && ((now - pending->pollStart) < SIM_QSPI_POLL_LIMIT_NS)) {
+				// Still busy, the controller keeps reading
+				pending->pollStart = now;
+				pending->due = now + (((ready - now + periodNs - 1u) / periodNs) * periodNs);
+				return NULL;
+			}
+
+			callback = HAL_QSPI_ErrorCallback;
+		}
+		break;
+	}
+	default:
+		break;
+	}
+
+	memset(pending, 0, sizeof(*pending));
+
+	return callback;
+}
+
+bool SimQspi_runInterrupt(void)
+{
+	if ((simQspiPending.type == SIM_QSPI_PENDING_NONE) || (simQspiPrimask != 0u)) {
+		return false;
+	}
+
+	pthread_mutex_lock(&simQspiIrqLock);
+
+	QSPI_HandleTypeDef *hqspi = simQspiPending.hqspi;
+	void (*callback)(QSPI_HandleTypeDef *) = NULL;
+
+	while ((callback == NULL) && (simQspiPending.type != SIM_QSPI_PENDING_NONE)) {
+		// Like WFI, the CPU sleeps until the transfer is over
+		uint64_t now = SimQspi_nowNs();
+
+		if (simQspiPending.due > now) {
+			SimQspi_advanceNs(simQspiPending.due - now);
+		}
+
+		callback = SimQspi_complete();
+	}
+
+	if (callback != NULL) {
+		if (simQspiInterruptHook != NULL) {
+			simQspiInterruptHook();
+		}
+
+		SimQspi_setState(hqspi, HAL_QSPI_STATE_READY);
+		simQspiStats.interrupts++;
+
+		// The handler runs as an ISR, masked against the threads that lock out interrupts
+		simQspiPrimask = 1u;
+		callback(hqspi);
+		simQspiPrimask = 0u;
+	}
+
+	pthread_mutex_unlock(&simQspiIrqLock);
+
+	return (callback != NULL);
+}
+
+uint32_t SimQspi_runInterrupts(void)
+{
+	uint32_t count = 0;
+
+	while (SimQspi_runInterrupt()) {
+		count++;
+	}
+
+	return count;
+}
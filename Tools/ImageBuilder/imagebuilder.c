@@ -0,0 +1,425 @@
+/*
+ * This program is host tool that builds ready-to-burn W25Q and W25N01G images.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Lays data out exactly as the firmware would, using the same region code, so a gang
+ * programmer or a bulk program mode can write the image at bus speed.
+ *
+ *   imagebuilder nor  <image> <bytes>  [raw <offset> <file>] [lz4 <offset> <capacity> <file>] ...
+ *   imagebuilder nand <image> <blocks> [spare <bytes>] [raw <page> <file>] [ringlog <first block> <block count> <file>] ...
+ *
+ * NOR images are plain bytes. NAND images hold 2048 data + 64 spare bytes per page (spare 128 for the
+ * W25N02KV), 64 pages per block, in page order, spare tags and bad block markers laid out by the ring
+ * log code the firmware runs. Blocks counts every die of a stacked part. They assume
+ * no bad blocks: use the programmer's skip-bad-block mode. Build with
+ *   cc -std=c99 -DFLASH_HOST_BUILD -IWinbond/Inc Tools/ImageBuilder/imagebuilder.c
+ *      Winbond/Src/compressedregion.c Winbond/Src/flashlz4.c Winbond/Src/flashverify.c Winbond/Src/ringlog.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compressedregion.h"
+#include "flashverify.h"
+#include "ringlog.h"
+
+#define IMAGE_BUILDER_NOR_ERASE_SIZE		4096
+#define IMAGE_BUILDER_NAND_PAGE_SIZE		2048	//!< Every W25N part
+#define IMAGE_BUILDER_NAND_PAGES_PER_BLOCK	64
+#define IMAGE_BUILDER_NAND_SPARE_SIZE		64		//!< Default, the spare option changes it
+
+typedef struct {
+	uint8_t *data;
+	uint32_t size;
+	uint32_t pages;					//!< NAND only
+	uint32_t pageStride;			//!< NAND data and spare bytes of a page
+} ImageBuilderImage;
+
+static ImageBuilderImage image;
+
+static bool ImageBuilder_loadFile(const char *path, uint8_t **data, uint32_t *length)
+{
+	bool success = false;
+	FILE *file = fopen(path, "rb");
+
+	*data = NULL;
+	*length = 0;
+
+	if (file != NULL) {
+		long size = -1;
+
+		if (fseek(file, 0, SEEK_END) == 0) {
+			size = ftell(file);
+		}
+
+		if ((size >= 0) && (fseek(file, 0, SEEK_SET) == 0)) {
+			*data = malloc((size > 0) ? (size_t)size : 1);
+			*length = (uint32_t)size;
+			success = (*data != NULL) && (fread(*data, 1, (size_t)size, file) == (size_t)size);
+		}
+
+		fclose(file);
+	}
+
+	if (!success) {
+		fprintf(stderr, "cannot read %s\n", path);
+		free(*data);
+		*data = NULL;
+	}
+
+	return success;
+}
+
+static bool ImageBuilder_parse(const char *text, uint32_t *value)
+{
+	char *end = NULL;
+	unsigned long parsed = strtoul(text, &end, 0);
+
+	*value = (uint32_t)parsed;
+
+	return (end != text) && (*end == '\0');
+}
+
+// NOR model: programming only clears bits, erasing sets whole sectors
+static bool ImageBuilder_norRead(void *context, uint32_t address, uint8_t *buffer, uint32_t length)
+{
+	bool success = (address <= image.size) && (length <= (image.size - address));
+
+	if (success) {
+		memcpy(buffer, &image.data[address], length);
+	}
+
+	return success;
+}
+
+static bool ImageBuilder_norProgram(void *context, uint32_t address, const uint8_t *buffer, uint32_t length)
+{
+	bool success = (address <= image.size) && (length <= (image.size - address));
+
+	for (uint32_t i = 0; success && (i < length); i++) {
+		image.data[address + i] &= buffer[i];
+	}
+
+	return success;
+}
+
+static bool ImageBuilder_norErase(void *context, uint32_t address, uint32_t length)
+{
+	bool success = (address <= image.size) && (length <= (image.size - address));
+
+	if (success) {
+		memset(&image.data[address], 0xFF, length);
+	}
+
+	return success;
+}
+
+static const CompressedRegionIo imageBuilderNorIo = {
+	.read		= ImageBuilder_norRead,
+	.program	= ImageBuilder_norProgram,
+	.erase		= ImageBuilder_norErase,
+	.context	= NULL,
+	.eraseSize	= IMAGE_BUILDER_NOR_ERASE_SIZE,
+};
+
+static uint8_t *ImageBuilder_nandPage(uint32_t page)
+{
+	return &image.data[page * image.pageStride];
+}
+
+// NAND model for the ring log, spare tags land where RingLog_w25n01gIo puts them
+static bool ImageBuilder_nandReadData(void *context, uint32_t page, uint32_t column, uint8_t *buffer, uint32_t length)
+{
+	bool success = (page < image.pages) && ((column + length) <= image.pageStride);
+
+	if (success) {
+		memcpy(buffer, &ImageBuilder_nandPage(page)[column], length);
+	}
+
+	return success;
+}
+
+static bool ImageBuilder_nandReadTags(void *context, uint32_t page, uint32_t *sequence, uint32_t *lengthWord)
+{
+	bool success = (page < image.pages);
+
+	if (success) {
+		RingLog_decodeTags(&ImageBuilder_nandPage(page)[IMAGE_BUILDER_NAND_PAGE_SIZE + RING_LOG_SPARE_SEQUENCE], sequence, lengthWord);
+	}
+
+	return success;
+}
+
+static bool ImageBuilder_nandStartProgram(void *context, uint32_t page, const uint8_t *data, uint32_t sequence, uint32_t lengthWord)
+{
+	bool success = (page < image.pages);
+
+	if (success) {
+		uint8_t *target = ImageBuilder_nandPage(page);
+
+		memcpy(target, data, IMAGE_BUILDER_NAND_PAGE_SIZE);
+		RingLog_encodeTags(&target[IMAGE_BUILDER_NAND_PAGE_SIZE + RING_LOG_SPARE_SEQUENCE], sequence, lengthWord);
+	}
+
+	return success;
+}
+
+static bool ImageBuilder_nandStartErase(void *context, uint32_t block)
+{
+	bool success = (((block + 1) * IMAGE_BUILDER_NAND_PAGES_PER_BLOCK) <= image.pages);
+
+	if (success) {
+		memset(ImageBuilder_nandPage(block * IMAGE_BUILDER_NAND_PAGES_PER_BLOCK), 0xFF, IMAGE_BUILDER_NAND_PAGES_PER_BLOCK * image.pageStride);
+	}
+
+	return success;
+}
+
+static bool ImageBuilder_nandPoll(void *context, bool *busy, bool *failed)
+{
+	*busy = false;
+	*failed = false;
+
+	return true;
+}
+
+static bool ImageBuilder_nandIsBlockBad(void *context, uint32_t block)
+{
+	return (ImageBuilder_nandPage(block * IMAGE_BUILDER_NAND_PAGES_PER_BLOCK)[IMAGE_BUILDER_NAND_PAGE_SIZE + RING_LOG_SPARE_BAD_BLOCK] != 0xFF);
+}
+
+static bool ImageBuilder_nandMarkBlockBad(void *context, uint32_t block)
+{
+	return false;
+}
+
+// totalBlocks is set once the image size is known
+static RingLogIo imageBuilderNandIo = {
+	.readData		= ImageBuilder_nandReadData,
+	.readTags		= ImageBuilder_nandReadTags,
+	.startProgram	= ImageBuilder_nandStartProgram,
+	.startErase		= ImageBuilder_nandStartErase,
+	.poll			= ImageBuilder_nandPoll,
+	.isBlockBad		= ImageBuilder_nandIsBlockBad,
+	.markBlockBad	= ImageBuilder_nandMarkBlockBad,
+	.context		= NULL,
+	.pageSize		= IMAGE_BUILDER_NAND_PAGE_SIZE,
+	.pagesPerBlock	= IMAGE_BUILDER_NAND_PAGES_PER_BLOCK,
+};
+
+static bool ImageBuilder_norRaw(uint32_t offset, const char *path)
+{
+	uint8_t *data;
+	uint32_t length;
+	bool success = ImageBuilder_loadFile(path, &data, &length);
+
+	if (success) {
+		success = ImageBuilder_norProgram(NULL, offset, data, length);
+		printf("raw     0x%08lX %8lu bytes  %s\n", (unsigned long)offset, (unsigned long)length, path);
+	}
+
+	free(data);
+	return success;
+}
+
+static bool ImageBuilder_norLz4(uint32_t offset, uint32_t capacity, const char *path)
+{
+	static CompressedRegion region;
+	uint8_t *data;
+	uint32_t length;
+	bool success = ImageBuilder_loadFile(path, &data, &length);
+
+	if (success) {
+		uint32_t maxFrames = (length + COMPRESSED_REGION_FRAME_SIZE - 1) / COMPRESSED_REGION_FRAME_SIZE;
+		uint32_t *index = malloc((maxFrames + 1) * sizeof(uint32_t));
+
+		success = (index != NULL) && CompressedRegion_create(&region, &imageBuilderNorIo, offset, capacity, index, maxFrames);
+
+		if (success) {
+			success = CompressedRegion_write(&region, data, length) && CompressedRegion_finish(&region);
+		}
+
+		if (success) {
+			printf("lz4     0x%08lX %8lu bytes  %s, stored %lu.%lu%%\n", (unsigned long)offset, (unsigned long)length, path,
+					(unsigned long)(CompressedRegion_ratioPermille(&region) / 10), (unsigned long)(CompressedRegion_ratioPermille(&region) % 10));
+		}
+
+		free(index);
+	}
+
+	free(data);
+	return success;
+}
+
+static bool ImageBuilder_nandRaw(uint32_t page, const char *path)
+{
+	uint8_t *data;
+	uint32_t length;
+	bool success = ImageBuilder_loadFile(path, &data, &length);
+
+	for (uint32_t done = 0; success && (done < length); done += IMAGE_BUILDER_NAND_PAGE_SIZE) {
+		uint32_t target = page + (done / IMAGE_BUILDER_NAND_PAGE_SIZE);
+		uint32_t chunk = ((length - done) < IMAGE_BUILDER_NAND_PAGE_SIZE) ? (length - done) : IMAGE_BUILDER_NAND_PAGE_SIZE;
+
+		success = (target < image.pages);
+		if (success) {
+			memcpy(ImageBuilder_nandPage(target), &data[done], chunk);
+		}
+	}
+
+	if (success) {
+		printf("raw     page %6lu %8lu bytes  %s\n", (unsigned long)page, (unsigned long)length, path);
+	}
+
+	free(data);
+	return success;
+}
+
+static bool ImageBuilder_nandRingLog(uint32_t firstBlock, uint32_t blockCount, const char *path)
+{
+	static RingLog log;
+	uint8_t *data;
+	uint32_t length;
+	bool success = ImageBuilder_loadFile(path, &data, &length);
+
+	if (success) {
+		success = RingLog_open(&log, &imageBuilderNandIo, firstBlock, blockCount) &&
+				RingLog_append(&log, data, length) &&
+				RingLog_flush(&log);
+	}
+
+	if (success) {
+		printf("ringlog block %5lu %8lu bytes  %s, %lu pages, %lu dropped as the log wrapped\n",
+				(unsigned long)firstBlock, (unsigned long)length, path,
+				(unsigned long)log.stats.pagesProgrammed, (unsigned long)log.stats.blocksOverwritten * IMAGE_BUILDER_NAND_PAGES_PER_BLOCK);
+	}
+
+	free(data);
+	return success;
+}
+
+static int ImageBuilder_usage(void)
+{
+	fprintf(stderr,
+			"usage: imagebuilder nor  <image> <bytes>  [raw <offset> <file>] [lz4 <offset> <capacity> <file>] ...\n"
+			"       imagebuilder nand <image> <blocks> [spare <bytes>] [raw <page> <file>] [ringlog <first block> <block count> <file>] ...\n");
+	return 2;
+}
+
+int main(int argc, char **argv)
+{
+	bool nand;
+	uint32_t size;
+	uint32_t spare = IMAGE_BUILDER_NAND_SPARE_SIZE;
+	bool success = true;
+	int first = 4;
+
+	if ((argc < 4) || !ImageBuilder_parse(argv[3], &size) || (size == 0)) {
+		return ImageBuilder_usage();
+	}
+
+	// The tags end inside the smallest spare, the bad block marker is its first byte
+	if ((argc > 5) && (strcmp(argv[4], "spare") == 0)) {
+		if (!ImageBuilder_parse(argv[5], &spare) || (spare < (RING_LOG_SPARE_SEQUENCE + RING_LOG_TAGS_SIZE))) {
+			return ImageBuilder_usage();
+		}
+		first = 6;
+	}
+
+	if (strcmp(argv[1], "nand") == 0) {
+		nand = true;
+		image.pages = size * IMAGE_BUILDER_NAND_PAGES_PER_BLOCK;
+		image.pageStride = IMAGE_BUILDER_NAND_PAGE_SIZE + spare;
+		image.size = image.pages * image.pageStride;
+		imageBuilderNandIo.totalBlocks = size;
+	} else if (first != 4) {
+		return ImageBuilder_usage();
+	} else if (strcmp(argv[1], "nor") == 0) {
+		nand = false;
+		image.size = size;
+	} else {
+		return ImageBuilder_usage();
+	}
+
+	// Blank flash reads back as 0xFF, spare areas included
+	image.data = malloc(image.size);
+	if (image.data == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	memset(image.data, 0xFF, image.size);
+
+	for (int arg = first; success && (arg < argc); ) {
+		uint32_t a;
+		uint32_t b;
+
+		if ((strcmp(argv[arg], "raw") == 0) && ((arg + 2) < argc) && ImageBuilder_parse(argv[arg + 1], &a)) {
+			success = nand ? ImageBuilder_nandRaw(a, argv[arg + 2]) : ImageBuilder_norRaw(a, argv[arg + 2]);
+			arg += 3;
+		} else if (!nand && (strcmp(argv[arg], "lz4") == 0) && ((arg + 3) < argc) &&
+				ImageBuilder_parse(argv[arg + 1], &a) && ImageBuilder_parse(argv[arg + 2], &b)) {
+			success = ImageBuilder_norLz4(a, b, argv[arg + 3]);
+			arg += 4;
+		} else if (nand && (strcmp(argv[arg], "ringlog") == 0) && ((arg + 3) < argc) &&
+				ImageBuilder_parse(argv[arg + 1], &a) && ImageBuilder_parse(argv[arg + 2], &b)) {
+			success = ImageBuilder_nandRingLog(a, b, argv[arg + 3]);
+			arg += 4;
+		} else {
+			free(image.data);
+			return ImageBuilder_usage();
+		}
+
+		if (!success) {
+			fprintf(stderr, "failed to place %s\n", argv[arg - 1]);
+		}
+	}
+
+	if (success) {
+		FILE *file = fopen(argv[2], "wb");
+
+		success = (file != NULL) && (fwrite(image.data, 1, image.size, file) == image.size);
+		if (file != NULL) {
+			success = (fclose(file) == 0) && success;
+		}
+
+		if (success) {
+			FlashVerifySha256 sha;
+			uint8_t digest[FLASH_VERIFY_SHA256_SIZE];
+
+			FlashVerify_sha256Init(&sha);
+			FlashVerify_sha256Update(&sha, image.data, image.size);
+			FlashVerify_sha256Final(&sha, digest);
+
+			printf("%s: %lu bytes, crc32 %08lX, sha256 ", argv[2], (unsigned long)image.size,
+					(unsigned long)FlashVerify_crc32Update(0, image.data, image.size));
+			for (uint32_t i = 0; i < sizeof(digest); i++) {
+				printf("%02x", digest[i]);
+			}
+			printf("\n");
+		} else {
+			fprintf(stderr, "cannot write %s\n", argv[2]);
+		}
+	}
+
+	free(image.data);
+	return success ? 0 : 1;
+}
@@ -0,0 +1,197 @@
+/*
+ * This program is host tool that replays QUADSPI command traces against a simulated W25Q/W25N part.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Reproduces a field trace offline:
+ *
+ *   tracereplay <w25q128jv|w25q256jv|w25m512jv|w25n01gv|w25m02gv> <trace> [<trace clock Hz>]
+ *
+ * The trace is the raw QuadSpiTraceRecord array from QuadSpiTrace_copy, oldest first, dumped from
+ * a unit built with the same compiler family. Recorded durations are converted with the trace
+ * clock (480 MHz DWT by default). Prints the time by opcode as recorded and as replayed on the
+ * simulated part, then the wasted polls and redundant operations of both runs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simflash.h"
+#include "simqspi.h"
+#include "quadspi.h"
+#include "quadspitrace.h"
+
+#define TRACE_REPLAY_CLOCK_HZ		480000000u
+#define TRACE_REPLAY_SCRATCH		(1024u * 1024u)
+#define TRACE_REPLAY_FLASH_SIZE		26
+
+typedef struct {
+	const char *name;
+	const SimFlashModel *model;
+} TraceReplayPart;
+
+static const TraceReplayPart traceReplayParts[] = {
+	{ "w25q128jv",	&SimFlash_w25q128jvIm },
+	{ "w25q256jv",	&SimFlash_w25q256jvIq },
+	{ "w25m512jv",	&SimFlash_w25m512jv },
+	{ "w25n01gv",	&SimFlash_w25n01gv },
+	{ "w25m02gv",	&SimFlash_w25m02gv },
+};
+
+static QSPI_HandleTypeDef traceReplayQspi;
+
+static QuadSpiTraceRecord *TraceReplay_load(const char *path, uint32_t *count)
+{
+	QuadSpiTraceRecord *records = NULL;
+	FILE *file = fopen(path, "rb");
+	long size = -1;
+
+	*count = 0;
+
+	if (file != NULL) {
+		if (fseek(file, 0, SEEK_END) == 0) {
+			size = ftell(file);
+		}
+
+		if ((size > 0) && ((size % (long)sizeof(QuadSpiTraceRecord)) == 0) && (fseek(file, 0, SEEK_SET) == 0)) {
+			records = malloc((size_t)size);
+			*count = (uint32_t)(size / (long)sizeof(QuadSpiTraceRecord));
+
+			if ((records != NULL) && (fread(records, 1, (size_t)size, file) != (size_t)size)) {
+				free(records);
+				records = NULL;
+			}
+		}
+
+		fclose(file);
+	}
+
+	if (records == NULL) {
+		fprintf(stderr, "cannot read %s as %u byte trace records\n", path, (unsigned)sizeof(QuadSpiTraceRecord));
+	}
+
+	return records;
+}
+
+static uint64_t TraceReplay_opcodeDuration(const QuadSpiTraceReport *report, uint8_t opcode)
+{
+	uint64_t duration = 0;
+
+	for (uint32_t i = 0; i < report->opcodeCount; i++) {
+		if (report->opcodes[i].opcode == opcode) {
+			duration = report->opcodes[i].duration;
+		}
+	}
+
+	return duration;
+}
+
+static void TraceReplay_print(const QuadSpiTraceReport *recorded, const QuadSpiTraceReport *replayed, uint32_t clockHz)
+{
+	double recordedScale = 1e6 / clockHz;
+
+	printf("opcode,count,bytes,recorded_us,replayed_us\n");
+
+	for (uint32_t i = 0; i < recorded->opcodeCount; i++) {
+		const QuadSpiTraceOpcode *entry = &recorded->opcodes[i];
+
+		printf("0x%02X,%u,%u,%.3f,%.3f\n", entry->opcode, entry->count, entry->bytes,
+				(double)entry->duration * recordedScale,
+				(double)TraceReplay_opcodeDuration(replayed, entry->opcode) / 1e3);
+	}
+
+	printf("\n,recorded,replayed\n");
+	printf("records,%u,%u\n", recorded->records, replayed->records);
+	printf("failures,%u,%u\n", recorded->failures, replayed->failures);
+	printf("total_us,%.3f,%.3f\n", (double)recorded->duration * recordedScale, (double)replayed->duration / 1e3);
+	printf("status_polls,%u,%u\n", recorded->statusPolls, replayed->statusPolls);
+	printf("wasted_polls,%u,%u\n", recorded->wastedPolls, replayed->wastedPolls);
+	printf("redundant_page_reads,%u,%u\n", recorded->redundantPageReads, replayed->redundantPageReads);
+	printf("redundant_write_enables,%u,%u\n", recorded->redundantWriteEnables, replayed->redundantWriteEnables);
+	printf("dropped_opcodes,%u,%u\n", recorded->droppedOpcodes, replayed->droppedOpcodes);
+}
+
+int main(int argc, char *argv[])
+{
+	const SimFlashModel *model = NULL;
+	uint32_t clockHz = TRACE_REPLAY_CLOCK_HZ;
+	uint32_t count = 0;
+
+	if ((argc < 3) || (argc > 4)) {
+		fprintf(stderr, "usage: tracereplay <w25q128jv|w25q256jv|w25m512jv|w25n01gv|w25m02gv> <trace> [<trace clock Hz>]\n");
+		return 1;
+	}
+
+	for (uint32_t i = 0; i < sizeof(traceReplayParts) / sizeof(traceReplayParts[0]); i++) {
+		if (strcmp(argv[1], traceReplayParts[i].name) == 0) {
+			model = traceReplayParts[i].model;
+		}
+	}
+
+	if (argc == 4) {
+		clockHz = (uint32_t)strtoul(argv[3], NULL, 0);
+	}
+
+	if ((model == NULL) || (clockHz == 0)) {
+		fprintf(stderr, "unknown part or clock\n");
+		return 1;
+	}
+
+	QuadSpiTraceRecord *records = TraceReplay_load(argv[2], &count);
+	QuadSpiTraceRecord *replay = malloc(((count > 0) ? count : 1u) * sizeof(QuadSpiTraceRecord));
+	uint8_t *scratch = malloc(TRACE_REPLAY_SCRATCH);
+
+	if ((records == NULL) || (replay == NULL) || (scratch == NULL)) {
+		return 1;
+	}
+
+	// Fresh part, erased array, the trace starts from whatever state the unit was in
+	SimQspi_reset();
+	SimFlash_attach(model);
+	memset(scratch, 0xFF, TRACE_REPLAY_SCRATCH);
+
+	if (!QuadSpi_Init(&traceReplayQspi, TRACE_REPLAY_FLASH_SIZE)) {
+		fprintf(stderr, "QUADSPI init failed\n");
+		return 1;
+	}
+
+	uint32_t replayed = QuadSpiTrace_replay(&traceReplayQspi, records, count, scratch, TRACE_REPLAY_SCRATCH, replay, SimQspi_clock);
+
+	QuadSpiTraceReport recordedReport;
+	QuadSpiTraceReport replayedReport;
+
+	QuadSpiTrace_analyze(records, count, &recordedReport);
+	QuadSpiTrace_analyze(replay, replayed, &replayedReport);
+	TraceReplay_print(&recordedReport, &replayedReport, clockHz);
+
+	const SimFlashStats *flash = SimFlash_getStats();
+
+	if ((flash->protocolErrors != 0) || (flash->busyViolations != 0) || (flash->welViolations != 0)) {
+		printf("\nprotocol_errors,%u\nbusy_violations,%u\nwel_violations,%u\n",
+				flash->protocolErrors, flash->busyViolations, flash->welViolations);
+	}
+
+	free(records);
+	free(replay);
+	free(scratch);
+
+	return 0;
+}
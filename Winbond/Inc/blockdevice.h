@@ -0,0 +1,87 @@
+/*
+ * This program is block device adapter for Winbond Serial flash memories.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BLOCKDEVICE_H
+#define __BLOCKDEVICE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "stm32h7xx_hal.h"
+
+// Return codes use the littlefs values so the callbacks can be forwarded as they are
+#define BLOCKDEVICE_OK					0
+#define BLOCKDEVICE_ERR_IO				(-5)	//!< Bus or device error
+#define BLOCKDEVICE_ERR_CORRUPT			(-84)	//!< Bad block, caller should relocate
+#define BLOCKDEVICE_ERR_INVAL			(-22)	//!< Out of range or misaligned request
+
+// Tunable cache and lookahead sizes (bytes)
+#ifndef BLOCKDEVICE_W25Q_READ_SIZE
+#define BLOCKDEVICE_W25Q_READ_SIZE			1
+#endif
+#ifndef BLOCKDEVICE_W25Q_CACHE_SIZE
+#define BLOCKDEVICE_W25Q_CACHE_SIZE			256
+#endif
+#ifndef BLOCKDEVICE_W25Q_LOOKAHEAD_SIZE
+#define BLOCKDEVICE_W25Q_LOOKAHEAD_SIZE		32
+#endif
+#ifndef BLOCKDEVICE_W25Q_BLOCK_CYCLES
+#define BLOCKDEVICE_W25Q_BLOCK_CYCLES		500
+#endif
+
+#ifndef BLOCKDEVICE_W25N01G_READ_SIZE
+#define BLOCKDEVICE_W25N01G_READ_SIZE		1
+#endif
+#ifndef BLOCKDEVICE_W25N01G_CACHE_SIZE
+#define BLOCKDEVICE_W25N01G_CACHE_SIZE		2048
+#endif
+#ifndef BLOCKDEVICE_W25N01G_LOOKAHEAD_SIZE
+#define BLOCKDEVICE_W25N01G_LOOKAHEAD_SIZE	32
+#endif
+#ifndef BLOCKDEVICE_W25N01G_BLOCK_CYCLES
+#define BLOCKDEVICE_W25N01G_BLOCK_CYCLES	500
+#endif
+
+typedef struct BlockDevice BlockDevice;
+
+struct BlockDevice {
+	void *context;
+
+	int (*read)(const BlockDevice *bd, uint32_t block, uint32_t offset, void *buffer, uint32_t size);
+	int (*prog)(const BlockDevice *bd, uint32_t block, uint32_t offset, const void *buffer, uint32_t size);
+	int (*erase)(const BlockDevice *bd, uint32_t block);
+	int (*sync)(const BlockDevice *bd);
+
+	// Geometry
+	uint32_t readSize;			//!< Minimum read unit (bytes)
+	uint32_t progSize;			//!< Minimum program unit (bytes)
+	uint32_t blockSize;			//!< Erase unit (bytes)
+	uint32_t blockCount;		//!< Number of erase units
+	uint32_t cacheSize;			//!< Suggested read/program cache size (bytes)
+	uint32_t lookaheadSize;		//!< Suggested allocator lookahead size (bytes)
+	int32_t blockCycles;		//!< Suggested erase cycles before wear leveling moves a block
+};
+
+bool BlockDevice_w25qInit(BlockDevice *bd);
+bool BlockDevice_w25n01gInit(BlockDevice *bd, QSPI_HandleTypeDef *hqspi);
+bool BlockDevice_isBad(const BlockDevice *bd, uint32_t block);
+uint32_t BlockDevice_badBlockCount(const BlockDevice *bd);
+
+#endif /* __BLOCKDEVICE_H */
@@ -0,0 +1,92 @@
+/*
+ * This program is LZ4 compressed storage region for Serial flash memories.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __COMPRESSEDREGION_H
+#define __COMPRESSEDREGION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "flashlz4.h"
+
+#define COMPRESSED_REGION_MAGIC			0x5A4C4352	//!< "RCLZ"
+#define COMPRESSED_REGION_FRAME_SIZE	4096		//!< Uncompressed bytes per frame, frames start 4KB aligned
+#define COMPRESSED_REGION_HEADER_SIZE	32
+#define COMPRESSED_REGION_INDEX_RAW		0x80000000u	//!< Index flag, frame stored uncompressed
+#define COMPRESSED_REGION_NO_FRAME		0xFFFFFFFFu
+
+#ifndef COMPRESSED_REGION_ERASE_AHEAD
+#define COMPRESSED_REGION_ERASE_AHEAD	65536		//!< Erased at once ahead of the frames, a multiple of eraseSize
+#endif
+
+// Flash access, lets the same code run on the target and in host tools
+typedef struct {
+	bool (*read)(void *context, uint32_t address, uint8_t *buffer, uint32_t length);
+	bool (*program)(void *context, uint32_t address, const uint8_t *buffer, uint32_t length);
+	bool (*erase)(void *context, uint32_t address, uint32_t length);
+	void *context;
+	uint32_t eraseSize;							//!< Erase granularity, the index area is rounded up to it
+} CompressedRegionIo;
+
+/*
+ * Layout from the region base:
+ *   header (32 bytes), index of frameCount + 1 little-endian words, padded to eraseSize
+ *   compressed frames, packed back to back
+ * Index word n is the stored offset of frame n from the data start, the last word is the end.
+ * The header is programmed last, so an interrupted write leaves no valid region.
+ */
+typedef struct {
+	const CompressedRegionIo *io;
+	uint32_t base;
+	uint32_t capacity;
+	uint32_t maxFrames;
+	uint32_t dataOffset;				//!< From base, where the first frame is stored
+
+	uint32_t frameCount;
+	uint32_t length;					//!< Uncompressed bytes
+	uint32_t storedBytes;				//!< Compressed bytes, without header and index
+
+	// Writing
+	uint32_t *index;					//!< maxFrames + 1 words supplied by the writer
+	uint32_t fill;
+	uint32_t erasedUntil;				//!< From base, erased just ahead of the frames
+
+	// Reading
+	uint32_t cachedFrame;
+
+	uint8_t frame[COMPRESSED_REGION_FRAME_SIZE];
+	uint8_t stored[FLASH_LZ4_COMPRESS_BOUND(COMPRESSED_REGION_FRAME_SIZE)];
+} CompressedRegion;
+
+#ifndef FLASH_HOST_BUILD
+extern const CompressedRegionIo CompressedRegion_w25qIo;
+#endif
+
+uint32_t CompressedRegion_indexAreaSize(const CompressedRegionIo *io, uint32_t maxFrames);
+
+bool CompressedRegion_create(CompressedRegion *region, const CompressedRegionIo *io, uint32_t base, uint32_t capacity, uint32_t *index, uint32_t maxFrames);
+bool CompressedRegion_write(CompressedRegion *region, const uint8_t *data, uint32_t length);
+bool CompressedRegion_finish(CompressedRegion *region);
+
+bool CompressedRegion_open(CompressedRegion *region, const CompressedRegionIo *io, uint32_t base);
+bool CompressedRegion_read(CompressedRegion *region, uint32_t offset, uint8_t *buffer, uint32_t length);
+uint32_t CompressedRegion_ratioPermille(const CompressedRegion *region);	//!< Stored size per 1000 uncompressed bytes
+
+#endif /* __COMPRESSEDREGION_H */
@@ -0,0 +1,73 @@
+/*
+ * This program is factory bulk programming for W25Q and W25N01G.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __FLASHBULK_H
+#define __FLASHBULK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "stm32h7xx_hal.h"
+
+#ifndef FLASH_BULK_NAND_PROGRAM_TIMEOUT_MS
+#define FLASH_BULK_NAND_PROGRAM_TIMEOUT_MS	2		//!< tPP max 700us
+#endif
+#ifndef FLASH_BULK_NAND_ERASE_TIMEOUT_MS
+#define FLASH_BULK_NAND_ERASE_TIMEOUT_MS	15		//!< tBERS max 10ms
+#endif
+
+typedef enum {
+	FLASH_BULK_ASSUME_BLANK,		//!< Part is known to be erased, e.g. straight from the reel
+	FLASH_BULK_ERASE_RANGE,
+	FLASH_BULK_CHIP_ERASE,			//!< W25Q chip erase on every die, every good block on the W25N01G
+} FlashBulkErase;
+
+// Fills buffer with image bytes from offset, called while the previous page programs
+typedef bool (*FlashBulkSource)(void *context, uint32_t offset, uint8_t *buffer, uint32_t length);
+
+typedef struct {
+	uint32_t pagesProgrammed;
+	uint32_t pagesSkipped;			//!< All 0xFF in the image, left erased
+	uint32_t blocksErased;
+	uint32_t badBlocks;				//!< NAND blocks left alone, factory marked or failing erase
+	uint32_t crc;					//!< CRC32 of the whole image
+	uint32_t elapsedMs;				//!< Erase, program and verify
+	bool verified;
+	uint32_t mismatchOffset;		//!< NAND data that landed on a bad block, a CRC mismatch has no offset
+} FlashBulkResult;
+
+/*
+ * Streams an image onto a blank part at bus speed: one write enable and one program per page,
+ * no per-page status read-back, BUSY polled by the QUADSPI controller while the next page is
+ * fetched, and a single CRC32 read-back over the whole range at the end.
+ * The return value is false on any bus, erase or verify failure.
+ */
+bool FlashBulk_w25qProgram(uint32_t address, uint32_t length, FlashBulkSource source, void *context, FlashBulkErase erase, FlashBulkResult *result);
+/*
+ * address must be page aligned. Bad blocks are skipped by the erase pass and counted, the image is not
+ * shifted around them: it only fails when a page with data lands on a bad block, blank pages there
+ * are left alone and read back as erased during verification.
+ */
+bool FlashBulk_w25n01gProgram(QSPI_HandleTypeDef *hqspi, uint32_t address, uint32_t length, FlashBulkSource source, void *context, FlashBulkErase erase, FlashBulkResult *result);
+
+bool FlashBulk_memorySource(void *context, uint32_t offset, uint8_t *buffer, uint32_t length);	//!< context is the image
+
+#endif /* __FLASHBULK_H */
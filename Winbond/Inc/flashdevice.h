@@ -0,0 +1,285 @@
+/*
+ * This program is generic device layer for Winbond Serial flash memories.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FLASHDEVICE_H
+#define __FLASHDEVICE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "stm32h7xx_hal.h"
+
+#define FLASH_DEVICE_MANUFACTURER_WINBOND	0xEF
+
+#define FLASH_DEVICE_INSTR_JEDEC_ID			0x9F
+#define FLASH_DEVICE_INSTR_WRITE_ENABLE		0x06
+#define FLASH_DEVICE_INSTR_READ_STATUS		0x05	//!< NOR: status register 1, NAND: register address follows
+#define FLASH_DEVICE_INSTR_DIE_SELECT		0xC2	//!< Stacked W25M parts, die ID follows
+#define FLASH_DEVICE_NAND_STATUS_REG		0xC0
+
+// BUSY and WEL share the bit positions on NOR status register 1 and NAND status register 3
+#define FLASH_DEVICE_STATUS_BUSY			(1 << 0)
+#define FLASH_DEVICE_STATUS_WEL				(1 << 1)
+
+// Feature flags
+#define FLASH_DEVICE_FEATURE_DTR			(1 << 0)	//!< Supports DTR fast read quad I/O
+#define FLASH_DEVICE_FEATURE_4B_OPCODES		(1 << 1)	//!< Has dedicated 4-byte address instructions
+#define FLASH_DEVICE_FEATURE_ECC_8BIT		(1 << 2)	//!< NAND ECC-1:0 = 11 reports 5-8 corrected bits, 10 an uncorrectable page
+
+typedef enum {
+	FLASH_DEVICE_TYPE_NOR,
+	FLASH_DEVICE_TYPE_NAND,
+} FlashDeviceType;
+
+typedef struct {
+	const char *name;
+	uint8_t manufacturerId;
+	uint16_t deviceId;
+	FlashDeviceType type;
+	uint8_t pageShift;			//!< log2 of program page size
+	uint8_t sectorShift;		//!< log2 of smallest erase unit
+	uint8_t blockShift;			//!< log2 of largest block erase unit
+	uint8_t capacityShift;		//!< log2 of capacity per die in bytes
+	uint8_t addressBytes;		//!< Address bytes needed to reach the whole die
+	uint8_t dieCount;
+	uint16_t spareSize;			//!< NAND bytes after each page, 0 on NOR
+	uint16_t features;
+} FlashDevice;
+
+/*
+ * Boards with a single known part of a type can pin its geometry at compile time, e.g.
+ * -DFLASH_DEVICE_NOR_FIXED_PAGE_SHIFT=8 -DFLASH_DEVICE_NAND_FIXED_PAGE_SHIFT=11.
+ * The accessors below then ignore the descriptor for that type and the split math
+ * folds to one constant per type, the other type still reads its own descriptor.
+ */
+#if defined(FLASH_DEVICE_FIXED_PAGE_SHIFT) || defined(FLASH_DEVICE_FIXED_SECTOR_SHIFT) || \
+	defined(FLASH_DEVICE_FIXED_BLOCK_SHIFT) || defined(FLASH_DEVICE_FIXED_CAPACITY_SHIFT)
+#error "FLASH_DEVICE_FIXED_* applied to NOR and NAND alike, use FLASH_DEVICE_NOR_FIXED_* or FLASH_DEVICE_NAND_FIXED_*"
+#endif
+
+#ifdef FLASH_DEVICE_NOR_FIXED_PAGE_SHIFT
+#define FLASH_DEVICE_NOR_PAGE_SHIFT(dev)		FLASH_DEVICE_NOR_FIXED_PAGE_SHIFT
+#else
+#define FLASH_DEVICE_NOR_PAGE_SHIFT(dev)		((dev)->pageShift)
+#endif
+
+#ifdef FLASH_DEVICE_NAND_FIXED_PAGE_SHIFT
+#define FLASH_DEVICE_NAND_PAGE_SHIFT(dev)		FLASH_DEVICE_NAND_FIXED_PAGE_SHIFT
+#else
+#define FLASH_DEVICE_NAND_PAGE_SHIFT(dev)		((dev)->pageShift)
+#endif
+
+#ifdef FLASH_DEVICE_NOR_FIXED_SECTOR_SHIFT
+#define FLASH_DEVICE_NOR_SECTOR_SHIFT(dev)		FLASH_DEVICE_NOR_FIXED_SECTOR_SHIFT
+#else
+#define FLASH_DEVICE_NOR_SECTOR_SHIFT(dev)		((dev)->sectorShift)
+#endif
+
+#ifdef FLASH_DEVICE_NAND_FIXED_SECTOR_SHIFT
+#define FLASH_DEVICE_NAND_SECTOR_SHIFT(dev)		FLASH_DEVICE_NAND_FIXED_SECTOR_SHIFT
+#else
+#define FLASH_DEVICE_NAND_SECTOR_SHIFT(dev)		((dev)->sectorShift)
+#endif
+
+#ifdef FLASH_DEVICE_NOR_FIXED_BLOCK_SHIFT
+#define FLASH_DEVICE_NOR_BLOCK_SHIFT(dev)		FLASH_DEVICE_NOR_FIXED_BLOCK_SHIFT
+#else
+#define FLASH_DEVICE_NOR_BLOCK_SHIFT(dev)		((dev)->blockShift)
+#endif
+
+#ifdef FLASH_DEVICE_NAND_FIXED_BLOCK_SHIFT
+#define FLASH_DEVICE_NAND_BLOCK_SHIFT(dev)		FLASH_DEVICE_NAND_FIXED_BLOCK_SHIFT
+#else
+#define FLASH_DEVICE_NAND_BLOCK_SHIFT(dev)		((dev)->blockShift)
+#endif
+
+#ifdef FLASH_DEVICE_NOR_FIXED_CAPACITY_SHIFT
+#define FLASH_DEVICE_NOR_CAPACITY_SHIFT(dev)	FLASH_DEVICE_NOR_FIXED_CAPACITY_SHIFT
+#else
+#define FLASH_DEVICE_NOR_CAPACITY_SHIFT(dev)	((dev)->capacityShift)
+#endif
+
+#ifdef FLASH_DEVICE_NAND_FIXED_CAPACITY_SHIFT
+#define FLASH_DEVICE_NAND_CAPACITY_SHIFT(dev)	FLASH_DEVICE_NAND_FIXED_CAPACITY_SHIFT
+#else
+#define FLASH_DEVICE_NAND_CAPACITY_SHIFT(dev)	((dev)->capacityShift)
+#endif
+
+static inline uint32_t FlashDevice_pageShift(const FlashDevice *dev)
+{
+	return (dev->type == FLASH_DEVICE_TYPE_NAND) ? FLASH_DEVICE_NAND_PAGE_SHIFT(dev) : FLASH_DEVICE_NOR_PAGE_SHIFT(dev);
+}
+
+static inline uint32_t FlashDevice_sectorShift(const FlashDevice *dev)
+{
+	return (dev->type == FLASH_DEVICE_TYPE_NAND) ? FLASH_DEVICE_NAND_SECTOR_SHIFT(dev) : FLASH_DEVICE_NOR_SECTOR_SHIFT(dev);
+}
+
+static inline uint32_t FlashDevice_blockShift(const FlashDevice *dev)
+{
+	return (dev->type == FLASH_DEVICE_TYPE_NAND) ? FLASH_DEVICE_NAND_BLOCK_SHIFT(dev) : FLASH_DEVICE_NOR_BLOCK_SHIFT(dev);
+}
+
+static inline uint32_t FlashDevice_capacityShift(const FlashDevice *dev)
+{
+	return (dev->type == FLASH_DEVICE_TYPE_NAND) ? FLASH_DEVICE_NAND_CAPACITY_SHIFT(dev) : FLASH_DEVICE_NOR_CAPACITY_SHIFT(dev);
+}
+
+static inline uint32_t FlashDevice_pageSize(const FlashDevice *dev)
+{
+	return (1u << FlashDevice_pageShift(dev));
+}
+
+static inline uint32_t FlashDevice_sectorSize(const FlashDevice *dev)
+{
+	return (1u << FlashDevice_sectorShift(dev));
+}
+
+static inline uint32_t FlashDevice_blockSize(const FlashDevice *dev)
+{
+	return (1u << FlashDevice_blockShift(dev));
+}
+
+static inline uint32_t FlashDevice_capacity(const FlashDevice *dev)
+{
+	return (1u << FlashDevice_capacityShift(dev));
+}
+
+//! All dies of a stacked part together
+static inline uint32_t FlashDevice_totalCapacity(const FlashDevice *dev)
+{
+	return (FlashDevice_capacity(dev) * dev->dieCount);
+}
+
+static inline uint32_t FlashDevice_totalBlocks(const FlashDevice *dev)
+{
+	return ((FlashDevice_capacity(dev) >> FlashDevice_blockShift(dev)) * dev->dieCount);
+}
+
+static inline uint32_t FlashDevice_addressMask(const FlashDevice *dev)
+{
+	return (FlashDevice_capacity(dev) - 1u);
+}
+
+static inline uint32_t FlashDevice_addressToPage(const FlashDevice *dev, uint32_t address)
+{
+	return (address >> FlashDevice_pageShift(dev));
+}
+
+//! Page inside the die holding address, what the NAND page commands take
+static inline uint32_t FlashDevice_addressToDiePage(const FlashDevice *dev, uint32_t address)
+{
+	return FlashDevice_addressToPage(dev, address & FlashDevice_addressMask(dev));
+}
+
+static inline uint32_t FlashDevice_pagesPerDie(const FlashDevice *dev)
+{
+	return (1u << (FlashDevice_capacityShift(dev) - FlashDevice_pageShift(dev)));
+}
+
+static inline uint32_t FlashDevice_addressToColumn(const FlashDevice *dev, uint32_t address)
+{
+	return (address & (FlashDevice_pageSize(dev) - 1u));
+}
+
+static inline uint32_t FlashDevice_addressToSector(const FlashDevice *dev, uint32_t address)
+{
+	return (address >> FlashDevice_sectorShift(dev));
+}
+
+static inline uint32_t FlashDevice_addressToBlock(const FlashDevice *dev, uint32_t address)
+{
+	return (address >> FlashDevice_blockShift(dev));
+}
+
+static inline uint32_t FlashDevice_pageToAddress(const FlashDevice *dev, uint32_t page)
+{
+	return (page << FlashDevice_pageShift(dev));
+}
+
+static inline uint32_t FlashDevice_blockToPage(const FlashDevice *dev, uint32_t block)
+{
+	return (block << (FlashDevice_blockShift(dev) - FlashDevice_pageShift(dev)));
+}
+
+//! Die of a linear address on stacked parts, every die covers capacity() bytes
+static inline uint32_t FlashDevice_addressToDie(const FlashDevice *dev, uint32_t address)
+{
+	return (address >> FlashDevice_capacityShift(dev));
+}
+
+//! Bytes that can be programmed from address before crossing a page boundary, capped at length
+static inline uint32_t FlashDevice_pageChunk(const FlashDevice *dev, uint32_t address, uint32_t length)
+{
+	uint32_t chunk = FlashDevice_pageSize(dev) - FlashDevice_addressToColumn(dev, address);
+	return (chunk < length) ? chunk : length;
+}
+
+#define FLASH_DEVICE_NAND_MAX_BLOCKS	2048	//!< FlashDevice_totalBlocks() of the largest NAND entries, W25M02GV and W25N02KV
+
+extern const FlashDevice FlashDevice_table[];
+extern const uint32_t FlashDevice_tableSize;
+
+const FlashDevice *FlashDevice_identify(const uint8_t *jedecId);
+bool FlashDevice_readJedec(QSPI_HandleTypeDef *hqspi, FlashDeviceType type, uint8_t *idBuffer);
+bool FlashDevice_readStatus(QSPI_HandleTypeDef *hqspi, FlashDeviceType type, uint8_t *status);
+bool FlashDevice_waitForReady(QSPI_HandleTypeDef *hqspi, FlashDeviceType type);	//!< False when BUSY outlasts the busy timeout
+bool FlashDevice_writeEnable(QSPI_HandleTypeDef *hqspi, FlashDeviceType type);
+bool FlashDevice_selectDie(QSPI_HandleTypeDef *hqspi, uint8_t die);
+
+/*
+ * Shadow of BUSY per device type: a completed ready wait marks the part idle, and anything that can
+ * start an internal operation (write enable, NAND page commands, reset, die select) clears it again.
+ * Waits on a part known to be idle and the WEL read-back after write enable are skipped.
+ * Define FLASH_DEVICE_STRICT_CHECKS to poll and verify every time while debugging.
+ */
+void FlashDevice_invalidateShadow(FlashDeviceType type);
+void FlashDevice_markIdle(FlashDeviceType type);
+
+/*
+ * NAND data buffer shadow, die << 24 | page of what a PAGE DATA READ left there unchanged. Invalidating the
+ * NAND BUSY shadow drops it too, so a program or erase started by the command queue cannot leave it stale.
+ */
+#define FLASH_DEVICE_NO_LOADED_PAGE		UINT32_MAX
+
+void FlashDevice_setLoadedPage(uint32_t loadedPage);
+uint32_t FlashDevice_loadedPage(void);
+
+/*
+ * Bound of a ready wait, the maximum time of the longest operation the driver starts routinely.
+ * Operations longer than that (chip erase) raise it with FlashDevice_expectBusy until the part is seen idle.
+ */
+#define FLASH_DEVICE_DEFAULT_BUSY_TIMEOUT_MS	3000u	//!< Until a driver sets its own, above any block erase
+
+void FlashDevice_setBusyTimeout(FlashDeviceType type, uint32_t timeoutMs);
+void FlashDevice_expectBusy(FlashDeviceType type, uint32_t timeoutMs);
+
+//! For waits the shadow proves redundant, only polls in strict builds
+static inline void FlashDevice_strictWaitForReady(QSPI_HandleTypeDef *hqspi, FlashDeviceType type)
+{
+#ifdef FLASH_DEVICE_STRICT_CHECKS
+	(void)FlashDevice_waitForReady(hqspi, type);
+#else
+	(void)hqspi;
+	(void)type;
+#endif
+}
+
+#endif /* __FLASHDEVICE_H */
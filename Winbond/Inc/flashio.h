@@ -0,0 +1,98 @@
+/*
+ * This program is scatter-gather buffer description for Serial flash memories.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FLASHIO_H
+#define __FLASHIO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+	uint8_t *base;
+	uint32_t length;
+} FlashIoVec;
+
+//! Read/write position inside a FlashIoVec array
+typedef struct {
+	const FlashIoVec *iov;
+	uint32_t count;
+	uint32_t index;
+	uint32_t offset;
+} FlashIoCursor;
+
+static inline void FlashIoCursor_init(FlashIoCursor *cursor, const FlashIoVec *iov, uint32_t count)
+{
+	cursor->iov		= iov;
+	cursor->count	= count;
+	cursor->index	= 0;
+	cursor->offset	= 0;
+
+	// Skip leading empty fragments so the cursor always points at a byte
+	while ((cursor->index < cursor->count) && (cursor->iov[cursor->index].length == 0)) {
+		cursor->index++;
+	}
+}
+
+static inline bool FlashIoCursor_done(const FlashIoCursor *cursor)
+{
+	return (cursor->index >= cursor->count);
+}
+
+static inline uint8_t *FlashIoCursor_pointer(const FlashIoCursor *cursor)
+{
+	return &cursor->iov[cursor->index].base[cursor->offset];
+}
+
+//! Contiguous bytes available at the cursor, capped at limit
+static inline uint32_t FlashIoCursor_span(const FlashIoCursor *cursor, uint32_t limit)
+{
+	uint32_t span = cursor->iov[cursor->index].length - cursor->offset;
+	return (span < limit) ? span : limit;
+}
+
+static inline void FlashIoCursor_advance(FlashIoCursor *cursor, uint32_t length)
+{
+	while ((length > 0) && !FlashIoCursor_done(cursor)) {
+		uint32_t step = FlashIoCursor_span(cursor, length);
+
+		cursor->offset += step;
+		length -= step;
+
+		if (cursor->offset == cursor->iov[cursor->index].length) {
+			cursor->offset = 0;
+			do {
+				cursor->index++;
+			} while ((cursor->index < cursor->count) && (cursor->iov[cursor->index].length == 0));
+		}
+	}
+}
+
+static inline uint32_t FlashIoVec_totalLength(const FlashIoVec *iov, uint32_t count)
+{
+	uint32_t total = 0;
+
+	for (uint32_t i = 0; i < count; i++) {
+		total += iov[i].length;
+	}
+
+	return total;
+}
+
+#endif /* __FLASHIO_H */
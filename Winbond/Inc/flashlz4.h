@@ -0,0 +1,38 @@
+/*
+ * This program is LZ4 block format codec for Serial flash memories.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FLASHLZ4_H
+#define __FLASHLZ4_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define FLASH_LZ4_MAX_INPUT				65535		//!< Positions are kept in 16 bits
+#define FLASH_LZ4_COMPRESS_BOUND(n)		((n) + ((n) / 255u) + 16u)	//!< Worst case output for n input bytes
+
+#ifndef FLASH_LZ4_HASH_BITS
+#define FLASH_LZ4_HASH_BITS				12			//!< 2^n match table entries, 2 bytes each
+#endif
+
+// Standard LZ4 block format, readable by any LZ4 block decoder
+uint32_t FlashLz4_compress(const uint8_t *src, uint32_t srcLength, uint8_t *dst, uint32_t dstCapacity);	//!< 0 if it doesn't fit
+bool FlashLz4_decompress(const uint8_t *src, uint32_t srcLength, uint8_t *dst, uint32_t dstCapacity, uint32_t *dstLength);
+
+#endif /* __FLASHLZ4_H */
@@ -0,0 +1,73 @@
+/*
+ * This program is streaming firmware update pipeline for W25Q.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FLASHOTA_H
+#define __FLASHOTA_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "stm32h7xx_hal.h"
+#include "w25q.h"
+
+#define FLASH_OTA_BUFFERS			2
+#define FLASH_OTA_NONE				0xFF
+
+#ifndef FLASH_OTA_ERASE_AHEAD
+#define FLASH_OTA_ERASE_AHEAD		W25Q_SECTOR_SIZE	//!< Erased space kept ahead of the write pointer (bytes)
+#endif
+
+typedef struct {
+	uint32_t bytesReceived;
+	uint32_t pagesProgrammed;
+	uint32_t sectorsErased;
+	uint32_t receiverStalls;		//!< write() calls that had to wait for the flash to free a buffer
+	uint32_t verifyFailures;
+} FlashOtaStats;
+
+typedef struct {
+	uint32_t baseAddress;			//!< Sector aligned
+	uint32_t capacity;				//!< Bytes reserved for the image, whole sectors
+	bool verify;					//!< Read back every page after it is programmed
+
+	uint8_t page[FLASH_OTA_BUFFERS][W25Q_PAGE_SIZE] __ALIGNED(32);
+	uint8_t active;					//!< Buffer being filled by write()
+	uint32_t fill;
+	uint8_t queued;					//!< Full buffer waiting for the flash, FLASH_OTA_NONE if none
+	uint32_t queuedOffset;
+	uint8_t inFlight;				//!< Buffer being programmed, kept until verified
+	uint32_t inFlightOffset;
+	uint32_t inFlightLength;
+
+	uint32_t writeOffset;			//!< Bytes handed to the flash so far
+	uint32_t erasedUntil;
+	bool deviceBusy;
+	bool finishing;					//!< Last page queued, nothing is erased past the data any more
+	bool failed;
+	uint32_t crc;					//!< CRC32 of everything received
+	FlashOtaStats stats;
+} FlashOta;
+
+bool FlashOta_begin(FlashOta *ota, uint32_t baseAddress, uint32_t capacity, bool verify);
+bool FlashOta_write(FlashOta *ota, const uint8_t *data, uint32_t length);
+bool FlashOta_poll(FlashOta *ota);		//!< Advances the flash side without blocking, call while the link is idle
+bool FlashOta_finish(FlashOta *ota, uint32_t expectedCrc);
+
+#endif /* __FLASHOTA_H */
@@ -0,0 +1,144 @@
+/*
+ * This program is priority I/O scheduler for Serial flash memories.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FLASHSCHEDULER_H
+#define __FLASHSCHEDULER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "flashio.h"
+
+#ifndef FLASH_HOST_BUILD
+#include "stm32h7xx_hal.h"
+#endif
+
+#ifndef FLASH_SCHEDULER_MAX_MERGE
+#define FLASH_SCHEDULER_MAX_MERGE			8		//!< Adjacent reads served by one bus transaction
+#endif
+#ifndef FLASH_SCHEDULER_WRITE_PENALTY
+#define FLASH_SCHEDULER_WRITE_PENALTY		4		//!< Priority levels a program/erase loses against a read
+#endif
+#ifndef FLASH_SCHEDULER_AGING_US
+#define FLASH_SCHEDULER_AGING_US			10000	//!< Waiting this long gains one priority level
+#endif
+#ifndef FLASH_SCHEDULER_DEADLINE_SLACK_US
+#define FLASH_SCHEDULER_DEADLINE_SLACK_US	2000	//!< Requests this close to their deadline go first
+#endif
+
+#ifndef FLASH_SCHEDULER_POLL_US
+#define FLASH_SCHEDULER_POLL_US				200		//!< Sleep between status polls while only busy dies are left
+#endif
+
+#ifndef FLASH_SCHEDULER_MAX_DIES
+#define FLASH_SCHEDULER_MAX_DIES			4
+#endif
+
+#define FLASH_SCHEDULER_HISTOGRAM_BUCKETS	32		//!< Bucket n counts latencies in [2^(n-1), 2^n) us
+
+typedef enum {
+	FLASH_REQUEST_READ,
+	FLASH_REQUEST_PROGRAM,
+	FLASH_REQUEST_ERASE,
+	FLASH_REQUEST_TYPE_COUNT
+} FlashRequestType;
+
+//! Thin RTOS layer, everything the scheduler needs from the OS
+typedef struct {
+	void *(*signalCreate)(void);				//!< Binary semaphore, created empty
+	void (*signalGive)(void *signal);
+	void (*signalTake)(void *signal);			//!< Blocks until given
+	void (*signalTakeTimeout)(void *signal, uint32_t timeoutUs);	//!< Optional, blocks until given or timed out, without it busy dies are polled back to back
+	void (*lock)(void);							//!< Mutex around the request queue
+	void (*unlock)(void);
+	uint32_t (*nowUs)(void);					//!< Free running, wraps
+} FlashSchedulerOs;
+
+/*
+ * The flash driver behind the scheduler, only the scheduler task calls these.
+ *
+ * Stacked parts fill the die fields as well: programs and erases are then split into pages and
+ * erase units that are started and polled instead of waited for, so a die that is busy writing
+ * never holds up reads on the others. Requests must not straddle a die boundary.
+ */
+typedef struct {
+	bool (*read)(uint32_t address, uint8_t *buffer, uint32_t length);
+	bool (*readVector)(uint32_t address, const FlashIoVec *iov, uint32_t count);	//!< Optional, enables read merging
+	bool (*program)(uint32_t address, const uint8_t *buffer, uint32_t length);
+	bool (*erase)(uint32_t address, uint32_t length);
+
+	uint8_t dieCount;				//!< 0 or 1 keeps every operation blocking
+	uint8_t dieShift;				//!< log2 of bytes per die
+	uint32_t pageSize;
+	bool (*startProgram)(uint32_t address, const uint8_t *buffer, uint32_t length);	//!< One page, returns with the die busy
+	uint32_t (*startErase)(uint32_t address, uint32_t length);	//!< Largest unit that fits, returns with the die busy and the bytes it clears, 0 on failure
+	bool (*poll)(uint8_t die, bool *busy);		//!< False if the operation that just finished failed
+} FlashSchedulerDevice;
+
+typedef struct FlashRequest {
+	FlashRequestType type;
+	uint8_t priority;				//!< 0 is the most urgent
+	uint32_t deadlineUs;			//!< Absolute, in nowUs() time, 0 for none
+	uint32_t address;
+	uint8_t *buffer;				//!< Unused for erase
+	uint32_t length;
+	void *signal;					//!< From signalCreate, given on completion, may be NULL
+
+	// Results, valid once done is set
+	volatile bool done;
+	bool success;
+	uint32_t latencyUs;
+
+	// Owned by the scheduler while queued
+	struct FlashRequest *next;
+	uint32_t submitUs;
+	uint32_t progress;				//!< Bytes already started on a stacked part
+} FlashRequest;
+
+typedef struct {
+	uint32_t histogram[FLASH_REQUEST_TYPE_COUNT][FLASH_SCHEDULER_HISTOGRAM_BUCKETS];
+	uint32_t completed[FLASH_REQUEST_TYPE_COUNT];
+	uint32_t failed[FLASH_REQUEST_TYPE_COUNT];
+	uint32_t maxLatencyUs[FLASH_REQUEST_TYPE_COUNT];
+	uint32_t mergedReads;			//!< Reads that rode along with another read
+	uint32_t deadlinePicks;			//!< Requests picked because their deadline was close
+	uint32_t maxQueueDepth;
+	uint32_t overlappedOps;			//!< Operations started while another die was busy
+} FlashSchedulerStats;
+
+#ifndef FLASH_HOST_BUILD
+extern const FlashSchedulerDevice FlashScheduler_w25q;
+
+// Fill the die fields from the identified part, single die parts come out blocking
+void FlashScheduler_w25qDevice(FlashSchedulerDevice *device);
+void FlashScheduler_w25n01gDevice(FlashSchedulerDevice *device, QSPI_HandleTypeDef *hqspi);
+#endif
+
+bool FlashScheduler_init(const FlashSchedulerOs *os, const FlashSchedulerDevice *device);
+void FlashScheduler_submit(FlashRequest *request);
+bool FlashScheduler_transfer(FlashRequest *request);	//!< Submits and blocks on request->signal
+bool FlashScheduler_serviceOnce(void);					//!< Runs one bus transaction, false when idle
+void FlashScheduler_task(void *argument);				//!< Scheduler task body, never returns
+
+const FlashSchedulerStats *FlashScheduler_getStats(void);
+void FlashScheduler_resetStats(void);
+uint32_t FlashScheduler_latencyPercentileUs(FlashRequestType type, uint32_t permille);
+
+#endif /* __FLASHSCHEDULER_H */
@@ -0,0 +1,96 @@
+/*
+ * This program is per-opcode latency instrumentation for Serial flash memories.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __FLASHSTATS_H
+#define __FLASHSTATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef FLASH_STATS_MAX_OPCODES
+#define FLASH_STATS_MAX_OPCODES			16		//!< Distinct opcodes tracked, later ones only bump droppedOps
+#endif
+#define FLASH_STATS_HISTOGRAM_BUCKETS	32		//!< Bucket n counts latencies in [2^(n-1), 2^n) cycles
+
+// Status polls are counted as their own opcode, busy-wait time is charged to the opcode that caused it
+#ifndef FLASH_STATS_IS_STATUS_READ
+#define FLASH_STATS_IS_STATUS_READ(opcode)	(((opcode) == 0x05u) || ((opcode) == 0x0Fu) || ((opcode) == 0x35u) || ((opcode) == 0x15u))
+#endif
+
+typedef uint32_t (*FlashStatsClock)(void);		//!< Free running cycle counter, e.g. DWT->CYCCNT
+
+typedef enum {
+	FLASH_STATS_OK,
+	FLASH_STATS_ERROR,
+	FLASH_STATS_TIMEOUT,
+} FlashStatsResult;
+
+typedef struct {
+	uint8_t opcode;
+	uint32_t count;
+	uint32_t bytes;
+	uint32_t errors;
+	uint32_t timeouts;
+	uint64_t busCycles;				//!< Command plus data phase
+	uint64_t busyWaitCycles;		//!< Spent polling BUSY after this opcode
+	uint32_t pollIterations;
+	uint32_t waitTimeouts;
+	uint32_t maxCycles;
+	uint32_t histogram[FLASH_STATS_HISTOGRAM_BUCKETS];
+} FlashStatsOpcode;
+
+typedef struct {
+	uint32_t used;
+	uint32_t droppedOps;
+	uint8_t lastFailedOpcode;
+	FlashStatsResult lastFailure;
+	FlashStatsOpcode opcodes[FLASH_STATS_MAX_OPCODES];
+} FlashStatsSnapshot;
+
+void FlashStats_setClock(FlashStatsClock clock);
+uint32_t FlashStats_now(void);
+void FlashStats_begin(uint8_t opcode, uint32_t bytes);
+void FlashStats_end(FlashStatsResult result);
+void FlashStats_wait(uint32_t startCycles, uint32_t polls, bool timedOut);
+// Copies the table out with interrupts masked, reset clears it in the same critical section
+void FlashStats_snapshot(FlashStatsSnapshot *snapshot, bool reset);
+void FlashStats_reset(void);
+const FlashStatsOpcode *FlashStats_find(const FlashStatsSnapshot *snapshot, uint8_t opcode);
+uint32_t FlashStats_percentileCycles(const FlashStatsOpcode *entry, uint32_t permille);
+// One CSV line per opcode plus a header, times in microseconds for a clockHz cycle counter. Returns bytes written
+uint32_t FlashStats_formatCsv(const FlashStatsSnapshot *snapshot, uint32_t clockHz, char *buffer, uint32_t size);
+
+// Driver hooks, without FLASH_STATS_ENABLE they expand to nothing
+#ifdef FLASH_STATS_ENABLE
+#define FLASH_STATS_NOW()							FlashStats_now()
+#define FLASH_STATS_BEGIN(opcode, bytes)			FlashStats_begin((uint8_t)(opcode), (uint32_t)(bytes))
+#define FLASH_STATS_END(result)						FlashStats_end(result)
+#define FLASH_STATS_WAIT(start, polls, timedOut)	FlashStats_wait((start), (polls), (timedOut))
+#define FLASH_STATS_POLL(polls)						((polls)++)
+#else
+#define FLASH_STATS_NOW()							0u
+#define FLASH_STATS_BEGIN(opcode, bytes)			((void)0)
+#define FLASH_STATS_END(result)						((void)0)
+#define FLASH_STATS_WAIT(start, polls, timedOut)	((void)(start), (void)(polls))
+#define FLASH_STATS_POLL(polls)						((void)0)
+#endif
+
+#endif /* __FLASHSTATS_H */
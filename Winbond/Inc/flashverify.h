@@ -0,0 +1,66 @@
+/*
+ * This program is read-back verification for Serial flash memories.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FLASHVERIFY_H
+#define __FLASHVERIFY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef FLASH_VERIFY_CHUNK_SIZE
+#define FLASH_VERIFY_CHUNK_SIZE		2048	//!< Read-back chunk (bytes), the only buffer verification needs
+#endif
+
+#define FLASH_VERIFY_NO_OFFSET		0xFFFFFFFFu	//!< mismatchOffset when no byte is known to differ
+#define FLASH_VERIFY_SHA256_SIZE	32
+
+typedef bool (*FlashVerifyRead)(void *context, uint32_t address, uint8_t *buffer, uint32_t length);
+
+typedef struct {
+	bool match;
+	uint32_t mismatchOffset;		//!< Offset from the start address of the first differing byte
+	uint32_t bytesRead;
+} FlashVerifyResult;
+
+typedef struct {
+	uint32_t state[8];
+	uint64_t length;
+	uint8_t block[64];
+	uint32_t used;
+} FlashVerifySha256;
+
+// Streaming digests, usable on their own while data arrives
+uint32_t FlashVerify_crc32Update(uint32_t crc, const uint8_t *data, uint32_t length);	//!< Start with 0, IEEE 802.3
+void FlashVerify_sha256Init(FlashVerifySha256 *sha);
+void FlashVerify_sha256Update(FlashVerifySha256 *sha, const uint8_t *data, uint32_t length);
+void FlashVerify_sha256Final(FlashVerifySha256 *sha, uint8_t *digest);
+
+// Read-back checks, the return value reports read errors, result->match the outcome
+bool FlashVerify_compare(FlashVerifyRead read, void *context, uint32_t address, const uint8_t *source, uint32_t length, FlashVerifyResult *result);
+bool FlashVerify_crc32(FlashVerifyRead read, void *context, uint32_t address, uint32_t length, uint32_t expected, FlashVerifyResult *result);
+bool FlashVerify_sha256(FlashVerifyRead read, void *context, uint32_t address, uint32_t length, const uint8_t *expected, FlashVerifyResult *result);
+
+#ifndef FLASH_HOST_BUILD
+// Read callbacks for the drivers in this library
+bool FlashVerify_w25qRead(void *context, uint32_t address, uint8_t *buffer, uint32_t length);			//!< context unused
+bool FlashVerify_w25n01gRead(void *context, uint32_t address, uint8_t *buffer, uint32_t length);		//!< context is the QSPI handle
+#endif
+
+#endif /* __FLASHVERIFY_H */
@@ -25,8 +25,30 @@
 #include <stdint.h>
 
 #include "stm32h7xx_hal.h"
+#include "flashio.h"
+
+typedef struct {
+	uint32_t clockPrescaler;		//!< QUADSPI clock = kernel clock / (clockPrescaler + 1)
+	uint32_t sampleShifting;
+	uint32_t chipSelectHighTime;
+} QuadSpiTiming;
+
+extern const QuadSpiTiming QuadSpi_defaultTiming;
+
+typedef enum {
+	QUADSPI_EVENT_RX_DONE,
+	QUADSPI_EVENT_TX_DONE,
+	QUADSPI_EVENT_CMD_DONE,
+	QUADSPI_EVENT_STATUS_MATCH,
+	QUADSPI_EVENT_TIMEOUT,
+	QUADSPI_EVENT_ERROR,
+	QUADSPI_EVENT_CLAIMED,		//!< Ownership handed to a waiting handler, no transfer completed
+} QuadSpiEvent;
+
+typedef void (*QuadSpiEventHandler)(QSPI_HandleTypeDef *hqspi, QuadSpiEvent event, void *context);
 
 bool QuadSpi_Init(QSPI_HandleTypeDef *hqspi, uint8_t flashSize);
+bool QuadSpi_InitWithTiming(QSPI_HandleTypeDef *hqspi, uint8_t flashSize, const QuadSpiTiming *timing);
 bool QuadSpiInstruction(QSPI_HandleTypeDef *hqspi, uint8_t instruction);
 bool QuadSpiInstructionWithAddress(QSPI_HandleTypeDef *hqspi, uint8_t instruction, uint32_t address, uint32_t addressSize);
 bool QuadSpiReceive1Line(QSPI_HandleTypeDef *hqspi, uint8_t instruction, uint8_t dummyCycles, uint8_t *in, uint16_t length);
@@ -35,13 +57,30 @@ bool QuadSpiTransmit1Line(QSPI_HandleTypeDef *hqspi, uint8_t instruction, uint8_
 bool QuadSpiTransmitWithAddress1Line(QSPI_HandleTypeDef *hqspi, uint8_t instruction, uint8_t dummyCycles, uint32_t address, uint32_t addressSize, const uint8_t *out, int length);
 bool QuadSpiTransmitWithAddress4Line(QSPI_HandleTypeDef *hqspi, uint8_t instruction, uint8_t dummyCycles, uint32_t address, uint32_t addressSize, const uint8_t *out, int length);
 
-bool QuadSpiReceiveWithAddress1Line(QSPI_HandleTypeDef *hqspi, uint8_t instruction, uint8_t dummyCycles, uint32_t address, uint8_t addressSize, uint8_t *in, int length);
-bool QuadSpiReceiveWithAddress4Lines(QSPI_HandleTypeDef *hqspi, uint8_t instruction, uint8_t dummyCycles, uint32_t address, uint8_t addressSize, uint8_t *in, int length);
+bool QuadSpiReceiveWithAddress1Line(QSPI_HandleTypeDef *hqspi, uint8_t instruction, uint8_t dummyCycles, uint32_t address, uint32_t addressSize, uint8_t *in, int length);
+bool QuadSpiReceiveWithAddress4Lines(QSPI_HandleTypeDef *hqspi, uint8_t instruction, uint8_t dummyCycles, uint32_t address, uint32_t addressSize, uint8_t *in, int length);
 
-bool QuadSpiInstructionWithAddress1LINE(QSPI_HandleTypeDef *hqspi, uint8_t instruction, uint8_t dummyCycles, uint32_t address, uint8_t addressSize);
+bool QuadSpiInstructionWithAddress1LINE(QSPI_HandleTypeDef *hqspi, uint8_t instruction, uint8_t dummyCycles, uint32_t address, uint32_t addressSize);
 
 bool QuadSpiReceiveWithAddress4LINES(QSPI_HandleTypeDef *hqspi, uint8_t instruction, uint8_t dummyCycles, uint32_t address, uint32_t addressSize, uint8_t *in, int length);
 
+bool QuadSpiSendCommand(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd);		//!< Command without a data phase
+bool QuadSpiReceiveCommand(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd, uint8_t *in);
+bool QuadSpiTransmitCommand(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd, const uint8_t *out);
+bool QuadSpiAutoPoll(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd, uint8_t mask, uint8_t match, uint32_t timeout);
+bool QuadSpiTransmitCursor(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd, FlashIoCursor *cursor);
+bool QuadSpiReceiveCursor(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd, FlashIoCursor *cursor);
+
+/*
+ * Interrupt/DMA completion. The application's HAL_QSPI_*Callback functions call QuadSpi_dispatchEvent,
+ * or define QUADSPI_HAL_CALLBACKS to have this file provide them.
+ * One handler owns the events at a time: the command queue while it runs, the DMA layer for one transfer.
+ * A claim with wait set makes the handler next in line, it gets QUADSPI_EVENT_CLAIMED once the owner releases.
+ */
+bool QuadSpi_claimEvents(QuadSpiEventHandler handler, void *context, bool wait);
+void QuadSpi_releaseEvents(QSPI_HandleTypeDef *hqspi, QuadSpiEventHandler handler);
+void QuadSpi_dispatchEvent(QSPI_HandleTypeDef *hqspi, QuadSpiEvent event);
+
 
 
 #endif /* __QUADSPI_H */
@@ -0,0 +1,69 @@
+/*
+ * This program is QUADSPI timing calibration.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __QUADSPICALIB_H
+#define __QUADSPICALIB_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "stm32h7xx_hal.h"
+#include "quadspi.h"
+
+#define QUADSPI_CALIB_MAGIC				0x424C4351	//!< "QCLB"
+#define QUADSPI_CALIB_MAX_PATTERN		256		//!< Bytes compared per pattern read
+
+typedef struct {
+	uint32_t magic;
+	QuadSpiTiming timing;
+	uint8_t dummyCycles;
+	uint32_t checksum;
+} QuadSpiCalibration;
+
+typedef struct {
+	QSPI_HandleTypeDef *hqspi;
+	uint8_t flashSize;						//!< Passed to QuadSpi_InitWithTiming
+	uint32_t chipSelectHighTime;
+
+	uint32_t fastestPrescaler;				//!< Sweep starts here
+	uint32_t slowestPrescaler;				//!< Known good, used to check the reference pattern
+	uint32_t marginSteps;					//!< Prescaler steps added above the fastest passing one
+	uint32_t repetitions;					//!< Pattern reads that must all match for a setting to pass
+
+	const uint8_t *dummyCycles;				//!< Candidate dummy cycles, first entry is the datasheet value
+	uint32_t dummyCount;
+
+	uint32_t patternAddress;
+	const uint8_t *pattern;
+	uint32_t patternLength;
+
+	bool (*readPattern)(uint32_t address, uint8_t *buffer, uint32_t length, uint8_t dummyCycles);
+	void (*setDummyCycles)(uint8_t dummyCycles);										//!< Locks in the result
+	bool (*writePattern)(uint32_t address, const uint8_t *pattern, uint32_t length);	//!< Optional
+	bool (*load)(QuadSpiCalibration *calibration);										//!< Optional
+	bool (*store)(const QuadSpiCalibration *calibration);								//!< Optional
+} QuadSpiCalibConfig;
+
+bool QuadSpiCalib_run(const QuadSpiCalibConfig *config, QuadSpiCalibration *result);
+bool QuadSpiCalib_apply(const QuadSpiCalibConfig *config, const QuadSpiCalibration *calibration);
+bool QuadSpiCalib_isValid(const QuadSpiCalibration *calibration);
+void QuadSpiCalib_seal(QuadSpiCalibration *calibration);
+
+#endif /* __QUADSPICALIB_H */
@@ -0,0 +1,69 @@
+/*
+ * This program is cache-aware DMA transfers for QUADSPI.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __QUADSPIDMA_H
+#define __QUADSPIDMA_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "stm32h7xx_hal.h"
+#include "quadspi.h"
+
+#ifdef __SCB_DCACHE_LINE_SIZE
+#define QUADSPI_DMA_CACHE_LINE		__SCB_DCACHE_LINE_SIZE
+#else
+#define QUADSPI_DMA_CACHE_LINE		32		//!< Cortex-M7 D-cache line, bytes
+#endif
+
+#ifndef QUADSPI_DMA_MIN_LENGTH
+#define QUADSPI_DMA_MIN_LENGTH		(4 * QUADSPI_DMA_CACHE_LINE)	//!< Shorter transfers are polled
+#endif
+
+// Cache maintenance hooks, a host build can point these at a cache model
+#ifndef QUADSPI_DMA_DCACHE_ENABLED
+#define QUADSPI_DMA_DCACHE_ENABLED()				((SCB->CCR & SCB_CCR_DC_Msk) != 0u)
+#endif
+#ifndef QUADSPI_DMA_DCACHE_CLEAN
+#define QUADSPI_DMA_DCACHE_CLEAN(address, length)		SCB_CleanDCache_by_Addr((void *)(address), (int32_t)(length))
+#endif
+#ifndef QUADSPI_DMA_DCACHE_INVALIDATE
+#define QUADSPI_DMA_DCACHE_INVALIDATE(address, length)	SCB_InvalidateDCache_by_Addr((void *)(address), (int32_t)(length))
+#endif
+
+typedef void (*QuadSpiDmaDone)(void *context, bool success);
+
+typedef struct {
+	uint32_t transfers;
+	uint32_t dmaBytes;				//!< Moved by DMA straight to/from caller memory
+	uint32_t slowPathBytes;			//!< Unaligned head/tail and short transfers moved by the CPU
+	uint32_t cleanedLines;
+	uint32_t invalidatedLines;
+} QuadSpiDmaStats;
+
+bool QuadSpiDma_init(QSPI_HandleTypeDef *hqspi);
+// done runs once for every call that returns true, from the QUADSPI interrupt or, for polled transfers, before returning
+bool QuadSpiDma_receive(const QSPI_CommandTypeDef *cmd, uint8_t *buffer, QuadSpiDmaDone done, void *context);
+bool QuadSpiDma_transmit(const QSPI_CommandTypeDef *cmd, const uint8_t *buffer, QuadSpiDmaDone done, void *context);
+bool QuadSpiDma_isBusy(void);
+const QuadSpiDmaStats *QuadSpiDma_getStats(void);
+void QuadSpiDma_resetStats(void);
+
+#endif /* __QUADSPIDMA_H */
@@ -0,0 +1,78 @@
+/*
+ * This program is interrupt driven command queue for QUADSPI.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __QUADSPIQUEUE_H
+#define __QUADSPIQUEUE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "stm32h7xx_hal.h"
+#include "quadspi.h"
+
+#define QUADSPI_QUEUE_POLL_INTERVAL		0x10	//!< QUADSPI clocks between auto-polling status reads
+
+typedef enum {
+	QUADSPI_OP_COMMAND,			//!< Instruction/address only
+	QUADSPI_OP_TRANSMIT,
+	QUADSPI_OP_RECEIVE,
+	QUADSPI_OP_POLL,			//!< Auto-polling until (status & mask) == match
+} QuadSpiOpType;
+
+typedef struct {
+	QuadSpiOpType type;
+	QSPI_CommandTypeDef cmd;
+	uint8_t *data;					//!< Transmit source or receive destination, NbData bytes
+	uint8_t pollMask;
+	uint8_t pollMatch;
+} QuadSpiOp;
+
+typedef void (*QuadSpiQueueDone)(void *context, bool success);
+
+typedef struct QuadSpiChain {
+	const QuadSpiOp *ops;
+	uint32_t count;
+	QuadSpiQueueDone done;			//!< Called once, from the QUADSPI interrupt, after the last op or the first failure
+	void *context;
+
+	// Owned by the queue while the chain is submitted
+	struct QuadSpiChain *next;
+	uint32_t index;
+} QuadSpiChain;
+
+typedef struct {
+	uint32_t depth;					//!< Chains waiting or running
+	uint32_t maxDepth;
+	uint32_t interrupts;			//!< Completion events handled
+	uint32_t opsCompleted;
+	uint32_t chainsCompleted;
+	uint32_t chainsFailed;
+} QuadSpiQueueStats;
+
+void QuadSpiQueue_init(QSPI_HandleTypeDef *hqspi);
+bool QuadSpiQueue_submit(QuadSpiChain *chain);
+bool QuadSpiQueue_isIdle(void);
+const QuadSpiQueueStats *QuadSpiQueue_getStats(void);
+void QuadSpiQueue_resetStats(void);
+
+void QuadSpiQueue_commandOp(QuadSpiOp *op, uint8_t instruction);
+void QuadSpiQueue_pollOp(QuadSpiOp *op, uint8_t statusInstruction, uint8_t mask, uint8_t match);
+
+#endif /* __QUADSPIQUEUE_H */
@@ -0,0 +1,114 @@
+/*
+ * This program is QUADSPI command trace recorder.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __QUADSPITRACE_H
+#define __QUADSPITRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "stm32h7xx_hal.h"
+#include "flashstats.h"
+
+#ifndef QUADSPI_TRACE_MAX_OPCODES
+#define QUADSPI_TRACE_MAX_OPCODES	16
+#endif
+
+// Packed line modes, the QUADSPI CCR layout squeezed into 16 bits
+#define QUADSPI_TRACE_MODE_INSTRUCTION(modes)	(((modes) >> 0) & 0x3u)		//!< 0 none, 1/2/3 = 1/2/4 lines
+#define QUADSPI_TRACE_MODE_ADDRESS(modes)		(((modes) >> 2) & 0x3u)
+#define QUADSPI_TRACE_MODE_ADDRESS_SIZE(modes)	(((modes) >> 4) & 0x3u)		//!< 0..3 = 8..32 bits
+#define QUADSPI_TRACE_MODE_ALTERNATE(modes)		(((modes) >> 6) & 0x3u)
+#define QUADSPI_TRACE_MODE_DATA(modes)			(((modes) >> 8) & 0x3u)
+#define QUADSPI_TRACE_MODE_SIOO					(1u << 10)
+#define QUADSPI_TRACE_MODE_DDR					(1u << 11)
+#define QUADSPI_TRACE_MODE_WRITE				(1u << 12)		//!< Data phase sent to the part
+
+#ifndef QUADSPI_TRACE_REPLAY_TIMEOUT_MS
+#define QUADSPI_TRACE_REPLAY_TIMEOUT_MS		200000			//!< Longest wait for BUSY to clear during a replay
+#endif
+
+typedef uint32_t (*QuadSpiTraceClock)(void);
+
+typedef struct {
+	uint32_t timestamp;			//!< Clock at command start
+	uint32_t duration;			//!< Command plus data phase, clock ticks
+	uint32_t address;
+	uint32_t length;
+	uint16_t modes;
+	uint8_t instruction;
+	uint8_t dummyCycles : 5;
+	uint8_t result : 3;			//!< FlashStatsResult
+} QuadSpiTraceRecord;
+
+typedef struct {
+	uint8_t opcode;
+	uint32_t count;
+	uint32_t bytes;
+	uint64_t duration;
+} QuadSpiTraceOpcode;
+
+typedef struct {
+	uint32_t records;
+	uint32_t failures;
+	uint64_t duration;
+	uint32_t statusPolls;
+	uint32_t wastedPolls;				//!< Status reads that were followed by another one
+	uint32_t redundantPageReads;		//!< PAGE_DATA_READ of the page already in the data buffer
+	uint32_t redundantWriteEnables;		//!< WRITE_ENABLE with an earlier one still unused
+	uint32_t opcodeCount;
+	uint32_t droppedOpcodes;
+	QuadSpiTraceOpcode opcodes[QUADSPI_TRACE_MAX_OPCODES];
+} QuadSpiTraceReport;
+
+// Recording into a caller supplied ring, the oldest records are overwritten once it is full
+void QuadSpiTrace_start(QuadSpiTraceRecord *buffer, uint32_t capacity, QuadSpiTraceClock clock);
+void QuadSpiTrace_stop(void);
+bool QuadSpiTrace_isRecording(void);
+void QuadSpiTrace_begin(const QSPI_CommandTypeDef *cmd);
+void QuadSpiTrace_markWrite(void);
+void QuadSpiTrace_end(FlashStatsResult result);
+// Copies out the oldest records first, returns the number copied
+uint32_t QuadSpiTrace_copy(QuadSpiTraceRecord *out, uint32_t max);
+uint32_t QuadSpiTrace_overwritten(void);
+
+void QuadSpiTrace_analyze(const QuadSpiTraceRecord *records, uint32_t count, QuadSpiTraceReport *report);
+
+/*
+ * Sends recorded commands again through quadspi.c, e.g. to the host simulator, and records the replay
+ * into out (count records) with clock for QuadSpiTrace_analyze. Write data phases send scratch, reads land
+ * in it, records longer than scratchSize are skipped. The last status read of a run waits for BUSY to clear
+ * like the driver did. Any recording in progress is replaced. Returns the number of records replayed.
+ */
+uint32_t QuadSpiTrace_replay(QSPI_HandleTypeDef *hqspi, const QuadSpiTraceRecord *records, uint32_t count,
+		uint8_t *scratch, uint32_t scratchSize, QuadSpiTraceRecord *out, QuadSpiTraceClock clock);
+
+#ifdef QUADSPI_TRACE_ENABLE
+#define QUADSPI_TRACE_BEGIN(cmd)		QuadSpiTrace_begin(cmd)
+#define QUADSPI_TRACE_WRITE()			QuadSpiTrace_markWrite()
+#define QUADSPI_TRACE_END(result)		QuadSpiTrace_end(result)
+#else
+#define QUADSPI_TRACE_BEGIN(cmd)		((void)0)
+#define QUADSPI_TRACE_WRITE()			((void)0)
+#define QUADSPI_TRACE_END(result)		((void)0)
+#endif
+
+#endif /* __QUADSPITRACE_H */
@@ -0,0 +1,139 @@
+/*
+ * This program is append-only ring log for W25N01G NAND flash.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __RINGLOG_H
+#define __RINGLOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef FLASH_HOST_BUILD
+#include "stm32h7xx_hal.h"
+#endif
+
+// Bounds of the geometry the IO reports, the buffers and bad block maps are sized for them
+#define RING_LOG_MAX_PAGE_SIZE		2048
+#define RING_LOG_MAX_BLOCKS			2048	//!< Region blocks, FLASH_DEVICE_NAND_MAX_BLOCKS
+#define RING_LOG_BUFFERS			2		//!< One page filling while the other programs
+
+// Spare area tags, both in ECC protected user bytes, and the factory bad block marker
+#define RING_LOG_SPARE_BAD_BLOCK	0x00		//!< First page of a block, anything but 0xFF is bad
+#define RING_LOG_SPARE_SEQUENCE		0x04
+#define RING_LOG_SPARE_LENGTH		0x14
+#define RING_LOG_TAGS_SIZE			(RING_LOG_SPARE_LENGTH + 4 - RING_LOG_SPARE_SEQUENCE)	//!< Spare bytes from the sequence to the end of the length
+#define RING_LOG_ERASED				0xFFFFFFFFu
+#define RING_LOG_NONE				0xFFFFFFFFu
+#define RING_LOG_LENGTH_WORD(len)	(((uint32_t)(len) & 0xFFFFu) | ((~(uint32_t)(len) & 0xFFFFu) << 16))
+
+// Pages and blocks are absolute device numbers, counted across the dies of stacked parts
+typedef struct {
+	bool (*readData)(void *context, uint32_t page, uint32_t column, uint8_t *buffer, uint32_t length);
+	bool (*readTags)(void *context, uint32_t page, uint32_t *sequence, uint32_t *lengthWord);
+	bool (*startProgram)(void *context, uint32_t page, const uint8_t *data, uint32_t sequence, uint32_t lengthWord);
+	bool (*startErase)(void *context, uint32_t block);
+	bool (*poll)(void *context, bool *busy, bool *failed);		//!< failed is only valid once busy clears
+	bool (*isBlockBad)(void *context, uint32_t block);
+	bool (*markBlockBad)(void *context, uint32_t block);
+	void *context;
+	uint32_t pageSize;				//!< Data bytes per page, the spare follows
+	uint32_t pagesPerBlock;
+	uint32_t totalBlocks;			//!< On the device, the region has to end inside it
+} RingLogIo;
+
+typedef struct {
+	uint32_t bytesAppended;
+	uint32_t pagesProgrammed;
+	uint32_t partialPages;			//!< Programmed by a flush before they were full
+	uint32_t blocksErased;
+	uint32_t blocksOverwritten;		//!< Oldest data dropped to keep a block erased ahead of the head
+	uint32_t blocksRetired;			//!< Program or erase failures, marked bad
+	uint32_t appendStalls;			//!< append() calls that waited for a free page buffer
+} RingLogStats;
+
+typedef enum {
+	RING_LOG_IDLE,
+	RING_LOG_PROGRAMMING,
+	RING_LOG_ERASING,
+} RingLogBusy;
+
+/*
+ * Blocks are filled in order, bad ones skipped, wrapping at the end of the region. Every page
+ * carries a sequence number one higher than the page before it, so at open the head is found by
+ * binary search over block first pages, then over the pages of the head block.
+ * The block after the head is kept erased, erasing it drops the oldest block once the log wraps.
+ */
+typedef struct {
+	const RingLogIo *io;
+	uint32_t firstBlock;
+	uint32_t blockCount;
+	uint32_t pageSize;
+	uint32_t pagesPerBlock;
+
+	uint32_t headBlock;				//!< Relative to firstBlock
+	uint32_t headPage;				//!< Next page to program, pagesPerBlock when the block is full
+	uint32_t erasedBlock;			//!< Erased block the head moves into next, RING_LOG_NONE if not erased yet
+	uint32_t tailBlock;				//!< Oldest block with data, RING_LOG_NONE while the log is empty
+	uint32_t nextSequence;
+
+	uint8_t page[RING_LOG_BUFFERS][RING_LOG_MAX_PAGE_SIZE];
+	uint16_t length[RING_LOG_BUFFERS];
+	uint8_t oldest;					//!< Oldest full buffer, programmed first
+	uint8_t pending;				//!< Full buffers waiting for or in program
+	uint32_t fill;					//!< Bytes in the buffer being filled
+
+	RingLogBusy busy;
+	uint32_t busyBlock;
+	bool failed;
+
+	uint32_t badKnown[RING_LOG_MAX_BLOCKS / 32];
+	uint32_t bad[RING_LOG_MAX_BLOCKS / 32];
+
+	RingLogStats stats;
+} RingLog;
+
+typedef struct {
+	uint32_t block;
+	uint32_t page;
+	uint32_t offset;
+	uint32_t sequence;				//!< Expected sequence of the page at block/page
+	uint32_t pageLength;			//!< 0 until the page tags are read
+	uint32_t lostPages;				//!< Overwritten or retired before they were read
+} RingLogReader;
+
+#ifndef FLASH_HOST_BUILD
+void RingLog_w25n01gIo(RingLogIo *io, QSPI_HandleTypeDef *hqspi);
+#endif
+
+// Tags as they sit in the spare from RING_LOG_SPARE_SEQUENCE on, shared by the driver IO and image tools
+void RingLog_encodeTags(uint8_t *tags, uint32_t sequence, uint32_t lengthWord);
+void RingLog_decodeTags(const uint8_t *tags, uint32_t *sequence, uint32_t *lengthWord);
+
+bool RingLog_open(RingLog *log, const RingLogIo *io, uint32_t firstBlock, uint32_t blockCount);	//!< False for a geometry or region that does not fit
+bool RingLog_append(RingLog *log, const uint8_t *data, uint32_t length);
+bool RingLog_poll(RingLog *log);		//!< Advances program/erase without blocking, call from the logging loop
+bool RingLog_flush(RingLog *log);		//!< Programs a partial page too and waits until the flash is idle
+bool RingLog_isEmpty(const RingLog *log);
+
+// Streaming export from the oldest page, only pages already programmed are returned
+void RingLog_readerInit(RingLog *log, RingLogReader *reader);
+uint32_t RingLog_read(RingLog *log, RingLogReader *reader, uint8_t *buffer, uint32_t length);
+
+#endif /* __RINGLOG_H */
@@ -0,0 +1,87 @@
+/*
+ * This program is JEDEC SFDP (JESD216) parser for Serial flash memories.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SFDP_H
+#define __SFDP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "stm32h7xx_hal.h"
+
+#define SFDP_INSTR_READ					0x5A
+#define SFDP_DUMMY_CYCLES				8
+#define SFDP_SIGNATURE					0x50444653	//!< "SFDP" little endian
+#define SFDP_BASIC_TABLE_ID				0xFF00
+#define SFDP_MAX_PARAMETER_HEADERS		8
+#define SFDP_BASIC_TABLE_MAX_DWORDS		20
+#define SFDP_ERASE_TYPES				4
+
+#define SFDP_INSTR_FAST_READ			0x0B
+#define SFDP_DUMMY_CYCLES_FAST_READ		8
+
+typedef enum {
+	SFDP_READ_1_1_1,
+	SFDP_READ_1_1_4,
+	SFDP_READ_1_4_4,
+	SFDP_READ_4_4_4,
+	SFDP_READ_MODE_COUNT
+} SfdpReadMode;
+
+typedef enum {
+	SFDP_ADDRESS_3_BYTES,
+	SFDP_ADDRESS_3_OR_4_BYTES,
+	SFDP_ADDRESS_4_BYTES,
+} SfdpAddressBytes;
+
+typedef struct {
+	bool supported;
+	uint8_t instruction;
+	uint8_t dummyCycles;		//!< Wait states plus mode clocks
+} SfdpReadCommand;
+
+typedef struct {
+	uint32_t size;				//!< Bytes, 0 when the type is not present
+	uint8_t instruction;
+	uint32_t typicalMs;
+	uint32_t maxMs;
+} SfdpEraseType;
+
+typedef struct {
+	uint8_t majorRevision;
+	uint8_t minorRevision;
+	uint32_t density;			//!< Bytes
+	uint32_t pageSize;			//!< Bytes
+	SfdpAddressBytes addressBytes;
+	bool dtrSupported;
+	SfdpReadCommand read[SFDP_READ_MODE_COUNT];
+	SfdpEraseType erase[SFDP_ERASE_TYPES];
+	uint32_t pageProgramTypicalUs;
+	uint32_t pageProgramMaxUs;
+	uint32_t chipEraseTypicalMs;
+	uint32_t chipEraseMaxMs;
+} SfdpParameters;
+
+bool Sfdp_read(QSPI_HandleTypeDef *hqspi, SfdpParameters *params);
+bool Sfdp_parseBasicTable(const uint32_t *dwords, uint32_t count, SfdpParameters *params);
+SfdpReadMode Sfdp_fastestReadMode(const SfdpParameters *params, bool allowQpi);
+const SfdpEraseType *Sfdp_smallestEraseType(const SfdpParameters *params);
+
+#endif /* __SFDP_H */
@@ -25,14 +25,20 @@
 #include <stdint.h>
 
 #include "stm32h7xx_hal.h"
+#include "flashdevice.h"
+#include "flashio.h"
 
 // Device size parameters
 #define W25N01G_PAGE_SIZE 			2048
 #define W25N01G_PAGES_PER_BLOCK		64
 #define W25N01G_BLOCKS_PER_DIE		1024
+#define W25N01G_SPARE_SIZE			64
+#define W25N01G_BLOCK_SIZE			(W25N01G_PAGE_SIZE * W25N01G_PAGES_PER_BLOCK)
+
+#define W25N01G_BAD_BLOCK_MARKER_GOOD			0xFF
 
 #define W25N01G_STATUS_REGISTER_SIZE			8
-#define W25N01G_STATUS_PAGE_ADDRESS_SIZE		16
+#define W25N01G_STATUS_PAGE_ADDRESS_SIZE		24	//!< Row address of the page commands, the W25N01GV ignores the top byte
 #define W25N01G_STATUS_COLUMN_ADDRESS_SIZE		16
 
 #define W25N01G_INSTR_DEVICE_RESET					0xFF
@@ -102,22 +108,50 @@ typedef struct protRegBits_structure {
 #define W25N01G_STATUS_FLAG_ECC_POS			4
 #define W25N01G_STATUS_FLAG_ECC_MASK		((1 << 5)|(1 << 4))
 #define W25N01G_STATUS_FLAG_ECC(status)		(((status) & W25N01G_STATUS_FLAG_ECC_MASK) >> 4)
+#define W25N01G_STATUS_ECC_CORRECTED		1
+#define W25N01G_STATUS_ECC_UNCORRECTABLE	2
+#define W25N01G_STATUS_ECC_MULTIPLE			3	//!< 1-bit ECC parts: uncorrectable page in a continuous read, 8-bit ECC parts: 5-8 bits corrected
 #define W25N01G_STATUS_PROGRAM_FAIL			(1 << 3)
 #define W25N01G_STATUS_ERASE_FAIL			(1 << 2)
 #define W25N01G_STATUS_FLAG_WRITE_ENABLED	(1 << 1)
 #define W25N01G_STATUS_FLAG_BUSY			(1 << 0)
 
+// What ECC-1:0 says about the page last read, decoded for the part in use
+typedef enum {
+	W25N01G_ECC_CLEAN,
+	W25N01G_ECC_CORRECTED,
+	W25N01G_ECC_UNCORRECTABLE,
+} W25n01gEcc;
+
+#define W25N01G_BUSY_TIMEOUT_MS				15		//!< tBERS max 10ms, longest operation of the part
+
+bool W25n01g_init(QSPI_HandleTypeDef *hqspi);
+const FlashDevice *W25n01g_getDevice(void);
 bool W25n01g_deviceRestart(QSPI_HandleTypeDef *hqspi);
+// Linear addresses pick the die themselves, calls taking a page address act on the selected die
+bool W25n01g_selectDie(QSPI_HandleTypeDef *hqspi, uint8_t die);
 void W25n01g_readJedec(QSPI_HandleTypeDef *hqspi, uint8_t* idBuffer);
 bool W25n01g_writeEnable(QSPI_HandleTypeDef *hqspi);
 bool W25n01g_blockErase(QSPI_HandleTypeDef *hqspi, uint32_t address);
 void W25n01g_writeStatusRegister(QSPI_HandleTypeDef *hqspi, uint8_t reg, uint8_t data);
+void W25n01g_updateStatusRegister(QSPI_HandleTypeDef *hqspi, uint8_t reg, uint8_t data);	//!< Writes only on a mismatch
 uint8_t W25n01g_readStatusRegister(QSPI_HandleTypeDef *hqspi, uint8_t reg);
-void W25n01g_waitForReady(QSPI_HandleTypeDef *hqspi);
+bool W25n01g_waitForReady(QSPI_HandleTypeDef *hqspi);
 //bool W25n01g_memoryMappedModeEnable(QSPI_HandleTypeDef *hqspi, bool bufferRead); // This memory can't work in the memory-mapped mode
 bool W25n01g_programDataLoad(QSPI_HandleTypeDef *hqspi, uint16_t columnAddress, const uint8_t *data, uint32_t length);
+bool W25n01g_quadProgramDataLoad(QSPI_HandleTypeDef *hqspi, uint16_t columnAddress, const uint8_t *data, uint32_t length);
+bool W25n01g_randomProgramDataLoad(QSPI_HandleTypeDef *hqspi, uint16_t columnAddress, const uint8_t *data, uint32_t length);
+bool W25n01g_startProgramExecute(QSPI_HandleTypeDef *hqspi, uint32_t pageAddress);
+bool W25n01g_startQuadPageProgram(QSPI_HandleTypeDef *hqspi, uint32_t pageAddress, const uint8_t *data, uint32_t length);
+bool W25n01g_waitForReadyPolled(QSPI_HandleTypeDef *hqspi, uint32_t timeoutMs);
 bool w25n01g_pageProgram(QSPI_HandleTypeDef *hqspi, uint32_t address, const uint8_t *data, uint32_t length);
+bool w25n01g_writeVector(QSPI_HandleTypeDef *hqspi, uint32_t address, const FlashIoVec *iov, uint32_t count);
+bool W25n01g_readVector(QSPI_HandleTypeDef *hqspi, uint32_t address, const FlashIoVec *iov, uint32_t count);
 bool w25n01g_writeFlash(QSPI_HandleTypeDef *hqspi, uint32_t address, const uint8_t *data, uint32_t length);
 uint32_t W25n01g_readBytes(QSPI_HandleTypeDef *hqspi, uint32_t address, uint8_t *buffer, uint32_t length, bool bufferMode);
+bool W25n01g_readPageData(QSPI_HandleTypeDef *hqspi, uint32_t pageAddress, uint16_t columnAddress, uint8_t *buffer, uint32_t length);
+bool W25n01g_isBlockBad(QSPI_HandleTypeDef *hqspi, uint32_t block);
+W25n01gEcc W25n01g_eccStatus(uint8_t status);
+W25n01gEcc W25n01g_readEcc(QSPI_HandleTypeDef *hqspi);
 
 #endif /* __W25N01G_H */
@@ -25,6 +25,12 @@
 #include <stdint.h>
 
 #include "stm32h7xx_hal.h"
+#include "flashdevice.h"
+#include "sfdp.h"
+#include "flashio.h"
+#include "quadspidma.h"
+#include "quadspiqueue.h"
+#include "quadspicalib.h"
 
 #define W25Q_MANUFACTURER_ID    0xEF //!< MF7 - MF0
 #define W25Q_DEVICE_ID_1_IQ     0x40 //!< W25Q128JV-IM - first part of ID15 - ID0 (4018h)
@@ -37,8 +43,14 @@
 #define W25Q_32K_BLOCK_SIZE 	32768		//!< Bytes (32KB)
 #define W25Q_64K_BLOCK_SIZE 	65536		//!< Bytes (64KB)
 #define W25Q_CHIP_SIZE 			16777216	//!< Bytes (16MB)
+#define W25Q_3B_ADDRESS_LIMIT	16777216	//!< Bytes reachable with 3-byte addresses
 #define W25Q_PAGES_PER_SECTOR	16
 #define W25Q_PAGES_PER_BLOCK	256
+#define W25Q_PROGRAM_OPS_PER_PAGE	3			//!< Queue ops per page: write enable, program, wait
+
+// Worst case timings used when the part has no SFDP timing information
+#define W25Q_PAGE_PROGRAM_MAX_US	3000
+#define W25Q_CHIP_ERASE_MAX_MS		200000
 
 #define W25Q_INSTR_DEVICE_RESET						0xFF
 #define W25Q_INSTR_JEDEC_ID							0x9F
@@ -51,9 +63,36 @@
 #define W25Q_INSTR_FAST_READ_QUAD					0xEB
 #define W25_INSTR_PAGE_PROGRAM						0x02
 #define W25_INSTR_QUAD_INPUT_PAGE_PROGRAM			0x32
+#define W25Q_INSTR_FAST_READ_QUAD_DTR				0xED	//!< W25QxxJV-IM/JM (DTR) parts only
+#define W25Q_INSTR_FAST_READ						0x0B
+#define W25Q_INSTR_FAST_READ_QUAD_OUTPUT			0x6B
+
+// 4-byte address instructions (W25Q256 and larger)
+#define W25Q_INSTR_ENTER_4B_MODE					0xB7
+#define W25Q_INSTR_EXIT_4B_MODE						0xE9
+#define W25Q_INSTR_FAST_READ_4B						0x0C
+#define W25Q_INSTR_FAST_READ_QUAD_OUTPUT_4B			0x6C
+#define W25Q_INSTR_FAST_READ_QUAD_4B				0xEC
+#define W25_INSTR_PAGE_PROGRAM_4B					0x12
+#define W25_INSTR_QUAD_INPUT_PAGE_PROGRAM_4B		0x34
+#define W25Q_INSTR_SECTOR_ERASE_4B					0x21
+#define W25Q_INSTR_64K_BLOCK_ERASE_4B				0xDC
+#define W25Q_INSTR_FAST_READ_QUAD_DTR_4B			0xEE
+
+// Output data hold for DTR reads, half clock delay gives the flash the widest sampling window
+#ifndef W25Q_DTR_HOLD_HALF_CYCLE
+#define W25Q_DTR_HOLD_HALF_CYCLE					QSPI_DDR_HHC_HALF_CLK_DELAY
+#endif
+
+// Set Burst with Wrap, affects the quad I/O reads only, 0x6B stays linear
+#define W25Q_INSTR_SET_BURST_WITH_WRAP				0x77
+#define W25Q_WRAP_BITS_DISABLE						0x10	//!< W4 set
+#define W25Q_WRAP_CACHE_LINE						32		//!< Cortex-M7 D-cache line
 
 #define W25Q_ZERO_DUMMY_CYCLES						0
+#define W25Q_DUMMY_CYCLES_FAST_READ_QUAD_OUTPUT		8
 #define W25Q_DUMMY_CYCLES_FAST_READ_QUAD			6
+#define W25Q_DUMMY_CYCLES_FAST_READ_QUAD_DTR		8	//!< One DTR mode clock plus seven dummy clocks
 
 #define W25Q_DUMMY_BITS_FAST_READ_QUAD_BUFFER		4
 #define W25Q_DUMMY_BITS_FAST_READ_QUAD_CONT			12
@@ -92,22 +131,92 @@
 #define W25Q_STATUS_REG3_DRV1			(1 << 6)	//!< Output driver strength 1 (Volatile/Non-Volatile Writable)
 #define W25Q_STATUS_REG3_DRV2			(1 << 5)	//!< Output driver strength 2 (Volatile/Non-Volatile Writable)
 #define W25Q_STATUS_REG3_WPS			(1 << 2)	//!< Write Protect Selection (Volatile/Non-Volatile Writable)
+#define W25Q_STATUS_REG3_ADP			(1 << 1)	//!< Power-Up Address Mode (Non-Volatile Writable, W25Q256 and larger)
+#define W25Q_STATUS_REG3_ADS			(1 << 0)	//!< Current Address Mode (Status-Only, W25Q256 and larger)
+
+typedef enum {
+	W25Q_ADDRESS_MODE_3B,			//!< 24-bit addresses, parts up to 16MB
+	W25Q_ADDRESS_MODE_4B_OPCODES,	//!< Dedicated 4-byte address instructions, device stays in 3-byte mode
+	W25Q_ADDRESS_MODE_4B_ENTERED,	//!< Device switched to 4-byte mode (0xB7), all instructions take 32-bit addresses
+} W25qAddressMode;
+
+typedef struct {
+	uint8_t instruction;
+	uint8_t dummyCycles;
+	uint32_t instructionMode;
+	uint32_t addressMode;
+	uint32_t dataMode;
+	bool ddr;
+} W25qReadConfig;
+
+typedef struct {
+	W25qReadConfig read;
+	W25qReadConfig sdrRead;				//!< SDR read restored when DTR is turned off
+	SfdpEraseType erase[SFDP_ERASE_TYPES];	//!< Sorted by size, unused entries have size 0
+	uint32_t pageProgramMaxUs;
+	uint32_t chipEraseTypicalMs;		//!< 0 when SFDP gave none, the controller then polls from the start
+	uint32_t chipEraseMaxMs;
+	W25qAddressMode addressMode;
+	bool sfdpValid;
+	bool dtrSupported;					//!< SFDP allows DTR, true when the part has no SFDP
+	uint8_t wrapSize;					//!< Burst wrap length in bytes, 0 for linear reads
+	W25qReadConfig wrapSavedRead;		//!< Read restored when wrap is turned off
+} W25qConfig;
+
+#define W25Q_BOOT_STATE_MAGIC		0x54534257	//!< "WBST"
+
+//! Device state captured after a full init and checked against the part on the next boot
+typedef struct {
+	uint32_t magic;
+	uint8_t jedecId[3];
+	uint8_t status[3];					//!< Status registers 1-3 without BUSY, WEL and SUS
+	W25qConfig config;
+	QuadSpiCalibration calibration;		//!< Left zeroed when the timing was never calibrated
+	uint32_t checksum;
+} W25qBootState;
 
 bool W25q_init(QSPI_HandleTypeDef *hqspi);
+const W25qConfig *W25q_getConfig(void);
+bool W25q_saveBootState(W25qBootState *state, const QuadSpiCalibration *calibration);	//!< Calibration may be NULL
+// After QuadSpi_Init, falls back to W25q_init when the snapshot no longer matches the part
+bool W25q_fastInit(QSPI_HandleTypeDef *hqspi, const W25qBootState *state, bool memoryMapped, bool *fromSnapshot);
+bool W25q_setAddressMode(W25qAddressMode mode);
+bool W25q_setDtrRead(bool enable);
+bool W25q_setWrapRead(uint8_t wrapSize);						//!< 8, 16, 32 or 64, 0 turns wrapping off, at 32 memory-mapped line fills wrap too
+bool W25q_readWrapped(uint32_t address, uint8_t *line);		//!< Fills the wrapSize line holding address, that byte first on the bus
+const FlashDevice *W25q_getDevice(void);
+bool W25q_selectDie(uint8_t die);								//!< Stacked W25M parts, linear addresses select their die themselves
 void W25q_readJedec(uint8_t* idBuffer);
 bool W25q_writeEnable(void);
 bool W25q_quadEnable(void);
 bool W25q_readStatusRegister(uint8_t instruction, uint8_t* statusRegister);
 bool W25q_writeStatusRegister(uint8_t reg, uint8_t data);
-void W25q_waitForReady(void);
+bool W25q_waitForReady(void);
+bool W25q_waitForReadyTimeout(uint32_t typicalMs, uint32_t maxMs);
+bool W25q_waitForReadyPolled(uint32_t timeoutMs);			//!< BUSY is polled by the QUADSPI controller
+bool W25q_waitForProgram(void);								//!< Bounded by the SFDP page program maximum
+bool W25q_waitForChipErase(void);							//!< Sleeps the SFDP typical time, bounded by the maximum
 bool W25q_readBytes(uint32_t address, uint8_t *buffer, uint32_t length);
+bool W25q_readBytesWithDummyCycles(uint32_t address, uint8_t *buffer, uint32_t length, uint8_t dummyCycles);
+void W25q_setReadDummyCycles(uint8_t dummyCycles);
 bool W25q_sectorErase(uint32_t address);
 bool W25q_blockErase32k(uint32_t address);
 bool W25q_blockErase64k(uint32_t address);
-bool W25q_chipErase(void);
+bool W25q_chipErase(void);										//!< Starts the erase on every die, finish with W25q_waitForChipErase
+bool W25q_eraseRange(uint32_t address, uint32_t length);
+uint32_t W25q_startEraseRange(uint32_t address, uint32_t length);	//!< First unit W25q_eraseRange would erase, not waited for, bytes it clears from address on or 0
 bool W25q_flexibleSizeErase(uint32_t size, uint32_t address);
 bool W25q_dynamicErase(uint32_t firmwareSize, uint32_t flashAddress);
 bool W25q_quadPageProgram(uint32_t address, uint8_t *buffer, uint32_t length);
+bool W25q_writeBytes(uint32_t address, const uint8_t *buffer, uint32_t length);
+bool W25q_startPageProgram(uint32_t address, const uint8_t *buffer, uint32_t length);		//!< Bulk path, returns while the page programs
+bool W25q_writeVector(uint32_t address, const FlashIoVec *iov, uint32_t count);
+bool W25q_readVector(uint32_t address, const FlashIoVec *iov, uint32_t count);
+bool W25q_readBytesAsync(uint32_t address, uint8_t *buffer, uint32_t length, QuadSpiDmaDone done, void *context);
+bool W25q_quadPageProgramAsync(uint32_t address, const uint8_t *buffer, uint32_t length, QuadSpiDmaDone done, void *context);	//!< done fires when the data is sent, wait for ready before the next write
+uint32_t W25q_fillProgramOps(QuadSpiOp *ops, uint32_t maxOps, uint32_t address, const uint8_t *buffer, uint32_t length);	//!< 0 if maxOps is too small
 bool W25q_memoryMappedModeEnable(void);
+bool W25q_memoryMappedModeDisable(void);
+bool W25q_isMemoryMapped(void);
 
 #endif /* __W25Q_H */
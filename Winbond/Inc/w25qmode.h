@@ -0,0 +1,51 @@
+/*
+ * This program is memory-mapped/indirect mode manager for W25Q.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __W25QMODE_H
+#define __W25QMODE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "stm32h7xx_hal.h"
+#include "w25q.h"
+
+#ifndef W25Q_MAPPED_BASE
+#define W25Q_MAPPED_BASE		QSPI_BASE		//!< Where the flash appears in memory-mapped mode
+#endif
+
+typedef struct {
+	uint32_t unmaps;				//!< Switches to indirect mode
+	uint32_t remaps;				//!< Switches back to memory-mapped mode
+	uint32_t updates;				//!< Program/erase calls issued
+	uint32_t failedRemaps;
+} W25qModeStats;
+
+bool W25qMode_init(bool lazyRemap);
+bool W25qMode_beginUpdate(void);
+bool W25qMode_endUpdate(void);
+bool W25qMode_writeBytes(uint32_t address, const uint8_t *buffer, uint32_t length);
+bool W25qMode_eraseRange(uint32_t address, uint32_t length);
+bool W25qMode_readBytes(uint32_t address, uint8_t *buffer, uint32_t length);
+const uint8_t *W25qMode_map(uint32_t address);			//!< Pointer into the mapped flash, NULL if it cannot be mapped
+uint32_t W25qMode_epoch(void);								//!< Changes whenever flash contents may have changed
+const W25qModeStats *W25qMode_getStats(void);
+
+#endif /* __W25QMODE_H */
@@ -0,0 +1,90 @@
+/*
+ * This program is sector wear leveling for W25Q NOR flash.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __WEARLEVEL_H
+#define __WEARLEVEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define WEAR_LEVEL_SECTOR_SIZE		4096
+#define WEAR_LEVEL_HEADER_SIZE		16
+#define WEAR_LEVEL_PAYLOAD_SIZE		(WEAR_LEVEL_SECTOR_SIZE - WEAR_LEVEL_HEADER_SIZE)	//!< Bytes per logical sector
+#define WEAR_LEVEL_MAGIC			0x31534C57	//!< "WLS1"
+#define WEAR_LEVEL_UNMAPPED			0xFFFF
+
+#ifndef WEAR_LEVEL_MAX_SECTORS
+#define WEAR_LEVEL_MAX_SECTORS		256
+#endif
+#ifndef WEAR_LEVEL_MAX_SPREAD
+#define WEAR_LEVEL_MAX_SPREAD		64		//!< Erase count gap that triggers moving cold data
+#endif
+
+// Header flags, cleared in order: assigned when a logical sector is placed, committed once its data is complete
+#define WEAR_LEVEL_FLAG_ASSIGNED	(1u << 0)
+#define WEAR_LEVEL_FLAG_COMMITTED	(1u << 1)
+
+typedef struct {
+	bool (*read)(void *context, uint32_t address, uint8_t *buffer, uint32_t length);
+	bool (*program)(void *context, uint32_t address, const uint8_t *buffer, uint32_t length);
+	bool (*eraseSector)(void *context, uint32_t address);
+	void *context;
+} WearLevelIo;
+
+typedef struct {
+	uint32_t erases;				//!< Physical sector erases, migrations included
+	uint32_t migrations;			//!< Cold sectors moved onto worn ones
+	uint32_t headerWrites;
+	uint32_t recovered;				//!< Stale or unformatted sectors cleaned up at mount
+} WearLevelStats;
+
+/*
+ * Every physical sector starts with a 16 byte header: magic, logical sector, flags, erase count
+ * and version. Free sectors are kept erased with logical 0xFFFF, so the header is programmed
+ * again in place when the sector is assigned. The erase count lives in the header and survives
+ * the erase by being written straight back after it.
+ */
+typedef struct {
+	const WearLevelIo *io;
+	uint32_t base;
+	uint32_t physicalSectors;
+	uint32_t logicalSectors;
+
+	uint16_t map[WEAR_LEVEL_MAX_SECTORS];			//!< Logical to physical, WEAR_LEVEL_UNMAPPED if never written
+	uint16_t owner[WEAR_LEVEL_MAX_SECTORS];		//!< Physical to logical, WEAR_LEVEL_UNMAPPED if free
+	uint32_t eraseCount[WEAR_LEVEL_MAX_SECTORS];
+	uint32_t version[WEAR_LEVEL_MAX_SECTORS];
+
+	WearLevelStats stats;
+} WearLevel;
+
+#ifndef FLASH_HOST_BUILD
+extern const WearLevelIo WearLevel_w25qIo;
+#endif
+
+// Needs at least one more physical than logical sector, an unformatted region is formatted on the way
+bool WearLevel_mount(WearLevel *wl, const WearLevelIo *io, uint32_t base, uint32_t physicalSectors, uint32_t logicalSectors);
+bool WearLevel_read(WearLevel *wl, uint32_t logical, uint32_t offset, uint8_t *buffer, uint32_t length);
+bool WearLevel_program(WearLevel *wl, uint32_t logical, uint32_t offset, const uint8_t *data, uint32_t length);
+bool WearLevel_erase(WearLevel *wl, uint32_t logical);
+void WearLevel_eraseSpread(const WearLevel *wl, uint32_t *minCount, uint32_t *maxCount);
+
+#endif /* __WEARLEVEL_H */
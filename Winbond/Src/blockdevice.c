@@ -0,0 +1,274 @@
+/*
+ * This program is block device adapter for Winbond Serial flash memories.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "blockdevice.h"
+#include "w25q.h"
+#include "w25n01g.h"
+
+#define BLOCKDEVICE_W25N01G_BAD_BLOCK_BYTES	(FLASH_DEVICE_NAND_MAX_BLOCKS / 8)
+
+typedef struct {
+	QSPI_HandleTypeDef *hqspi;
+	uint8_t badBlocks[BLOCKDEVICE_W25N01G_BAD_BLOCK_BYTES];
+} BlockDeviceW25n01g;
+
+static BlockDeviceW25n01g w25n01gContext;
+
+static bool BlockDevice_isInRange(const BlockDevice *bd, uint32_t block, uint32_t offset, uint32_t size)
+{
+	return ((block < bd->blockCount) && (offset <= bd->blockSize) && (size <= (bd->blockSize - offset)));
+}
+
+static int BlockDevice_w25qRead(const BlockDevice *bd, uint32_t block, uint32_t offset, void *buffer, uint32_t size)
+{
+	int result = BLOCKDEVICE_OK;
+
+	if (!BlockDevice_isInRange(bd, block, offset, size)) {
+		result = BLOCKDEVICE_ERR_INVAL;
+	} else if (!W25q_readBytes((block * bd->blockSize) + offset, (uint8_t *)buffer, size)) {
+		result = BLOCKDEVICE_ERR_IO;
+	}
+
+	return result;
+}
+
+static int BlockDevice_w25qProg(const BlockDevice *bd, uint32_t block, uint32_t offset, const void *buffer, uint32_t size)
+{
+	int result = BLOCKDEVICE_OK;
+
+	if (!BlockDevice_isInRange(bd, block, offset, size)) {
+		result = BLOCKDEVICE_ERR_INVAL;
+	} else if (!W25q_writeBytes((block * bd->blockSize) + offset, (const uint8_t *)buffer, size)) {
+		result = BLOCKDEVICE_ERR_IO;
+	}
+
+	return result;
+}
+
+static int BlockDevice_w25qErase(const BlockDevice *bd, uint32_t block)
+{
+	int result = BLOCKDEVICE_OK;
+
+	if (block >= bd->blockCount) {
+		result = BLOCKDEVICE_ERR_INVAL;
+	} else if (!W25q_sectorErase(block * bd->blockSize)) {
+		result = BLOCKDEVICE_ERR_IO;
+	}
+
+	return result;
+}
+
+static int BlockDevice_w25qSync(const BlockDevice *bd)
+{
+	(void)bd;
+
+	return W25q_waitForReady() ? BLOCKDEVICE_OK : BLOCKDEVICE_ERR_IO;
+}
+
+bool BlockDevice_w25qInit(BlockDevice *bd)
+{
+	const FlashDevice *device = W25q_getDevice();
+
+	if (device == NULL) {
+		return false;
+	}
+
+	bd->context			= NULL;
+	bd->read			= BlockDevice_w25qRead;
+	bd->prog			= BlockDevice_w25qProg;
+	bd->erase			= BlockDevice_w25qErase;
+	bd->sync			= BlockDevice_w25qSync;
+
+	bd->readSize		= BLOCKDEVICE_W25Q_READ_SIZE;
+	bd->progSize		= FlashDevice_pageSize(device);
+	bd->blockSize		= FlashDevice_sectorSize(device);
+	bd->blockCount		= (FlashDevice_capacity(device) >> FlashDevice_sectorShift(device)) * device->dieCount;
+	bd->cacheSize		= BLOCKDEVICE_W25Q_CACHE_SIZE;
+	bd->lookaheadSize	= BLOCKDEVICE_W25Q_LOOKAHEAD_SIZE;
+	bd->blockCycles		= BLOCKDEVICE_W25Q_BLOCK_CYCLES;
+
+	return true;
+}
+
+static void BlockDevice_w25n01gMarkBad(BlockDeviceW25n01g *context, uint32_t block)
+{
+	context->badBlocks[block / 8] |= (uint8_t)(1u << (block % 8));
+}
+
+static int BlockDevice_w25n01gRead(const BlockDevice *bd, uint32_t block, uint32_t offset, void *buffer, uint32_t size)
+{
+	BlockDeviceW25n01g *context = (BlockDeviceW25n01g *)bd->context;
+	int result = BLOCKDEVICE_OK;
+	uint32_t address = (block * bd->blockSize) + offset;
+	uint8_t *data = (uint8_t *)buffer;
+
+	if (!BlockDevice_isInRange(bd, block, offset, size)) {
+		result = BLOCKDEVICE_ERR_INVAL;
+	}
+
+	while ((result == BLOCKDEVICE_OK) && (size > 0)) {
+
+		uint32_t transferred = W25n01g_readBytes(context->hqspi, address, data, size, true);
+
+		if (transferred == 0) {
+			result = BLOCKDEVICE_ERR_IO;
+		}
+
+		address += transferred;
+		data += transferred;
+		size -= transferred;
+	}
+
+	return result;
+}
+
+static int BlockDevice_w25n01gProg(const BlockDevice *bd, uint32_t block, uint32_t offset, const void *buffer, uint32_t size)
+{
+	BlockDeviceW25n01g *context = (BlockDeviceW25n01g *)bd->context;
+	int result = BLOCKDEVICE_OK;
+	uint32_t address = (block * bd->blockSize) + offset;
+	const uint8_t *data = (const uint8_t *)buffer;
+
+	if (!BlockDevice_isInRange(bd, block, offset, size) || ((offset % bd->progSize) != 0)) {
+		result = BLOCKDEVICE_ERR_INVAL;
+	} else if (BlockDevice_isBad(bd, block)) {
+		result = BLOCKDEVICE_ERR_CORRUPT;
+	}
+
+	while ((result == BLOCKDEVICE_OK) && (size > 0)) {
+
+		uint32_t chunk = (size > bd->progSize) ? bd->progSize : size;
+
+		if (!w25n01g_pageProgram(context->hqspi, address, data, chunk)) {
+			uint8_t statusReg = W25n01g_readStatusRegister(context->hqspi, W25N01G_STAT_REG);
+
+			if (statusReg & W25N01G_STATUS_PROGRAM_FAIL) {
+				BlockDevice_w25n01gMarkBad(context, block);
+				result = BLOCKDEVICE_ERR_CORRUPT;
+			} else {
+				result = BLOCKDEVICE_ERR_IO;
+			}
+		}
+
+		address += chunk;
+		data += chunk;
+		size -= chunk;
+	}
+
+	return result;
+}
+
+static int BlockDevice_w25n01gErase(const BlockDevice *bd, uint32_t block)
+{
+	BlockDeviceW25n01g *context = (BlockDeviceW25n01g *)bd->context;
+	int result = BLOCKDEVICE_OK;
+
+	if (block >= bd->blockCount) {
+		result = BLOCKDEVICE_ERR_INVAL;
+	} else if (BlockDevice_isBad(bd, block)) {
+		result = BLOCKDEVICE_ERR_CORRUPT;
+	} else if (!W25n01g_blockErase(context->hqspi, block * bd->blockSize)) {
+		result = BLOCKDEVICE_ERR_IO;
+	} else if (!W25n01g_waitForReady(context->hqspi)) {
+		result = BLOCKDEVICE_ERR_IO;
+	} else {
+		uint8_t statusReg = W25n01g_readStatusRegister(context->hqspi, W25N01G_STAT_REG);
+
+		if (statusReg & W25N01G_STATUS_ERASE_FAIL) {
+			BlockDevice_w25n01gMarkBad(context, block);
+			result = BLOCKDEVICE_ERR_CORRUPT;
+		}
+	}
+
+	return result;
+}
+
+static int BlockDevice_w25n01gSync(const BlockDevice *bd)
+{
+	BlockDeviceW25n01g *context = (BlockDeviceW25n01g *)bd->context;
+
+	return W25n01g_waitForReady(context->hqspi) ? BLOCKDEVICE_OK : BLOCKDEVICE_ERR_IO;
+}
+
+bool BlockDevice_w25n01gInit(BlockDevice *bd, QSPI_HandleTypeDef *hqspi)
+{
+	BlockDeviceW25n01g *context = &w25n01gContext;
+	const FlashDevice *device = W25n01g_getDevice();
+
+	if (FlashDevice_totalBlocks(device) > (BLOCKDEVICE_W25N01G_BAD_BLOCK_BYTES * 8)) {
+		return false;
+	}
+
+	context->hqspi		= hqspi;
+	bd->context			= context;
+	bd->read			= BlockDevice_w25n01gRead;
+	bd->prog			= BlockDevice_w25n01gProg;
+	bd->erase			= BlockDevice_w25n01gErase;
+	bd->sync			= BlockDevice_w25n01gSync;
+
+	bd->readSize		= BLOCKDEVICE_W25N01G_READ_SIZE;
+	bd->progSize		= FlashDevice_pageSize(device);
+	bd->blockSize		= FlashDevice_blockSize(device);
+	bd->blockCount		= FlashDevice_totalBlocks(device);
+	bd->cacheSize		= BLOCKDEVICE_W25N01G_CACHE_SIZE;
+	bd->lookaheadSize	= BLOCKDEVICE_W25N01G_LOOKAHEAD_SIZE;
+	bd->blockCycles		= BLOCKDEVICE_W25N01G_BLOCK_CYCLES;
+
+	// Unlock all blocks and make sure reads go through the ECC protected page buffer
+	W25n01g_updateStatusRegister(hqspi, W25N01G_PROT_REG, W25N01G_PROT_CLEAR);
+	W25n01g_updateStatusRegister(hqspi, W25N01G_CONF_REG, W25N01G_CONFIG_ECC_ENABLE | W25N01G_CONFIG_BUFFER_READ_MODE);
+
+	for (uint32_t i = 0; i < BLOCKDEVICE_W25N01G_BAD_BLOCK_BYTES; i++) {
+		context->badBlocks[i] = 0;
+	}
+
+	for (uint32_t block = 0; block < bd->blockCount; block++) {
+		if (W25n01g_isBlockBad(hqspi, block)) {
+			BlockDevice_w25n01gMarkBad(context, block);
+		}
+	}
+
+	return true;
+}
+
+bool BlockDevice_isBad(const BlockDevice *bd, uint32_t block)
+{
+	bool bad = false;
+	const BlockDeviceW25n01g *context = (const BlockDeviceW25n01g *)bd->context;
+
+	if ((context != NULL) && (block < bd->blockCount)) {
+		bad = ((context->badBlocks[block / 8] & (1u << (block % 8))) != 0);
+	}
+
+	return bad;
+}
+
+uint32_t BlockDevice_badBlockCount(const BlockDevice *bd)
+{
+	uint32_t count = 0;
+
+	for (uint32_t block = 0; block < bd->blockCount; block++) {
+		if (BlockDevice_isBad(bd, block)) {
+			count++;
+		}
+	}
+
+	return count;
+}
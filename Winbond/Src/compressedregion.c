@@ -0,0 +1,315 @@
+/*
+ * This program is LZ4 compressed storage region for Serial flash memories.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "compressedregion.h"
+#include "flashverify.h"
+
+#ifndef FLASH_HOST_BUILD
+#include "w25q.h"
+
+static bool CompressedRegion_w25qRead(void *context, uint32_t address, uint8_t *buffer, uint32_t length)
+{
+	return W25q_readBytes(address, buffer, length);
+}
+
+static bool CompressedRegion_w25qProgram(void *context, uint32_t address, const uint8_t *buffer, uint32_t length)
+{
+	return W25q_writeBytes(address, buffer, length);
+}
+
+static bool CompressedRegion_w25qErase(void *context, uint32_t address, uint32_t length)
+{
+	return W25q_eraseRange(address, length);
+}
+
+const CompressedRegionIo CompressedRegion_w25qIo = {
+	.read		= CompressedRegion_w25qRead,
+	.program	= CompressedRegion_w25qProgram,
+	.erase		= CompressedRegion_w25qErase,
+	.context	= NULL,
+	.eraseSize	= W25Q_SECTOR_SIZE,
+};
+#endif
+
+#define COMPRESSED_REGION_HEADER_WORDS	7
+
+static void CompressedRegion_putLe32(uint8_t *data, uint32_t value)
+{
+	data[0] = (uint8_t)value;
+	data[1] = (uint8_t)(value >> 8);
+	data[2] = (uint8_t)(value >> 16);
+	data[3] = (uint8_t)(value >> 24);
+}
+
+static uint32_t CompressedRegion_getLe32(const uint8_t *data)
+{
+	return ((uint32_t)data[0]) | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+uint32_t CompressedRegion_indexAreaSize(const CompressedRegionIo *io, uint32_t maxFrames)
+{
+	uint32_t size = COMPRESSED_REGION_HEADER_SIZE + ((maxFrames + 1u) * 4u);
+
+	return ((size + io->eraseSize - 1u) / io->eraseSize) * io->eraseSize;
+}
+
+static bool CompressedRegion_eraseTo(CompressedRegion *region, uint32_t end)
+{
+	bool success = true;
+
+	while (success && (region->erasedUntil < end)) {
+		uint32_t address = region->base + region->erasedUntil;
+		uint32_t length = COMPRESSED_REGION_ERASE_AHEAD - (address % COMPRESSED_REGION_ERASE_AHEAD);
+
+		// Up to the next erase-ahead boundary in one call, so the part can use a block erase
+		if (length > (region->capacity - region->erasedUntil)) {
+			length = region->capacity - region->erasedUntil;
+		}
+		length = ((length + region->io->eraseSize - 1u) / region->io->eraseSize) * region->io->eraseSize;
+
+		success = region->io->erase(region->io->context, address, length);
+		region->erasedUntil += length;
+	}
+
+	return success;
+}
+
+static bool CompressedRegion_storeFrame(CompressedRegion *region, uint32_t length)
+{
+	uint32_t flag = 0;
+	const uint8_t *source = region->stored;
+	uint32_t storedLength = FlashLz4_compress(region->frame, length, region->stored, sizeof(region->stored));
+
+	// Incompressible data is kept as it is, it must never cost more than raw storage
+	if ((storedLength == 0) || (storedLength >= length)) {
+		source = region->frame;
+		storedLength = length;
+		flag = COMPRESSED_REGION_INDEX_RAW;
+	}
+
+	uint32_t offset = region->dataOffset + region->storedBytes;
+	bool success = (region->frameCount < region->maxFrames) && ((offset + storedLength) <= region->capacity);
+
+	if (success) {
+		success = CompressedRegion_eraseTo(region, offset + storedLength);
+	}
+
+	if (success) {
+		success = region->io->program(region->io->context, region->base + offset, source, storedLength);
+	}
+
+	if (success) {
+		region->index[region->frameCount++] = region->storedBytes | flag;
+		region->storedBytes += storedLength;
+		region->length += length;
+	}
+
+	return success;
+}
+
+bool CompressedRegion_create(CompressedRegion *region, const CompressedRegionIo *io, uint32_t base, uint32_t capacity, uint32_t *index, uint32_t maxFrames)
+{
+	region->io			= io;
+	region->base		= base;
+	region->capacity	= capacity;
+	region->index		= index;
+	region->maxFrames	= maxFrames;
+	region->dataOffset	= CompressedRegion_indexAreaSize(io, maxFrames);
+	region->frameCount	= 0;
+	region->length		= 0;
+	region->storedBytes	= 0;
+	region->fill		= 0;
+	region->erasedUntil	= 0;
+	region->cachedFrame	= COMPRESSED_REGION_NO_FRAME;
+
+	// Erasing the header first invalidates whatever region was here before
+	return (region->dataOffset < capacity) && CompressedRegion_eraseTo(region, region->dataOffset);
+}
+
+bool CompressedRegion_write(CompressedRegion *region, const uint8_t *data, uint32_t length)
+{
+	bool success = true;
+
+	while (success && (length > 0)) {
+		uint32_t take = COMPRESSED_REGION_FRAME_SIZE - region->fill;
+		if (take > length) {
+			take = length;
+		}
+
+		memcpy(&region->frame[region->fill], data, take);
+		region->fill += take;
+		data += take;
+		length -= take;
+
+		if (region->fill == COMPRESSED_REGION_FRAME_SIZE) {
+			success = CompressedRegion_storeFrame(region, region->fill);
+			region->fill = 0;
+		}
+	}
+
+	return success;
+}
+
+bool CompressedRegion_finish(CompressedRegion *region)
+{
+	bool success = true;
+	uint8_t header[COMPRESSED_REGION_HEADER_SIZE];
+
+	if (region->fill > 0) {
+		success = CompressedRegion_storeFrame(region, region->fill);
+		region->fill = 0;
+	}
+
+	if (success) {
+		region->index[region->frameCount] = region->storedBytes;
+	}
+
+	// Index first, the frame buffer is free now and serves as staging for it
+	for (uint32_t word = 0; success && (word <= region->frameCount); ) {
+		uint32_t count = 0;
+
+		while (((word + count) <= region->frameCount) && (count < (COMPRESSED_REGION_FRAME_SIZE / 4u))) {
+			CompressedRegion_putLe32(&region->frame[count * 4u], region->index[word + count]);
+			count++;
+		}
+
+		success = region->io->program(region->io->context, region->base + COMPRESSED_REGION_HEADER_SIZE + (word * 4u), region->frame, count * 4u);
+		word += count;
+	}
+
+	if (success) {
+		memset(header, 0xFF, sizeof(header));
+		CompressedRegion_putLe32(&header[0], COMPRESSED_REGION_MAGIC);
+		CompressedRegion_putLe32(&header[4], COMPRESSED_REGION_FRAME_SIZE);
+		CompressedRegion_putLe32(&header[8], region->frameCount);
+		CompressedRegion_putLe32(&header[12], region->length);
+		CompressedRegion_putLe32(&header[16], region->storedBytes);
+		CompressedRegion_putLe32(&header[20], region->dataOffset);
+		CompressedRegion_putLe32(&header[24], FlashVerify_crc32Update(0, header, (COMPRESSED_REGION_HEADER_WORDS - 1u) * 4u));
+
+		success = region->io->program(region->io->context, region->base, header, COMPRESSED_REGION_HEADER_WORDS * 4u);
+	}
+
+	region->cachedFrame = COMPRESSED_REGION_NO_FRAME;
+
+	return success;
+}
+
+bool CompressedRegion_open(CompressedRegion *region, const CompressedRegionIo *io, uint32_t base)
+{
+	uint8_t header[COMPRESSED_REGION_HEADER_SIZE];
+	bool success = io->read(io->context, base, header, sizeof(header));
+
+	if (success) {
+		success = (CompressedRegion_getLe32(&header[0]) == COMPRESSED_REGION_MAGIC) &&
+				(CompressedRegion_getLe32(&header[4]) == COMPRESSED_REGION_FRAME_SIZE) &&
+				(CompressedRegion_getLe32(&header[24]) == FlashVerify_crc32Update(0, header, (COMPRESSED_REGION_HEADER_WORDS - 1u) * 4u));
+	}
+
+	if (success) {
+		region->io			= io;
+		region->base		= base;
+		region->frameCount	= CompressedRegion_getLe32(&header[8]);
+		region->length		= CompressedRegion_getLe32(&header[12]);
+		region->storedBytes	= CompressedRegion_getLe32(&header[16]);
+		region->dataOffset	= CompressedRegion_getLe32(&header[20]);
+		region->capacity	= region->dataOffset + region->storedBytes;
+		region->maxFrames	= region->frameCount;
+		region->index		= NULL;
+		region->fill		= 0;
+		region->cachedFrame	= COMPRESSED_REGION_NO_FRAME;
+	}
+
+	return success;
+}
+
+//! Only the two index words around the frame are read, the index never has to fit in RAM
+static bool CompressedRegion_loadFrame(CompressedRegion *region, uint32_t frame)
+{
+	uint8_t words[8];
+	uint32_t expected = region->length - (frame * COMPRESSED_REGION_FRAME_SIZE);
+	bool success = region->io->read(region->io->context, region->base + COMPRESSED_REGION_HEADER_SIZE + (frame * 4u), words, sizeof(words));
+
+	if (expected > COMPRESSED_REGION_FRAME_SIZE) {
+		expected = COMPRESSED_REGION_FRAME_SIZE;
+	}
+
+	region->cachedFrame = COMPRESSED_REGION_NO_FRAME;
+
+	if (success) {
+		uint32_t start = CompressedRegion_getLe32(&words[0]);
+		uint32_t end = CompressedRegion_getLe32(&words[4]) & ~COMPRESSED_REGION_INDEX_RAW;
+		bool raw = ((start & COMPRESSED_REGION_INDEX_RAW) != 0);
+		uint32_t storedLength = end - (start & ~COMPRESSED_REGION_INDEX_RAW);
+		uint32_t address = region->base + region->dataOffset + (start & ~COMPRESSED_REGION_INDEX_RAW);
+		uint32_t length = 0;
+
+		if (raw) {
+			success = (storedLength == expected) && region->io->read(region->io->context, address, region->frame, storedLength);
+			length = storedLength;
+		} else {
+			success = (storedLength <= sizeof(region->stored)) && region->io->read(region->io->context, address, region->stored, storedLength) &&
+					FlashLz4_decompress(region->stored, storedLength, region->frame, sizeof(region->frame), &length);
+		}
+
+		success = success && (length == expected);
+	}
+
+	if (success) {
+		region->cachedFrame = frame;
+	}
+
+	return success;
+}
+
+bool CompressedRegion_read(CompressedRegion *region, uint32_t offset, uint8_t *buffer, uint32_t length)
+{
+	bool success = (offset <= region->length) && (length <= (region->length - offset));
+
+	while (success && (length > 0)) {
+		uint32_t frame = offset / COMPRESSED_REGION_FRAME_SIZE;
+		uint32_t column = offset % COMPRESSED_REGION_FRAME_SIZE;
+		uint32_t take = COMPRESSED_REGION_FRAME_SIZE - column;
+
+		if (take > length) {
+			take = length;
+		}
+
+		if (frame != region->cachedFrame) {
+			success = CompressedRegion_loadFrame(region, frame);
+		}
+
+		if (success) {
+			memcpy(buffer, &region->frame[column], take);
+			buffer += take;
+			offset += take;
+			length -= take;
+		}
+	}
+
+	return success;
+}
+
+uint32_t CompressedRegion_ratioPermille(const CompressedRegion *region)
+{
+	return (region->length == 0) ? 1000u : (uint32_t)(((uint64_t)region->storedBytes * 1000u) / region->length);
+}
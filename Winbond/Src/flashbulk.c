@@ -0,0 +1,267 @@
+/*
+ * This program is factory bulk programming for W25Q and W25N01G.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+
+#include "flashbulk.h"
+#include "flashverify.h"
+#include "w25q.h"
+#include "w25n01g.h"
+
+#define FLASH_BULK_PAGE_BUFFER_SIZE		2048	//!< Largest program page in FlashDevice_table
+
+static uint8_t flashBulkPage[FLASH_BULK_PAGE_BUFFER_SIZE] __ALIGNED(32);
+static uint8_t flashBulkBadBlocks[FLASH_DEVICE_NAND_MAX_BLOCKS / 8];	//!< Blocks of the current NAND run left alone
+
+static bool FlashBulk_isBlank(const uint8_t *data, uint32_t length)
+{
+	bool blank = true;
+
+	for (uint32_t i = 0; blank && (i < length); i++) {
+		blank = (data[i] == 0xFF);
+	}
+
+	return blank;
+}
+
+static void FlashBulk_resultInit(FlashBulkResult *result)
+{
+	memset(result, 0, sizeof(*result));
+	result->mismatchOffset = FLASH_VERIFY_NO_OFFSET;
+}
+
+static bool FlashBulk_verify(FlashVerifyRead read, void *context, uint32_t address, uint32_t length, FlashBulkResult *result)
+{
+	FlashVerifyResult verify;
+
+	bool success = FlashVerify_crc32(read, context, address, length, result->crc, &verify);
+
+	result->verified = success && verify.match;
+	result->mismatchOffset = verify.mismatchOffset;
+
+	return result->verified;
+}
+
+bool FlashBulk_memorySource(void *context, uint32_t offset, uint8_t *buffer, uint32_t length)
+{
+	memcpy(buffer, &((const uint8_t *)context)[offset], length);
+	return true;
+}
+
+bool FlashBulk_w25qProgram(uint32_t address, uint32_t length, FlashBulkSource source, void *context, FlashBulkErase erase, FlashBulkResult *result)
+{
+	bool success = true;
+	bool busy = false;
+	uint32_t offset = 0;
+	uint32_t chunk = FlashDevice_pageChunk(W25q_getDevice(), address, length);
+
+	uint32_t start = HAL_GetTick();
+
+	FlashBulk_resultInit(result);
+
+	if (erase == FLASH_BULK_CHIP_ERASE) {
+		success = W25q_chipErase() && W25q_waitForChipErase();
+	} else if (erase == FLASH_BULK_ERASE_RANGE) {
+		success = W25q_eraseRange(address, length);
+	}
+
+	if (success) {
+		success = W25q_waitForReady() && ((length == 0) || source(context, 0, flashBulkPage, chunk));
+	}
+
+	while (success && (offset < length)) {
+		result->crc = FlashVerify_crc32Update(result->crc, flashBulkPage, chunk);
+
+		if (busy) {
+			success = W25q_waitForProgram();
+			busy = false;
+		}
+
+		if (success && FlashBulk_isBlank(flashBulkPage, chunk)) {
+			result->pagesSkipped++;
+		} else if (success) {
+			success = W25q_startPageProgram(address + offset, flashBulkPage, chunk);
+			busy = true;
+			result->pagesProgrammed++;
+		}
+
+		// The page is in the device buffer now, fetch the next one while it programs
+		offset += chunk;
+		if (success && (offset < length)) {
+			chunk = FlashDevice_pageChunk(W25q_getDevice(), address + offset, length - offset);
+			success = source(context, offset, flashBulkPage, chunk);
+		}
+	}
+
+	if (success && busy) {
+		success = W25q_waitForProgram();
+	}
+
+	if (success) {
+		success = FlashBulk_verify(FlashVerify_w25qRead, NULL, address, length, result);
+	}
+
+	result->elapsedMs = HAL_GetTick() - start;
+
+	return success;
+}
+
+static bool FlashBulk_isBadBlock(uint32_t block)
+{
+	return ((flashBulkBadBlocks[block / 8] & (1u << (block % 8))) != 0);
+}
+
+static void FlashBulk_markBadBlock(uint32_t block, FlashBulkResult *result)
+{
+	flashBulkBadBlocks[block / 8] |= (uint8_t)(1u << (block % 8));
+	result->badBlocks++;
+}
+
+static bool FlashBulk_w25n01gEraseBlock(QSPI_HandleTypeDef *hqspi, uint32_t block, FlashBulkResult *result)
+{
+	bool success = true;
+
+	if (W25n01g_isBlockBad(hqspi, block)) {
+		FlashBulk_markBadBlock(block, result);
+	} else {
+		success = W25n01g_blockErase(hqspi, block << FlashDevice_blockShift(W25n01g_getDevice())) &&
+				W25n01g_waitForReadyPolled(hqspi, FLASH_BULK_NAND_ERASE_TIMEOUT_MS);
+
+		// A block failing erase joins the bad ones, the image only fails if it needs that block
+		if (success && (W25n01g_readStatusRegister(hqspi, W25N01G_STAT_REG) & W25N01G_STATUS_ERASE_FAIL)) {
+			FlashBulk_markBadBlock(block, result);
+		} else if (success) {
+			result->blocksErased++;
+		}
+	}
+
+	return success;
+}
+
+static bool FlashBulk_w25n01gVerifyRead(void *context, uint32_t address, uint8_t *buffer, uint32_t length)
+{
+	const FlashDevice *device = W25n01g_getDevice();
+	bool success = true;
+
+	// Bad blocks were never programmed, they stand for the blank pages the image had there
+	while (success && (length > 0)) {
+		uint32_t block = FlashDevice_addressToBlock(device, address);
+		uint32_t span = FlashDevice_blockSize(device) - (address & (FlashDevice_blockSize(device) - 1u));
+
+		if (span > length) {
+			span = length;
+		}
+
+		if (FlashBulk_isBadBlock(block)) {
+			memset(buffer, 0xFF, span);
+		} else {
+			success = FlashVerify_w25n01gRead(context, address, buffer, span);
+		}
+
+		address += span;
+		buffer += span;
+		length -= span;
+	}
+
+	return success;
+}
+
+bool FlashBulk_w25n01gProgram(QSPI_HandleTypeDef *hqspi, uint32_t address, uint32_t length, FlashBulkSource source, void *context, FlashBulkErase erase, FlashBulkResult *result)
+{
+	const FlashDevice *device = W25n01g_getDevice();
+	uint32_t pageSize = FlashDevice_pageSize(device);
+	uint32_t pagesPerBlock = FlashDevice_blockSize(device) >> FlashDevice_pageShift(device);
+	bool success = (FlashDevice_addressToColumn(device, address) == 0) && (pageSize <= sizeof(flashBulkPage)) &&
+			(FlashDevice_totalBlocks(device) <= (sizeof(flashBulkBadBlocks) * 8));
+	bool busy = false;
+	uint32_t offset = 0;
+	uint32_t chunk = (length < pageSize) ? length : pageSize;
+	uint32_t firstBlock = FlashDevice_addressToBlock(device, address);
+	uint32_t endBlock = FlashDevice_addressToBlock(device, address + length + FlashDevice_blockSize(device) - 1);
+
+	uint32_t start = HAL_GetTick();
+
+	FlashBulk_resultInit(result);
+	memset(flashBulkBadBlocks, 0, sizeof(flashBulkBadBlocks));
+
+	if (erase == FLASH_BULK_CHIP_ERASE) {
+		firstBlock = 0;
+		endBlock = FlashDevice_totalBlocks(device);
+	}
+
+	for (uint32_t block = firstBlock; success && (block < endBlock); block++) {
+		if (erase == FLASH_BULK_ASSUME_BLANK) {
+			// Nothing to erase, the factory markers still decide which blocks take data
+			if (W25n01g_isBlockBad(hqspi, block)) {
+				FlashBulk_markBadBlock(block, result);
+			}
+		} else {
+			success = FlashBulk_w25n01gEraseBlock(hqspi, block, result);
+		}
+	}
+
+	if (success) {
+		success = W25n01g_waitForReady(hqspi) && ((length == 0) || source(context, 0, flashBulkPage, chunk));
+	}
+
+	while (success && (offset < length)) {
+		uint32_t page = FlashDevice_addressToPage(device, address + offset);
+
+		result->crc = FlashVerify_crc32Update(result->crc, flashBulkPage, chunk);
+
+		if (busy) {
+			success = W25n01g_waitForReadyPolled(hqspi, FLASH_BULK_NAND_PROGRAM_TIMEOUT_MS);
+			busy = false;
+		}
+
+		if (success && FlashBulk_isBlank(flashBulkPage, chunk)) {
+			result->pagesSkipped++;
+		} else if (success && FlashBulk_isBadBlock(page / pagesPerBlock)) {
+			// Data the part cannot hold where the image wants it
+			result->mismatchOffset = offset;
+			success = false;
+		} else if (success) {
+			// Stacked parts: the previous page has finished, the next one may sit on the other die
+			success = W25n01g_selectDie(hqspi, FlashDevice_addressToDie(device, address + offset)) &&
+					W25n01g_startQuadPageProgram(hqspi, FlashDevice_addressToDiePage(device, address + offset), flashBulkPage, chunk);
+			busy = true;
+			result->pagesProgrammed++;
+		}
+
+		offset += chunk;
+		if (success && (offset < length)) {
+			chunk = ((length - offset) < pageSize) ? (length - offset) : pageSize;
+			success = source(context, offset, flashBulkPage, chunk);
+		}
+	}
+
+	if (success && busy) {
+		success = W25n01g_waitForReadyPolled(hqspi, FLASH_BULK_NAND_PROGRAM_TIMEOUT_MS);
+	}
+
+	if (success) {
+		success = FlashBulk_verify(FlashBulk_w25n01gVerifyRead, hqspi, address, length, result);
+	}
+
+	result->elapsedMs = HAL_GetTick() - start;
+
+	return success;
+}
@@ -0,0 +1,214 @@
+/*
+ * This program is generic device layer for Winbond Serial flash memories.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "flashdevice.h"
+#include "quadspi.h"
+#include "flashstats.h"
+
+#define FLASH_DEVICE_NOR_JEDEC_DUMMY_CYCLES		0
+#define FLASH_DEVICE_NAND_JEDEC_DUMMY_CYCLES	8
+
+#define FLASH_DEVICE_NOR(name, id, capacityShift, addressBytes, features) \
+	FLASH_DEVICE_NOR_STACK(name, id, capacityShift, addressBytes, 1, features)
+
+#define FLASH_DEVICE_NOR_STACK(name, id, capacityShift, addressBytes, dieCount, features) \
+	{ name, FLASH_DEVICE_MANUFACTURER_WINBOND, id, FLASH_DEVICE_TYPE_NOR, 8, 12, 16, capacityShift, addressBytes, dieCount, 0, features }
+
+#define FLASH_DEVICE_NAND(name, id, capacityShift, dieCount, spareSize, features) \
+	{ name, FLASH_DEVICE_MANUFACTURER_WINBOND, id, FLASH_DEVICE_TYPE_NAND, 11, 17, 17, capacityShift, 2, dieCount, spareSize, features }
+
+// New parts only need an entry here
+const FlashDevice FlashDevice_table[] = {
+	FLASH_DEVICE_NOR("W25Q16JV-IQ",		0x4015,	21,	3,	0),
+	FLASH_DEVICE_NOR("W25Q16JV-IM",		0x7015,	21,	3,	FLASH_DEVICE_FEATURE_DTR),
+	FLASH_DEVICE_NOR("W25Q32JV-IQ",		0x4016,	22,	3,	0),
+	FLASH_DEVICE_NOR("W25Q32JV-IM",		0x7016,	22,	3,	FLASH_DEVICE_FEATURE_DTR),
+	FLASH_DEVICE_NOR("W25Q64JV-IQ",		0x4017,	23,	3,	0),
+	FLASH_DEVICE_NOR("W25Q64JV-IM",		0x7017,	23,	3,	FLASH_DEVICE_FEATURE_DTR),
+	FLASH_DEVICE_NOR("W25Q128JV-IQ",	0x4018,	24,	3,	0),
+	FLASH_DEVICE_NOR("W25Q128JV-IM",	0x7018,	24,	3,	FLASH_DEVICE_FEATURE_DTR),
+	FLASH_DEVICE_NOR("W25Q256JV-IQ",	0x4019,	25,	4,	FLASH_DEVICE_FEATURE_4B_OPCODES),
+	FLASH_DEVICE_NOR("W25Q256JV-IM",	0x7019,	25,	4,	FLASH_DEVICE_FEATURE_4B_OPCODES | FLASH_DEVICE_FEATURE_DTR),
+	FLASH_DEVICE_NOR("W25Q512JV-IQ",	0x4020,	26,	4,	FLASH_DEVICE_FEATURE_4B_OPCODES),
+	FLASH_DEVICE_NOR("W25Q512JV-IM",	0x7020,	26,	4,	FLASH_DEVICE_FEATURE_4B_OPCODES | FLASH_DEVICE_FEATURE_DTR),
+	FLASH_DEVICE_NOR_STACK("W25M512JV-IQ",	0x7119,	25,	4,	2,	FLASH_DEVICE_FEATURE_4B_OPCODES),
+	FLASH_DEVICE_NAND("W25N01GV",		0xAA21,	27,	1,	64,		0),
+	FLASH_DEVICE_NAND("W25N02KV",		0xAA22,	28,	1,	128,	FLASH_DEVICE_FEATURE_ECC_8BIT),
+	FLASH_DEVICE_NAND("W25M02GV",		0xAB21,	27,	2,	64,		0),
+};
+
+const uint32_t FlashDevice_tableSize = sizeof(FlashDevice_table) / sizeof(FlashDevice_table[0]);
+
+static bool flashDeviceIdle[2];		//!< Indexed by FlashDeviceType, BUSY known to be clear
+static uint32_t flashDeviceLoadedPage = FLASH_DEVICE_NO_LOADED_PAGE;
+static uint32_t flashDeviceBusyTimeoutMs[2] = { FLASH_DEVICE_DEFAULT_BUSY_TIMEOUT_MS, FLASH_DEVICE_DEFAULT_BUSY_TIMEOUT_MS };
+static uint32_t flashDeviceWaitTimeoutMs[2] = { FLASH_DEVICE_DEFAULT_BUSY_TIMEOUT_MS, FLASH_DEVICE_DEFAULT_BUSY_TIMEOUT_MS };
+
+const FlashDevice *FlashDevice_identify(const uint8_t *jedecId)
+{
+	const FlashDevice *device = NULL;
+	uint16_t deviceId = (uint16_t)((jedecId[1] << 8) | jedecId[2]);
+
+	for (uint32_t i = 0; (device == NULL) && (i < FlashDevice_tableSize); i++) {
+		if ((FlashDevice_table[i].manufacturerId == jedecId[0]) && (FlashDevice_table[i].deviceId == deviceId)) {
+			device = &FlashDevice_table[i];
+		}
+	}
+
+	return device;
+}
+
+bool FlashDevice_readJedec(QSPI_HandleTypeDef *hqspi, FlashDeviceType type, uint8_t *idBuffer)
+{
+	uint8_t dummyCycles = FLASH_DEVICE_NOR_JEDEC_DUMMY_CYCLES;
+
+	if (type == FLASH_DEVICE_TYPE_NAND) {
+		dummyCycles = FLASH_DEVICE_NAND_JEDEC_DUMMY_CYCLES;
+	}
+
+	return QuadSpiReceive1Line(hqspi, FLASH_DEVICE_INSTR_JEDEC_ID, dummyCycles, idBuffer, 3);
+}
+
+bool FlashDevice_readStatus(QSPI_HandleTypeDef *hqspi, FlashDeviceType type, uint8_t *status)
+{
+	bool success = false;
+
+	if (type == FLASH_DEVICE_TYPE_NAND) {
+		success = QuadSpiReceiveWithAddress1Line(
+				hqspi,
+				FLASH_DEVICE_INSTR_READ_STATUS,
+				0,
+				FLASH_DEVICE_NAND_STATUS_REG,
+				QSPI_ADDRESS_8_BITS,
+				status,
+				1
+				);
+	} else {
+		success = QuadSpiReceive1Line(hqspi, FLASH_DEVICE_INSTR_READ_STATUS, 0, status, 1);
+	}
+
+	return success;
+}
+
+void FlashDevice_invalidateShadow(FlashDeviceType type)
+{
+	flashDeviceIdle[type] = false;
+
+	if (type == FLASH_DEVICE_TYPE_NAND) {
+		flashDeviceLoadedPage = FLASH_DEVICE_NO_LOADED_PAGE;
+	}
+}
+
+void FlashDevice_setLoadedPage(uint32_t loadedPage)
+{
+	flashDeviceLoadedPage = loadedPage;
+}
+
+uint32_t FlashDevice_loadedPage(void)
+{
+	return flashDeviceLoadedPage;
+}
+
+void FlashDevice_markIdle(FlashDeviceType type)
+{
+	flashDeviceIdle[type] = true;
+	flashDeviceWaitTimeoutMs[type] = flashDeviceBusyTimeoutMs[type];
+}
+
+void FlashDevice_setBusyTimeout(FlashDeviceType type, uint32_t timeoutMs)
+{
+	flashDeviceBusyTimeoutMs[type] = timeoutMs;
+	flashDeviceWaitTimeoutMs[type] = timeoutMs;
+}
+
+void FlashDevice_expectBusy(FlashDeviceType type, uint32_t timeoutMs)
+{
+	if (timeoutMs > flashDeviceWaitTimeoutMs[type]) {
+		flashDeviceWaitTimeoutMs[type] = timeoutMs;
+	}
+}
+
+bool FlashDevice_waitForReady(QSPI_HandleTypeDef *hqspi, FlashDeviceType type)
+{
+#ifndef FLASH_DEVICE_STRICT_CHECKS
+	if (flashDeviceIdle[type]) {
+		return true;
+	}
+#endif
+
+	uint8_t status = FLASH_DEVICE_STATUS_BUSY;
+	uint32_t start = HAL_GetTick();
+	uint32_t statsStart = FLASH_STATS_NOW();
+	uint32_t polls = 0;
+	bool success = FlashDevice_readStatus(hqspi, type, &status);
+
+	// A part that never clears BUSY, or a bus that floats high, fails here instead of hanging the caller
+	while (success && (status & FLASH_DEVICE_STATUS_BUSY)) {
+		if ((HAL_GetTick() - start) > flashDeviceWaitTimeoutMs[type]) {
+			success = false;
+		} else {
+			FLASH_STATS_POLL(polls);
+			success = FlashDevice_readStatus(hqspi, type, &status);
+		}
+	}
+
+	FLASH_STATS_WAIT(statsStart, polls, !success);
+
+	if (success) {
+		FlashDevice_markIdle(type);
+	} else {
+		flashDeviceIdle[type] = false;
+	}
+
+	return success;
+}
+
+bool FlashDevice_writeEnable(QSPI_HandleTypeDef *hqspi, FlashDeviceType type)
+{
+	uint8_t status = 0;
+
+	bool success = FlashDevice_waitForReady(hqspi, type) && QuadSpiInstruction(hqspi, FLASH_DEVICE_INSTR_WRITE_ENABLE);
+
+	// Whatever follows may start a program or erase
+	flashDeviceIdle[type] = false;
+
+#ifdef FLASH_DEVICE_STRICT_CHECKS
+	if (success) {
+		success = FlashDevice_readStatus(hqspi, type, &status);
+	}
+
+	if (success && !(status & FLASH_DEVICE_STATUS_WEL)) {
+		success = false;
+	}
+#else
+	(void)status;
+#endif
+
+	return success;
+}
+
+bool FlashDevice_selectDie(QSPI_HandleTypeDef *hqspi, uint8_t die)
+{
+	// Accepted while the other die is busy, status reads and waits then follow the selected die
+	flashDeviceIdle[FLASH_DEVICE_TYPE_NOR] = false;
+	flashDeviceIdle[FLASH_DEVICE_TYPE_NAND] = false;
+
+	return QuadSpiTransmit1Line(hqspi, FLASH_DEVICE_INSTR_DIE_SELECT, 0, &die, 1);
+}
@@ -0,0 +1,227 @@
+/*
+ * This program is LZ4 block format codec for Serial flash memories.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "flashlz4.h"
+
+#define FLASH_LZ4_MIN_MATCH			4
+#define FLASH_LZ4_LAST_LITERALS		5		//!< The block must end with at least this many literals
+#define FLASH_LZ4_MATCH_FIND_LIMIT	12		//!< No match may start closer than this to the end
+#define FLASH_LZ4_MAX_OFFSET		65535
+#define FLASH_LZ4_RUN_MASK			15
+
+static uint16_t flashLz4Table[1u << FLASH_LZ4_HASH_BITS];
+
+static uint32_t FlashLz4_read32(const uint8_t *data)
+{
+	uint32_t value;
+	memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+static uint32_t FlashLz4_hash(uint32_t sequence)
+{
+	return (sequence * 2654435761u) >> (32u - FLASH_LZ4_HASH_BITS);
+}
+
+//! Writes the 255-continued length extension, returns false if it doesn't fit
+static bool FlashLz4_writeLength(uint8_t *dst, uint32_t *op, uint32_t dstCapacity, uint32_t length)
+{
+	while (length >= 255u) {
+		if (*op >= dstCapacity) {
+			return false;
+		}
+		dst[(*op)++] = 255u;
+		length -= 255u;
+	}
+
+	if (*op >= dstCapacity) {
+		return false;
+	}
+	dst[(*op)++] = (uint8_t)length;
+
+	return true;
+}
+
+static bool FlashLz4_emit(uint8_t *dst, uint32_t *op, uint32_t dstCapacity, const uint8_t *literals, uint32_t literalLength, uint32_t offset, uint32_t matchLength)
+{
+	uint32_t tokenPosition = *op;
+	uint32_t matchCode = (matchLength > 0) ? (matchLength - FLASH_LZ4_MIN_MATCH) : 0;
+	bool fits = (*op < dstCapacity);
+
+	if (fits) {
+		dst[tokenPosition] = (uint8_t)(((literalLength < FLASH_LZ4_RUN_MASK) ? literalLength : FLASH_LZ4_RUN_MASK) << 4);
+		(*op)++;
+	}
+
+	if (fits && (literalLength >= FLASH_LZ4_RUN_MASK)) {
+		fits = FlashLz4_writeLength(dst, op, dstCapacity, literalLength - FLASH_LZ4_RUN_MASK);
+	}
+
+	if (fits && ((*op + literalLength) <= dstCapacity)) {
+		memcpy(&dst[*op], literals, literalLength);
+		*op += literalLength;
+	} else {
+		fits = false;
+	}
+
+	// The last sequence carries literals only
+	if (fits && (matchLength > 0)) {
+		dst[tokenPosition] |= (uint8_t)((matchCode < FLASH_LZ4_RUN_MASK) ? matchCode : FLASH_LZ4_RUN_MASK);
+
+		if ((*op + 2u) <= dstCapacity) {
+			dst[(*op)++] = (uint8_t)offset;
+			dst[(*op)++] = (uint8_t)(offset >> 8);
+		} else {
+			fits = false;
+		}
+
+		if (fits && (matchCode >= FLASH_LZ4_RUN_MASK)) {
+			fits = FlashLz4_writeLength(dst, op, dstCapacity, matchCode - FLASH_LZ4_RUN_MASK);
+		}
+	}
+
+	return fits;
+}
+
+uint32_t FlashLz4_compress(const uint8_t *src, uint32_t srcLength, uint8_t *dst, uint32_t dstCapacity)
+{
+	uint32_t ip = 0;
+	uint32_t anchor = 0;
+	uint32_t op = 0;
+	bool fits = (srcLength <= FLASH_LZ4_MAX_INPUT);
+
+	// Entries hold position + 1 so that zero means empty
+	memset(flashLz4Table, 0, sizeof(flashLz4Table));
+
+	if (srcLength > FLASH_LZ4_MATCH_FIND_LIMIT) {
+		uint32_t findLimit = srcLength - FLASH_LZ4_MATCH_FIND_LIMIT;
+		uint32_t matchLimit = srcLength - FLASH_LZ4_LAST_LITERALS;
+
+		while (fits && (ip < findLimit)) {
+			uint32_t sequence = FlashLz4_read32(&src[ip]);
+			uint32_t hash = FlashLz4_hash(sequence);
+			uint32_t candidate = flashLz4Table[hash];
+
+			flashLz4Table[hash] = (uint16_t)(ip + 1u);
+
+			if ((candidate != 0) && ((ip - (candidate - 1u)) <= FLASH_LZ4_MAX_OFFSET) && (FlashLz4_read32(&src[candidate - 1u]) == sequence)) {
+				uint32_t reference = candidate - 1u;
+				uint32_t matchLength = FLASH_LZ4_MIN_MATCH;
+
+				while (((ip + matchLength) < matchLimit) && (src[reference + matchLength] == src[ip + matchLength])) {
+					matchLength++;
+				}
+
+				fits = FlashLz4_emit(dst, &op, dstCapacity, &src[anchor], ip - anchor, ip - reference, matchLength);
+
+				ip += matchLength;
+				anchor = ip;
+			} else {
+				ip++;
+			}
+		}
+	}
+
+	if (fits) {
+		fits = FlashLz4_emit(dst, &op, dstCapacity, &src[anchor], srcLength - anchor, 0, 0);
+	}
+
+	return fits ? op : 0;
+}
+
+static bool FlashLz4_readLength(const uint8_t *src, uint32_t srcLength, uint32_t *ip, uint32_t *length)
+{
+	uint8_t byte = 255u;
+
+	while (byte == 255u) {
+		if (*ip >= srcLength) {
+			return false;
+		}
+		byte = src[(*ip)++];
+		*length += byte;
+	}
+
+	return true;
+}
+
+bool FlashLz4_decompress(const uint8_t *src, uint32_t srcLength, uint8_t *dst, uint32_t dstCapacity, uint32_t *dstLength)
+{
+	uint32_t ip = 0;
+	uint32_t op = 0;
+	bool valid = (srcLength > 0);
+
+	while (valid && (ip < srcLength)) {
+		uint8_t token = src[ip++];
+		uint32_t literalLength = token >> 4;
+
+		if (literalLength == FLASH_LZ4_RUN_MASK) {
+			valid = FlashLz4_readLength(src, srcLength, &ip, &literalLength);
+		}
+
+		if (valid && ((literalLength > (srcLength - ip)) || (literalLength > (dstCapacity - op)))) {
+			valid = false;
+		}
+
+		if (valid) {
+			memcpy(&dst[op], &src[ip], literalLength);
+			ip += literalLength;
+			op += literalLength;
+		}
+
+		if (!valid || (ip == srcLength)) {
+			break;
+		}
+
+		if ((ip + 2u) > srcLength) {
+			valid = false;
+			break;
+		}
+
+		uint32_t offset = (uint32_t)src[ip] | ((uint32_t)src[ip + 1u] << 8);
+		uint32_t matchLength = token & FLASH_LZ4_RUN_MASK;
+		ip += 2u;
+
+		if ((offset == 0) || (offset > op)) {
+			valid = false;
+		}
+
+		if (valid && (matchLength == FLASH_LZ4_RUN_MASK)) {
+			valid = FlashLz4_readLength(src, srcLength, &ip, &matchLength);
+		}
+
+		matchLength += FLASH_LZ4_MIN_MATCH;
+
+		if (valid && (matchLength > (dstCapacity - op))) {
+			valid = false;
+		}
+
+		// Byte by byte, the match may overlap the bytes it produces
+		for (uint32_t i = 0; valid && (i < matchLength); i++) {
+			dst[op] = dst[op - offset];
+			op++;
+		}
+	}
+
+	*dstLength = op;
+
+	return valid;
+}
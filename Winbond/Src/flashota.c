@@ -0,0 +1,234 @@
+/*
+ * This program is streaming firmware update pipeline for W25Q.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "flashota.h"
+#include "flashverify.h"
+
+static bool FlashOta_isBusy(bool *busy)
+{
+	uint8_t statusReg = W25Q_STATUS_REG1_BUSY;
+	bool success = W25q_readStatusRegister(W25Q_INSTR_READ_STATUS_REG1, &statusReg);
+
+	*busy = ((statusReg & W25Q_STATUS_REG1_BUSY) != 0);
+
+	return success;
+}
+
+static void FlashOta_verifyInFlight(FlashOta *ota)
+{
+	FlashVerifyResult result;
+
+	if (ota->verify) {
+		bool success = FlashVerify_compare(FlashVerify_w25qRead, NULL, ota->baseAddress + ota->inFlightOffset, ota->page[ota->inFlight], ota->inFlightLength, &result);
+
+		if (!success || !result.match) {
+			ota->stats.verifyFailures++;
+			ota->failed = true;
+		}
+	}
+
+	ota->inFlight = FLASH_OTA_NONE;
+}
+
+static void FlashOta_startProgram(FlashOta *ota, uint32_t length)
+{
+	// Returns once the page is sent, the flash programs it while the next one is received
+	if (W25q_quadPageProgram(ota->baseAddress + ota->queuedOffset, ota->page[ota->queued], length)) {
+		ota->inFlight = ota->queued;
+		ota->inFlightOffset = ota->queuedOffset;
+		ota->inFlightLength = length;
+		ota->deviceBusy = true;
+		ota->stats.pagesProgrammed++;
+	} else {
+		ota->failed = true;
+	}
+
+	ota->queued = FLASH_OTA_NONE;
+}
+
+static void FlashOta_startErase(FlashOta *ota)
+{
+	if (W25q_sectorErase(ota->baseAddress + ota->erasedUntil)) {
+		ota->erasedUntil += W25Q_SECTOR_SIZE;
+		ota->deviceBusy = true;
+		ota->stats.sectorsErased++;
+	} else {
+		ota->failed = true;
+	}
+}
+
+//! One step of the flash side, queuedLength is the byte count of the queued buffer
+static void FlashOta_step(FlashOta *ota, uint32_t queuedLength)
+{
+	if (ota->deviceBusy) {
+		bool busy = true;
+
+		if (!FlashOta_isBusy(&busy)) {
+			ota->failed = true;
+		}
+
+		ota->deviceBusy = busy && !ota->failed;
+
+		if (!ota->deviceBusy && (ota->inFlight != FLASH_OTA_NONE)) {
+			FlashOta_verifyInFlight(ota);
+		}
+	}
+
+	if (ota->deviceBusy || ota->failed) {
+		return;
+	}
+
+	uint32_t eraseTarget = ota->finishing ? ota->writeOffset : (ota->writeOffset + FLASH_OTA_ERASE_AHEAD);
+	if (eraseTarget > ota->capacity) {
+		eraseTarget = ota->capacity;
+	}
+
+	// A queued page whose sector is erased goes first, otherwise use the idle flash to erase ahead
+	if ((ota->queued != FLASH_OTA_NONE) && ((ota->queuedOffset + queuedLength) <= ota->erasedUntil)) {
+		FlashOta_startProgram(ota, queuedLength);
+	} else if (ota->erasedUntil < eraseTarget) {
+		FlashOta_startErase(ota);
+	}
+}
+
+bool FlashOta_begin(FlashOta *ota, uint32_t baseAddress, uint32_t capacity, bool verify)
+{
+	if ((baseAddress & (W25Q_SECTOR_SIZE - 1u)) != 0) {
+		return false;
+	}
+
+	memset(&ota->stats, 0, sizeof(ota->stats));
+	ota->baseAddress	= baseAddress;
+	ota->capacity		= capacity;
+	ota->verify			= verify;
+	ota->active			= 0;
+	ota->fill			= 0;
+	ota->queued			= FLASH_OTA_NONE;
+	ota->inFlight		= FLASH_OTA_NONE;
+	ota->writeOffset	= 0;
+	ota->erasedUntil	= 0;
+	ota->deviceBusy		= false;
+	ota->finishing		= false;
+	ota->failed			= false;
+	ota->crc			= 0;
+
+	// Only the first sector is erased up front, the rest follows the write pointer
+	FlashOta_step(ota, 0);
+
+	return !ota->failed;
+}
+
+static bool FlashOta_queueActive(FlashOta *ota)
+{
+	uint8_t other = (uint8_t)(ota->active ^ 1u);
+
+	if ((ota->queued != FLASH_OTA_NONE) || (ota->inFlight == other)) {
+		ota->stats.receiverStalls++;
+	}
+
+	// Wait until the other buffer is programmed and verified, the flash is the bottleneck here
+	while (!ota->failed && ((ota->queued != FLASH_OTA_NONE) || (ota->inFlight == other))) {
+		FlashOta_step(ota, W25Q_PAGE_SIZE);
+	}
+
+	if (!ota->failed) {
+		ota->queued = ota->active;
+		ota->queuedOffset = ota->writeOffset;
+		ota->writeOffset += ota->fill;
+		ota->active = other;
+
+		FlashOta_step(ota, ota->fill);
+		ota->fill = 0;
+	}
+
+	return !ota->failed;
+}
+
+bool FlashOta_write(FlashOta *ota, const uint8_t *data, uint32_t length)
+{
+	if ((ota->writeOffset + ota->fill + length) > ota->capacity) {
+		ota->failed = true;
+	}
+
+	if (!ota->failed) {
+		ota->crc = FlashVerify_crc32Update(ota->crc, data, length);
+		ota->stats.bytesReceived += length;
+	}
+
+	while (!ota->failed && (length > 0)) {
+		uint32_t take = W25Q_PAGE_SIZE - ota->fill;
+		if (take > length) {
+			take = length;
+		}
+
+		memcpy(&ota->page[ota->active][ota->fill], data, take);
+		ota->fill += take;
+		data += take;
+		length -= take;
+
+		if (ota->fill == W25Q_PAGE_SIZE) {
+			FlashOta_queueActive(ota);
+		}
+	}
+
+	return !ota->failed;
+}
+
+bool FlashOta_poll(FlashOta *ota)
+{
+	if (!ota->failed) {
+		FlashOta_step(ota, W25Q_PAGE_SIZE);
+	}
+
+	return !ota->failed;
+}
+
+bool FlashOta_finish(FlashOta *ota, uint32_t expectedCrc)
+{
+	ota->finishing = true;
+
+	if (!ota->failed && (ota->fill > 0)) {
+		uint32_t length = ota->fill;
+
+		// The partial last page is queued like any other, with its real length
+		while (!ota->failed && ((ota->queued != FLASH_OTA_NONE) || (ota->inFlight == (ota->active ^ 1u)))) {
+			FlashOta_step(ota, W25Q_PAGE_SIZE);
+		}
+
+		if (!ota->failed) {
+			ota->queued = ota->active;
+			ota->queuedOffset = ota->writeOffset;
+			ota->writeOffset += length;
+			ota->fill = 0;
+		}
+
+		while (!ota->failed && (ota->queued != FLASH_OTA_NONE)) {
+			FlashOta_step(ota, length);
+		}
+	}
+
+	while (!ota->failed && (ota->deviceBusy || (ota->queued != FLASH_OTA_NONE) || (ota->inFlight != FLASH_OTA_NONE))) {
+		FlashOta_step(ota, W25Q_PAGE_SIZE);
+	}
+
+	return !ota->failed && (ota->crc == expectedCrc);
+}
@@ -0,0 +1,636 @@
+/*
+ * This program is priority I/O scheduler for Serial flash memories.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "flashscheduler.h"
+
+#ifndef FLASH_HOST_BUILD
+#include "w25q.h"
+#include "w25n01g.h"
+
+const FlashSchedulerDevice FlashScheduler_w25q = {
+	.read		= W25q_readBytes,
+	.readVector	= W25q_readVector,
+	.program	= W25q_writeBytes,
+	.erase		= W25q_eraseRange,
+};
+
+static QSPI_HandleTypeDef *flashSchedulerQspi = NULL;
+
+static bool FlashScheduler_w25qPoll(uint8_t die, bool *busy)
+{
+	uint8_t status = W25Q_STATUS_REG1_BUSY;
+	bool success = W25q_selectDie(die) && W25q_readStatusRegister(W25Q_INSTR_READ_STATUS_REG1, &status);
+
+	// NOR reports no program or erase failure, only a failed status read counts
+	*busy = success && (status & W25Q_STATUS_REG1_BUSY);
+	return success;
+}
+
+void FlashScheduler_w25qDevice(FlashSchedulerDevice *device)
+{
+	const FlashDevice *part = W25q_getDevice();
+
+	*device = FlashScheduler_w25q;
+
+	if ((part != NULL) && (part->dieCount > 1)) {
+		device->dieCount		= part->dieCount;
+		device->dieShift		= FlashDevice_capacityShift(part);
+		device->pageSize		= FlashDevice_pageSize(part);
+		device->startProgram	= W25q_startPageProgram;
+		device->startErase		= W25q_startEraseRange;
+		device->poll			= FlashScheduler_w25qPoll;
+	}
+}
+
+static bool FlashScheduler_w25n01gRead(uint32_t address, uint8_t *buffer, uint32_t length)
+{
+	FlashIoVec iov = { buffer, length };
+	return W25n01g_readVector(flashSchedulerQspi, address, &iov, 1);
+}
+
+static bool FlashScheduler_w25n01gReadVector(uint32_t address, const FlashIoVec *iov, uint32_t count)
+{
+	return W25n01g_readVector(flashSchedulerQspi, address, iov, count);
+}
+
+static bool FlashScheduler_w25n01gProgram(uint32_t address, const uint8_t *buffer, uint32_t length)
+{
+	FlashIoVec iov = { (uint8_t *)buffer, length };
+	return w25n01g_writeVector(flashSchedulerQspi, address, &iov, 1);
+}
+
+static bool FlashScheduler_w25n01gErase(uint32_t address, uint32_t length)
+{
+	bool success = true;
+	uint32_t blockSize = FlashDevice_blockSize(W25n01g_getDevice());
+
+	for (uint32_t offset = 0; success && (offset < length); offset += blockSize) {
+		success = W25n01g_blockErase(flashSchedulerQspi, address + offset);
+
+		if (success) {
+			success = W25n01g_waitForReady(flashSchedulerQspi) &&
+					!(W25n01g_readStatusRegister(flashSchedulerQspi, W25N01G_STAT_REG) & W25N01G_STATUS_ERASE_FAIL);
+		}
+	}
+
+	return success;
+}
+
+static bool FlashScheduler_w25n01gStartProgram(uint32_t address, const uint8_t *buffer, uint32_t length)
+{
+	const FlashDevice *part = W25n01g_getDevice();
+	bool success = W25n01g_selectDie(flashSchedulerQspi, FlashDevice_addressToDie(part, address));
+
+	if (success) {
+		// Over four lines, the load holds the bus while the other die could be working
+		success = W25n01g_quadProgramDataLoad(flashSchedulerQspi, FlashDevice_addressToColumn(part, address), buffer, length);
+	}
+
+	if (success) {
+		success = W25n01g_startProgramExecute(flashSchedulerQspi, FlashDevice_addressToDiePage(part, address));
+	}
+
+	return success;
+}
+
+static uint32_t FlashScheduler_w25n01gStartErase(uint32_t address, uint32_t length)
+{
+	uint32_t blockSize = FlashDevice_blockSize(W25n01g_getDevice());
+
+	(void)length;
+	return W25n01g_blockErase(flashSchedulerQspi, address) ? (blockSize - (address & (blockSize - 1u))) : 0u;
+}
+
+static bool FlashScheduler_w25n01gPoll(uint8_t die, bool *busy)
+{
+	bool success = W25n01g_selectDie(flashSchedulerQspi, die);
+	uint8_t status = 0;
+
+	if (success) {
+		status = W25n01g_readStatusRegister(flashSchedulerQspi, W25N01G_STAT_REG);
+		success = !(status & (W25N01G_STATUS_PROGRAM_FAIL | W25N01G_STATUS_ERASE_FAIL));
+	}
+
+	*busy = success && (status & W25N01G_STATUS_FLAG_BUSY);
+	return success;
+}
+
+void FlashScheduler_w25n01gDevice(FlashSchedulerDevice *device, QSPI_HandleTypeDef *hqspi)
+{
+	const FlashDevice *part = W25n01g_getDevice();
+
+	flashSchedulerQspi = hqspi;
+
+	memset(device, 0, sizeof(*device));
+	device->read		= FlashScheduler_w25n01gRead;
+	device->readVector	= FlashScheduler_w25n01gReadVector;
+	device->program		= FlashScheduler_w25n01gProgram;
+	device->erase		= FlashScheduler_w25n01gErase;
+
+	if (part->dieCount > 1) {
+		device->dieCount		= part->dieCount;
+		device->dieShift		= FlashDevice_capacityShift(part);
+		device->pageSize		= FlashDevice_pageSize(part);
+		device->startProgram	= FlashScheduler_w25n01gStartProgram;
+		device->startErase		= FlashScheduler_w25n01gStartErase;
+		device->poll			= FlashScheduler_w25n01gPoll;
+	}
+}
+#endif
+
+static const FlashSchedulerOs *flashSchedulerOs = NULL;
+static const FlashSchedulerDevice *flashSchedulerDevice = NULL;
+static void *flashSchedulerWork = NULL;
+static FlashRequest *flashSchedulerHead = NULL;
+static FlashRequest *flashSchedulerTail = NULL;
+static uint32_t flashSchedulerDepth = 0;
+static FlashSchedulerStats flashSchedulerStats;
+static FlashRequest *flashSchedulerActive[FLASH_SCHEDULER_MAX_DIES];	//!< Program/erase running on each die
+static bool flashSchedulerWaiting = false;		//!< Last service found nothing to start, only busy dies to poll
+
+static bool FlashScheduler_isStacked(void)
+{
+	return (flashSchedulerDevice->dieCount > 1) && (flashSchedulerDevice->startProgram != NULL);
+}
+
+static uint32_t FlashScheduler_die(const FlashRequest *request)
+{
+	uint32_t die = 0;
+
+	if (FlashScheduler_isStacked()) {
+		die = request->address >> flashSchedulerDevice->dieShift;
+
+		// Out of range addresses still need a slot, the driver rejects them
+		if (die >= flashSchedulerDevice->dieCount) {
+			die = flashSchedulerDevice->dieCount - 1u;
+		}
+	}
+
+	return die;
+}
+
+static uint32_t FlashScheduler_busyDies(void)
+{
+	uint32_t busy = 0;
+
+	for (uint32_t die = 0; die < FLASH_SCHEDULER_MAX_DIES; die++) {
+		busy += (flashSchedulerActive[die] != NULL);
+	}
+
+	return busy;
+}
+
+static bool FlashScheduler_overlaps(const FlashRequest *a, const FlashRequest *b)
+{
+	return (a->address < (b->address + b->length)) && (b->address < (a->address + a->length));
+}
+
+//! An older overlapping request must finish first unless both only read, and a busy die takes nothing new
+static bool FlashScheduler_isBlocked(const FlashRequest *request)
+{
+	bool blocked = (flashSchedulerActive[FlashScheduler_die(request)] != NULL);
+
+	for (const FlashRequest *older = flashSchedulerHead; !blocked && (older != request); older = older->next) {
+		blocked = FlashScheduler_overlaps(older, request) &&
+				((older->type != FLASH_REQUEST_READ) || (request->type != FLASH_REQUEST_READ));
+	}
+
+	return blocked;
+}
+
+static int32_t FlashScheduler_score(const FlashRequest *request, uint32_t now)
+{
+	int32_t score = (int32_t)request->priority * FLASH_SCHEDULER_AGING_US;
+
+	// Background writes yield to reads until they have waited long enough to catch up
+	if (request->type != FLASH_REQUEST_READ) {
+		score += FLASH_SCHEDULER_WRITE_PENALTY * FLASH_SCHEDULER_AGING_US;
+	}
+
+	return score - (int32_t)(now - request->submitUs);
+}
+
+static bool FlashScheduler_isUrgent(const FlashRequest *request, uint32_t now)
+{
+	return (request->deadlineUs != 0) && ((int32_t)(request->deadlineUs - now) < FLASH_SCHEDULER_DEADLINE_SLACK_US);
+}
+
+static FlashRequest *FlashScheduler_pick(uint32_t now)
+{
+	FlashRequest *best = NULL;
+	bool bestUrgent = false;
+	int32_t bestScore = 0;
+
+	for (FlashRequest *request = flashSchedulerHead; request != NULL; request = request->next) {
+		if (FlashScheduler_isBlocked(request)) {
+			continue;
+		}
+
+		bool urgent = FlashScheduler_isUrgent(request, now);
+		int32_t score = urgent ? (int32_t)(request->deadlineUs - now) : FlashScheduler_score(request, now);
+
+		// Urgent requests beat everything and go earliest deadline first, ties keep submission order
+		if ((best == NULL) || (urgent && !bestUrgent) || ((urgent == bestUrgent) && (score < bestScore))) {
+			best = request;
+			bestUrgent = urgent;
+			bestScore = score;
+		}
+	}
+
+	if (bestUrgent) {
+		flashSchedulerStats.deadlinePicks++;
+	}
+
+	return best;
+}
+
+//! Best write for an idle die other than the one about to be read, starting it first costs only its data transfer
+static FlashRequest *FlashScheduler_pickBackgroundWrite(uint32_t now, uint32_t readDie)
+{
+	FlashRequest *best = NULL;
+	int32_t bestScore = 0;
+
+	for (FlashRequest *request = flashSchedulerHead; request != NULL; request = request->next) {
+		if ((request->type == FLASH_REQUEST_READ) || (FlashScheduler_die(request) == readDie) || FlashScheduler_isBlocked(request)) {
+			continue;
+		}
+
+		int32_t score = FlashScheduler_score(request, now);
+
+		if ((best == NULL) || (score < bestScore)) {
+			best = request;
+			bestScore = score;
+		}
+	}
+
+	return best;
+}
+
+static void FlashScheduler_unlink(FlashRequest *request)
+{
+	FlashRequest *prev = NULL;
+
+	for (FlashRequest *it = flashSchedulerHead; it != request; it = it->next) {
+		prev = it;
+	}
+
+	if (prev == NULL) {
+		flashSchedulerHead = request->next;
+	} else {
+		prev->next = request->next;
+	}
+
+	if (flashSchedulerTail == request) {
+		flashSchedulerTail = prev;
+	}
+
+	request->next = NULL;
+	flashSchedulerDepth--;
+}
+
+//! Pulls queued reads that continue exactly where the batch ends
+static uint32_t FlashScheduler_collectReads(FlashRequest **batch)
+{
+	uint32_t count = 1;
+	uint32_t end = batch[0]->address + batch[0]->length;
+	bool extended = true;
+
+	while (extended && (count < FLASH_SCHEDULER_MAX_MERGE)) {
+		extended = false;
+
+		for (FlashRequest *request = flashSchedulerHead; !extended && (request != NULL); request = request->next) {
+			if ((request->type == FLASH_REQUEST_READ) && (request->address == end) && (request->length > 0) &&
+					(FlashScheduler_die(request) == FlashScheduler_die(batch[0])) && !FlashScheduler_isBlocked(request)) {
+				FlashScheduler_unlink(request);
+				batch[count++] = request;
+				end += request->length;
+				extended = true;
+			}
+		}
+	}
+
+	return count;
+}
+
+static uint32_t FlashScheduler_bucket(uint32_t latencyUs)
+{
+	uint32_t bucket = 0;
+
+	while ((latencyUs != 0) && (bucket < (FLASH_SCHEDULER_HISTOGRAM_BUCKETS - 1))) {
+		latencyUs >>= 1;
+		bucket++;
+	}
+
+	return bucket;
+}
+
+static void FlashScheduler_complete(FlashRequest *request, bool success, uint32_t now)
+{
+	FlashRequestType type = request->type;
+
+	request->success = success;
+	request->latencyUs = now - request->submitUs;
+
+	flashSchedulerStats.histogram[type][FlashScheduler_bucket(request->latencyUs)]++;
+	flashSchedulerStats.completed[type]++;
+	if (!success) {
+		flashSchedulerStats.failed[type]++;
+	}
+	if (request->latencyUs > flashSchedulerStats.maxLatencyUs[type]) {
+		flashSchedulerStats.maxLatencyUs[type] = request->latencyUs;
+	}
+
+	// The request may go out of scope as soon as the submitter wakes, nothing touches it afterwards
+	void *signal = request->signal;
+	request->done = true;
+
+	if (signal != NULL) {
+		flashSchedulerOs->signalGive(signal);
+	}
+}
+
+//! Starts the next page or erase unit of a request running on a stacked part
+static bool FlashScheduler_startNext(FlashRequest *request)
+{
+	uint32_t address = request->address + request->progress;
+	uint32_t chunk;
+	bool success;
+
+	if (request->type == FLASH_REQUEST_PROGRAM) {
+		chunk = flashSchedulerDevice->pageSize - (address & (flashSchedulerDevice->pageSize - 1u));
+		if (chunk > (request->length - request->progress)) {
+			chunk = request->length - request->progress;
+		}
+		success = flashSchedulerDevice->startProgram(address, &request->buffer[request->progress], chunk);
+	} else {
+		chunk = flashSchedulerDevice->startErase(address, request->length - request->progress);
+		success = (chunk != 0);
+	}
+
+	request->progress += chunk;
+
+	return success;
+}
+
+static void FlashScheduler_startWrite(FlashRequest *request)
+{
+	uint32_t die = FlashScheduler_die(request);
+	bool success = true;
+
+	request->progress = 0;
+
+	if (request->length > 0) {
+		success = FlashScheduler_startNext(request);
+	}
+
+	if (success && (request->length > 0)) {
+		flashSchedulerActive[die] = request;
+	} else {
+		FlashScheduler_complete(request, success, flashSchedulerOs->nowUs());
+	}
+}
+
+//! Moves every busy die along, true while any of them still has work running
+static bool FlashScheduler_pollDies(void)
+{
+	bool pending = false;
+
+	for (uint32_t die = 0; die < FLASH_SCHEDULER_MAX_DIES; die++) {
+		FlashRequest *request = flashSchedulerActive[die];
+		bool busy = false;
+
+		if (request == NULL) {
+			continue;
+		}
+
+		bool success = flashSchedulerDevice->poll(die, &busy);
+
+		if (success && !busy && (request->progress < request->length)) {
+			success = FlashScheduler_startNext(request);
+			busy = success;
+		}
+
+		if (success && busy) {
+			pending = true;
+		} else {
+			flashSchedulerActive[die] = NULL;
+			FlashScheduler_complete(request, success, flashSchedulerOs->nowUs());
+		}
+	}
+
+	return pending;
+}
+
+bool FlashScheduler_init(const FlashSchedulerOs *os, const FlashSchedulerDevice *device)
+{
+	if (device->dieCount > FLASH_SCHEDULER_MAX_DIES) {
+		return false;
+	}
+
+	flashSchedulerOs = os;
+	flashSchedulerDevice = device;
+	flashSchedulerHead = NULL;
+	flashSchedulerTail = NULL;
+	flashSchedulerDepth = 0;
+	memset(flashSchedulerActive, 0, sizeof(flashSchedulerActive));
+	flashSchedulerWaiting = false;
+	FlashScheduler_resetStats();
+
+	flashSchedulerWork = os->signalCreate();
+
+	return (flashSchedulerWork != NULL);
+}
+
+void FlashScheduler_submit(FlashRequest *request)
+{
+	request->done = false;
+	request->success = false;
+	request->next = NULL;
+
+	flashSchedulerOs->lock();
+
+	request->submitUs = flashSchedulerOs->nowUs();
+
+	if (flashSchedulerTail != NULL) {
+		flashSchedulerTail->next = request;
+	} else {
+		flashSchedulerHead = request;
+	}
+	flashSchedulerTail = request;
+
+	flashSchedulerDepth++;
+	if (flashSchedulerDepth > flashSchedulerStats.maxQueueDepth) {
+		flashSchedulerStats.maxQueueDepth = flashSchedulerDepth;
+	}
+
+	flashSchedulerOs->unlock();
+	flashSchedulerOs->signalGive(flashSchedulerWork);
+}
+
+bool FlashScheduler_transfer(FlashRequest *request)
+{
+	FlashScheduler_submit(request);
+
+	if (request->signal != NULL) {
+		flashSchedulerOs->signalTake(request->signal);
+	}
+
+	return request->done && request->success;
+}
+
+bool FlashScheduler_serviceOnce(void)
+{
+	FlashRequest *batch[FLASH_SCHEDULER_MAX_MERGE];
+	FlashRequest *background = NULL;
+	uint32_t count = 0;
+	bool pending = false;
+
+	if (FlashScheduler_isStacked()) {
+		pending = FlashScheduler_pollDies();
+	}
+
+	flashSchedulerOs->lock();
+
+	batch[0] = FlashScheduler_pick(flashSchedulerOs->nowUs());
+
+	if (batch[0] != NULL) {
+		FlashScheduler_unlink(batch[0]);
+		count = 1;
+
+		if ((batch[0]->type == FLASH_REQUEST_READ) && (flashSchedulerDevice->readVector != NULL)) {
+			count = FlashScheduler_collectReads(batch);
+		}
+
+		if (FlashScheduler_isStacked() && (batch[0]->type == FLASH_REQUEST_READ)) {
+			background = FlashScheduler_pickBackgroundWrite(flashSchedulerOs->nowUs(), FlashScheduler_die(batch[0]));
+			if (background != NULL) {
+				FlashScheduler_unlink(background);
+			}
+		}
+	}
+
+	flashSchedulerOs->unlock();
+
+	if (background != NULL) {
+		FlashScheduler_startWrite(background);
+	}
+
+	flashSchedulerWaiting = (count == 0) && (background == NULL);
+
+	if (count == 0) {
+		return pending;
+	}
+
+	bool success = false;
+	FlashRequest *first = batch[0];
+
+	if (FlashScheduler_busyDies() > 0) {
+		flashSchedulerStats.overlappedOps++;
+	}
+
+	// Stacked parts only start the write here, pollDies finishes it while other dies keep working
+	if (FlashScheduler_isStacked() && (first->type != FLASH_REQUEST_READ)) {
+		FlashScheduler_startWrite(first);
+		return true;
+	}
+
+	// The bus belongs to this task alone, so no lock is held while the driver runs
+	if (count > 1) {
+		FlashIoVec iov[FLASH_SCHEDULER_MAX_MERGE];
+
+		for (uint32_t i = 0; i < count; i++) {
+			iov[i].base = batch[i]->buffer;
+			iov[i].length = batch[i]->length;
+		}
+
+		success = flashSchedulerDevice->readVector(first->address, iov, count);
+		flashSchedulerStats.mergedReads += count - 1;
+	} else if (first->type == FLASH_REQUEST_READ) {
+		success = flashSchedulerDevice->read(first->address, first->buffer, first->length);
+	} else if (first->type == FLASH_REQUEST_PROGRAM) {
+		success = flashSchedulerDevice->program(first->address, first->buffer, first->length);
+	} else {
+		success = flashSchedulerDevice->erase(first->address, first->length);
+	}
+
+	uint32_t now = flashSchedulerOs->nowUs();
+
+	for (uint32_t i = 0; i < count; i++) {
+		FlashScheduler_complete(batch[i], success, now);
+	}
+
+	return true;
+}
+
+void FlashScheduler_task(void *argument)
+{
+	for (;;) {
+		flashSchedulerOs->signalTake(flashSchedulerWork);
+
+		while (FlashScheduler_serviceOnce()) {
+			// A long erase would otherwise keep this task polling status and starve everything below it,
+			// a submit ends the sleep early
+			if (flashSchedulerWaiting && (flashSchedulerOs->signalTakeTimeout != NULL)) {
+				flashSchedulerOs->signalTakeTimeout(flashSchedulerWork, FLASH_SCHEDULER_POLL_US);
+			}
+		}
+	}
+}
+
+const FlashSchedulerStats *FlashScheduler_getStats(void)
+{
+	return &flashSchedulerStats;
+}
+
+void FlashScheduler_resetStats(void)
+{
+	memset(&flashSchedulerStats, 0, sizeof(flashSchedulerStats));
+}
+
+uint32_t FlashScheduler_latencyPercentileUs(FlashRequestType type, uint32_t permille)
+{
+	const uint32_t *histogram = flashSchedulerStats.histogram[type];
+	uint32_t total = 0;
+	uint32_t seen = 0;
+	uint32_t bucket = 0;
+
+	for (uint32_t i = 0; i < FLASH_SCHEDULER_HISTOGRAM_BUCKETS; i++) {
+		total += histogram[i];
+	}
+
+	if (total == 0) {
+		return 0;
+	}
+
+	uint32_t target = (uint32_t)((((uint64_t)total * permille) + 999u) / 1000u);
+	if (target == 0) {
+		target = 1;
+	}
+
+	while ((bucket < (FLASH_SCHEDULER_HISTOGRAM_BUCKETS - 1)) && ((seen + histogram[bucket]) < target)) {
+		seen += histogram[bucket];
+		bucket++;
+	}
+
+	// Upper edge of the bucket, the histogram cannot resolve any finer
+	return (bucket == 0) ? 0 : (uint32_t)((1ull << bucket) - 1u);
+}
@@ -0,0 +1,261 @@
+/*
+ * This program is per-opcode latency instrumentation for Serial flash memories.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "flashstats.h"
+
+#ifndef FLASH_HOST_BUILD
+#include "stm32h7xx_hal.h"
+#endif
+
+static FlashStatsClock flashStatsClock = NULL;
+static FlashStatsSnapshot flashStats;
+
+// One blocking operation is on the bus at a time
+static uint8_t flashStatsOpcode;
+static uint32_t flashStatsBytes;
+static uint32_t flashStatsStart;
+static uint8_t flashStatsLastWorkOpcode;
+static bool flashStatsLastWorkValid = false;
+
+static uint32_t FlashStats_lock(void)
+{
+#ifndef FLASH_HOST_BUILD
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	return primask;
+#else
+	return 0;
+#endif
+}
+
+static void FlashStats_unlock(uint32_t primask)
+{
+#ifndef FLASH_HOST_BUILD
+	if (primask == 0) {
+		__enable_irq();
+	}
+#else
+	(void)primask;
+#endif
+}
+
+static uint32_t FlashStats_bucket(uint32_t cycles)
+{
+	uint32_t bucket = 0;
+
+	while ((cycles != 0) && (bucket < (FLASH_STATS_HISTOGRAM_BUCKETS - 1))) {
+		cycles >>= 1;
+		bucket++;
+	}
+
+	return bucket;
+}
+
+static FlashStatsOpcode *FlashStats_entry(uint8_t opcode)
+{
+	FlashStatsOpcode *entry = NULL;
+
+	for (uint32_t i = 0; (entry == NULL) && (i < flashStats.used); i++) {
+		if (flashStats.opcodes[i].opcode == opcode) {
+			entry = &flashStats.opcodes[i];
+		}
+	}
+
+	if ((entry == NULL) && (flashStats.used < FLASH_STATS_MAX_OPCODES)) {
+		entry = &flashStats.opcodes[flashStats.used++];
+		memset(entry, 0, sizeof(*entry));
+		entry->opcode = opcode;
+	}
+
+	return entry;
+}
+
+void FlashStats_setClock(FlashStatsClock clock)
+{
+	flashStatsClock = clock;
+}
+
+uint32_t FlashStats_now(void)
+{
+	return (flashStatsClock != NULL) ? flashStatsClock() : 0;
+}
+
+void FlashStats_begin(uint8_t opcode, uint32_t bytes)
+{
+	flashStatsOpcode = opcode;
+	flashStatsBytes = bytes;
+	flashStatsStart = FlashStats_now();
+}
+
+void FlashStats_end(FlashStatsResult result)
+{
+	uint32_t cycles = FlashStats_now() - flashStatsStart;
+	uint32_t primask = FlashStats_lock();
+	FlashStatsOpcode *entry = FlashStats_entry(flashStatsOpcode);
+
+	if (entry != NULL) {
+		entry->count++;
+		entry->bytes += flashStatsBytes;
+		entry->busCycles += cycles;
+		entry->histogram[FlashStats_bucket(cycles)]++;
+
+		if (cycles > entry->maxCycles) {
+			entry->maxCycles = cycles;
+		}
+
+		if (result == FLASH_STATS_TIMEOUT) {
+			entry->timeouts++;
+		} else if (result == FLASH_STATS_ERROR) {
+			entry->errors++;
+		}
+	} else {
+		flashStats.droppedOps++;
+	}
+
+	if (result != FLASH_STATS_OK) {
+		flashStats.lastFailedOpcode = flashStatsOpcode;
+		flashStats.lastFailure = result;
+	}
+
+	if (!FLASH_STATS_IS_STATUS_READ(flashStatsOpcode)) {
+		flashStatsLastWorkOpcode = flashStatsOpcode;
+		flashStatsLastWorkValid = true;
+	}
+
+	FlashStats_unlock(primask);
+}
+
+void FlashStats_wait(uint32_t startCycles, uint32_t polls, bool timedOut)
+{
+	uint32_t cycles = FlashStats_now() - startCycles;
+	uint32_t primask = FlashStats_lock();
+	FlashStatsOpcode *entry = flashStatsLastWorkValid ? FlashStats_entry(flashStatsLastWorkOpcode) : NULL;
+
+	if (entry != NULL) {
+		entry->busyWaitCycles += cycles;
+		entry->pollIterations += polls;
+
+		if (timedOut) {
+			entry->waitTimeouts++;
+		}
+	}
+
+	FlashStats_unlock(primask);
+}
+
+void FlashStats_snapshot(FlashStatsSnapshot *snapshot, bool reset)
+{
+	uint32_t primask = FlashStats_lock();
+
+	memcpy(snapshot, &flashStats, sizeof(flashStats));
+
+	if (reset) {
+		memset(&flashStats, 0, sizeof(flashStats));
+	}
+
+	FlashStats_unlock(primask);
+}
+
+void FlashStats_reset(void)
+{
+	uint32_t primask = FlashStats_lock();
+
+	memset(&flashStats, 0, sizeof(flashStats));
+	flashStatsLastWorkValid = false;
+
+	FlashStats_unlock(primask);
+}
+
+const FlashStatsOpcode *FlashStats_find(const FlashStatsSnapshot *snapshot, uint8_t opcode)
+{
+	const FlashStatsOpcode *entry = NULL;
+
+	for (uint32_t i = 0; (entry == NULL) && (i < snapshot->used); i++) {
+		if (snapshot->opcodes[i].opcode == opcode) {
+			entry = &snapshot->opcodes[i];
+		}
+	}
+
+	return entry;
+}
+
+//! Upper bound of the histogram bucket holding the given percentile, in cycles
+uint32_t FlashStats_percentileCycles(const FlashStatsOpcode *entry, uint32_t permille)
+{
+	uint32_t target = (uint32_t)(((uint64_t)entry->count * permille + 999) / 1000);
+	uint32_t seen = 0;
+	uint32_t bucket = 0;
+
+	if (entry->count == 0) {
+		return 0;
+	}
+
+	while ((bucket < (FLASH_STATS_HISTOGRAM_BUCKETS - 1)) && ((seen + entry->histogram[bucket]) < target)) {
+		seen += entry->histogram[bucket];
+		bucket++;
+	}
+
+	if (bucket == (FLASH_STATS_HISTOGRAM_BUCKETS - 1)) {
+		return UINT32_MAX;
+	}
+
+	return (1u << bucket) - 1;
+}
+
+static uint32_t FlashStats_cyclesToUs(uint64_t cycles, uint32_t clockHz)
+{
+	return (clockHz == 0) ? 0 : (uint32_t)((cycles * 1000000u) / clockHz);
+}
+
+uint32_t FlashStats_formatCsv(const FlashStatsSnapshot *snapshot, uint32_t clockHz, char *buffer, uint32_t size)
+{
+	uint32_t used = 0;
+	int written = snprintf(buffer, size, "opcode,count,bytes,errors,timeouts,bus_us,busy_us,polls,p50_us,p99_us,max_us,bytes_per_s\n");
+
+	for (uint32_t i = 0; (written > 0) && ((used + (uint32_t)written) < size) && (i <= snapshot->used); i++) {
+		used += (uint32_t)written;
+		written = 0;
+
+		if (i < snapshot->used) {
+			const FlashStatsOpcode *entry = &snapshot->opcodes[i];
+			uint64_t bytesPerSecond = (entry->busCycles == 0) ? 0 : ((uint64_t)entry->bytes * clockHz) / entry->busCycles;
+
+			written = snprintf(&buffer[used], size - used, "0x%02X,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu\n",
+					entry->opcode,
+					(unsigned long)entry->count,
+					(unsigned long)entry->bytes,
+					(unsigned long)entry->errors,
+					(unsigned long)entry->timeouts,
+					(unsigned long)FlashStats_cyclesToUs(entry->busCycles, clockHz),
+					(unsigned long)FlashStats_cyclesToUs(entry->busyWaitCycles, clockHz),
+					(unsigned long)entry->pollIterations,
+					(unsigned long)FlashStats_cyclesToUs(FlashStats_percentileCycles(entry, 500), clockHz),
+					(unsigned long)FlashStats_cyclesToUs(FlashStats_percentileCycles(entry, 990), clockHz),
+					(unsigned long)FlashStats_cyclesToUs(entry->maxCycles, clockHz),
+					(unsigned long)bytesPerSecond);
+		}
+	}
+
+	return used;
+}
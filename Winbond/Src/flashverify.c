@@ -0,0 +1,357 @@
+/*
+ * This program is read-back verification for Serial flash memories.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "flashverify.h"
+
+#ifndef FLASH_HOST_BUILD
+#include "stm32h7xx_hal.h"
+#include "w25q.h"
+#include "w25n01g.h"
+#else
+#define __ALIGNED(x)	__attribute__((aligned(x)))
+#endif
+
+#define FLASH_VERIFY_CRC32_POLY		0xEDB88320u
+
+#define FLASH_VERIFY_ROR(x, n)		(((x) >> (n)) | ((x) << (32u - (n))))
+
+static uint32_t flashVerifyCrcTable[8][256];
+static bool flashVerifyCrcReady = false;
+static uint8_t flashVerifyChunk[FLASH_VERIFY_CHUNK_SIZE] __ALIGNED(32);
+
+static const uint32_t flashVerifySha256K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+//! Slice-by-8 tables, built once on first use (8KB of RAM)
+static void FlashVerify_crc32Tables(void)
+{
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t crc = i;
+
+		for (uint32_t bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ ((crc & 1u) ? FLASH_VERIFY_CRC32_POLY : 0u);
+		}
+
+		flashVerifyCrcTable[0][i] = crc;
+	}
+
+	for (uint32_t i = 0; i < 256; i++) {
+		for (uint32_t slice = 1; slice < 8; slice++) {
+			uint32_t previous = flashVerifyCrcTable[slice - 1][i];
+			flashVerifyCrcTable[slice][i] = (previous >> 8) ^ flashVerifyCrcTable[0][previous & 0xFFu];
+		}
+	}
+
+	flashVerifyCrcReady = true;
+}
+
+static uint32_t FlashVerify_le32(const uint8_t *data)
+{
+	return ((uint32_t)data[0]) | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+uint32_t FlashVerify_crc32Update(uint32_t crc, const uint8_t *data, uint32_t length)
+{
+	if (!flashVerifyCrcReady) {
+		FlashVerify_crc32Tables();
+	}
+
+	crc = ~crc;
+
+	while (length >= 8) {
+		uint32_t low = FlashVerify_le32(data) ^ crc;
+		uint32_t high = FlashVerify_le32(data + 4);
+
+		crc = flashVerifyCrcTable[7][low & 0xFFu] ^
+				flashVerifyCrcTable[6][(low >> 8) & 0xFFu] ^
+				flashVerifyCrcTable[5][(low >> 16) & 0xFFu] ^
+				flashVerifyCrcTable[4][low >> 24] ^
+				flashVerifyCrcTable[3][high & 0xFFu] ^
+				flashVerifyCrcTable[2][(high >> 8) & 0xFFu] ^
+				flashVerifyCrcTable[1][(high >> 16) & 0xFFu] ^
+				flashVerifyCrcTable[0][high >> 24];
+
+		data += 8;
+		length -= 8;
+	}
+
+	while (length > 0) {
+		crc = (crc >> 8) ^ flashVerifyCrcTable[0][(crc ^ *data) & 0xFFu];
+		data++;
+		length--;
+	}
+
+	return ~crc;
+}
+
+static void FlashVerify_sha256Block(FlashVerifySha256 *sha, const uint8_t *block)
+{
+	uint32_t w[64];
+	uint32_t s[8];
+
+	for (uint32_t i = 0; i < 16; i++) {
+		w[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16) | ((uint32_t)block[i * 4 + 2] << 8) | block[i * 4 + 3];
+	}
+
+	for (uint32_t i = 16; i < 64; i++) {
+		uint32_t s0 = FLASH_VERIFY_ROR(w[i - 15], 7) ^ FLASH_VERIFY_ROR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		uint32_t s1 = FLASH_VERIFY_ROR(w[i - 2], 17) ^ FLASH_VERIFY_ROR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	memcpy(s, sha->state, sizeof(s));
+
+	for (uint32_t i = 0; i < 64; i++) {
+		uint32_t sum1 = FLASH_VERIFY_ROR(s[4], 6) ^ FLASH_VERIFY_ROR(s[4], 11) ^ FLASH_VERIFY_ROR(s[4], 25);
+		uint32_t choose = (s[4] & s[5]) ^ (~s[4] & s[6]);
+		uint32_t t1 = s[7] + sum1 + choose + flashVerifySha256K[i] + w[i];
+		uint32_t sum0 = FLASH_VERIFY_ROR(s[0], 2) ^ FLASH_VERIFY_ROR(s[0], 13) ^ FLASH_VERIFY_ROR(s[0], 22);
+		uint32_t majority = (s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]);
+		uint32_t t2 = sum0 + majority;
+
+		s[7] = s[6];
+		s[6] = s[5];
+		s[5] = s[4];
+		s[4] = s[3] + t1;
+		s[3] = s[2];
+		s[2] = s[1];
+		s[1] = s[0];
+		s[0] = t1 + t2;
+	}
+
+	for (uint32_t i = 0; i < 8; i++) {
+		sha->state[i] += s[i];
+	}
+}
+
+void FlashVerify_sha256Init(FlashVerifySha256 *sha)
+{
+	static const uint32_t initial[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+
+	memcpy(sha->state, initial, sizeof(initial));
+	sha->length = 0;
+	sha->used = 0;
+}
+
+void FlashVerify_sha256Update(FlashVerifySha256 *sha, const uint8_t *data, uint32_t length)
+{
+	sha->length += length;
+
+	while (length > 0) {
+		if ((sha->used == 0) && (length >= sizeof(sha->block))) {
+			FlashVerify_sha256Block(sha, data);
+			data += sizeof(sha->block);
+			length -= sizeof(sha->block);
+		} else {
+			uint32_t take = sizeof(sha->block) - sha->used;
+			if (take > length) {
+				take = length;
+			}
+
+			memcpy(&sha->block[sha->used], data, take);
+			sha->used += take;
+			data += take;
+			length -= take;
+
+			if (sha->used == sizeof(sha->block)) {
+				FlashVerify_sha256Block(sha, sha->block);
+				sha->used = 0;
+			}
+		}
+	}
+}
+
+void FlashVerify_sha256Final(FlashVerifySha256 *sha, uint8_t *digest)
+{
+	uint64_t bits = sha->length * 8u;
+
+	sha->block[sha->used++] = 0x80;
+
+	if (sha->used > 56) {
+		memset(&sha->block[sha->used], 0, sizeof(sha->block) - sha->used);
+		FlashVerify_sha256Block(sha, sha->block);
+		sha->used = 0;
+	}
+
+	memset(&sha->block[sha->used], 0, 56 - sha->used);
+
+	for (uint32_t i = 0; i < 8; i++) {
+		sha->block[63 - i] = (uint8_t)(bits >> (i * 8u));
+	}
+
+	FlashVerify_sha256Block(sha, sha->block);
+
+	for (uint32_t i = 0; i < 8; i++) {
+		digest[i * 4]		= (uint8_t)(sha->state[i] >> 24);
+		digest[i * 4 + 1]	= (uint8_t)(sha->state[i] >> 16);
+		digest[i * 4 + 2]	= (uint8_t)(sha->state[i] >> 8);
+		digest[i * 4 + 3]	= (uint8_t)(sha->state[i]);
+	}
+}
+
+//! Index of the first differing byte, length if equal. Words first, bytes only to locate the difference
+static uint32_t FlashVerify_firstDifference(const uint8_t *a, const uint8_t *b, uint32_t length)
+{
+	uint32_t i = 0;
+
+	while ((i + 4u) <= length) {
+		uint32_t wordA;
+		uint32_t wordB;
+
+		memcpy(&wordA, &a[i], sizeof(wordA));
+		memcpy(&wordB, &b[i], sizeof(wordB));
+
+		if (wordA != wordB) {
+			break;
+		}
+
+		i += 4u;
+	}
+
+	while ((i < length) && (a[i] == b[i])) {
+		i++;
+	}
+
+	return i;
+}
+
+static void FlashVerify_resultInit(FlashVerifyResult *result)
+{
+	result->match = false;
+	result->mismatchOffset = FLASH_VERIFY_NO_OFFSET;
+	result->bytesRead = 0;
+}
+
+bool FlashVerify_compare(FlashVerifyRead read, void *context, uint32_t address, const uint8_t *source, uint32_t length, FlashVerifyResult *result)
+{
+	bool success = true;
+
+	FlashVerify_resultInit(result);
+	result->match = true;
+
+	while (success && result->match && (result->bytesRead < length)) {
+		uint32_t chunk = length - result->bytesRead;
+		if (chunk > FLASH_VERIFY_CHUNK_SIZE) {
+			chunk = FLASH_VERIFY_CHUNK_SIZE;
+		}
+
+		success = read(context, address + result->bytesRead, flashVerifyChunk, chunk);
+
+		if (success) {
+			uint32_t difference = FlashVerify_firstDifference(flashVerifyChunk, &source[result->bytesRead], chunk);
+
+			if (difference < chunk) {
+				result->match = false;
+				result->mismatchOffset = result->bytesRead + difference;
+			}
+
+			result->bytesRead += chunk;
+		}
+	}
+
+	if (!success) {
+		result->match = false;
+	}
+
+	return success;
+}
+
+bool FlashVerify_crc32(FlashVerifyRead read, void *context, uint32_t address, uint32_t length, uint32_t expected, FlashVerifyResult *result)
+{
+	bool success = true;
+	uint32_t crc = 0;
+
+	FlashVerify_resultInit(result);
+
+	while (success && (result->bytesRead < length)) {
+		uint32_t chunk = length - result->bytesRead;
+		if (chunk > FLASH_VERIFY_CHUNK_SIZE) {
+			chunk = FLASH_VERIFY_CHUNK_SIZE;
+		}
+
+		success = read(context, address + result->bytesRead, flashVerifyChunk, chunk);
+
+		if (success) {
+			crc = FlashVerify_crc32Update(crc, flashVerifyChunk, chunk);
+			result->bytesRead += chunk;
+		}
+	}
+
+	result->match = success && (crc == expected);
+
+	return success;
+}
+
+bool FlashVerify_sha256(FlashVerifyRead read, void *context, uint32_t address, uint32_t length, const uint8_t *expected, FlashVerifyResult *result)
+{
+	bool success = true;
+	FlashVerifySha256 sha;
+	uint8_t digest[FLASH_VERIFY_SHA256_SIZE];
+
+	FlashVerify_resultInit(result);
+	FlashVerify_sha256Init(&sha);
+
+	while (success && (result->bytesRead < length)) {
+		uint32_t chunk = length - result->bytesRead;
+		if (chunk > FLASH_VERIFY_CHUNK_SIZE) {
+			chunk = FLASH_VERIFY_CHUNK_SIZE;
+		}
+
+		success = read(context, address + result->bytesRead, flashVerifyChunk, chunk);
+
+		if (success) {
+			FlashVerify_sha256Update(&sha, flashVerifyChunk, chunk);
+			result->bytesRead += chunk;
+		}
+	}
+
+	if (success) {
+		FlashVerify_sha256Final(&sha, digest);
+		result->match = (memcmp(digest, expected, sizeof(digest)) == 0);
+	}
+
+	return success;
+}
+
+#ifndef FLASH_HOST_BUILD
+bool FlashVerify_w25qRead(void *context, uint32_t address, uint8_t *buffer, uint32_t length)
+{
+	return W25q_readBytes(address, buffer, length);
+}
+
+bool FlashVerify_w25n01gRead(void *context, uint32_t address, uint8_t *buffer, uint32_t length)
+{
+	FlashIoVec iov = { buffer, length };
+
+	return W25n01g_readVector((QSPI_HandleTypeDef *)context, address, &iov, 1);
+}
+#endif
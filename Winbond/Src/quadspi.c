@@ -19,18 +19,77 @@
  */
 
 #include "quadspi.h"
+#include "flashstats.h"
+#include "quadspitrace.h"
 
 #define QUADSPI_DEFAULT_TIMEOUT 200
+#define QUADSPI_AUTO_POLL_INTERVAL 0x10		// QUADSPI clocks between status reads
+
+const QuadSpiTiming QuadSpi_defaultTiming = {
+	.clockPrescaler		= 1,
+	.sampleShifting		= QSPI_SAMPLE_SHIFTING_HALFCYCLE,
+	.chipSelectHighTime	= QSPI_CS_HIGH_TIME_1_CYCLE,
+};
+
+static QuadSpiEventHandler quadSpiEventHandler = NULL;
+static void *quadSpiEventContext = NULL;
+static QuadSpiEventHandler quadSpiEventWaiting = NULL;
+static void *quadSpiEventWaitingContext = NULL;
+
+#define QUADSPI_STATS_RESULT(status)	(((status) == HAL_OK) ? FLASH_STATS_OK : \
+										(((status) == HAL_TIMEOUT) ? FLASH_STATS_TIMEOUT : FLASH_STATS_ERROR))
+
+#define QUADSPI_OP_END(result)			do { FLASH_STATS_END(result); QUADSPI_TRACE_END(result); } while (0)
+
+// All blocking bus traffic goes through these three so it can be instrumented in one place
+static HAL_StatusTypeDef QuadSpiCommand(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd)
+{
+	FLASH_STATS_BEGIN(cmd->Instruction, (cmd->DataMode == QSPI_DATA_NONE) ? 0u : cmd->NbData);
+	QUADSPI_TRACE_BEGIN(cmd);
+
+	HAL_StatusTypeDef status = HAL_QSPI_Command(hqspi, cmd, QUADSPI_DEFAULT_TIMEOUT);
+
+	if ((status != HAL_OK) || (cmd->DataMode == QSPI_DATA_NONE)) {
+		QUADSPI_OP_END(QUADSPI_STATS_RESULT(status));
+	}
+
+	return status;
+}
+
+static HAL_StatusTypeDef QuadSpiReceiveData(QSPI_HandleTypeDef *hqspi, uint8_t *in)
+{
+	HAL_StatusTypeDef status = HAL_QSPI_Receive(hqspi, in, QUADSPI_DEFAULT_TIMEOUT);
+
+	QUADSPI_OP_END(QUADSPI_STATS_RESULT(status));
+
+	return status;
+}
+
+static HAL_StatusTypeDef QuadSpiTransmitData(QSPI_HandleTypeDef *hqspi, const uint8_t *out)
+{
+	QUADSPI_TRACE_WRITE();
+
+	HAL_StatusTypeDef status = HAL_QSPI_Transmit(hqspi, (uint8_t *)out, QUADSPI_DEFAULT_TIMEOUT);
+
+	QUADSPI_OP_END(QUADSPI_STATS_RESULT(status));
+
+	return status;
+}
 
 bool QuadSpi_Init(QSPI_HandleTypeDef *hqspi, uint8_t flashSize)
+{
+	return QuadSpi_InitWithTiming(hqspi, flashSize, &QuadSpi_defaultTiming);
+}
+
+bool QuadSpi_InitWithTiming(QSPI_HandleTypeDef *hqspi, uint8_t flashSize, const QuadSpiTiming *timing)
 {
 	bool success = true;
 	hqspi->Instance = QUADSPI;
-	hqspi->Init.ClockPrescaler		= 1;
+	hqspi->Init.ClockPrescaler		= timing->clockPrescaler;
 	hqspi->Init.FifoThreshold		= 1;
-	hqspi->Init.SampleShifting		= QSPI_SAMPLE_SHIFTING_HALFCYCLE;
+	hqspi->Init.SampleShifting		= timing->sampleShifting;
 	hqspi->Init.FlashSize			= flashSize; 						// (2^flashSize + 1) = flash size in bytes
-	hqspi->Init.ChipSelectHighTime	= QSPI_CS_HIGH_TIME_1_CYCLE;
+	hqspi->Init.ChipSelectHighTime	= timing->chipSelectHighTime;
 	hqspi->Init.ClockMode			= QSPI_CLOCK_MODE_0;
 	hqspi->Init.FlashID				= QSPI_FLASH_ID_1;
 	hqspi->Init.DualFlash			= QSPI_DUALFLASH_DISABLE;
@@ -59,7 +118,7 @@ bool QuadSpiInstruction(QSPI_HandleTypeDef *hqspi, uint8_t instruction)
 	cmd.Instruction			= instruction;
 	cmd.DummyCycles			= 0u;
 
-	status = HAL_QSPI_Command(hqspi, &cmd, QUADSPI_DEFAULT_TIMEOUT);
+	status = QuadSpiCommand(hqspi, &cmd);
 
 	if(status == HAL_OK){
 		success = true;
@@ -87,7 +146,7 @@ bool QuadSpiInstructionWithAddress(QSPI_HandleTypeDef *hqspi, uint8_t instructio
 	cmd.AddressSize			= addressSize;
 	cmd.DummyCycles			= 0u;
 
-	status = HAL_QSPI_Command(hqspi, &cmd, QUADSPI_DEFAULT_TIMEOUT);
+	status = QuadSpiCommand(hqspi, &cmd);
 
 	if(status == HAL_OK){
 		success = true;
@@ -113,10 +172,10 @@ bool QuadSpiReceive1Line(QSPI_HandleTypeDef *hqspi, uint8_t instruction, uint8_t
 	cmd.DummyCycles			= dummyCycles;
 	cmd.NbData				= length;
 
-	status = HAL_QSPI_Command(hqspi, &cmd, QUADSPI_DEFAULT_TIMEOUT);
+	status = QuadSpiCommand(hqspi, &cmd);
 	bool timeout = (status != HAL_OK);
 	if (!timeout) {
-		status = HAL_QSPI_Receive(hqspi, in, QUADSPI_DEFAULT_TIMEOUT);
+		status = QuadSpiReceiveData(hqspi, in);
 
 		timeout = (status != HAL_OK);
 	}
@@ -145,10 +204,10 @@ bool QuadSpiReceive4Lines(QSPI_HandleTypeDef *hqspi, uint8_t instruction, uint8_
 	cmd.DummyCycles			= dummyCycles;
 	cmd.NbData				= length;
 
-	status = HAL_QSPI_Command(hqspi, &cmd, QUADSPI_DEFAULT_TIMEOUT);
+	status = QuadSpiCommand(hqspi, &cmd);
 	bool timeout = (status != HAL_OK);
 	if (!timeout) {
-		status = HAL_QSPI_Receive(hqspi, in, QUADSPI_DEFAULT_TIMEOUT);
+		status = QuadSpiReceiveData(hqspi, in);
 
 		timeout = (status != HAL_OK);
 	}
@@ -160,7 +219,7 @@ bool QuadSpiReceive4Lines(QSPI_HandleTypeDef *hqspi, uint8_t instruction, uint8_
 	return true;
 }
 
-bool QuadSpiReceiveWithAddress1Line(QSPI_HandleTypeDef *hqspi, uint8_t instruction, uint8_t dummyCycles, uint32_t address, uint8_t addressSize, uint8_t *in, int length)
+bool QuadSpiReceiveWithAddress1Line(QSPI_HandleTypeDef *hqspi, uint8_t instruction, uint8_t dummyCycles, uint32_t address, uint32_t addressSize, uint8_t *in, int length)
 {
 	HAL_StatusTypeDef status;
 
@@ -179,10 +238,10 @@ bool QuadSpiReceiveWithAddress1Line(QSPI_HandleTypeDef *hqspi, uint8_t instructi
 	cmd.AddressSize			= addressSize;
 	cmd.NbData				= length;
 
-	status = HAL_QSPI_Command(hqspi, &cmd, QUADSPI_DEFAULT_TIMEOUT);
+	status = QuadSpiCommand(hqspi, &cmd);
 	bool timeout = (status != HAL_OK);
 	if (!timeout) {
-		status = HAL_QSPI_Receive(hqspi, in, QUADSPI_DEFAULT_TIMEOUT);
+		status = QuadSpiReceiveData(hqspi, in);
 		timeout = (status != HAL_OK);
 	}
 
@@ -193,7 +252,7 @@ bool QuadSpiReceiveWithAddress1Line(QSPI_HandleTypeDef *hqspi, uint8_t instructi
 	return true;
 }
 
-bool QuadSpiReceiveWithAddress4Lines(QSPI_HandleTypeDef *hqspi, uint8_t instruction, uint8_t dummyCycles, uint32_t address, uint8_t addressSize, uint8_t *in, int length)
+bool QuadSpiReceiveWithAddress4Lines(QSPI_HandleTypeDef *hqspi, uint8_t instruction, uint8_t dummyCycles, uint32_t address, uint32_t addressSize, uint8_t *in, int length)
 {
 	HAL_StatusTypeDef status;
 
@@ -212,10 +271,10 @@ bool QuadSpiReceiveWithAddress4Lines(QSPI_HandleTypeDef *hqspi, uint8_t instruct
 	cmd.AddressSize			= addressSize;
 	cmd.NbData				= length;
 
-	status = HAL_QSPI_Command(hqspi, &cmd, QUADSPI_DEFAULT_TIMEOUT);
+	status = QuadSpiCommand(hqspi, &cmd);
 	bool timeout = (status != HAL_OK);
 	if (!timeout) {
-		status = HAL_QSPI_Receive(hqspi, in, QUADSPI_DEFAULT_TIMEOUT);
+		status = QuadSpiReceiveData(hqspi, in);
 		timeout = (status != HAL_OK);
 	}
 
@@ -248,11 +307,11 @@ bool QuadSpiTransmit1Line(QSPI_HandleTypeDef *hqspi, uint8_t instruction, uint8_
 		cmd.DataMode		= QSPI_DATA_1_LINE;
 	}
 
-	status = HAL_QSPI_Command(hqspi, &cmd, QUADSPI_DEFAULT_TIMEOUT);
+	status = QuadSpiCommand(hqspi, &cmd);
 	bool timeout = (status != HAL_OK);
 	if (!timeout) {
 		if (out && length > 0) {
-			status = HAL_QSPI_Transmit(hqspi, (uint8_t *)out, QUADSPI_DEFAULT_TIMEOUT);
+			status = QuadSpiTransmitData(hqspi, out);
 			timeout = (status != HAL_OK);
 		}
 	}
@@ -291,11 +350,11 @@ bool QuadSpiTransmitWithAddress1Line(
 	cmd.AddressSize			= addressSize;
 	cmd.NbData				= length;
 
-	status = HAL_QSPI_Command(hqspi, &cmd, QUADSPI_DEFAULT_TIMEOUT);
+	status = QuadSpiCommand(hqspi, &cmd);
 	bool timeout = (status != HAL_OK);
 
 	if (!timeout) {
-		status = HAL_QSPI_Transmit(hqspi, (uint8_t *)out, QUADSPI_DEFAULT_TIMEOUT);
+		status = QuadSpiTransmitData(hqspi, out);
 		timeout = (status != HAL_OK);
 	}
 
@@ -333,11 +392,11 @@ bool QuadSpiTransmitWithAddress4Line(
 	cmd.AddressSize			= addressSize;
 	cmd.NbData				= length;
 
-	status = HAL_QSPI_Command(hqspi, &cmd, QUADSPI_DEFAULT_TIMEOUT);
+	status = QuadSpiCommand(hqspi, &cmd);
 	bool timeout = (status != HAL_OK);
 
 	if (!timeout) {
-		status = HAL_QSPI_Transmit(hqspi, (uint8_t *)out, QUADSPI_DEFAULT_TIMEOUT);
+		status = QuadSpiTransmitData(hqspi, out);
 		timeout = (status != HAL_OK);
 	}
 
@@ -348,7 +407,7 @@ bool QuadSpiTransmitWithAddress4Line(
 	return true;
 }
 
-bool QuadSpiInstructionWithAddress1LINE(QSPI_HandleTypeDef *hqspi, uint8_t instruction, uint8_t dummyCycles, uint32_t address, uint8_t addressSize)
+bool QuadSpiInstructionWithAddress1LINE(QSPI_HandleTypeDef *hqspi, uint8_t instruction, uint8_t dummyCycles, uint32_t address, uint32_t addressSize)
 {
 	HAL_StatusTypeDef status;
 
@@ -367,7 +426,7 @@ bool QuadSpiInstructionWithAddress1LINE(QSPI_HandleTypeDef *hqspi, uint8_t instr
 	cmd.AddressSize			= QSPI_ADDRESS_24_BITS;
 	cmd.NbData				= 0;
 
-	status = HAL_QSPI_Command(hqspi, &cmd, QUADSPI_DEFAULT_TIMEOUT);
+	status = QuadSpiCommand(hqspi, &cmd);
 	bool timeout = (status != HAL_OK);
 
 
@@ -404,10 +463,51 @@ bool QuadSpiReceiveWithAddress4LINES(
 	cmd.AddressSize			= addressSize;
 	cmd.NbData				= length;
 
-	status = HAL_QSPI_Command(hqspi, &cmd, QUADSPI_DEFAULT_TIMEOUT);
+	status = QuadSpiCommand(hqspi, &cmd);
+	bool timeout = (status != HAL_OK);
+	if (!timeout) {
+		status = QuadSpiReceiveData(hqspi, in);
+		timeout = (status != HAL_OK);
+	}
+
+	if (timeout) {
+		return false;
+	}
+
+	return true;
+}
+
+bool QuadSpiSendCommand(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd)
+{
+	return (QuadSpiCommand(hqspi, cmd) == HAL_OK);
+}
+
+bool QuadSpiReceiveCommand(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd, uint8_t *in)
+{
+	HAL_StatusTypeDef status;
+
+	status = QuadSpiCommand(hqspi, cmd);
+	bool timeout = (status != HAL_OK);
+	if (!timeout) {
+		status = QuadSpiReceiveData(hqspi, in);
+		timeout = (status != HAL_OK);
+	}
+
+	if (timeout) {
+		return false;
+	}
+
+	return true;
+}
+
+bool QuadSpiTransmitCommand(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd, const uint8_t *out)
+{
+	HAL_StatusTypeDef status;
+
+	status = QuadSpiCommand(hqspi, cmd);
 	bool timeout = (status != HAL_OK);
 	if (!timeout) {
-		status = HAL_QSPI_Receive(hqspi, in, QUADSPI_DEFAULT_TIMEOUT);
+		status = QuadSpiTransmitData(hqspi, out);
 		timeout = (status != HAL_OK);
 	}
 
@@ -418,3 +518,219 @@ bool QuadSpiReceiveWithAddress4LINES(
 	return true;
 }
 
+static bool QuadSpiWaitFlag(QSPI_HandleTypeDef *hqspi, uint32_t flag, uint32_t tickStart)
+{
+	bool success = true;
+
+	while (success && !__HAL_QSPI_GET_FLAG(hqspi, flag)) {
+		if ((HAL_GetTick() - tickStart) > QUADSPI_DEFAULT_TIMEOUT) {
+			success = false;
+		}
+	}
+
+	return success;
+}
+
+bool QuadSpiAutoPoll(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd, uint8_t mask, uint8_t match, uint32_t timeout)
+{
+	HAL_StatusTypeDef status;
+	QSPI_AutoPollingTypeDef config;
+
+	config.Match			= match;
+	config.Mask				= mask;
+	config.MatchMode		= QSPI_MATCH_MODE_AND;
+	config.StatusBytesSize	= 1;
+	config.Interval			= QUADSPI_AUTO_POLL_INTERVAL;
+	config.AutomaticStop	= QSPI_AUTOMATIC_STOP_ENABLE;
+
+	// The controller repeats the status read itself, the CPU only sees the match. The whole poll is
+	// busy-wait of the operation before it, the same as a software status loop
+	uint32_t statsStart = FLASH_STATS_NOW();
+	QUADSPI_TRACE_BEGIN(cmd);
+
+	status = HAL_QSPI_AutoPolling(hqspi, cmd, &config, timeout);
+
+	QUADSPI_TRACE_END(QUADSPI_STATS_RESULT(status));
+	FLASH_STATS_WAIT(statsStart, 1u, (status != HAL_OK));
+
+	return (status == HAL_OK);
+}
+
+bool QuadSpiTransmitCursor(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd, FlashIoCursor *cursor)
+{
+	HAL_StatusTypeDef status;
+	__IO uint8_t *dataReg = (__IO uint8_t *)&hqspi->Instance->DR;
+	uint32_t remaining = cmd->NbData;
+
+	status = QuadSpiCommand(hqspi, cmd);
+	bool timeout = (status != HAL_OK);
+
+	if (!timeout) {
+		uint32_t tickStart = HAL_GetTick();
+		MODIFY_REG(hqspi->Instance->CCR, QUADSPI_CCR_FMODE, 0u);
+		QUADSPI_TRACE_WRITE();
+
+		// Feed the FIFO from each fragment in turn, chip select stays low across fragment boundaries
+		while (!timeout && (remaining > 0) && !FlashIoCursor_done(cursor)) {
+			uint32_t span = FlashIoCursor_span(cursor, remaining);
+			const uint8_t *data = FlashIoCursor_pointer(cursor);
+
+			for (uint32_t i = 0; !timeout && (i < span); i++) {
+				timeout = !QuadSpiWaitFlag(hqspi, QSPI_FLAG_FT, tickStart);
+				*dataReg = data[i];
+			}
+
+			FlashIoCursor_advance(cursor, span);
+			remaining -= span;
+		}
+
+		if (!timeout && (remaining == 0)) {
+			timeout = !QuadSpiWaitFlag(hqspi, QSPI_FLAG_TC, tickStart);
+			__HAL_QSPI_CLEAR_FLAG(hqspi, QSPI_FLAG_TC);
+		} else {
+			timeout = true;
+		}
+
+		QUADSPI_OP_END(timeout ? FLASH_STATS_TIMEOUT : FLASH_STATS_OK);
+	}
+
+	if (timeout) {
+		HAL_QSPI_Abort(hqspi);
+		return false;
+	}
+
+	return true;
+}
+
+bool QuadSpiReceiveCursor(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd, FlashIoCursor *cursor)
+{
+	HAL_StatusTypeDef status;
+	__IO uint8_t *dataReg = (__IO uint8_t *)&hqspi->Instance->DR;
+	uint32_t remaining = cmd->NbData;
+
+	status = QuadSpiCommand(hqspi, cmd);
+	bool timeout = (status != HAL_OK);
+
+	if (!timeout) {
+		uint32_t tickStart = HAL_GetTick();
+		uint32_t addressReg = READ_REG(hqspi->Instance->AR);
+
+		// Switch to indirect read and restart the transfer by rewriting the address, as HAL_QSPI_Receive does
+		MODIFY_REG(hqspi->Instance->CCR, QUADSPI_CCR_FMODE, QUADSPI_CCR_FMODE_0);
+		WRITE_REG(hqspi->Instance->AR, addressReg);
+
+		while (!timeout && (remaining > 0) && !FlashIoCursor_done(cursor)) {
+			uint32_t span = FlashIoCursor_span(cursor, remaining);
+			uint8_t *data = FlashIoCursor_pointer(cursor);
+
+			for (uint32_t i = 0; !timeout && (i < span); i++) {
+				timeout = !QuadSpiWaitFlag(hqspi, QSPI_FLAG_FT | QSPI_FLAG_TC, tickStart);
+				data[i] = *dataReg;
+			}
+
+			FlashIoCursor_advance(cursor, span);
+			remaining -= span;
+		}
+
+		if (!timeout && (remaining == 0)) {
+			timeout = !QuadSpiWaitFlag(hqspi, QSPI_FLAG_TC, tickStart);
+			__HAL_QSPI_CLEAR_FLAG(hqspi, QSPI_FLAG_TC);
+		} else {
+			timeout = true;
+		}
+
+		QUADSPI_OP_END(timeout ? FLASH_STATS_TIMEOUT : FLASH_STATS_OK);
+	}
+
+	if (timeout) {
+		HAL_QSPI_Abort(hqspi);
+		return false;
+	}
+
+	return true;
+}
+
+bool QuadSpi_claimEvents(QuadSpiEventHandler handler, void *context, bool wait)
+{
+	bool claimed = false;
+	uint32_t primask = __get_PRIMASK();
+
+	__disable_irq();
+
+	if ((quadSpiEventHandler == NULL) || (quadSpiEventHandler == handler)) {
+		quadSpiEventContext = context;
+		quadSpiEventHandler = handler;
+		claimed = true;
+	} else if (wait && ((quadSpiEventWaiting == NULL) || (quadSpiEventWaiting == handler))) {
+		quadSpiEventWaitingContext = context;
+		quadSpiEventWaiting = handler;
+	}
+
+	if (primask == 0u) {
+		__enable_irq();
+	}
+
+	return claimed;
+}
+
+void QuadSpi_releaseEvents(QSPI_HandleTypeDef *hqspi, QuadSpiEventHandler handler)
+{
+	bool handOver = false;
+	uint32_t primask = __get_PRIMASK();
+
+	__disable_irq();
+
+	if (quadSpiEventHandler == handler) {
+		quadSpiEventContext = quadSpiEventWaitingContext;
+		quadSpiEventHandler = quadSpiEventWaiting;
+		quadSpiEventWaiting = NULL;
+		handOver = (quadSpiEventHandler != NULL);
+	}
+
+	if (primask == 0u) {
+		__enable_irq();
+	}
+
+	if (handOver) {
+		QuadSpi_dispatchEvent(hqspi, QUADSPI_EVENT_CLAIMED);
+	}
+}
+
+void QuadSpi_dispatchEvent(QSPI_HandleTypeDef *hqspi, QuadSpiEvent event)
+{
+	if (quadSpiEventHandler != NULL) {
+		quadSpiEventHandler(hqspi, event, quadSpiEventContext);
+	}
+}
+
+#ifdef QUADSPI_HAL_CALLBACKS
+void HAL_QSPI_RxCpltCallback(QSPI_HandleTypeDef *hqspi)
+{
+	QuadSpi_dispatchEvent(hqspi, QUADSPI_EVENT_RX_DONE);
+}
+
+void HAL_QSPI_TxCpltCallback(QSPI_HandleTypeDef *hqspi)
+{
+	QuadSpi_dispatchEvent(hqspi, QUADSPI_EVENT_TX_DONE);
+}
+
+void HAL_QSPI_CmdCpltCallback(QSPI_HandleTypeDef *hqspi)
+{
+	QuadSpi_dispatchEvent(hqspi, QUADSPI_EVENT_CMD_DONE);
+}
+
+void HAL_QSPI_StatusMatchCallback(QSPI_HandleTypeDef *hqspi)
+{
+	QuadSpi_dispatchEvent(hqspi, QUADSPI_EVENT_STATUS_MATCH);
+}
+
+void HAL_QSPI_TimeOutCallback(QSPI_HandleTypeDef *hqspi)
+{
+	QuadSpi_dispatchEvent(hqspi, QUADSPI_EVENT_TIMEOUT);
+}
+
+void HAL_QSPI_ErrorCallback(QSPI_HandleTypeDef *hqspi)
+{
+	QuadSpi_dispatchEvent(hqspi, QUADSPI_EVENT_ERROR);
+}
+#endif
@@ -0,0 +1,187 @@
+/*
+ * This program is QUADSPI timing calibration.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "quadspicalib.h"
+
+static const uint32_t quadSpiCalibShifts[] = { QSPI_SAMPLE_SHIFTING_NONE, QSPI_SAMPLE_SHIFTING_HALFCYCLE };
+
+#define QUADSPI_CALIB_SHIFT_COUNT	(sizeof(quadSpiCalibShifts) / sizeof(quadSpiCalibShifts[0]))
+
+static uint8_t quadSpiCalibBuffer[QUADSPI_CALIB_MAX_PATTERN];
+
+static uint32_t QuadSpiCalib_checksum(const QuadSpiCalibration *calibration)
+{
+	// Fields one by one so structure padding never reaches the checksum
+	uint32_t words[5] = {
+		calibration->magic,
+		calibration->timing.clockPrescaler,
+		calibration->timing.sampleShifting,
+		calibration->timing.chipSelectHighTime,
+		calibration->dummyCycles,
+	};
+	uint32_t sum = 0x5A5A5A5Au;
+
+	for (uint32_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+		sum = ((sum << 5) | (sum >> 27)) ^ words[i];
+	}
+
+	return sum;
+}
+
+bool QuadSpiCalib_isValid(const QuadSpiCalibration *calibration)
+{
+	return ((calibration->magic == QUADSPI_CALIB_MAGIC) && (calibration->checksum == QuadSpiCalib_checksum(calibration)));
+}
+
+void QuadSpiCalib_seal(QuadSpiCalibration *calibration)
+{
+	calibration->magic = QUADSPI_CALIB_MAGIC;
+	calibration->checksum = QuadSpiCalib_checksum(calibration);
+}
+
+static uint32_t QuadSpiCalib_patternLength(const QuadSpiCalibConfig *config)
+{
+	return (config->patternLength < QUADSPI_CALIB_MAX_PATTERN) ? config->patternLength : QUADSPI_CALIB_MAX_PATTERN;
+}
+
+static bool QuadSpiCalib_patternMatches(const QuadSpiCalibConfig *config, uint8_t dummyCycles)
+{
+	uint32_t length = QuadSpiCalib_patternLength(config);
+	bool match = config->readPattern(config->patternAddress, quadSpiCalibBuffer, length, dummyCycles);
+
+	for (uint32_t i = 0; match && (i < length); i++) {
+		match = (quadSpiCalibBuffer[i] == config->pattern[i]);
+	}
+
+	return match;
+}
+
+static bool QuadSpiCalib_try(const QuadSpiCalibConfig *config, const QuadSpiTiming *timing, uint8_t dummyCycles)
+{
+	bool pass = QuadSpi_InitWithTiming(config->hqspi, config->flashSize, timing);
+
+	for (uint32_t i = 0; pass && (i < config->repetitions); i++) {
+		pass = QuadSpiCalib_patternMatches(config, dummyCycles);
+	}
+
+	return pass;
+}
+
+//! Finds a passing sample shift and dummy setting at the given prescaler, trying the preferred one first
+static bool QuadSpiCalib_findAt(const QuadSpiCalibConfig *config, uint32_t prescaler, QuadSpiCalibration *found)
+{
+	QuadSpiTiming timing = {
+		.clockPrescaler		= prescaler,
+		.sampleShifting		= found->timing.sampleShifting,
+		.chipSelectHighTime	= config->chipSelectHighTime,
+	};
+	bool pass = QuadSpiCalib_try(config, &timing, found->dummyCycles);
+
+	for (uint32_t s = 0; !pass && (s < QUADSPI_CALIB_SHIFT_COUNT); s++) {
+		for (uint32_t d = 0; !pass && (d < config->dummyCount); d++) {
+			timing.sampleShifting = quadSpiCalibShifts[s];
+			pass = QuadSpiCalib_try(config, &timing, config->dummyCycles[d]);
+
+			if (pass) {
+				found->dummyCycles = config->dummyCycles[d];
+			}
+		}
+	}
+
+	if (pass) {
+		found->timing = timing;
+	}
+
+	return pass;
+}
+
+bool QuadSpiCalib_apply(const QuadSpiCalibConfig *config, const QuadSpiCalibration *calibration)
+{
+	bool success = QuadSpi_InitWithTiming(config->hqspi, config->flashSize, &calibration->timing);
+
+	if (success && (config->setDummyCycles != NULL)) {
+		config->setDummyCycles(calibration->dummyCycles);
+	}
+
+	return success;
+}
+
+bool QuadSpiCalib_run(const QuadSpiCalibConfig *config, QuadSpiCalibration *result)
+{
+	bool success = false;
+	QuadSpiCalibration candidate;
+	QuadSpiTiming reference = {
+		.clockPrescaler		= config->slowestPrescaler,
+		.sampleShifting		= QSPI_SAMPLE_SHIFTING_HALFCYCLE,
+		.chipSelectHighTime	= config->chipSelectHighTime,
+	};
+
+	// A stored result from an earlier boot only needs one confirming read
+	if ((config->load != NULL) && config->load(&candidate) && QuadSpiCalib_isValid(&candidate)) {
+		success = QuadSpi_InitWithTiming(config->hqspi, config->flashSize, &candidate.timing) &&
+				QuadSpiCalib_patternMatches(config, candidate.dummyCycles);
+	}
+
+	if (!success) {
+		candidate.timing = reference;
+		candidate.dummyCycles = config->dummyCycles[0];
+
+		// The reference pattern must read back at the conservative setting before anything is judged against it
+		bool referenceValid = QuadSpiCalib_try(config, &reference, candidate.dummyCycles);
+		if (!referenceValid && (config->writePattern != NULL)) {
+			referenceValid = config->writePattern(config->patternAddress, config->pattern, QuadSpiCalib_patternLength(config)) &&
+					QuadSpiCalib_try(config, &reference, candidate.dummyCycles);
+		}
+
+		uint32_t fastest = config->slowestPrescaler + 1u;
+		for (uint32_t prescaler = config->fastestPrescaler; referenceValid && (fastest > config->slowestPrescaler) && (prescaler <= config->slowestPrescaler); prescaler++) {
+			if (QuadSpiCalib_findAt(config, prescaler, &candidate)) {
+				fastest = prescaler;
+			}
+		}
+
+		// Back off by the margin, keep going slower until a setting passes there too
+		uint32_t locked = fastest + config->marginSteps;
+		if (locked > config->slowestPrescaler) {
+			locked = config->slowestPrescaler;
+		}
+
+		for (; referenceValid && !success && (locked <= config->slowestPrescaler); locked++) {
+			success = QuadSpiCalib_findAt(config, locked, &candidate);
+		}
+
+		if (success) {
+			QuadSpiCalib_seal(&candidate);
+
+			if (config->store != NULL) {
+				config->store(&candidate);
+			}
+		}
+	}
+
+	if (success) {
+		*result = candidate;
+		success = QuadSpiCalib_apply(config, &candidate);
+	} else {
+		QuadSpi_InitWithTiming(config->hqspi, config->flashSize, &QuadSpi_defaultTiming);
+	}
+
+	return success;
+}
@@ -0,0 +1,229 @@
+/*
+ * This program is cache-aware DMA transfers for QUADSPI.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "quadspidma.h"
+
+#define QUADSPI_DMA_TIMEOUT				200
+#define QUADSPI_DMA_LINE_MASK			((uintptr_t)QUADSPI_DMA_CACHE_LINE - 1u)
+
+static QSPI_HandleTypeDef *quadSpiDmaHandle = NULL;
+static volatile bool quadSpiDmaBusy = false;
+static QuadSpiDmaDone quadSpiDmaDone = NULL;
+static void *quadSpiDmaContext = NULL;
+static uint8_t *quadSpiDmaRxBuffer = NULL;
+static uint32_t quadSpiDmaRxLength = 0;
+static QuadSpiDmaStats quadSpiDmaStats;
+
+static void QuadSpiDma_invalidate(uint8_t *buffer, uint32_t length)
+{
+	if (QUADSPI_DMA_DCACHE_ENABLED()) {
+		QUADSPI_DMA_DCACHE_INVALIDATE(buffer, length);
+		quadSpiDmaStats.invalidatedLines += length / QUADSPI_DMA_CACHE_LINE;
+	}
+}
+
+static void QuadSpiDma_event(QSPI_HandleTypeDef *hqspi, QuadSpiEvent event, void *context)
+{
+	bool success = ((event == QUADSPI_EVENT_RX_DONE) || (event == QUADSPI_EVENT_TX_DONE));
+
+	if (quadSpiDmaBusy && (success || (event == QUADSPI_EVENT_ERROR) || (event == QUADSPI_EVENT_TIMEOUT))) {
+
+		// Lines may have been speculatively refetched while the DMA was writing behind the cache
+		if (quadSpiDmaRxLength > 0) {
+			QuadSpiDma_invalidate(quadSpiDmaRxBuffer, quadSpiDmaRxLength);
+			quadSpiDmaRxLength = 0;
+		}
+
+		quadSpiDmaBusy = false;
+		QuadSpi_releaseEvents(hqspi, QuadSpiDma_event);
+
+		if (quadSpiDmaDone != NULL) {
+			quadSpiDmaDone(quadSpiDmaContext, success);
+		}
+	}
+}
+
+static bool QuadSpiDma_claim(QuadSpiDmaDone done, void *context)
+{
+	bool claimed = false;
+
+	// The polled ends run before the DMA does, so the peripheral is taken for the whole transfer
+	if ((quadSpiDmaHandle != NULL) && !quadSpiDmaBusy && QuadSpi_claimEvents(QuadSpiDma_event, NULL, false)) {
+		quadSpiDmaBusy = true;
+		quadSpiDmaDone = done;
+		quadSpiDmaContext = context;
+		quadSpiDmaRxLength = 0;
+		quadSpiDmaStats.transfers++;
+		claimed = true;
+	}
+
+	return claimed;
+}
+
+//! Short transfers and unaligned fragments, the CPU writes through the cache so no maintenance is needed
+static bool QuadSpiDma_pollReceive(const QSPI_CommandTypeDef *cmd, uint32_t offset, uint8_t *buffer, uint32_t length)
+{
+	QSPI_CommandTypeDef part = *cmd;
+
+	part.Address += offset;
+	part.NbData = length;
+	quadSpiDmaStats.slowPathBytes += length;
+
+	return QuadSpiReceiveCommand(quadSpiDmaHandle, &part, buffer);
+}
+
+//! A failed start is reported by the return value only, the callback fires for transfers that were accepted
+static void QuadSpiDma_finishPolled(bool success)
+{
+	quadSpiDmaBusy = false;
+	QuadSpi_releaseEvents(quadSpiDmaHandle, QuadSpiDma_event);
+
+	if (success && (quadSpiDmaDone != NULL)) {
+		quadSpiDmaDone(quadSpiDmaContext, true);
+	}
+}
+
+bool QuadSpiDma_init(QSPI_HandleTypeDef *hqspi)
+{
+	QuadSpi_releaseEvents(hqspi, QuadSpiDma_event);
+	quadSpiDmaHandle = hqspi;
+	quadSpiDmaBusy = false;
+	QuadSpiDma_resetStats();
+
+	return (hqspi->hmdma != NULL);
+}
+
+bool QuadSpiDma_receive(const QSPI_CommandTypeDef *cmd, uint8_t *buffer, QuadSpiDmaDone done, void *context)
+{
+	if (!QuadSpiDma_claim(done, context)) {
+		return false;
+	}
+
+	uint32_t length = cmd->NbData;
+	uintptr_t start = (uintptr_t)buffer;
+	uintptr_t end = start + length;
+	uintptr_t alignedStart = (start + QUADSPI_DMA_LINE_MASK) & ~QUADSPI_DMA_LINE_MASK;
+	uintptr_t alignedEnd = end & ~QUADSPI_DMA_LINE_MASK;
+	uint32_t head = (uint32_t)(alignedStart - start);
+	uint32_t tail = (uint32_t)(end - alignedEnd);
+
+	// Splitting needs an address to restart the read from, otherwise the whole buffer must already be aligned
+	bool splittable = (cmd->AddressMode != QSPI_ADDRESS_NONE) || ((head == 0) && (tail == 0));
+	bool useDma = splittable && (length >= QUADSPI_DMA_MIN_LENGTH) && (alignedEnd > alignedStart);
+	bool success = true;
+
+	if (!useDma) {
+		success = QuadSpiDma_pollReceive(cmd, 0, buffer, length);
+		QuadSpiDma_finishPolled(success);
+		return success;
+	}
+
+	// Partial lines at either end share the cache line with unrelated data, they are never touched by DMA
+	if (head > 0) {
+		success = QuadSpiDma_pollReceive(cmd, 0, buffer, head);
+	}
+
+	if (success && (tail > 0)) {
+		success = QuadSpiDma_pollReceive(cmd, length - tail, buffer + (length - tail), tail);
+	}
+
+	if (success) {
+		QSPI_CommandTypeDef middle = *cmd;
+		uint8_t *middleBuffer = buffer + head;
+		uint32_t middleLength = (uint32_t)(alignedEnd - alignedStart);
+
+		middle.Address += head;
+		middle.NbData = middleLength;
+
+		// Drop any dirty lines now so an eviction cannot overwrite what the DMA writes
+		QuadSpiDma_invalidate(middleBuffer, middleLength);
+		quadSpiDmaRxBuffer = middleBuffer;
+		quadSpiDmaRxLength = middleLength;
+		quadSpiDmaStats.dmaBytes += middleLength;
+
+		success = (HAL_QSPI_Command(quadSpiDmaHandle, &middle, QUADSPI_DMA_TIMEOUT) == HAL_OK) &&
+				(HAL_QSPI_Receive_DMA(quadSpiDmaHandle, middleBuffer) == HAL_OK);
+	}
+
+	if (!success) {
+		quadSpiDmaRxLength = 0;
+		quadSpiDmaBusy = false;
+		QuadSpi_releaseEvents(quadSpiDmaHandle, QuadSpiDma_event);
+	}
+
+	return success;
+}
+
+bool QuadSpiDma_transmit(const QSPI_CommandTypeDef *cmd, const uint8_t *buffer, QuadSpiDmaDone done, void *context)
+{
+	if (!QuadSpiDma_claim(done, context)) {
+		return false;
+	}
+
+	QSPI_CommandTypeDef command = *cmd;
+	uint32_t length = cmd->NbData;
+	bool success = (HAL_QSPI_Command(quadSpiDmaHandle, &command, QUADSPI_DMA_TIMEOUT) == HAL_OK);
+
+	if (success && (length < QUADSPI_DMA_MIN_LENGTH)) {
+		quadSpiDmaStats.slowPathBytes += length;
+		success = (HAL_QSPI_Transmit(quadSpiDmaHandle, (uint8_t *)buffer, QUADSPI_DMA_TIMEOUT) == HAL_OK);
+		QuadSpiDma_finishPolled(success);
+		return success;
+	}
+
+	if (success) {
+		// Only dirty data has to reach RAM, cleaning partial lines at the ends is harmless to their neighbours
+		if (QUADSPI_DMA_DCACHE_ENABLED()) {
+			uintptr_t first = (uintptr_t)buffer & ~QUADSPI_DMA_LINE_MASK;
+			uintptr_t last = ((uintptr_t)buffer + length + QUADSPI_DMA_LINE_MASK) & ~QUADSPI_DMA_LINE_MASK;
+
+			QUADSPI_DMA_DCACHE_CLEAN(first, last - first);
+			quadSpiDmaStats.cleanedLines += (uint32_t)((last - first) / QUADSPI_DMA_CACHE_LINE);
+		}
+
+		quadSpiDmaStats.dmaBytes += length;
+
+		success = (HAL_QSPI_Transmit_DMA(quadSpiDmaHandle, (uint8_t *)buffer) == HAL_OK);
+	}
+
+	if (!success) {
+		quadSpiDmaBusy = false;
+		QuadSpi_releaseEvents(quadSpiDmaHandle, QuadSpiDma_event);
+	}
+
+	return success;
+}
+
+bool QuadSpiDma_isBusy(void)
+{
+	return quadSpiDmaBusy;
+}
+
+const QuadSpiDmaStats *QuadSpiDma_getStats(void)
+{
+	return &quadSpiDmaStats;
+}
+
+void QuadSpiDma_resetStats(void)
+{
+	memset(&quadSpiDmaStats, 0, sizeof(quadSpiDmaStats));
+}
@@ -0,0 +1,258 @@
+/*
+ * This program is interrupt driven command queue for QUADSPI.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "quadspiqueue.h"
+#include "flashdevice.h"
+
+static QSPI_HandleTypeDef *quadSpiQueueHandle = NULL;
+static QuadSpiChain *quadSpiQueueHead = NULL;
+static QuadSpiChain *quadSpiQueueTail = NULL;
+static volatile bool quadSpiQueueRunning = false;
+static QuadSpiQueueStats quadSpiQueueStats;
+
+static void QuadSpiQueue_event(QSPI_HandleTypeDef *hqspi, QuadSpiEvent event, void *context);
+
+static uint32_t QuadSpiQueue_lock(void)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	return primask;
+}
+
+static void QuadSpiQueue_unlock(uint32_t primask)
+{
+	if (primask == 0u) {
+		__enable_irq();
+	}
+}
+
+static void QuadSpiQueue_finishHead(bool success)
+{
+	uint32_t primask = QuadSpiQueue_lock();
+	QuadSpiChain *chain = quadSpiQueueHead;
+
+	quadSpiQueueHead = chain->next;
+	if (quadSpiQueueHead == NULL) {
+		quadSpiQueueTail = NULL;
+	}
+	quadSpiQueueStats.depth--;
+	QuadSpiQueue_unlock(primask);
+
+	if (success) {
+		quadSpiQueueStats.chainsCompleted++;
+	} else {
+		quadSpiQueueStats.chainsFailed++;
+	}
+
+	// The chain belongs to the caller again, it may be resubmitted from here
+	if (chain->done != NULL) {
+		chain->done(chain->context, success);
+	}
+}
+
+//! Starts an op that completes in the interrupt, returns false if the HAL refused it
+static bool QuadSpiQueue_startOp(const QuadSpiOp *op)
+{
+	QSPI_CommandTypeDef cmd = op->cmd;
+	HAL_StatusTypeDef status = HAL_ERROR;
+
+	// Same opcode on NOR and NAND, the chain doesn't say which part it drives
+	if (cmd.Instruction == FLASH_DEVICE_INSTR_WRITE_ENABLE) {
+		FlashDevice_invalidateShadow(FLASH_DEVICE_TYPE_NOR);
+		FlashDevice_invalidateShadow(FLASH_DEVICE_TYPE_NAND);
+	}
+
+	if (op->type == QUADSPI_OP_POLL) {
+		QSPI_AutoPollingTypeDef config;
+
+		config.Match			= op->pollMatch;
+		config.Mask				= op->pollMask;
+		config.MatchMode		= QSPI_MATCH_MODE_AND;
+		config.StatusBytesSize	= 1;
+		config.Interval			= QUADSPI_QUEUE_POLL_INTERVAL;
+		config.AutomaticStop	= QSPI_AUTOMATIC_STOP_ENABLE;
+
+		status = HAL_QSPI_AutoPolling_IT(quadSpiQueueHandle, &cmd, &config);
+	} else {
+		// Runs from the interrupt, nothing here may wait: a bare instruction completes with its own interrupt,
+		// with a data phase the command only programs the registers and the transfer starts with the data call
+		status = HAL_QSPI_Command_IT(quadSpiQueueHandle, &cmd);
+
+		if ((status == HAL_OK) && (op->type == QUADSPI_OP_TRANSMIT)) {
+			status = HAL_QSPI_Transmit_IT(quadSpiQueueHandle, op->data);
+		} else if ((status == HAL_OK) && (op->type == QUADSPI_OP_RECEIVE)) {
+			status = HAL_QSPI_Receive_IT(quadSpiQueueHandle, op->data);
+		}
+	}
+
+	return (status == HAL_OK);
+}
+
+//! Starts the next op of the chain at the head, chains that fail to start are finished on the spot
+static void QuadSpiQueue_run(void)
+{
+	bool waiting = false;
+	uint32_t primask = QuadSpiQueue_lock();
+	bool running = (quadSpiQueueHead != NULL);
+	quadSpiQueueRunning = running;
+	QuadSpiQueue_unlock(primask);
+
+	while (running && !waiting) {
+		QuadSpiChain *chain = quadSpiQueueHead;
+		bool success = true;
+
+		if (chain->index < chain->count) {
+			success = QuadSpiQueue_startOp(&chain->ops[chain->index]);
+			waiting = success;
+		}
+
+		if (!success || (chain->index >= chain->count)) {
+			QuadSpiQueue_finishHead(success);
+		}
+
+		if (!waiting) {
+			primask = QuadSpiQueue_lock();
+			running = (quadSpiQueueHead != NULL);
+			quadSpiQueueRunning = running;
+			QuadSpiQueue_unlock(primask);
+		}
+	}
+
+	// Idle again, a DMA transfer may have the peripheral
+	if (!running) {
+		QuadSpi_releaseEvents(quadSpiQueueHandle, QuadSpiQueue_event);
+	}
+}
+
+static void QuadSpiQueue_event(QSPI_HandleTypeDef *hqspi, QuadSpiEvent event, void *context)
+{
+	if (!quadSpiQueueRunning || (quadSpiQueueHead == NULL)) {
+		return;
+	}
+
+	if (event == QUADSPI_EVENT_CLAIMED) {
+		QuadSpiQueue_run();
+		return;
+	}
+
+	quadSpiQueueStats.interrupts++;
+
+	if ((event == QUADSPI_EVENT_ERROR) || (event == QUADSPI_EVENT_TIMEOUT)) {
+		QuadSpiQueue_finishHead(false);
+	} else {
+		quadSpiQueueHead->index++;
+		quadSpiQueueStats.opsCompleted++;
+	}
+
+	QuadSpiQueue_run();
+}
+
+void QuadSpiQueue_init(QSPI_HandleTypeDef *hqspi)
+{
+	QuadSpi_releaseEvents(hqspi, QuadSpiQueue_event);
+	quadSpiQueueHandle = hqspi;
+	quadSpiQueueHead = NULL;
+	quadSpiQueueTail = NULL;
+	quadSpiQueueRunning = false;
+	QuadSpiQueue_resetStats();
+}
+
+bool QuadSpiQueue_submit(QuadSpiChain *chain)
+{
+	if ((quadSpiQueueHandle == NULL) || (chain->count == 0)) {
+		return false;
+	}
+
+	chain->next = NULL;
+	chain->index = 0;
+
+	uint32_t primask = QuadSpiQueue_lock();
+	bool start = !quadSpiQueueRunning;
+
+	if (quadSpiQueueTail != NULL) {
+		quadSpiQueueTail->next = chain;
+	} else {
+		quadSpiQueueHead = chain;
+	}
+	quadSpiQueueTail = chain;
+
+	quadSpiQueueStats.depth++;
+	if (quadSpiQueueStats.depth > quadSpiQueueStats.maxDepth) {
+		quadSpiQueueStats.maxDepth = quadSpiQueueStats.depth;
+	}
+
+	quadSpiQueueRunning = true;
+	QuadSpiQueue_unlock(primask);
+
+	// An idle engine is kicked from the caller, otherwise the running chain's interrupt picks this one up.
+	// While a DMA transfer owns the peripheral the chain waits for it to hand the events over.
+	if (start && QuadSpi_claimEvents(QuadSpiQueue_event, NULL, true)) {
+		QuadSpiQueue_run();
+	}
+
+	return true;
+}
+
+bool QuadSpiQueue_isIdle(void)
+{
+	return !quadSpiQueueRunning;
+}
+
+const QuadSpiQueueStats *QuadSpiQueue_getStats(void)
+{
+	return &quadSpiQueueStats;
+}
+
+void QuadSpiQueue_resetStats(void)
+{
+	uint32_t depth = quadSpiQueueStats.depth;
+
+	memset(&quadSpiQueueStats, 0, sizeof(quadSpiQueueStats));
+	quadSpiQueueStats.depth = depth;
+	quadSpiQueueStats.maxDepth = depth;
+}
+
+void QuadSpiQueue_commandOp(QuadSpiOp *op, uint8_t instruction)
+{
+	memset(op, 0, sizeof(*op));
+
+	op->type					= QUADSPI_OP_COMMAND;
+	op->cmd.InstructionMode		= QSPI_INSTRUCTION_1_LINE;
+	op->cmd.Instruction			= instruction;
+	op->cmd.AddressMode			= QSPI_ADDRESS_NONE;
+	op->cmd.AlternateByteMode	= QSPI_ALTERNATE_BYTES_NONE;
+	op->cmd.DataMode			= QSPI_DATA_NONE;
+	op->cmd.DdrMode				= QSPI_DDR_MODE_DISABLE;
+	op->cmd.DdrHoldHalfCycle	= QSPI_DDR_HHC_ANALOG_DELAY;
+	op->cmd.SIOOMode			= QSPI_SIOO_INST_EVERY_CMD;
+}
+
+void QuadSpiQueue_pollOp(QuadSpiOp *op, uint8_t statusInstruction, uint8_t mask, uint8_t match)
+{
+	QuadSpiQueue_commandOp(op, statusInstruction);
+
+	op->type			= QUADSPI_OP_POLL;
+	op->cmd.DataMode	= QSPI_DATA_1_LINE;
+	op->cmd.NbData		= 1;
+	op->pollMask		= mask;
+	op->pollMatch		= match;
+}
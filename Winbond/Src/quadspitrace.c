@@ -0,0 +1,295 @@
+/*
+ * This program is QUADSPI command trace recorder.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+
+#include "quadspitrace.h"
+#include "quadspi.h"
+#include "w25n01g.h"
+
+static QuadSpiTraceRecord *traceBuffer = NULL;
+static bool traceRecording = false;
+static uint32_t traceCapacity = 0;
+static uint32_t traceHead = 0;			//!< Next slot to write
+static uint32_t traceCount = 0;
+static uint32_t traceOverwritten = 0;
+static QuadSpiTraceClock traceClock = NULL;
+static QuadSpiTraceRecord tracePending;
+
+static uint16_t QuadSpiTrace_packModes(const QSPI_CommandTypeDef *cmd)
+{
+	uint16_t modes = 0;
+	uint32_t ccr = (cmd->InstructionMode & QUADSPI_CCR_IMODE) | (cmd->AddressMode & QUADSPI_CCR_ADMODE) | (cmd->AlternateByteMode & QUADSPI_CCR_ABMODE);
+
+	// Callers leave AddressSize unset without an address phase, the HAL ignores it then as well
+	if (cmd->AddressMode != QSPI_ADDRESS_NONE) {
+		ccr |= cmd->AddressSize & QUADSPI_CCR_ADSIZE;
+	}
+
+	// IMODE, ADMODE, ADSIZE and ABMODE sit next to each other in CCR[15:8]
+	modes |= (uint16_t)((ccr >> 8) & 0xFFu);
+	modes |= (uint16_t)(((cmd->DataMode & QUADSPI_CCR_DMODE) >> 24) << 8);
+
+	if (cmd->SIOOMode != QSPI_SIOO_INST_EVERY_CMD) {
+		modes |= QUADSPI_TRACE_MODE_SIOO;
+	}
+
+	if (cmd->DdrMode != QSPI_DDR_MODE_DISABLE) {
+		modes |= QUADSPI_TRACE_MODE_DDR;
+	}
+
+	return modes;
+}
+
+void QuadSpiTrace_start(QuadSpiTraceRecord *buffer, uint32_t capacity, QuadSpiTraceClock clock)
+{
+	traceRecording = false;
+	traceBuffer = buffer;
+	traceCapacity = capacity;
+	traceHead = 0;
+	traceCount = 0;
+	traceOverwritten = 0;
+	traceClock = clock;
+	traceRecording = (buffer != NULL) && (capacity > 0);
+}
+
+//! Stops recording, the captured records stay readable until the next start
+void QuadSpiTrace_stop(void)
+{
+	traceRecording = false;
+}
+
+bool QuadSpiTrace_isRecording(void)
+{
+	return traceRecording;
+}
+
+void QuadSpiTrace_begin(const QSPI_CommandTypeDef *cmd)
+{
+	if (QuadSpiTrace_isRecording()) {
+		tracePending.timestamp		= (traceClock != NULL) ? traceClock() : 0;
+		tracePending.address		= (cmd->AddressMode != QSPI_ADDRESS_NONE) ? cmd->Address : 0;
+		tracePending.length			= (cmd->DataMode != QSPI_DATA_NONE) ? cmd->NbData : 0;
+		tracePending.modes			= QuadSpiTrace_packModes(cmd);
+		tracePending.instruction	= (uint8_t)cmd->Instruction;
+		tracePending.dummyCycles	= (uint8_t)cmd->DummyCycles;
+	}
+}
+
+//! The command in progress sends its data phase to the part
+void QuadSpiTrace_markWrite(void)
+{
+	tracePending.modes |= QUADSPI_TRACE_MODE_WRITE;
+}
+
+void QuadSpiTrace_end(FlashStatsResult result)
+{
+	if (QuadSpiTrace_isRecording()) {
+		tracePending.duration	= ((traceClock != NULL) ? traceClock() : 0) - tracePending.timestamp;
+		tracePending.result		= (uint8_t)result;
+
+		traceBuffer[traceHead] = tracePending;
+		traceHead = (traceHead + 1) % traceCapacity;
+
+		if (traceCount < traceCapacity) {
+			traceCount++;
+		} else {
+			traceOverwritten++;
+		}
+	}
+}
+
+uint32_t QuadSpiTrace_copy(QuadSpiTraceRecord *out, uint32_t max)
+{
+	uint32_t count = (traceCount < max) ? traceCount : max;
+	uint32_t index = 0;
+
+	if (count > 0) {
+		index = (traceHead + traceCapacity - traceCount) % traceCapacity;
+	}
+
+	for (uint32_t i = 0; i < count; i++) {
+		out[i] = traceBuffer[index];
+		index = (index + 1) % traceCapacity;
+	}
+
+	return count;
+}
+
+uint32_t QuadSpiTrace_overwritten(void)
+{
+	return traceOverwritten;
+}
+
+static QuadSpiTraceOpcode *QuadSpiTrace_opcode(QuadSpiTraceReport *report, uint8_t opcode)
+{
+	QuadSpiTraceOpcode *entry = NULL;
+
+	for (uint32_t i = 0; (entry == NULL) && (i < report->opcodeCount); i++) {
+		if (report->opcodes[i].opcode == opcode) {
+			entry = &report->opcodes[i];
+		}
+	}
+
+	if ((entry == NULL) && (report->opcodeCount < QUADSPI_TRACE_MAX_OPCODES)) {
+		entry = &report->opcodes[report->opcodeCount++];
+		entry->opcode = opcode;
+	}
+
+	return entry;
+}
+
+//! Opcodes that change the NAND data buffer, a following PAGE_DATA_READ is not redundant
+static bool QuadSpiTrace_touchesPageBuffer(uint8_t opcode)
+{
+	return (opcode == W25N01G_INSTR_PROGRAM_DATA_LOAD) ||
+			(opcode == W25N01G_INSTR_RANDOM_PROGRAM_DATA_LOAD) ||
+			(opcode == W25N01G_INSTR_QUAD_PROGRAM_DATA_LOAD) ||
+			(opcode == W25N01G_INSTR_QUAD_RANDOM_PROGRAM_DATA_LOAD) ||
+			(opcode == W25N01G_INSTR_PROGRAM_EXECUTE) ||
+			(opcode == W25N01G_INSTR_BLOCK_ERASE) ||
+			(opcode == W25N01G_INSTR_DEVICE_RESET);
+}
+
+void QuadSpiTrace_analyze(const QuadSpiTraceRecord *records, uint32_t count, QuadSpiTraceReport *report)
+{
+	bool pageLoaded = false;
+	uint32_t loadedPage = 0;
+	bool writeEnabled = false;
+	bool previousWasPoll = false;
+
+	memset(report, 0, sizeof(*report));
+
+	for (uint32_t i = 0; i < count; i++) {
+		const QuadSpiTraceRecord *record = &records[i];
+		uint8_t opcode = record->instruction;
+		QuadSpiTraceOpcode *entry = QuadSpiTrace_opcode(report, opcode);
+		bool poll = FLASH_STATS_IS_STATUS_READ(opcode);
+
+		report->records++;
+		report->duration += record->duration;
+
+		if (entry != NULL) {
+			entry->count++;
+			entry->bytes += record->length;
+			entry->duration += record->duration;
+		} else {
+			report->droppedOpcodes++;
+		}
+
+		if (record->result != FLASH_STATS_OK) {
+			report->failures++;
+		}
+
+		if (poll) {
+			report->statusPolls++;
+			if (previousWasPoll) {
+				report->wastedPolls++;
+			}
+		} else if (opcode == W25N01G_INSTR_WRITE_ENABLE) {
+			if (writeEnabled) {
+				report->redundantWriteEnables++;
+			}
+			writeEnabled = true;
+		} else {
+			writeEnabled = false;
+		}
+
+		if (opcode == W25N01G_INSTR_PAGE_DATA_READ) {
+			if (pageLoaded && (loadedPage == record->address)) {
+				report->redundantPageReads++;
+			}
+			pageLoaded = (record->result == FLASH_STATS_OK);
+			loadedPage = record->address;
+		} else if (QuadSpiTrace_touchesPageBuffer(opcode)) {
+			pageLoaded = false;
+		}
+
+		previousWasPoll = poll;
+	}
+}
+
+static void QuadSpiTrace_unpack(const QuadSpiTraceRecord *record, QSPI_CommandTypeDef *cmd)
+{
+	uint32_t modes = record->modes;
+
+	memset(cmd, 0, sizeof(*cmd));
+
+	cmd->Instruction		= record->instruction;
+	cmd->Address			= record->address;
+	cmd->NbData				= record->length;
+	cmd->DummyCycles		= record->dummyCycles;
+	cmd->InstructionMode	= QUADSPI_TRACE_MODE_INSTRUCTION(modes) << 8;
+	cmd->AddressMode		= QUADSPI_TRACE_MODE_ADDRESS(modes) << 10;
+	cmd->AddressSize		= QUADSPI_TRACE_MODE_ADDRESS_SIZE(modes) << 12;
+	cmd->AlternateByteMode	= QUADSPI_TRACE_MODE_ALTERNATE(modes) << 14;
+	cmd->DataMode			= QUADSPI_TRACE_MODE_DATA(modes) << 24;
+	cmd->DdrMode			= (modes & QUADSPI_TRACE_MODE_DDR) ? QSPI_DDR_MODE_ENABLE : QSPI_DDR_MODE_DISABLE;
+	cmd->DdrHoldHalfCycle	= QSPI_DDR_HHC_ANALOG_DELAY;
+	cmd->SIOOMode			= (modes & QUADSPI_TRACE_MODE_SIOO) ? QSPI_SIOO_INST_ONLY_FIRST_CMD : QSPI_SIOO_INST_EVERY_CMD;
+}
+
+//! Status read holding BUSY in bit 0, status register 1 on W25Q and the status register on W25N01G
+static bool QuadSpiTrace_isBusyRead(const QuadSpiTraceRecord *record)
+{
+	bool addressed = (QUADSPI_TRACE_MODE_ADDRESS(record->modes) != 0);
+
+	return ((record->instruction == W25N01G_INSTR_READ_STATUS_REG) || (record->instruction == W25N01G_INSTR_READ_STATUS_ALTERNATE_REG)) &&
+			(!addressed || (record->address == W25N01G_STAT_REG));
+}
+
+uint32_t QuadSpiTrace_replay(QSPI_HandleTypeDef *hqspi, const QuadSpiTraceRecord *records, uint32_t count,
+		uint8_t *scratch, uint32_t scratchSize, QuadSpiTraceRecord *out, QuadSpiTraceClock clock)
+{
+	uint32_t replayed = 0;
+	QSPI_CommandTypeDef cmd;
+
+	QuadSpiTrace_start(out, count, clock);
+
+	for (uint32_t i = 0; i < count; i++) {
+		const QuadSpiTraceRecord *record = &records[i];
+		bool lastPoll = QuadSpiTrace_isBusyRead(record) &&
+				(((i + 1) == count) || !FLASH_STATS_IS_STATUS_READ(records[i + 1].instruction));
+
+		if (record->length > scratchSize) {
+			continue;
+		}
+
+		QuadSpiTrace_unpack(record, &cmd);
+
+		// The driver went on once the part was ready, a single read could still see it busy here
+		if (lastPoll) {
+			QuadSpiAutoPoll(hqspi, &cmd, W25N01G_STATUS_FLAG_BUSY, 0, QUADSPI_TRACE_REPLAY_TIMEOUT_MS);
+		} else if (cmd.DataMode == QSPI_DATA_NONE) {
+			QuadSpiSendCommand(hqspi, &cmd);
+		} else if (record->modes & QUADSPI_TRACE_MODE_WRITE) {
+			QuadSpiTransmitCommand(hqspi, &cmd, scratch);
+		} else {
+			QuadSpiReceiveCommand(hqspi, &cmd, scratch);
+		}
+
+		replayed++;
+	}
+
+	QuadSpiTrace_stop();
+
+	return replayed;
+}
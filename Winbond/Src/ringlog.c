@@ -0,0 +1,624 @@
+/*
+ * This program is append-only ring log for W25N01G NAND flash.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+
+#include "ringlog.h"
+
+#define RING_LOG_WORD(block)	((block) / 32)
+#define RING_LOG_BIT(block)		(1u << ((block) % 32))
+
+static void RingLog_putWord(uint8_t *out, uint32_t value)
+{
+	out[0] = (uint8_t)value;
+	out[1] = (uint8_t)(value >> 8);
+	out[2] = (uint8_t)(value >> 16);
+	out[3] = (uint8_t)(value >> 24);
+}
+
+static uint32_t RingLog_getWord(const uint8_t *in)
+{
+	return (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+void RingLog_encodeTags(uint8_t *tags, uint32_t sequence, uint32_t lengthWord)
+{
+	// The bytes between the two words are left erased
+	memset(tags, 0xFF, RING_LOG_TAGS_SIZE);
+	RingLog_putWord(&tags[0], sequence);
+	RingLog_putWord(&tags[RING_LOG_SPARE_LENGTH - RING_LOG_SPARE_SEQUENCE], lengthWord);
+}
+
+void RingLog_decodeTags(const uint8_t *tags, uint32_t *sequence, uint32_t *lengthWord)
+{
+	*sequence = RingLog_getWord(&tags[0]);
+	*lengthWord = RingLog_getWord(&tags[RING_LOG_SPARE_LENGTH - RING_LOG_SPARE_SEQUENCE]);
+}
+
+static uint32_t RingLog_absolutePage(const RingLog *log, uint32_t block, uint32_t page)
+{
+	return ((log->firstBlock + block) * log->pagesPerBlock) + page;
+}
+
+static bool RingLog_isBad(RingLog *log, uint32_t block)
+{
+	uint32_t word = RING_LOG_WORD(block);
+	uint32_t bit = RING_LOG_BIT(block);
+
+	// Factory markers are read once per block and cached
+	if ((log->badKnown[word] & bit) == 0) {
+		if (log->io->isBlockBad(log->io->context, log->firstBlock + block)) {
+			log->bad[word] |= bit;
+		}
+		log->badKnown[word] |= bit;
+	}
+
+	return ((log->bad[word] & bit) != 0);
+}
+
+static void RingLog_retire(RingLog *log, uint32_t block)
+{
+	log->io->markBlockBad(log->io->context, log->firstBlock + block);
+	log->bad[RING_LOG_WORD(block)] |= RING_LOG_BIT(block);
+	log->badKnown[RING_LOG_WORD(block)] |= RING_LOG_BIT(block);
+	log->stats.blocksRetired++;
+}
+
+//! Next good block after block, wrapping at the end of the region
+static uint32_t RingLog_nextGood(RingLog *log, uint32_t block)
+{
+	uint32_t next = RING_LOG_NONE;
+
+	for (uint32_t i = 1; (next == RING_LOG_NONE) && (i <= log->blockCount); i++) {
+		uint32_t candidate = (block + i) % log->blockCount;
+
+		if (!RingLog_isBad(log, candidate)) {
+			next = candidate;
+		}
+	}
+
+	return next;
+}
+
+static uint32_t RingLog_sequence(RingLog *log, uint32_t block, uint32_t page)
+{
+	uint32_t sequence = RING_LOG_ERASED;
+	uint32_t lengthWord;
+
+	if (!log->io->readTags(log->io->context, RingLog_absolutePage(log, block, page), &sequence, &lengthWord)) {
+		sequence = RING_LOG_ERASED;
+	}
+
+	return sequence;
+}
+
+bool RingLog_open(RingLog *log, const RingLogIo *io, uint32_t firstBlock, uint32_t blockCount)
+{
+	uint32_t first = RING_LOG_NONE;
+	uint32_t firstSequence = 0;
+
+	memset(log, 0, sizeof(*log));
+	log->io				= io;
+	log->firstBlock		= firstBlock;
+	log->blockCount		= blockCount;
+	log->pageSize		= io->pageSize;
+	log->pagesPerBlock	= io->pagesPerBlock;
+	log->erasedBlock	= RING_LOG_NONE;
+	log->tailBlock		= RING_LOG_NONE;
+	log->busy			= RING_LOG_IDLE;
+
+	// An empty log looks like a full last block, so the first erase lands on the first good block
+	log->headBlock		= blockCount - 1;
+	log->headPage		= io->pagesPerBlock;
+
+	// The page lengths in the tags are 16 bits, the region may not run past the device
+	if ((io->pageSize == 0) || (io->pageSize > RING_LOG_MAX_PAGE_SIZE) || (io->pagesPerBlock == 0) ||
+			(blockCount < 2) || (blockCount > RING_LOG_MAX_BLOCKS) ||
+			(firstBlock >= io->totalBlocks) || (blockCount > (io->totalBlocks - firstBlock))) {
+		return false;
+	}
+
+	// Oldest block of the newest run, only the erased-ahead block and bad blocks can come before it
+	for (uint32_t block = 0; (first == RING_LOG_NONE) && (block < blockCount); block++) {
+		if (!RingLog_isBad(log, block)) {
+			uint32_t sequence = RingLog_sequence(log, block, 0);
+
+			if (sequence != RING_LOG_ERASED) {
+				first = block;
+				firstSequence = sequence;
+			}
+		}
+	}
+
+	if (first == RING_LOG_NONE) {
+		return true;
+	}
+
+	// Blocks from first up to the head carry rising sequences, anything after is erased or older
+	uint32_t head = first;
+	uint32_t low = first;
+	uint32_t high = blockCount;
+
+	while ((high - low) > 1) {
+		uint32_t mid = low + ((high - low) / 2);
+		uint32_t probe = mid;
+
+		while ((probe > low) && RingLog_isBad(log, probe)) {
+			probe--;
+		}
+
+		if (probe == low) {
+			low = mid;
+		} else {
+			uint32_t sequence = RingLog_sequence(log, probe, 0);
+
+			if ((sequence != RING_LOG_ERASED) && (sequence >= firstSequence)) {
+				low = mid;
+				head = probe;
+			} else {
+				high = probe;
+			}
+		}
+	}
+
+	uint32_t lowPage = 0;
+	uint32_t highPage = log->pagesPerBlock;
+
+	while ((highPage - lowPage) > 1) {
+		uint32_t mid = lowPage + ((highPage - lowPage) / 2);
+
+		if (RingLog_sequence(log, head, mid) != RING_LOG_ERASED) {
+			lowPage = mid;
+		} else {
+			highPage = mid;
+		}
+	}
+
+	log->headBlock		= head;
+	log->headPage		= lowPage + 1;
+	log->nextSequence	= RingLog_sequence(log, head, lowPage) + 1;
+	log->tailBlock		= first;
+
+	// Data in the last good block means the log has wrapped, the oldest block follows the erased one
+	uint32_t last = blockCount - 1;
+
+	while ((last > head) && RingLog_isBad(log, last)) {
+		last--;
+	}
+
+	if ((last != head) && (RingLog_sequence(log, last, 0) != RING_LOG_ERASED)) {
+		uint32_t block = RingLog_nextGood(log, head);
+
+		while ((block != head) && (RingLog_sequence(log, block, 0) == RING_LOG_ERASED)) {
+			block = RingLog_nextGood(log, block);
+		}
+
+		log->tailBlock = block;
+	}
+
+	return true;
+}
+
+static void RingLog_startProgram(RingLog *log)
+{
+	uint8_t index = log->oldest;
+	uint32_t page = RingLog_absolutePage(log, log->headBlock, log->headPage);
+
+	if (log->io->startProgram(log->io->context, page, log->page[index], log->nextSequence, RING_LOG_LENGTH_WORD(log->length[index]))) {
+		log->busy = RING_LOG_PROGRAMMING;
+	} else {
+		log->failed = true;
+	}
+}
+
+static void RingLog_startErase(RingLog *log)
+{
+	uint32_t target = RingLog_nextGood(log, log->headBlock);
+
+	if ((target == RING_LOG_NONE) || (target == log->headBlock)) {
+		log->failed = true;			// Fewer than two good blocks left
+	} else {
+		if (target == log->tailBlock) {
+			log->tailBlock = RingLog_nextGood(log, target);
+			log->stats.blocksOverwritten++;
+		}
+
+		if (log->io->startErase(log->io->context, log->firstBlock + target)) {
+			log->busy = RING_LOG_ERASING;
+			log->busyBlock = target;
+		} else {
+			log->failed = true;
+		}
+	}
+}
+
+static void RingLog_complete(RingLog *log, bool failed)
+{
+	if (log->busy == RING_LOG_PROGRAMMING) {
+		if (failed) {
+			// The page stays queued and goes to the erased block, what this block held is lost
+			RingLog_retire(log, log->headBlock);
+			if (log->tailBlock == log->headBlock) {
+				log->tailBlock = RING_LOG_NONE;
+			}
+			log->headPage = log->pagesPerBlock;
+		} else {
+			if (log->tailBlock == RING_LOG_NONE) {
+				log->tailBlock = log->headBlock;
+			}
+			log->headPage++;
+			log->nextSequence++;
+			log->oldest = (log->oldest + 1) % RING_LOG_BUFFERS;
+			log->pending--;
+			log->stats.pagesProgrammed++;
+		}
+	} else {
+		if (failed) {
+			RingLog_retire(log, log->busyBlock);
+		} else {
+			log->erasedBlock = log->busyBlock;
+			log->stats.blocksErased++;
+		}
+	}
+
+	log->busy = RING_LOG_IDLE;
+}
+
+static void RingLog_step(RingLog *log)
+{
+	if (log->busy != RING_LOG_IDLE) {
+		bool busy = true;
+		bool failed = false;
+
+		if (!log->io->poll(log->io->context, &busy, &failed)) {
+			log->failed = true;
+		} else if (!busy) {
+			RingLog_complete(log, failed);
+		}
+	}
+
+	if (log->failed || (log->busy != RING_LOG_IDLE)) {
+		return;
+	}
+
+	if ((log->headPage >= log->pagesPerBlock) && (log->erasedBlock != RING_LOG_NONE)) {
+		log->headBlock = log->erasedBlock;
+		log->headPage = 0;
+		log->erasedBlock = RING_LOG_NONE;
+	}
+
+	// Programs go first, erasing the next block fits in the time it takes to fill this one
+	if ((log->pending > 0) && (log->headPage < log->pagesPerBlock)) {
+		RingLog_startProgram(log);
+	} else if (log->erasedBlock == RING_LOG_NONE) {
+		RingLog_startErase(log);
+	}
+}
+
+bool RingLog_append(RingLog *log, const uint8_t *data, uint32_t length)
+{
+	bool stalled = false;
+
+	while (!log->failed && (length > 0)) {
+		if (log->pending == RING_LOG_BUFFERS) {
+			stalled = true;
+			RingLog_step(log);
+		} else {
+			uint8_t index = (log->oldest + log->pending) % RING_LOG_BUFFERS;
+			uint32_t chunk = log->pageSize - log->fill;
+
+			if (chunk > length) {
+				chunk = length;
+			}
+
+			memcpy(&log->page[index][log->fill], data, chunk);
+			log->fill += chunk;
+			data += chunk;
+			length -= chunk;
+			log->stats.bytesAppended += chunk;
+
+			if (log->fill == log->pageSize) {
+				log->length[index] = (uint16_t)log->pageSize;
+				log->pending++;
+				log->fill = 0;
+			}
+		}
+	}
+
+	if (stalled) {
+		log->stats.appendStalls++;
+	}
+
+	if (!log->failed) {
+		RingLog_step(log);
+	}
+
+	return !log->failed;
+}
+
+bool RingLog_poll(RingLog *log)
+{
+	if (!log->failed) {
+		RingLog_step(log);
+	}
+
+	return !log->failed;
+}
+
+bool RingLog_flush(RingLog *log)
+{
+	while (!log->failed && (log->fill > 0) && (log->pending == RING_LOG_BUFFERS)) {
+		RingLog_step(log);
+	}
+
+	if (!log->failed && (log->fill > 0)) {
+		uint8_t index = (log->oldest + log->pending) % RING_LOG_BUFFERS;
+
+		memset(&log->page[index][log->fill], 0xFF, log->pageSize - log->fill);
+		log->length[index] = (uint16_t)log->fill;
+		log->pending++;
+		log->fill = 0;
+		log->stats.partialPages++;
+	}
+
+	while (!log->failed && ((log->pending > 0) || (log->busy != RING_LOG_IDLE) || (log->erasedBlock == RING_LOG_NONE))) {
+		RingLog_step(log);
+	}
+
+	return !log->failed;
+}
+
+bool RingLog_isEmpty(const RingLog *log)
+{
+	return (log->tailBlock == RING_LOG_NONE);
+}
+
+static void RingLog_readerRewind(RingLog *log, RingLogReader *reader)
+{
+	reader->block		= log->tailBlock;
+	reader->page		= 0;
+	reader->offset		= 0;
+	reader->pageLength	= 0;
+
+	if (log->tailBlock != RING_LOG_NONE) {
+		uint32_t sequence = RingLog_sequence(log, log->tailBlock, 0);
+
+		if ((sequence != RING_LOG_ERASED) && (sequence > reader->sequence)) {
+			reader->lostPages += sequence - reader->sequence;
+			reader->sequence = sequence;
+		}
+	}
+}
+
+void RingLog_readerInit(RingLog *log, RingLogReader *reader)
+{
+	memset(reader, 0, sizeof(*reader));
+	reader->block = RING_LOG_NONE;
+
+	if (log->tailBlock != RING_LOG_NONE) {
+		reader->sequence = RingLog_sequence(log, log->tailBlock, 0);
+		RingLog_readerRewind(log, reader);
+	}
+}
+
+uint32_t RingLog_read(RingLog *log, RingLogReader *reader, uint8_t *buffer, uint32_t length)
+{
+	uint32_t copied = 0;
+	bool stop = false;
+
+	while (!stop && (copied < length)) {
+		if (reader->block == RING_LOG_NONE) {
+			RingLog_readerRewind(log, reader);
+			stop = (reader->block == RING_LOG_NONE);
+		} else if ((reader->block == log->headBlock) && (reader->page >= log->headPage)) {
+			stop = true;			// Caught up with the programmed pages
+		} else if (reader->page >= log->pagesPerBlock) {
+			reader->block = RingLog_nextGood(log, reader->block);
+			reader->page = 0;
+		} else if (reader->pageLength == 0) {
+			uint32_t page = RingLog_absolutePage(log, reader->block, reader->page);
+			uint32_t sequence;
+			uint32_t lengthWord;
+
+			if (!log->io->readTags(log->io->context, page, &sequence, &lengthWord)) {
+				stop = true;
+			} else if ((sequence == RING_LOG_ERASED) || (sequence < reader->sequence)) {
+				// Erased or rewritten under the reader, continue from the oldest page
+				reader->block = RING_LOG_NONE;
+			} else {
+				// A jump forward means pages were lost with a retired block
+				reader->lostPages += sequence - reader->sequence;
+				reader->sequence = sequence;
+
+				if ((lengthWord != RING_LOG_LENGTH_WORD(lengthWord)) || ((lengthWord & 0xFFFFu) == 0) ||
+						((lengthWord & 0xFFFFu) > log->pageSize)) {
+					reader->lostPages++;
+					reader->sequence++;
+					reader->page++;
+				} else {
+					reader->pageLength = lengthWord & 0xFFFFu;
+				}
+			}
+		} else {
+			uint32_t chunk = reader->pageLength - reader->offset;
+			uint32_t page = RingLog_absolutePage(log, reader->block, reader->page);
+
+			if (chunk > (length - copied)) {
+				chunk = length - copied;
+			}
+
+			if (!log->io->readData(log->io->context, page, reader->offset, &buffer[copied], chunk)) {
+				stop = true;
+			} else {
+				copied += chunk;
+				reader->offset += chunk;
+
+				if (reader->offset == reader->pageLength) {
+					reader->page++;
+					reader->offset = 0;
+					reader->pageLength = 0;
+					reader->sequence++;
+				}
+			}
+		}
+	}
+
+	return copied;
+}
+
+#ifndef FLASH_HOST_BUILD
+#include "w25n01g.h"
+
+static uint8_t ringLogW25n01gDie = 0;		//!< Die of the last program or erase, the one poll() asks
+
+static uint8_t RingLog_w25n01gDieOf(uint32_t page)
+{
+	const FlashDevice *device = W25n01g_getDevice();
+
+	return (uint8_t)FlashDevice_addressToDie(device, FlashDevice_pageToAddress(device, page));
+}
+
+//! Selects the die holding an absolute page, the page commands then take its number inside the die
+static bool RingLog_w25n01gSelectPage(QSPI_HandleTypeDef *hqspi, uint32_t page, uint32_t *diePage)
+{
+	const FlashDevice *device = W25n01g_getDevice();
+
+	*diePage = FlashDevice_addressToDiePage(device, FlashDevice_pageToAddress(device, page));
+
+	return W25n01g_selectDie(hqspi, RingLog_w25n01gDieOf(page));
+}
+
+static bool RingLog_w25n01gReadData(void *context, uint32_t page, uint32_t column, uint8_t *buffer, uint32_t length)
+{
+	QSPI_HandleTypeDef *hqspi = (QSPI_HandleTypeDef *)context;
+	uint32_t diePage;
+
+	return RingLog_w25n01gSelectPage(hqspi, page, &diePage) && W25n01g_readPageData(hqspi, diePage, (uint16_t)column, buffer, length);
+}
+
+static bool RingLog_w25n01gReadTags(void *context, uint32_t page, uint32_t *sequence, uint32_t *lengthWord)
+{
+	QSPI_HandleTypeDef *hqspi = (QSPI_HandleTypeDef *)context;
+	uint8_t tags[RING_LOG_TAGS_SIZE];
+	uint32_t diePage;
+
+	bool success = RingLog_w25n01gSelectPage(hqspi, page, &diePage) &&
+			W25n01g_readPageData(hqspi, diePage, (uint16_t)(FlashDevice_pageSize(W25n01g_getDevice()) + RING_LOG_SPARE_SEQUENCE), tags, sizeof(tags));
+
+	RingLog_decodeTags(tags, sequence, lengthWord);
+
+	return success;
+}
+
+static bool RingLog_w25n01gStartProgram(void *context, uint32_t page, const uint8_t *data, uint32_t sequence, uint32_t lengthWord)
+{
+	QSPI_HandleTypeDef *hqspi = (QSPI_HandleTypeDef *)context;
+	uint16_t pageSize = (uint16_t)FlashDevice_pageSize(W25n01g_getDevice());
+	uint8_t tags[RING_LOG_TAGS_SIZE];
+	uint32_t diePage;
+
+	// The page goes over four lines, the spare tags are short enough for one
+	bool success = RingLog_w25n01gSelectPage(hqspi, page, &diePage) && W25n01g_quadProgramDataLoad(hqspi, 0, data, pageSize);
+
+	RingLog_encodeTags(tags, sequence, lengthWord);
+
+	if (success) {
+		success = W25n01g_randomProgramDataLoad(hqspi, pageSize + RING_LOG_SPARE_SEQUENCE, tags, 4);
+	}
+
+	if (success) {
+		success = W25n01g_randomProgramDataLoad(hqspi, pageSize + RING_LOG_SPARE_LENGTH,
+				&tags[RING_LOG_SPARE_LENGTH - RING_LOG_SPARE_SEQUENCE], 4);
+	}
+
+	if (success) {
+		ringLogW25n01gDie = RingLog_w25n01gDieOf(page);
+		success = W25n01g_startProgramExecute(hqspi, diePage);
+	}
+
+	return success;
+}
+
+static bool RingLog_w25n01gStartErase(void *context, uint32_t block)
+{
+	const FlashDevice *device = W25n01g_getDevice();
+
+	// The linear address selects the die itself
+	ringLogW25n01gDie = RingLog_w25n01gDieOf(FlashDevice_blockToPage(device, block));
+
+	return W25n01g_blockErase((QSPI_HandleTypeDef *)context, FlashDevice_pageToAddress(device, FlashDevice_blockToPage(device, block)));
+}
+
+static bool RingLog_w25n01gPoll(void *context, bool *busy, bool *failed)
+{
+	QSPI_HandleTypeDef *hqspi = (QSPI_HandleTypeDef *)context;
+
+	// Reads in between may have moved to the other die of a stacked part
+	bool success = W25n01g_selectDie(hqspi, ringLogW25n01gDie);
+	uint8_t status = W25n01g_readStatusRegister(hqspi, W25N01G_STAT_REG);
+
+	*busy = ((status & W25N01G_STATUS_FLAG_BUSY) != 0);
+	*failed = ((status & (W25N01G_STATUS_PROGRAM_FAIL | W25N01G_STATUS_ERASE_FAIL)) != 0);
+
+	return success;
+}
+
+static bool RingLog_w25n01gIsBlockBad(void *context, uint32_t block)
+{
+	return W25n01g_isBlockBad((QSPI_HandleTypeDef *)context, block);
+}
+
+static bool RingLog_w25n01gMarkBlockBad(void *context, uint32_t block)
+{
+	QSPI_HandleTypeDef *hqspi = (QSPI_HandleTypeDef *)context;
+	const FlashDevice *device = W25n01g_getDevice();
+	uint8_t marker = 0x00;
+	uint32_t diePage;
+
+	bool success = RingLog_w25n01gSelectPage(hqspi, FlashDevice_blockToPage(device, block), &diePage) &&
+			W25n01g_programDataLoad(hqspi, (uint16_t)(FlashDevice_pageSize(device) + RING_LOG_SPARE_BAD_BLOCK), &marker, sizeof(marker));
+
+	if (success) {
+		success = W25n01g_startProgramExecute(hqspi, diePage) && W25n01g_waitForReady(hqspi);
+	}
+
+	return success;
+}
+
+void RingLog_w25n01gIo(RingLogIo *io, QSPI_HandleTypeDef *hqspi)
+{
+	const FlashDevice *device = W25n01g_getDevice();
+
+	io->readData		= RingLog_w25n01gReadData;
+	io->readTags		= RingLog_w25n01gReadTags;
+	io->startProgram	= RingLog_w25n01gStartProgram;
+	io->startErase		= RingLog_w25n01gStartErase;
+	io->poll			= RingLog_w25n01gPoll;
+	io->isBlockBad		= RingLog_w25n01gIsBlockBad;
+	io->markBlockBad	= RingLog_w25n01gMarkBlockBad;
+	io->context			= hqspi;
+
+	// No part found leaves a geometry open refuses
+	io->pageSize		= (device != NULL) ? FlashDevice_pageSize(device) : 0;
+	io->pagesPerBlock	= (device != NULL) ? FlashDevice_blockToPage(device, 1) : 0;
+	io->totalBlocks		= (device != NULL) ? FlashDevice_totalBlocks(device) : 0;
+}
+#endif
@@ -0,0 +1,223 @@
+/*
+ * This program is JEDEC SFDP (JESD216) parser for Serial flash memories.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sfdp.h"
+#include "quadspi.h"
+
+#define SFDP_HEADER_SIZE				8
+#define SFDP_PARAMETER_HEADER_SIZE		8
+#define SFDP_BASIC_TABLE_MIN_DWORDS		9	//!< JESD216 original revision
+#define SFDP_BASIC_TABLE_TIMING_DWORDS	11	//!< JESD216A adds erase/program timing and page size
+
+#define SFDP_BITS(value, high, low)		(((value) >> (low)) & ((1u << ((high) - (low) + 1u)) - 1u))
+#define SFDP_DWORD(dwords, n)			((dwords)[(n) - 1])	//!< The standard numbers DWORDs from 1
+
+static uint32_t Sfdp_le32(const uint8_t *data)
+{
+	return ((uint32_t)data[0]) | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static bool Sfdp_readBytes(QSPI_HandleTypeDef *hqspi, uint32_t address, uint8_t *buffer, uint32_t length)
+{
+	return QuadSpiReceiveWithAddress1Line(
+			hqspi,
+			SFDP_INSTR_READ,
+			SFDP_DUMMY_CYCLES,
+			address,
+			QSPI_ADDRESS_24_BITS,
+			buffer,
+			length
+			);
+}
+
+static void Sfdp_parseReadCommand(SfdpReadCommand *read, bool supported, uint32_t field)
+{
+	// field: [4:0] wait states, [7:5] mode clocks, [15:8] instruction
+	read->supported		= supported;
+	read->dummyCycles	= (uint8_t)(SFDP_BITS(field, 4, 0) + SFDP_BITS(field, 7, 5));
+	read->instruction	= (uint8_t)SFDP_BITS(field, 15, 8);
+}
+
+static uint32_t Sfdp_eraseTimeMs(uint32_t field)
+{
+	static const uint32_t unitMs[4] = { 1, 16, 128, 1000 };
+	return (SFDP_BITS(field, 4, 0) + 1u) * unitMs[SFDP_BITS(field, 6, 5)];
+}
+
+static uint32_t Sfdp_chipEraseTimeMs(uint32_t field)
+{
+	static const uint32_t unitMs[4] = { 16, 256, 4000, 64000 };
+	return (SFDP_BITS(field, 4, 0) + 1u) * unitMs[SFDP_BITS(field, 6, 5)];
+}
+
+bool Sfdp_parseBasicTable(const uint32_t *dwords, uint32_t count, SfdpParameters *params)
+{
+	if (count < SFDP_BASIC_TABLE_MIN_DWORDS) {
+		return false;
+	}
+
+	uint32_t dword1 = SFDP_DWORD(dwords, 1);
+	uint32_t dword2 = SFDP_DWORD(dwords, 2);
+
+	// Density is in bits, either N-1 or 2^N
+	if (dword2 & (1u << 31)) {
+		uint32_t exponent = dword2 & 0x7FFFFFFFu;
+		if ((exponent < 3) || (exponent > 34)) {
+			return false;
+		}
+		params->density = 1u << (exponent - 3);
+	} else {
+		params->density = (dword2 >> 3) + 1u;
+	}
+
+	params->addressBytes = (SfdpAddressBytes)SFDP_BITS(dword1, 18, 17);
+	params->dtrSupported = (SFDP_BITS(dword1, 19, 19) != 0);
+
+	params->read[SFDP_READ_1_1_1].supported		= true;
+	params->read[SFDP_READ_1_1_1].instruction	= SFDP_INSTR_FAST_READ;
+	params->read[SFDP_READ_1_1_1].dummyCycles	= SFDP_DUMMY_CYCLES_FAST_READ;
+	Sfdp_parseReadCommand(&params->read[SFDP_READ_1_4_4], SFDP_BITS(dword1, 21, 21), SFDP_BITS(SFDP_DWORD(dwords, 3), 15, 0));
+	Sfdp_parseReadCommand(&params->read[SFDP_READ_1_1_4], SFDP_BITS(dword1, 22, 22), SFDP_BITS(SFDP_DWORD(dwords, 3), 31, 16));
+	Sfdp_parseReadCommand(&params->read[SFDP_READ_4_4_4], SFDP_BITS(SFDP_DWORD(dwords, 5), 4, 4), SFDP_BITS(SFDP_DWORD(dwords, 7), 31, 16));
+
+	for (uint32_t i = 0; i < SFDP_ERASE_TYPES; i++) {
+		uint32_t field = SFDP_BITS(SFDP_DWORD(dwords, 8 + (i / 2)), ((i % 2) * 16) + 15, (i % 2) * 16);
+		uint32_t sizeExponent = SFDP_BITS(field, 7, 0);
+
+		params->erase[i].size			= (sizeExponent != 0 && sizeExponent < 32) ? (1u << sizeExponent) : 0;
+		params->erase[i].instruction	= (uint8_t)SFDP_BITS(field, 15, 8);
+		params->erase[i].typicalMs		= 0;
+		params->erase[i].maxMs			= 0;
+	}
+
+	// Conservative defaults, only reachable on pre-JESD216A tables
+	params->pageSize				= 256;
+	params->pageProgramTypicalUs	= 0;
+	params->pageProgramMaxUs		= 0;
+	params->chipEraseTypicalMs		= 0;
+	params->chipEraseMaxMs			= 0;
+
+	if (count >= SFDP_BASIC_TABLE_TIMING_DWORDS) {
+		uint32_t dword10 = SFDP_DWORD(dwords, 10);
+		uint32_t dword11 = SFDP_DWORD(dwords, 11);
+		uint32_t eraseMultiplier = 2u * (SFDP_BITS(dword10, 3, 0) + 1u);
+		uint32_t programMultiplier = 2u * (SFDP_BITS(dword11, 3, 0) + 1u);
+
+		for (uint32_t i = 0; i < SFDP_ERASE_TYPES; i++) {
+			uint32_t low = 4u + (i * 7u);
+			params->erase[i].typicalMs	= Sfdp_eraseTimeMs(SFDP_BITS(dword10, low + 6u, low));
+			params->erase[i].maxMs		= params->erase[i].typicalMs * eraseMultiplier;
+		}
+
+		params->pageSize				= 1u << SFDP_BITS(dword11, 7, 4);
+		params->pageProgramTypicalUs	= (SFDP_BITS(dword11, 12, 8) + 1u) * (SFDP_BITS(dword11, 13, 13) ? 64u : 8u);
+		params->pageProgramMaxUs		= params->pageProgramTypicalUs * programMultiplier;
+		params->chipEraseTypicalMs		= Sfdp_chipEraseTimeMs(SFDP_BITS(dword11, 30, 24));
+		params->chipEraseMaxMs			= params->chipEraseTypicalMs * eraseMultiplier;
+	}
+
+	return true;
+}
+
+bool Sfdp_read(QSPI_HandleTypeDef *hqspi, SfdpParameters *params)
+{
+	uint8_t buffer[SFDP_BASIC_TABLE_MAX_DWORDS * 4];
+	uint32_t dwords[SFDP_BASIC_TABLE_MAX_DWORDS];
+	uint32_t tableAddress = 0;
+	uint32_t tableLength = 0;
+
+	bool success = Sfdp_readBytes(hqspi, 0, buffer, SFDP_HEADER_SIZE);
+
+	if (success && (Sfdp_le32(buffer) != SFDP_SIGNATURE)) {
+		success = false;
+	}
+
+	if (success) {
+		params->minorRevision = buffer[4];
+		params->majorRevision = buffer[5];
+
+		uint32_t headerCount = (uint32_t)buffer[6] + 1u;
+		if (headerCount > SFDP_MAX_PARAMETER_HEADERS) {
+			headerCount = SFDP_MAX_PARAMETER_HEADERS;
+		}
+
+		success = Sfdp_readBytes(hqspi, SFDP_HEADER_SIZE, buffer, headerCount * SFDP_PARAMETER_HEADER_SIZE);
+
+		for (uint32_t i = 0; success && (tableLength == 0) && (i < headerCount); i++) {
+			const uint8_t *header = &buffer[i * SFDP_PARAMETER_HEADER_SIZE];
+			uint16_t id = (uint16_t)((header[7] << 8) | header[0]);
+
+			if (id == SFDP_BASIC_TABLE_ID) {
+				tableLength = header[3];
+				tableAddress = Sfdp_le32(&header[4]) & 0x00FFFFFFu;
+			}
+		}
+	}
+
+	if (success && (tableLength < SFDP_BASIC_TABLE_MIN_DWORDS)) {
+		success = false;
+	}
+
+	if (success) {
+		if (tableLength > SFDP_BASIC_TABLE_MAX_DWORDS) {
+			tableLength = SFDP_BASIC_TABLE_MAX_DWORDS;
+		}
+
+		success = Sfdp_readBytes(hqspi, tableAddress, buffer, tableLength * 4u);
+	}
+
+	if (success) {
+		for (uint32_t i = 0; i < tableLength; i++) {
+			dwords[i] = Sfdp_le32(&buffer[i * 4u]);
+		}
+
+		success = Sfdp_parseBasicTable(dwords, tableLength, params);
+	}
+
+	return success;
+}
+
+SfdpReadMode Sfdp_fastestReadMode(const SfdpParameters *params, bool allowQpi)
+{
+	// 4-4-4 needs the whole device in QPI mode, callers that only switch reads must skip it
+	static const SfdpReadMode preference[] = { SFDP_READ_4_4_4, SFDP_READ_1_4_4, SFDP_READ_1_1_4 };
+	SfdpReadMode mode = SFDP_READ_1_1_1;
+
+	for (uint32_t i = 0; (mode == SFDP_READ_1_1_1) && (i < sizeof(preference) / sizeof(preference[0])); i++) {
+		if (params->read[preference[i]].supported && (allowQpi || (preference[i] != SFDP_READ_4_4_4))) {
+			mode = preference[i];
+		}
+	}
+
+	return mode;
+}
+
+const SfdpEraseType *Sfdp_smallestEraseType(const SfdpParameters *params)
+{
+	const SfdpEraseType *smallest = NULL;
+
+	for (uint32_t i = 0; i < SFDP_ERASE_TYPES; i++) {
+		if ((params->erase[i].size != 0) && ((smallest == NULL) || (params->erase[i].size < smallest->size))) {
+			smallest = &params->erase[i];
+		}
+	}
+
+	return smallest;
+}
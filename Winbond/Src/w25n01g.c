@@ -21,93 +21,192 @@
 #include "w25n01g.h"
 #include "quadspi.h"
 
-#define W25N01G_LINEAR_TO_COLUMN(laddr) ((laddr) % W25N01G_PAGE_SIZE)
-#define W25N01G_LINEAR_TO_PAGE(laddr) (((laddr) / W25N01G_PAGE_SIZE) & 0xffff)
-#define W25N01G_LINEAR_TO_BLOCK(laddr) (W25N01G_LINEAR_TO_PAGE(laddr) / W25N01G_PAGES_PER_BLOCK)
-#define W25N01G_BLOCK_TO_PAGE(block) ((block) * W25N01G_PAGES_PER_BLOCK)
-#define W25N01G_BLOCK_TO_LINEAR(block) (W25N01G_BLOCK_TO_PAGE(block) * W25N01G_PAGE_SIZE)
+#define W25N01G_LINEAR_TO_COLUMN(laddr) FlashDevice_addressToColumn(W25n01g_getDevice(), laddr)
+#define W25N01G_LINEAR_TO_PAGE(laddr) FlashDevice_addressToDiePage(W25n01g_getDevice(), laddr)
+#define W25N01G_BLOCK_TO_PAGE(block) FlashDevice_blockToPage(W25n01g_getDevice(), block)
 
-static bool W25n01g_performCommandWithPageAddress(QSPI_HandleTypeDef *hqspi, uint8_t command, uint16_t pageAddress);
+static const uint8_t w25n01gDefaultId[3] = { FLASH_DEVICE_MANUFACTURER_WINBOND, 0xAA, 0x21 };
+static const FlashDevice *w25n01gDevice;
+static uint8_t w25n01gDie = 0;		//!< Die the part currently answers on, stacked W25M parts only
 
-void W25n01g_readJedec(QSPI_HandleTypeDef *hqspi, uint8_t* idBuffer) {
-	QuadSpiReceive1Line(hqspi, W25N01G_INSTR_JEDEC_ID, 8, idBuffer, 3);
+static bool W25n01g_performCommandWithPageAddress(QSPI_HandleTypeDef *hqspi, uint8_t command, uint32_t pageAddress);
+
+static inline void W25n01g_forgetLoadedPage(void)
+{
+	FlashDevice_setLoadedPage(FLASH_DEVICE_NO_LOADED_PAGE);
 }
 
-bool W25n01g_deviceRestart(QSPI_HandleTypeDef *hqspi)
+bool W25n01g_init(QSPI_HandleTypeDef *hqspi)
 {
-	W25n01g_waitForReady(hqspi);
-	bool success = true;
-	success = QuadSpiTransmit1Line(hqspi, W25N01G_INSTR_DEVICE_RESET, 0, NULL, 0);
+	bool success = false;
+	uint8_t buffer[3];
+	const FlashDevice *device;
+
+	W25n01g_readJedec(hqspi, buffer);
+	device = FlashDevice_identify(buffer);
+
+	// Page commands carry a 24-bit row address, larger dies would alias their lower half
+	if ((device != NULL) && (device->type == FLASH_DEVICE_TYPE_NAND) &&
+			((FlashDevice_capacityShift(device) - FlashDevice_pageShift(device)) <= W25N01G_STATUS_PAGE_ADDRESS_SIZE)) {
+		w25n01gDevice = device;
+		w25n01gDie = 0;
+		W25n01g_forgetLoadedPage();
+		FlashDevice_invalidateShadow(FLASH_DEVICE_TYPE_NAND);
+		FlashDevice_setBusyTimeout(FLASH_DEVICE_TYPE_NAND, W25N01G_BUSY_TIMEOUT_MS);
+		success = true;
+
+		// The part may still sit on another die from before an MCU reset
+		if (device->dieCount > 1) {
+			success = FlashDevice_selectDie(hqspi, 0);
+		}
+	}
+
 	return success;
 }
 
-bool W25n01g_writeEnable(QSPI_HandleTypeDef *hqspi)
+const FlashDevice *W25n01g_getDevice(void)
 {
-	uint8_t statusReg;
+	// Callers that never run W25n01g_init get the W25N01GV geometry
+	if (w25n01gDevice == NULL) {
+		w25n01gDevice = FlashDevice_identify(w25n01gDefaultId);
+	}
 
-	W25n01g_waitForReady(hqspi);
-	bool success = false;
-	success = QuadSpiTransmit1Line(hqspi, W25N01G_INSTR_WRITE_ENABLE, 0, NULL, 0);
+	return w25n01gDevice;
+}
 
-	if(success) {
-		statusReg = W25n01g_readStatusRegister(hqspi, W25N01G_STAT_REG);
+bool W25n01g_selectDie(QSPI_HandleTypeDef *hqspi, uint8_t die)
+{
+	bool success = true;
+	const FlashDevice *device = W25n01g_getDevice();
+
+	// Single die parts keep wrapping addresses past the end like before
+	if (device->dieCount <= 1) {
+		return true;
+	}
 
-		if(!(statusReg & W25N01G_STATUS_FLAG_WRITE_ENABLED)) {
-			success = false;
+	if (die >= device->dieCount) {
+		success = false;
+	} else if (die != w25n01gDie) {
+		success = FlashDevice_selectDie(hqspi, die);
+		if (success) {
+			w25n01gDie = die;
 		}
 	}
 
 	return success;
 }
 
+static bool W25n01g_selectAddressDie(QSPI_HandleTypeDef *hqspi, uint32_t address)
+{
+	return W25n01g_selectDie(hqspi, FlashDevice_addressToDie(W25n01g_getDevice(), address));
+}
+
+void W25n01g_readJedec(QSPI_HandleTypeDef *hqspi, uint8_t* idBuffer) {
+	FlashDevice_readJedec(hqspi, FLASH_DEVICE_TYPE_NAND, idBuffer);
+}
+
+bool W25n01g_deviceRestart(QSPI_HandleTypeDef *hqspi)
+{
+	bool success = W25n01g_waitForReady(hqspi) && QuadSpiTransmit1Line(hqspi, W25N01G_INSTR_DEVICE_RESET, 0, NULL, 0);
+	W25n01g_forgetLoadedPage();
+	FlashDevice_invalidateShadow(FLASH_DEVICE_TYPE_NAND);
+	return success;
+}
+
+bool W25n01g_writeEnable(QSPI_HandleTypeDef *hqspi)
+{
+	return FlashDevice_writeEnable(hqspi, FLASH_DEVICE_TYPE_NAND);
+}
+
 uint8_t W25n01g_readStatusRegister(QSPI_HandleTypeDef *hqspi, uint8_t reg)
 {
 	uint8_t buffer = 0xFF;
-	QuadSpiReceiveWithAddress1Line(hqspi, W25N01G_INSTR_READ_STATUS_REG, 0, reg, W25N01G_STATUS_REGISTER_SIZE, &buffer, sizeof(buffer));
+	QuadSpiReceiveWithAddress1Line(hqspi, W25N01G_INSTR_READ_STATUS_REG, 0, reg, QSPI_ADDRESS_8_BITS, &buffer, sizeof(buffer));
 
 	return buffer;
 }
 
-void W25n01g_waitForReady(QSPI_HandleTypeDef *hqspi)
+bool W25n01g_waitForReady(QSPI_HandleTypeDef *hqspi)
 {
-	uint8_t statusReg = W25n01g_readStatusRegister(hqspi, W25N01G_STAT_REG);
-	while (statusReg & W25N01G_STATUS_FLAG_BUSY) {
-		//HAL_Delay(1);
-		statusReg = W25n01g_readStatusRegister(hqspi, W25N01G_STAT_REG);
-	}
+	return FlashDevice_waitForReady(hqspi, FLASH_DEVICE_TYPE_NAND);
 }
 
 bool W25n01g_blockErase(QSPI_HandleTypeDef *hqspi, uint32_t address)
 {
 	bool success = true;
-	uint16_t pageAddress = W25N01G_LINEAR_TO_PAGE(address) & 0xffff;
+	uint32_t pageAddress = W25N01G_LINEAR_TO_PAGE(address);
 
-	success = W25n01g_writeEnable(hqspi);
+	success = W25n01g_selectAddressDie(hqspi, address);
+
+	if(success) {
+		success = W25n01g_writeEnable(hqspi);
+	}
 
 	if(success) {
-		W25n01g_waitForReady(hqspi);
+		FlashDevice_strictWaitForReady(hqspi, FLASH_DEVICE_TYPE_NAND);
 		//in data sheet is  dummy cycles but it works with 0
 		success = QuadSpiInstructionWithAddress1LINE(hqspi, W25N01G_INSTR_BLOCK_ERASE, 0, pageAddress, W25N01G_STATUS_PAGE_ADDRESS_SIZE);
+		W25n01g_forgetLoadedPage();
 	}
 	return success;
 }
 
 void W25n01g_writeStatusRegister(QSPI_HandleTypeDef *hqspi, uint8_t reg, uint8_t data)
 {
-	W25n01g_waitForReady(hqspi);
-	QuadSpiTransmitWithAddress1Line(hqspi, W25N01G_INSTR_WRITE_STATUS_ALTERNATE_REG, 0, reg, W25N01G_STATUS_REGISTER_SIZE, &data, 1);
+	if (W25n01g_waitForReady(hqspi)) {
+		QuadSpiTransmitWithAddress1Line(hqspi, W25N01G_INSTR_WRITE_STATUS_ALTERNATE_REG, 0, reg, QSPI_ADDRESS_8_BITS, &data, 1);
+	}
+
+	// BUF and ECC-E change what a FAST_READ out of the buffer returns
+	W25n01g_forgetLoadedPage();
 }
 
-static bool W25n01g_performCommandWithPageAddress(QSPI_HandleTypeDef *hqspi, uint8_t command, uint16_t pageAddress)
+void W25n01g_updateStatusRegister(QSPI_HandleTypeDef *hqspi, uint8_t reg, uint8_t data)
+{
+	// After a warm reset the registers usually hold the value already, skip the wait and the write
+	if (W25n01g_readStatusRegister(hqspi, reg) != data) {
+		W25n01g_writeStatusRegister(hqspi, reg, data);
+	}
+}
+
+static bool W25n01g_performCommandWithPageAddress(QSPI_HandleTypeDef *hqspi, uint8_t command, uint32_t pageAddress)
 {
 	bool success = true;
 
 	//success = W25n01g_writeEnable(hqspi);
-	W25n01g_waitForReady(hqspi);
+	success = W25n01g_waitForReady(hqspi);
 
 	if(success) {
 		success = QuadSpiInstructionWithAddress1LINE(hqspi, command, 0, pageAddress, W25N01G_STATUS_PAGE_ADDRESS_SIZE);
 	}
+
+	// PAGE_DATA_READ and PROGRAM_EXECUTE both leave the part busy
+	FlashDevice_invalidateShadow(FLASH_DEVICE_TYPE_NAND);
+	W25n01g_forgetLoadedPage();
+
+	return success;
+}
+
+static bool W25n01g_loadPage(QSPI_HandleTypeDef *hqspi, uint32_t pageAddress)
+{
+	uint32_t loadedPage = ((uint32_t)w25n01gDie << 24) | pageAddress;
+	bool success = true;
+
+#ifndef FLASH_DEVICE_STRICT_CHECKS
+	// Nothing has touched the buffer since this page was read into it
+	if (FlashDevice_loadedPage() == loadedPage) {
+		return true;
+	}
+#endif
+
+	success = W25n01g_performCommandWithPageAddress(hqspi, W25N01G_INSTR_PAGE_DATA_READ, pageAddress);
+
+	if(success && W25n01g_waitForReady(hqspi)) {
+		FlashDevice_setLoadedPage(loadedPage);
+	} else {
+		success = false;
+	}
+
 	return success;
 }
 
@@ -116,11 +215,191 @@ bool W25n01g_programDataLoad(QSPI_HandleTypeDef *hqspi, uint16_t columnAddress,
 	bool success = false;
 
 	success = W25n01g_writeEnable(hqspi);
-	W25n01g_waitForReady(hqspi);
+	FlashDevice_strictWaitForReady(hqspi, FLASH_DEVICE_TYPE_NAND);
+	W25n01g_forgetLoadedPage();
+
+	if (success) {
+		success = QuadSpiTransmitWithAddress1Line(hqspi, W25N01G_INSTR_PROGRAM_DATA_LOAD, 0, columnAddress, QSPI_ADDRESS_16_BITS, data, length);
+	}
+	return success;
+}
+
+bool W25n01g_quadProgramDataLoad(QSPI_HandleTypeDef *hqspi, uint16_t columnAddress, const uint8_t *data, uint32_t length)
+{
+	bool success = false;
+
+	success = W25n01g_writeEnable(hqspi);
+	FlashDevice_strictWaitForReady(hqspi, FLASH_DEVICE_TYPE_NAND);
+	W25n01g_forgetLoadedPage();
+
+	if (success) {
+		success = QuadSpiTransmitWithAddress4Line(hqspi, W25N01G_INSTR_QUAD_PROGRAM_DATA_LOAD, 0, columnAddress, QSPI_ADDRESS_16_BITS, data, length);
+	}
+	return success;
+}
+
+bool W25n01g_randomProgramDataLoad(QSPI_HandleTypeDef *hqspi, uint16_t columnAddress, const uint8_t *data, uint32_t length)
+{
+	// Unlike PROGRAM_DATA_LOAD this keeps the rest of the page buffer, so fragments can be placed one by one
+	W25n01g_forgetLoadedPage();
+
+	return QuadSpiTransmitWithAddress1Line(hqspi, W25N01G_INSTR_RANDOM_PROGRAM_DATA_LOAD, 0, columnAddress, QSPI_ADDRESS_16_BITS, data, length);
+}
+
+bool W25n01g_startProgramExecute(QSPI_HandleTypeDef *hqspi, uint32_t pageAddress)
+{
+	// Returns once the command is issued, poll W25N01G_STAT_REG for BUSY and PROGRAM_FAIL
+	return W25n01g_performCommandWithPageAddress(hqspi, W25N01G_INSTR_PROGRAM_EXECUTE, pageAddress);
+}
+
+bool W25n01g_startQuadPageProgram(QSPI_HandleTypeDef *hqspi, uint32_t pageAddress, const uint8_t *data, uint32_t length)
+{
+	// Bulk path for a part the caller has already seen idle: no ready waits, no WEL read-back
+	bool success = QuadSpiInstruction(hqspi, W25N01G_INSTR_WRITE_ENABLE);
+
+	FlashDevice_invalidateShadow(FLASH_DEVICE_TYPE_NAND);
+	W25n01g_forgetLoadedPage();
+
+	if(success) {
+		success = QuadSpiTransmitWithAddress4Line(hqspi, W25N01G_INSTR_QUAD_PROGRAM_DATA_LOAD, 0, 0, QSPI_ADDRESS_16_BITS, data, length);
+	}
+
+	if(success) {
+		success = QuadSpiInstructionWithAddress1LINE(hqspi, W25N01G_INSTR_PROGRAM_EXECUTE, 0, pageAddress, W25N01G_STATUS_PAGE_ADDRESS_SIZE);
+	}
+
+	return success;
+}
+
+bool W25n01g_waitForReadyPolled(QSPI_HandleTypeDef *hqspi, uint32_t timeoutMs)
+{
+	QSPI_CommandTypeDef cmd;
+
+	cmd.InstructionMode		= QSPI_INSTRUCTION_1_LINE;
+	cmd.Instruction			= W25N01G_INSTR_READ_STATUS_REG;
+	cmd.AddressMode			= QSPI_ADDRESS_1_LINE;
+	cmd.AddressSize			= QSPI_ADDRESS_8_BITS;
+	cmd.Address				= W25N01G_STAT_REG;
+	cmd.AlternateByteMode	= QSPI_ALTERNATE_BYTES_NONE;
+	cmd.DataMode			= QSPI_DATA_1_LINE;
+	cmd.DummyCycles			= 0;
+	cmd.NbData				= 1;
+	cmd.DdrMode				= QSPI_DDR_MODE_DISABLE;
+	cmd.DdrHoldHalfCycle	= QSPI_DDR_HHC_ANALOG_DELAY;
+	cmd.SIOOMode			= QSPI_SIOO_INST_EVERY_CMD;
+
+	bool success = QuadSpiAutoPoll(hqspi, &cmd, W25N01G_STATUS_FLAG_BUSY, 0, timeoutMs);
 
 	if (success) {
-		success = QuadSpiTransmitWithAddress1Line(hqspi, W25N01G_INSTR_PROGRAM_DATA_LOAD, 0, columnAddress, W25N01G_STATUS_COLUMN_ADDRESS_SIZE, data, length);
+		FlashDevice_markIdle(FLASH_DEVICE_TYPE_NAND);
+	}
+
+	return success;
+}
+
+static bool W25n01g_programExecute(QSPI_HandleTypeDef *hqspi, uint32_t pageAddress)
+{
+	bool success = W25n01g_startProgramExecute(hqspi, pageAddress);
+
+	if(success) {
+		success = W25n01g_waitForReady(hqspi);
+	}
+
+	if(success) {
+		uint8_t statusReg = W25n01g_readStatusRegister(hqspi, W25N01G_STAT_REG);
+		success = ((W25N01G_STATUS_PROGRAM_FAIL & statusReg) != W25N01G_STATUS_PROGRAM_FAIL);
+	}
+
+	return success;
+}
+
+bool w25n01g_writeVector(QSPI_HandleTypeDef *hqspi, uint32_t address, const FlashIoVec *iov, uint32_t count)
+{
+	bool success = true;
+	FlashIoCursor cursor;
+	uint32_t length = FlashIoVec_totalLength(iov, count);
+
+	FlashIoCursor_init(&cursor, iov, count);
+
+	while(success && (length > 0)) {
+		uint32_t pageAddress = W25N01G_LINEAR_TO_PAGE(address);
+		uint16_t column = W25N01G_LINEAR_TO_COLUMN(address);
+		uint32_t pageChunk = FlashDevice_pageChunk(W25n01g_getDevice(), address, length);
+		bool firstLoad = true;
+
+		success = W25n01g_selectAddressDie(hqspi, address);
+
+		if(success) {
+			success = W25n01g_writeEnable(hqspi);
+			W25n01g_forgetLoadedPage();
+		}
+
+		// Gather the fragments in the device page buffer, then program the page once
+		for(uint32_t loaded = 0; success && (loaded < pageChunk); ) {
+			uint32_t span = FlashIoCursor_span(&cursor, pageChunk - loaded);
+			const uint8_t *data = FlashIoCursor_pointer(&cursor);
+
+			if(firstLoad) {
+				success = QuadSpiTransmitWithAddress1Line(hqspi, W25N01G_INSTR_PROGRAM_DATA_LOAD, 0, column, QSPI_ADDRESS_16_BITS, data, span);
+				firstLoad = false;
+			} else {
+				success = W25n01g_randomProgramDataLoad(hqspi, column + loaded, data, span);
+			}
+
+			FlashIoCursor_advance(&cursor, span);
+			loaded += span;
+		}
+
+		if(success) {
+			success = W25n01g_programExecute(hqspi, pageAddress);
+		}
+
+		address += pageChunk;
+		length -= pageChunk;
+	}
+
+	return success;
+}
+
+bool W25n01g_readVector(QSPI_HandleTypeDef *hqspi, uint32_t address, const FlashIoVec *iov, uint32_t count)
+{
+	bool success = true;
+	FlashIoCursor cursor;
+	QSPI_CommandTypeDef cmd;
+	uint32_t length = FlashIoVec_totalLength(iov, count);
+
+	FlashIoCursor_init(&cursor, iov, count);
+
+	cmd.InstructionMode		= QSPI_INSTRUCTION_1_LINE;
+	cmd.Instruction			= W25N01G_INSTR_FAST_READ_QUAD;
+	cmd.AddressMode			= QSPI_ADDRESS_4_LINES;
+	cmd.AddressSize			= QSPI_ADDRESS_16_BITS;
+	cmd.AlternateByteMode	= QSPI_ALTERNATE_BYTES_NONE;
+	cmd.DataMode			= QSPI_DATA_4_LINES;
+	cmd.DummyCycles			= W25N01G_DUMMY_CYCLES_FAST_READ_QUAD_BUFFER;
+	cmd.DdrMode				= QSPI_DDR_MODE_DISABLE;
+	cmd.DdrHoldHalfCycle	= QSPI_DDR_HHC_ANALOG_DELAY;
+	cmd.SIOOMode			= QSPI_SIOO_INST_EVERY_CMD;
+
+	while(success && (length > 0)) {
+		uint32_t pageChunk = FlashDevice_pageChunk(W25n01g_getDevice(), address, length);
+
+		success = W25n01g_selectAddressDie(hqspi, address);
+
+		if(success) {
+			success = W25n01g_loadPage(hqspi, W25N01G_LINEAR_TO_PAGE(address));
+		}
+
+		if(success) {
+			cmd.Address = W25N01G_LINEAR_TO_COLUMN(address);
+			cmd.NbData = pageChunk;
+			success = QuadSpiReceiveCursor(hqspi, &cmd, &cursor);
+		}
+
+		address += pageChunk;
+		length -= pageChunk;
 	}
+
 	return success;
 }
 
@@ -129,18 +408,16 @@ bool w25n01g_pageProgram(QSPI_HandleTypeDef *hqspi, uint32_t address, const uint
 	bool success = true;
 
 	uint16_t columnAddress = W25N01G_LINEAR_TO_COLUMN(address);
-	uint16_t pageAddress = W25N01G_LINEAR_TO_PAGE(address);
+	uint32_t pageAddress = W25N01G_LINEAR_TO_PAGE(address);
 
-	success = W25n01g_programDataLoad(hqspi, columnAddress, data,length);
+	success = W25n01g_selectAddressDie(hqspi, address);
 
 	if(success) {
-		success = W25n01g_performCommandWithPageAddress(hqspi, W25N01G_INSTR_PROGRAM_EXECUTE, pageAddress);
+		success = W25n01g_programDataLoad(hqspi, columnAddress, data,length);
 	}
 
 	if(success) {
-		W25n01g_waitForReady(hqspi);
-		uint8_t statusReg = W25n01g_readStatusRegister(hqspi, W25N01G_STAT_REG);
-		success = ((W25N01G_STATUS_PROGRAM_FAIL & statusReg) != W25N01G_STATUS_PROGRAM_FAIL);
+		success = W25n01g_programExecute(hqspi, pageAddress);
 	}
 	return success;
 }
@@ -149,21 +426,22 @@ bool w25n01g_writeFlash(QSPI_HandleTypeDef *hqspi, uint32_t address, const uint8
 
 	bool success = true;
 
-	uint32_t numberOfpages = length / W25N01G_PAGE_SIZE;
+	uint32_t pageSize = FlashDevice_pageSize(W25n01g_getDevice());
+	uint32_t numberOfpages = length / pageSize;
 	uint32_t pageIndex;
 	uint32_t pageAddress;
 
 	for(pageIndex = 0; (pageIndex < numberOfpages) && success; pageIndex++) {
 
-		pageAddress = address + W25N01G_PAGE_SIZE*pageIndex;
-		success = w25n01g_pageProgram(hqspi, pageAddress, &(data[W25N01G_PAGE_SIZE*pageIndex]), W25N01G_PAGE_SIZE);
+		pageAddress = address + pageSize*pageIndex;
+		success = w25n01g_pageProgram(hqspi, pageAddress, &(data[pageSize*pageIndex]), pageSize);
 	}
 
-	uint32_t notFullPageSize = (length % W25N01G_PAGE_SIZE);
+	uint32_t notFullPageSize = (length & (pageSize - 1));
 
 	if(success & (notFullPageSize != 0)) {
-		pageAddress = address + W25N01G_PAGE_SIZE*pageIndex;
-		success = w25n01g_pageProgram(hqspi, pageAddress, &(data[W25N01G_PAGE_SIZE*pageIndex]), notFullPageSize);
+		pageAddress = address + pageSize*pageIndex;
+		success = w25n01g_pageProgram(hqspi, pageAddress, &(data[pageSize*pageIndex]), notFullPageSize);
 	}
 
 	return success;
@@ -171,30 +449,101 @@ bool w25n01g_writeFlash(QSPI_HandleTypeDef *hqspi, uint32_t address, const uint8
 
 uint32_t W25n01g_readBytes(QSPI_HandleTypeDef *hqspi, uint32_t address, uint8_t *buffer, uint32_t length, bool bufferMode)
 {
+	bool success = false;
 	uint32_t targetPage = W25N01G_LINEAR_TO_PAGE(address);
 
-	W25n01g_waitForReady(hqspi);
-	W25n01g_performCommandWithPageAddress(hqspi, W25N01G_INSTR_PAGE_DATA_READ, targetPage);
+	// W25n01g_loadPage waits before and after PAGE_DATA_READ, or skips both when the page is still loaded
+	success = W25n01g_selectAddressDie(hqspi, address);
 
-	uint16_t column = W25N01G_LINEAR_TO_COLUMN(address);
-	uint16_t transferLength;
-
-	if (length > (W25N01G_PAGE_SIZE - column)) {
-		transferLength = W25N01G_PAGE_SIZE - column;
-	} else {
-		transferLength = length;
+	if(success) {
+		success = W25n01g_loadPage(hqspi, targetPage);
 	}
-	W25n01g_waitForReady(hqspi);
+
+	uint16_t column = W25N01G_LINEAR_TO_COLUMN(address);
+	uint16_t transferLength = FlashDevice_pageChunk(W25n01g_getDevice(), address, length);
 
 	uint8_t dummyCycles;
 
 	if(bufferMode) {
 		dummyCycles = W25N01G_DUMMY_CYCLES_FAST_READ_QUAD_BUFFER;
-		QuadSpiReceiveWithAddress4LINES(hqspi, W25N01G_INSTR_FAST_READ_QUAD, dummyCycles, column, buffer, length, bufferMode);
 	} else {
 		dummyCycles = W25N01G_DUMMY_CYCLES_FAST_READ_QUAD_CONT;
-		QuadSpiReceiveWithAddress4LINES(hqspi, W25N01G_INSTR_FAST_READ_QUAD, dummyCycles, column, buffer, length, bufferMode);
+	}
+
+	if(success) {
+		success = QuadSpiReceiveWithAddress4LINES(hqspi, W25N01G_INSTR_FAST_READ_QUAD, dummyCycles, column, QSPI_ADDRESS_16_BITS, buffer, transferLength);
+	}
+
+	// A continuous read streams the following pages through the buffer
+	if(!bufferMode) {
+		W25n01g_forgetLoadedPage();
+	}
+
+	if(!success) {
+		transferLength = 0;
 	}
 
 	return transferLength;
 }
+
+bool W25n01g_readPageData(QSPI_HandleTypeDef *hqspi, uint32_t pageAddress, uint16_t columnAddress, uint8_t *buffer, uint32_t length)
+{
+	bool success = false;
+
+	success = W25n01g_loadPage(hqspi, pageAddress);
+
+	if(success) {
+		success = QuadSpiReceiveWithAddress4LINES(
+				hqspi,
+				W25N01G_INSTR_FAST_READ_QUAD,
+				W25N01G_DUMMY_CYCLES_FAST_READ_QUAD_BUFFER,
+				columnAddress,
+				QSPI_ADDRESS_16_BITS,
+				buffer,
+				length
+				);
+	}
+
+	return success;
+}
+
+bool W25n01g_isBlockBad(QSPI_HandleTypeDef *hqspi, uint32_t block)
+{
+	uint8_t marker = W25N01G_BAD_BLOCK_MARKER_GOOD;
+	uint32_t address = FlashDevice_pageToAddress(W25n01g_getDevice(), W25N01G_BLOCK_TO_PAGE(block));
+
+	// Factory bad block marker is the first spare byte of the first page in the block
+	bool success = W25n01g_selectAddressDie(hqspi, address);
+
+	if(success) {
+		success = W25n01g_readPageData(hqspi, W25N01G_LINEAR_TO_PAGE(address), FlashDevice_pageSize(W25n01g_getDevice()), &marker, sizeof(marker));
+	}
+
+	return (!success || (marker != W25N01G_BAD_BLOCK_MARKER_GOOD));
+}
+
+W25n01gEcc W25n01g_eccStatus(uint8_t status)
+{
+	W25n01gEcc ecc = W25N01G_ECC_CLEAN;
+
+	switch (W25N01G_STATUS_FLAG_ECC(status)) {
+	case W25N01G_STATUS_ECC_CORRECTED:
+		ecc = W25N01G_ECC_CORRECTED;
+		break;
+	case W25N01G_STATUS_ECC_MULTIPLE:
+		ecc = ((W25n01g_getDevice()->features & FLASH_DEVICE_FEATURE_ECC_8BIT) != 0) ? W25N01G_ECC_CORRECTED : W25N01G_ECC_UNCORRECTABLE;
+		break;
+	case W25N01G_STATUS_ECC_UNCORRECTABLE:
+		ecc = W25N01G_ECC_UNCORRECTABLE;
+		break;
+	default:
+		break;
+	}
+
+	return ecc;
+}
+
+W25n01gEcc W25n01g_readEcc(QSPI_HandleTypeDef *hqspi)
+{
+	return W25n01g_eccStatus(W25n01g_readStatusRegister(hqspi, W25N01G_STAT_REG));
+}
@@ -18,31 +18,255 @@
  *  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stddef.h>
+#include <string.h>
+
 #include "w25q.h"
 #include "quadspi.h"
+#include "quadspidma.h"
+#include "quadspiqueue.h"
+#include "flashstats.h"
 
-#define W25Q_LINEAR_TO_PAGE(laddr) ((laddr) & 0xFFFFFF)
-#define W25Q_LINEAR_TO_BLOCK(laddr) (W25Q_LINEAR_TO_PAGE(laddr) / W25Q_PAGES_PER_BLOCK)
-#define W25Q_BLOCK_TO_PAGE(block) ((block) * W25Q_PAGES_PER_BLOCK)
-#define W25Q_BLOCK_TO_LINEAR(block) (W25Q_BLOCK_TO_PAGE(block) * W25Q_PAGE_SIZE)
+#define W25Q_LINEAR_TO_PAGE(laddr) ((laddr) & FlashDevice_addressMask(w25qDevice))
 
 QSPI_HandleTypeDef *ptr_hqspi;
+static const FlashDevice *w25qDevice;
+static FlashDevice w25qSfdpDevice;
+static W25qConfig w25qConfig;
+static bool w25qMemoryMapped = false;
+static uint8_t w25qDie = 0;		//!< Die the part currently answers on, stacked W25M parts only
+static bool w25qQuadEnabled = false;	//!< QE seen set on the selected die
+
+static const SfdpEraseType w25qDefaultEraseTypes[SFDP_ERASE_TYPES] = {
+	{ W25Q_SECTOR_SIZE,		W25Q_INSTR_SECTOR_ERASE,		45,		400 },
+	{ W25Q_32K_BLOCK_SIZE,	W25Q_INSTR_32K_BLOCK_ERASE,		120,	1600 },
+	{ W25Q_64K_BLOCK_SIZE,	W25Q_INSTR_64K_BLOCK_ERASE,		150,	2000 },
+	{ 0,					0,								0,		0 },
+};
+
+static uint8_t W25q_log2(uint32_t value)
+{
+	uint8_t shift = 0;
+
+	while ((value >> shift) > 1u) {
+		shift++;
+	}
+
+	return shift;
+}
+
+static void W25q_configDefaults(void)
+{
+	w25qConfig.read.instruction			= W25Q_INSTR_FAST_READ_QUAD;
+	w25qConfig.read.dummyCycles			= W25Q_DUMMY_CYCLES_FAST_READ_QUAD;
+	w25qConfig.read.instructionMode		= QSPI_INSTRUCTION_1_LINE;
+	w25qConfig.read.addressMode			= QSPI_ADDRESS_4_LINES;
+	w25qConfig.read.dataMode			= QSPI_DATA_4_LINES;
+	w25qConfig.read.ddr					= false;
+
+	for (uint32_t i = 0; i < SFDP_ERASE_TYPES; i++) {
+		w25qConfig.erase[i] = w25qDefaultEraseTypes[i];
+	}
+
+	w25qConfig.pageProgramMaxUs			= W25Q_PAGE_PROGRAM_MAX_US;
+	w25qConfig.chipEraseTypicalMs		= 0;
+	w25qConfig.chipEraseMaxMs			= W25Q_CHIP_ERASE_MAX_MS;
+	w25qConfig.sfdpValid				= false;
+	w25qConfig.addressMode				= W25Q_ADDRESS_MODE_3B;
+	w25qConfig.dtrSupported				= true;
+	w25qConfig.wrapSize					= 0;
+}
+
+//! A ready wait outlasting the longest erase or program the part may take has lost the part
+static void W25q_setBusyTimeout(void)
+{
+	uint32_t timeoutMs = (w25qConfig.pageProgramMaxUs / 1000u) + 1u;
+
+	for (uint32_t i = 0; i < SFDP_ERASE_TYPES; i++) {
+		if ((w25qConfig.erase[i].size != 0) && (w25qConfig.erase[i].maxMs > timeoutMs)) {
+			timeoutMs = w25qConfig.erase[i].maxMs;
+		}
+	}
+
+	FlashDevice_setBusyTimeout(FLASH_DEVICE_TYPE_NOR, timeoutMs);
+}
+
+static void W25q_defaultEraseTimes(SfdpEraseType *type)
+{
+	const SfdpEraseType *source = NULL;
+
+	// The defaults are sorted by size, the walk stops on a match or runs on to the largest
+	for (uint32_t i = 0; (i < SFDP_ERASE_TYPES) && (w25qDefaultEraseTypes[i].size != 0); i++) {
+		if ((source == NULL) || (source->size != type->size)) {
+			source = &w25qDefaultEraseTypes[i];
+		}
+	}
+
+	type->typicalMs	= source->typicalMs;
+	type->maxMs		= source->maxMs;
+}
+
+static void W25q_configFromSfdp(const SfdpParameters *params)
+{
+	static const uint32_t addressModes[SFDP_READ_MODE_COUNT] = {
+		QSPI_ADDRESS_1_LINE, QSPI_ADDRESS_1_LINE, QSPI_ADDRESS_4_LINES, QSPI_ADDRESS_4_LINES
+	};
+	static const uint32_t dataModes[SFDP_READ_MODE_COUNT] = {
+		QSPI_DATA_1_LINE, QSPI_DATA_4_LINES, QSPI_DATA_4_LINES, QSPI_DATA_4_LINES
+	};
+
+	// The rest of the driver talks to the part in SPI mode, so QPI reads are not selected
+	SfdpReadMode mode = Sfdp_fastestReadMode(params, false);
+
+	w25qConfig.read.instruction		= params->read[mode].instruction;
+	w25qConfig.read.dummyCycles		= params->read[mode].dummyCycles;
+	w25qConfig.read.instructionMode	= QSPI_INSTRUCTION_1_LINE;
+	w25qConfig.read.addressMode		= addressModes[mode];
+	w25qConfig.read.dataMode		= dataModes[mode];
+	w25qConfig.read.ddr				= false;
+	w25qConfig.dtrSupported			= params->dtrSupported;
+
+	// Keep erase types sorted by size so range erase can walk them from the largest
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < SFDP_ERASE_TYPES; i++) {
+		if (params->erase[i].size != 0) {
+			uint32_t j = count++;
+			while ((j > 0) && (w25qConfig.erase[j - 1].size > params->erase[i].size)) {
+				w25qConfig.erase[j] = w25qConfig.erase[j - 1];
+				j--;
+			}
+			w25qConfig.erase[j] = params->erase[i];
+
+			// Pre-JESD216A tables carry no times, keep the datasheet ones of the same or the largest size
+			if (params->erase[i].maxMs == 0) {
+				W25q_defaultEraseTimes(&w25qConfig.erase[j]);
+			}
+		}
+	}
+	for (uint32_t i = count; i < SFDP_ERASE_TYPES; i++) {
+		w25qConfig.erase[i].size = 0;
+	}
+
+	if (params->pageProgramMaxUs != 0) {
+		w25qConfig.pageProgramMaxUs	= params->pageProgramMaxUs;
+	}
+	if (params->chipEraseMaxMs != 0) {
+		w25qConfig.chipEraseTypicalMs	= params->chipEraseTypicalMs;
+		w25qConfig.chipEraseMaxMs		= params->chipEraseMaxMs;
+	}
+	w25qConfig.sfdpValid			= true;
+}
+
+static const FlashDevice *W25q_deviceFromSfdp(const uint8_t *jedecId, const SfdpParameters *params)
+{
+	const SfdpEraseType *smallest = Sfdp_smallestEraseType(params);
+	uint32_t largestSize = 0;
+
+	if (smallest == NULL) {
+		return NULL;
+	}
+
+	for (uint32_t i = 0; i < SFDP_ERASE_TYPES; i++) {
+		if (params->erase[i].size > largestSize) {
+			largestSize = params->erase[i].size;
+		}
+	}
+
+	w25qSfdpDevice.name				= "SFDP";
+	w25qSfdpDevice.manufacturerId	= jedecId[0];
+	w25qSfdpDevice.deviceId			= (uint16_t)((jedecId[1] << 8) | jedecId[2]);
+	w25qSfdpDevice.type				= FLASH_DEVICE_TYPE_NOR;
+	w25qSfdpDevice.pageShift		= W25q_log2(params->pageSize);
+	w25qSfdpDevice.sectorShift		= W25q_log2(smallest->size);
+	w25qSfdpDevice.blockShift		= W25q_log2(largestSize);
+	w25qSfdpDevice.capacityShift	= W25q_log2(params->density);
+	w25qSfdpDevice.addressBytes		= (params->density > (1u << 24)) ? 4 : 3;
+	w25qSfdpDevice.dieCount			= 1;
+	w25qSfdpDevice.features			= params->dtrSupported ? FLASH_DEVICE_FEATURE_DTR : 0;
+
+	return &w25qSfdpDevice;
+}
+
+static W25qAddressMode W25q_defaultAddressMode(void)
+{
+	W25qAddressMode mode = W25Q_ADDRESS_MODE_4B_ENTERED;
+
+#ifndef W25Q_PREFER_ENTER_4B_MODE
+	// Stateless opcodes survive a device reset behind the driver's back, prefer them when present
+	if (w25qDevice->features & FLASH_DEVICE_FEATURE_4B_OPCODES) {
+		mode = W25Q_ADDRESS_MODE_4B_OPCODES;
+	}
+#endif
+
+	return mode;
+}
+
+//! A re-init may find the peripheral still mapped by the previous session, nothing indirect gets through until it is left
+static void W25q_attachHandle(QSPI_HandleTypeDef *hqspi)
+{
+	ptr_hqspi = hqspi;
+	w25qMemoryMapped = (HAL_QSPI_GetState(hqspi) == HAL_QSPI_STATE_BUSY_MEM_MAPPED);
+	W25q_memoryMappedModeDisable();
+}
 
 bool W25q_init(QSPI_HandleTypeDef *hqspi)
 {
 	bool success = true;
-	ptr_hqspi = hqspi;
 	uint8_t buffer[3];
+	SfdpParameters sfdp;
+
+	W25q_attachHandle(hqspi);
+	w25qQuadEnabled = false;
+	FlashDevice_invalidateShadow(FLASH_DEVICE_TYPE_NOR);
+
+	// Without an MDMA channel linked to the handle the async calls report failure at start
+	QuadSpiDma_init(hqspi);
 
 	W25q_readJedec(buffer);
-	if(
-			(buffer[0] != W25Q_MANUFACTURER_ID) ||
-			(buffer[1] != W25Q_DEVICE_ID_1_IQ && buffer[1] != W25Q_DEVICE_ID_1_IM) ||
-			(buffer[2] != W25Q_DEVICE_ID_2)
-			) {
+	w25qDevice = FlashDevice_identify(buffer);
+
+	W25q_configDefaults();
+
+	if (Sfdp_read(ptr_hqspi, &sfdp)) {
+		W25q_configFromSfdp(&sfdp);
+
+		// Unknown second-source part, describe it from its own parameter table
+		if (w25qDevice == NULL) {
+			w25qDevice = W25q_deviceFromSfdp(buffer, &sfdp);
+		}
+	}
+
+	W25q_setBusyTimeout();
+
+	if((w25qDevice == NULL) || (w25qDevice->type != FLASH_DEVICE_TYPE_NOR)) {
+		w25qDevice = NULL;
 		success = false;
 	}
 
+	if(success && (w25qDevice->dieCount > 1)) {
+		// The part may still sit on another die from before an MCU reset
+		success = FlashDevice_selectDie(ptr_hqspi, 0);
+		w25qDie = 0;
+	}
+
+	if(success && (w25qDevice->addressBytes > 3)) {
+		// Every die keeps its own address mode, die 0 is set last and stays selected
+		for(int32_t die = w25qDevice->dieCount - 1; success && (die >= 0); die--) {
+			success = W25q_selectDie(die);
+
+			if(success) {
+				success = W25q_setAddressMode(W25q_defaultAddressMode());
+			}
+		}
+	}
+
+#ifndef W25Q_DISABLE_DTR
+	if(success) {
+		// Falls back to the SDR read silently when the ID or SFDP says the part has no DTR
+		W25q_setDtrRead(true);
+	}
+#endif
+
 	if(success) {
 		//success = W25q_writeStatusRegister(ptr_hqspi, W25Q_INSTR_WRITE_STATUS_REG1, W25Q_STATUS_REG_CLEAR_ALL);
 	}
@@ -50,30 +274,385 @@ bool W25q_init(QSPI_HandleTypeDef *hqspi)
 	return success;
 }
 
-void W25q_readJedec(uint8_t* idBuffer) {
-	QuadSpiReceive1Line(ptr_hqspi, W25Q_INSTR_JEDEC_ID, 0, idBuffer, 3);
+static bool W25q_readBootStatus(uint8_t *status)
+{
+	static const uint8_t instructions[3] = { W25Q_INSTR_READ_STATUS_REG1, W25Q_INSTR_READ_STATUS_REG2, W25Q_INSTR_READ_STATUS_REG3 };
+	static const uint8_t masks[3] = {
+		(uint8_t)~(W25Q_STATUS_REG1_BUSY | W25Q_STATUS_REG1_WEL),
+		(uint8_t)~W25Q_STATUS_REG2_SUS,
+		0xFF,
+	};
+	bool success = true;
+
+	for (uint32_t i = 0; success && (i < sizeof(instructions)); i++) {
+		success = W25q_readStatusRegister(instructions[i], &status[i]);
+		status[i] &= masks[i];
+	}
+
+	return success;
 }
 
-bool W25q_writeEnable(void)
+static uint32_t W25q_bootStateChecksum(const W25qBootState *state)
+{
+	// Bytewise up to the checksum, W25q_saveBootState zeroes the padding first
+	const uint8_t *bytes = (const uint8_t *)state;
+	uint32_t sum = 0x5A5A5A5Au;
+
+	for (uint32_t i = 0; i < offsetof(W25qBootState, checksum); i++) {
+		sum = ((sum << 5) | (sum >> 27)) ^ bytes[i];
+	}
+
+	return sum;
+}
+
+bool W25q_saveBootState(W25qBootState *state, const QuadSpiCalibration *calibration)
+{
+	bool success = (w25qDevice != NULL) && (w25qDevice->dieCount == 1) && !w25qMemoryMapped;
+
+	memset(state, 0, sizeof(*state));
+
+	if (success) {
+		W25q_readJedec(state->jedecId);
+
+		// Parts described from SFDP alone have nothing to restore their geometry from
+		success = (FlashDevice_identify(state->jedecId) == w25qDevice) && W25q_readBootStatus(state->status);
+	}
+
+	if (success) {
+		memcpy(&state->config, &w25qConfig, sizeof(w25qConfig));
+
+		if ((calibration != NULL) && QuadSpiCalib_isValid(calibration)) {
+			memcpy(&state->calibration, calibration, sizeof(*calibration));
+		}
+
+		state->magic = W25Q_BOOT_STATE_MAGIC;
+		state->checksum = W25q_bootStateChecksum(state);
+	}
+
+	return success;
+}
+
+bool W25q_fastInit(QSPI_HandleTypeDef *hqspi, const W25qBootState *state, bool memoryMapped, bool *fromSnapshot)
+{
+	const FlashDevice *device = NULL;
+	uint8_t jedecId[3];
+	uint8_t status[3];
+	bool success = true;
+	bool fast = (state != NULL) && (state->magic == W25Q_BOOT_STATE_MAGIC) && (state->checksum == W25q_bootStateChecksum(state));
+
+	W25q_attachHandle(hqspi);
+
+	if (fast) {
+		device = FlashDevice_identify(state->jedecId);
+		fast = (device != NULL) && (device->dieCount == 1);
+	}
+
+	// ID and status registers in one pass stand in for SFDP parsing and the mode writes
+	if (fast) {
+		W25q_readJedec(jedecId);
+		fast = (memcmp(jedecId, state->jedecId, sizeof(jedecId)) == 0) &&
+				W25q_readBootStatus(status) && (memcmp(status, state->status, sizeof(status)) == 0);
+	}
+
+	if (fast) {
+		QuadSpiDma_init(hqspi);
+		w25qDevice = device;
+		w25qDie = 0;
+		w25qQuadEnabled = (status[1] & W25Q_STATUS_REG2_QE) != 0;
+		memcpy(&w25qConfig, &state->config, sizeof(w25qConfig));
+		W25q_setBusyTimeout();
+
+		if (QuadSpiCalib_isValid(&state->calibration)) {
+			success = QuadSpi_InitWithTiming(hqspi, hqspi->Init.FlashSize, &state->calibration.timing);
+		}
+
+		// Burst wrap does not survive a power cycle, send it again
+		if (success && (w25qConfig.wrapSize != 0)) {
+			uint8_t wrapSize = w25qConfig.wrapSize;
+
+			w25qConfig.read = w25qConfig.wrapSavedRead;
+			w25qConfig.wrapSize = 0;
+			success = W25q_setWrapRead(wrapSize);
+		}
+	} else {
+		success = W25q_init(hqspi);
+	}
+
+	if (success && memoryMapped) {
+		success = W25q_memoryMappedModeEnable();
+	}
+
+	if (fromSnapshot != NULL) {
+		*fromSnapshot = fast && success;
+	}
+
+	return success;
+}
+
+const FlashDevice *W25q_getDevice(void)
+{
+	return w25qDevice;
+}
+
+const W25qConfig *W25q_getConfig(void)
+{
+	return &w25qConfig;
+}
+
+bool W25q_selectDie(uint8_t die)
+{
+	bool success = true;
+
+	// Nothing identified, every addressed entry point ends up here and reports the failure
+	if (w25qDevice == NULL) {
+		return false;
+	}
+
+	// Single die parts keep wrapping addresses past the end like before
+	if (w25qDevice->dieCount <= 1) {
+		return true;
+	}
+
+	if (die >= w25qDevice->dieCount) {
+		success = false;
+	} else if (die != w25qDie) {
+		success = FlashDevice_selectDie(ptr_hqspi, die);
+		if (success) {
+			w25qDie = die;
+			w25qQuadEnabled = false;
+		}
+	}
+
+	return success;
+}
+
+static bool W25q_selectAddressDie(uint32_t address)
 {
-	uint8_t statusReg;
+	if (w25qDevice == NULL) {
+		return false;
+	}
+
+	return W25q_selectDie(FlashDevice_addressToDie(w25qDevice, address));
+}
+
+//! Instruction to send for an addressed command in the current address mode, 0 if the part has no 4-byte form
+static uint8_t W25q_addressedInstruction(uint8_t instruction)
+{
+	static const uint8_t opcodes4b[][2] = {
+		{ W25Q_INSTR_FAST_READ,					W25Q_INSTR_FAST_READ_4B },
+		{ W25Q_INSTR_FAST_READ_QUAD_OUTPUT,		W25Q_INSTR_FAST_READ_QUAD_OUTPUT_4B },
+		{ W25Q_INSTR_FAST_READ_QUAD,			W25Q_INSTR_FAST_READ_QUAD_4B },
+		{ W25Q_INSTR_FAST_READ_QUAD_DTR,		W25Q_INSTR_FAST_READ_QUAD_DTR_4B },
+		{ W25_INSTR_PAGE_PROGRAM,				W25_INSTR_PAGE_PROGRAM_4B },
+		{ W25_INSTR_QUAD_INPUT_PAGE_PROGRAM,	W25_INSTR_QUAD_INPUT_PAGE_PROGRAM_4B },
+		{ W25Q_INSTR_SECTOR_ERASE,				W25Q_INSTR_SECTOR_ERASE_4B },
+		{ W25Q_INSTR_64K_BLOCK_ERASE,			W25Q_INSTR_64K_BLOCK_ERASE_4B },
+	};
+
+	if (w25qConfig.addressMode != W25Q_ADDRESS_MODE_4B_OPCODES) {
+		return instruction;
+	}
 
-	W25q_waitForReady();
+	uint8_t translated = 0;
+	for (uint32_t i = 0; (translated == 0) && (i < sizeof(opcodes4b) / sizeof(opcodes4b[0])); i++) {
+		if (opcodes4b[i][0] == instruction) {
+			translated = opcodes4b[i][1];
+		}
+	}
+
+	return translated;
+}
+
+static uint32_t W25q_addressSize(void)
+{
+	return (w25qConfig.addressMode == W25Q_ADDRESS_MODE_3B) ? QSPI_ADDRESS_24_BITS : QSPI_ADDRESS_32_BITS;
+}
+
+static bool W25q_addressedInstructionSend(uint8_t instruction, uint32_t address)
+{
 	bool success = false;
+	uint8_t addressedInstruction = W25q_addressedInstruction(instruction);
 
-	success = QuadSpiInstruction(ptr_hqspi, W25Q_INSTR_WRITE_ENABLE);
+	if (addressedInstruction != 0) {
+		success = QuadSpiInstructionWithAddress(
+				ptr_hqspi,
+				addressedInstruction,
+				W25Q_LINEAR_TO_PAGE(address),
+				W25q_addressSize()
+				);
+	}
 
-	if(success) {
-		W25q_readStatusRegister(W25Q_INSTR_READ_STATUS_REG1, &statusReg);
+	return success;
+}
 
-		if(!(statusReg & W25Q_STATUS_REG1_WEL)) {
-			success = false;
+bool W25q_setAddressMode(W25qAddressMode mode)
+{
+	bool success = true;
+	uint8_t statusReg = 0;
+
+	if ((w25qDevice == NULL) || ((mode == W25Q_ADDRESS_MODE_4B_OPCODES) && !(w25qDevice->features & FLASH_DEVICE_FEATURE_4B_OPCODES))) {
+		return false;
+	}
+
+	// Dedicated 4-byte opcodes work in either device mode, keep the device in 3-byte mode for them
+	success = W25q_waitForReady();
+	if (success && (mode == W25Q_ADDRESS_MODE_4B_ENTERED)) {
+		success = QuadSpiInstruction(ptr_hqspi, W25Q_INSTR_ENTER_4B_MODE);
+	} else if (success) {
+		success = QuadSpiInstruction(ptr_hqspi, W25Q_INSTR_EXIT_4B_MODE);
+	}
+
+	if (success) {
+		success = W25q_readStatusRegister(W25Q_INSTR_READ_STATUS_REG3, &statusReg);
+	}
+
+	if (success && (((statusReg & W25Q_STATUS_REG3_ADS) != 0) != (mode == W25Q_ADDRESS_MODE_4B_ENTERED))) {
+		success = false;
+	}
+
+	if (success) {
+		w25qConfig.addressMode = mode;
+	}
+
+	return success;
+}
+
+bool W25q_setDtrRead(bool enable)
+{
+	bool success = true;
+
+	if (!enable) {
+		if (w25qConfig.read.ddr) {
+			w25qConfig.read = w25qConfig.sdrRead;
 		}
+	} else if ((w25qDevice == NULL) || !(w25qDevice->features & FLASH_DEVICE_FEATURE_DTR) || !w25qConfig.dtrSupported || (w25qConfig.wrapSize != 0)) {
+		success = false;
+	} else if (!w25qConfig.read.ddr) {
+		w25qConfig.sdrRead = w25qConfig.read;
+
+		w25qConfig.read.instruction		= W25Q_INSTR_FAST_READ_QUAD_DTR;
+		w25qConfig.read.dummyCycles		= W25Q_DUMMY_CYCLES_FAST_READ_QUAD_DTR;
+		w25qConfig.read.instructionMode	= QSPI_INSTRUCTION_1_LINE;
+		w25qConfig.read.addressMode		= QSPI_ADDRESS_4_LINES;
+		w25qConfig.read.dataMode		= QSPI_DATA_4_LINES;
+		w25qConfig.read.ddr				= true;
+	}
+
+	return success;
+}
+
+bool W25q_setWrapRead(uint8_t wrapSize)
+{
+	bool success = true;
+	uint8_t wrap[4] = { 0, 0, 0, W25Q_WRAP_BITS_DISABLE };	// 24 dummy bits, then W7-W0
+	QSPI_CommandTypeDef cmd;
+
+	switch (wrapSize) {
+	case 0:		break;
+	case 8:		wrap[3] = 0x00; break;
+	case 16:	wrap[3] = 0x20; break;
+	case 32:	wrap[3] = 0x40; break;
+	case 64:	wrap[3] = 0x60; break;
+	default:	success = false; break;
+	}
+
+	// Wrapping follows the quad I/O read, so it cannot be combined with a DTR read that would need it linear
+	if (success && (wrapSize != 0) && w25qConfig.read.ddr) {
+		success = false;
+	}
+
+	if (success) {
+		cmd.InstructionMode		= QSPI_INSTRUCTION_1_LINE;
+		cmd.Instruction			= W25Q_INSTR_SET_BURST_WITH_WRAP;
+		cmd.AddressMode			= QSPI_ADDRESS_NONE;
+		cmd.AlternateByteMode	= QSPI_ALTERNATE_BYTES_NONE;
+		cmd.DataMode			= QSPI_DATA_4_LINES;
+		cmd.DummyCycles			= W25Q_ZERO_DUMMY_CYCLES;
+		cmd.NbData				= sizeof(wrap);
+		cmd.DdrMode				= QSPI_DDR_MODE_DISABLE;
+		cmd.DdrHoldHalfCycle	= QSPI_DDR_HHC_ANALOG_DELAY;
+		cmd.SIOOMode			= QSPI_SIOO_INST_EVERY_CMD;
+
+		success = W25q_waitForReady() && QuadSpiTransmitCommand(ptr_hqspi, &cmd, wrap);
+	}
+
+	if (success && (wrapSize != 0) && (w25qConfig.wrapSize == 0)) {
+		// Reads that cross a line would wrap back with quad I/O, they move to Fast Read Quad Output
+		w25qConfig.wrapSavedRead = w25qConfig.read;
+
+		w25qConfig.read.instruction		= W25Q_INSTR_FAST_READ_QUAD_OUTPUT;
+		w25qConfig.read.dummyCycles		= W25Q_DUMMY_CYCLES_FAST_READ_QUAD_OUTPUT;
+		w25qConfig.read.instructionMode	= QSPI_INSTRUCTION_1_LINE;
+		w25qConfig.read.addressMode		= QSPI_ADDRESS_1_LINE;
+		w25qConfig.read.dataMode		= QSPI_DATA_4_LINES;
+		w25qConfig.read.ddr				= false;
+	} else if (success && (wrapSize == 0) && (w25qConfig.wrapSize != 0)) {
+		w25qConfig.read = w25qConfig.wrapSavedRead;
+	}
+
+	if (success) {
+		w25qConfig.wrapSize = wrapSize;
 	}
 
 	return success;
 }
 
+static void W25q_fillReadCommand(QSPI_CommandTypeDef *cmd, uint32_t address, uint32_t length)
+{
+	cmd->InstructionMode	= w25qConfig.read.instructionMode;
+	cmd->Instruction		= W25q_addressedInstruction(w25qConfig.read.instruction);
+	cmd->AddressMode		= w25qConfig.read.addressMode;
+	cmd->AddressSize		= W25q_addressSize();
+	cmd->Address			= address;
+	cmd->AlternateByteMode	= QSPI_ALTERNATE_BYTES_NONE;
+	cmd->DataMode			= w25qConfig.read.dataMode;
+	cmd->DummyCycles		= w25qConfig.read.dummyCycles;
+	cmd->NbData				= length;
+	cmd->DdrMode			= w25qConfig.read.ddr ? QSPI_DDR_MODE_ENABLE : QSPI_DDR_MODE_DISABLE;
+	cmd->DdrHoldHalfCycle	= w25qConfig.read.ddr ? W25Q_DTR_HOLD_HALF_CYCLE : QSPI_DDR_HHC_ANALOG_DELAY;
+	cmd->SIOOMode			= QSPI_SIOO_INST_EVERY_CMD;
+}
+
+//! Quad I/O read, the one the wrap setting applies to
+static void W25q_fillWrapReadCommand(QSPI_CommandTypeDef *cmd, uint32_t address, uint32_t length)
+{
+	cmd->InstructionMode	= QSPI_INSTRUCTION_1_LINE;
+	cmd->Instruction		= W25q_addressedInstruction(W25Q_INSTR_FAST_READ_QUAD);
+	cmd->AddressMode		= QSPI_ADDRESS_4_LINES;
+	cmd->AddressSize		= W25q_addressSize();
+	cmd->Address			= address;
+	cmd->AlternateByteMode	= QSPI_ALTERNATE_BYTES_NONE;
+	cmd->DataMode			= QSPI_DATA_4_LINES;
+	cmd->DummyCycles		= W25Q_DUMMY_CYCLES_FAST_READ_QUAD;
+	cmd->NbData				= length;
+	cmd->DdrMode			= QSPI_DDR_MODE_DISABLE;
+	cmd->DdrHoldHalfCycle	= QSPI_DDR_HHC_ANALOG_DELAY;
+	cmd->SIOOMode			= QSPI_SIOO_INST_EVERY_CMD;
+}
+
+//! Up to one wrap line from address on, the device wraps to the line start after its end
+static bool W25q_receiveWrapped(uint32_t address, FlashIoCursor *cursor, uint32_t length)
+{
+	QSPI_CommandTypeDef cmd;
+
+	if (!W25q_selectAddressDie(address) || !W25q_waitForReady()) {
+		return false;
+	}
+
+	W25q_fillWrapReadCommand(&cmd, W25Q_LINEAR_TO_PAGE(address), length);
+
+	return QuadSpiReceiveCursor(ptr_hqspi, &cmd, cursor);
+}
+
+void W25q_readJedec(uint8_t* idBuffer) {
+	FlashDevice_readJedec(ptr_hqspi, FLASH_DEVICE_TYPE_NOR, idBuffer);
+}
+
+bool W25q_writeEnable(void)
+{
+	return FlashDevice_writeEnable(ptr_hqspi, FLASH_DEVICE_TYPE_NOR);
+}
+
 bool W25q_quadEnable(void) {
 
 	bool success = false;
@@ -81,6 +660,13 @@ bool W25q_quadEnable(void) {
 	uint16_t length = 1u;
 	uint8_t statusRegister;
 
+#ifndef FLASH_DEVICE_STRICT_CHECKS
+	// QE is non-volatile, once seen set there is nothing to write or verify
+	if (w25qQuadEnabled) {
+		return true;
+	}
+#endif
+
 	success = W25q_writeEnable();
 
 	if (success) {
@@ -98,6 +684,8 @@ bool W25q_quadEnable(void) {
 		success = false;
 	}
 
+	w25qQuadEnabled = success;
+
 	return success;
 }
 
@@ -127,35 +715,97 @@ bool W25q_writeStatusRegister(uint8_t instruction, uint8_t statusRegister)
 				);
 	}
 
+	if (instruction == W25Q_INSTR_WRITE_STATUS_REG2) {
+		w25qQuadEnabled = false;
+	}
+
 	return success;
 }
 
-void W25q_waitForReady(void)
+bool W25q_waitForReady(void)
 {
-	uint8_t statusReg;
-	W25q_readStatusRegister(W25Q_INSTR_READ_STATUS_REG1, &statusReg);
+	// Status of a part that never identified means nothing, an empty bus reads busy forever
+	if (w25qDevice == NULL) {
+		return false;
+	}
+
+	return FlashDevice_waitForReady(ptr_hqspi, FLASH_DEVICE_TYPE_NOR);
+}
 
-	while (statusReg & W25Q_STATUS_REG1_BUSY) {
-		W25q_readStatusRegister(W25Q_INSTR_READ_STATUS_REG1, &statusReg);
+bool W25q_waitForReadyTimeout(uint32_t typicalMs, uint32_t maxMs)
+{
+	uint32_t start = HAL_GetTick();
+	uint32_t statsStart = FLASH_STATS_NOW();
+	uint32_t polls = 0;
+	uint8_t statusReg = W25Q_STATUS_REG1_BUSY;
+
+	// Don't hammer the bus with status reads for an operation that can't be done yet
+	if (typicalMs > 1) {
+		HAL_Delay(typicalMs - 1);
 	}
+
+	bool success = W25q_readStatusRegister(W25Q_INSTR_READ_STATUS_REG1, &statusReg);
+
+	while (success && (statusReg & W25Q_STATUS_REG1_BUSY)) {
+		if ((HAL_GetTick() - start) > maxMs) {
+			success = false;
+		} else {
+			FLASH_STATS_POLL(polls);
+			success = W25q_readStatusRegister(W25Q_INSTR_READ_STATUS_REG1, &statusReg);
+		}
+	}
+
+	FLASH_STATS_WAIT(statsStart, polls, !success);
+
+	if (success) {
+		FlashDevice_markIdle(FLASH_DEVICE_TYPE_NOR);
+	}
+
+	return success;
+}
+
+bool W25q_readBytesWithDummyCycles(uint32_t address, uint8_t *buffer, uint32_t length, uint8_t dummyCycles)
+{
+	QSPI_CommandTypeDef cmd;
+
+	if (!W25q_selectAddressDie(address)) {
+		return false;
+	}
+
+	W25q_fillReadCommand(&cmd, W25Q_LINEAR_TO_PAGE(address), length);
+	cmd.DummyCycles = dummyCycles;
+
+	return QuadSpiReceiveCommand(ptr_hqspi, &cmd, buffer);
+}
+
+void W25q_setReadDummyCycles(uint8_t dummyCycles)
+{
+	w25qConfig.read.dummyCycles = dummyCycles;
 }
 
 bool W25q_readBytes(uint32_t address, uint8_t *buffer, uint32_t length)
 {
 	bool success = false;
-	uint32_t pageAddress = W25Q_LINEAR_TO_PAGE(address);
+	QSPI_CommandTypeDef cmd;
+
+	// A miss inside one line starts the quad I/O wrap read at the missed byte and ends before the read wraps,
+	// only reads crossing a line sit on the linear 0x6B while wrap is on
+	if ((w25qConfig.wrapSize != 0) && (length != 0) &&
+			((address & (w25qConfig.wrapSize - 1u)) + length <= w25qConfig.wrapSize)) {
+		FlashIoVec iov = { buffer, length };
+		FlashIoCursor cursor;
 
-	W25q_waitForReady();
+		FlashIoCursor_init(&cursor, &iov, 1);
 
-	success = QuadSpiReceiveWithAddress4LINES(
-			ptr_hqspi,
-			W25Q_INSTR_FAST_READ_QUAD,
-			W25Q_DUMMY_CYCLES_FAST_READ_QUAD,
-			pageAddress,
-			QSPI_ADDRESS_24_BITS,
-			buffer,
-			length
-			);
+		return W25q_receiveWrapped(address, &cursor, length);
+	}
+
+	success = W25q_selectAddressDie(address) && W25q_waitForReady();
+
+	if (success) {
+		W25q_fillReadCommand(&cmd, W25Q_LINEAR_TO_PAGE(address), length);
+		success = QuadSpiReceiveCommand(ptr_hqspi, &cmd, buffer);
+	}
 
 	return success;
 }
@@ -164,18 +814,11 @@ bool W25q_sectorErase(uint32_t address)
 {
 	bool success = false;
 
-	uint32_t pageAddress = W25Q_LINEAR_TO_PAGE(address);
-
-	success = W25q_writeEnable();
-	W25q_waitForReady();
+	success = W25q_selectAddressDie(address) && W25q_writeEnable();
+	FlashDevice_strictWaitForReady(ptr_hqspi, FLASH_DEVICE_TYPE_NOR);
 
 	if(success) {
-		success = QuadSpiInstructionWithAddress(
-				ptr_hqspi,
-				W25Q_INSTR_SECTOR_ERASE,
-				pageAddress,
-				QSPI_ADDRESS_24_BITS
-				);
+		success = W25q_addressedInstructionSend(W25Q_INSTR_SECTOR_ERASE, address);
 	}
 
 	return success;
@@ -186,18 +829,26 @@ bool W25q_blockErase32k(uint32_t address)
 {
 	bool success = false;
 
-	uint32_t pageAddress = W25Q_LINEAR_TO_PAGE(address);
+	// There is no 4-byte 32KB erase, above 16MB in opcode mode fall back to its sectors
+	if((w25qConfig.addressMode == W25Q_ADDRESS_MODE_4B_OPCODES) && (W25Q_LINEAR_TO_PAGE(address) >= W25Q_3B_ADDRESS_LIMIT)) {
+		uint32_t blockAddress = address & ~(W25Q_32K_BLOCK_SIZE - 1u);
 
-	success = W25q_writeEnable();
-	W25q_waitForReady();
+		success = true;
+		for(uint32_t offset = 0; success && (offset < W25Q_32K_BLOCK_SIZE); offset += W25Q_SECTOR_SIZE) {
+			success = W25q_sectorErase(blockAddress + offset);
+		}
 
-	if(success) {
-		success = QuadSpiInstructionWithAddress(
-				ptr_hqspi,
-				W25Q_INSTR_32K_BLOCK_ERASE,
-				pageAddress,
-				QSPI_ADDRESS_24_BITS
-				);
+		return success;
+	}
+
+	success = W25q_selectAddressDie(address) && W25q_writeEnable();
+	FlashDevice_strictWaitForReady(ptr_hqspi, FLASH_DEVICE_TYPE_NOR);
+
+	if(success && (w25qConfig.addressMode == W25Q_ADDRESS_MODE_4B_OPCODES)) {
+		// The device stays in 3-byte mode, below 16MB the plain opcode still reaches the block
+		success = QuadSpiInstructionWithAddress(ptr_hqspi, W25Q_INSTR_32K_BLOCK_ERASE, W25Q_LINEAR_TO_PAGE(address), QSPI_ADDRESS_24_BITS);
+	} else if(success) {
+		success = W25q_addressedInstructionSend(W25Q_INSTR_32K_BLOCK_ERASE, address);
 	}
 
 	return success;
@@ -207,18 +858,11 @@ bool W25q_blockErase64k(uint32_t address)
 {
 	bool success = false;
 
-	uint32_t pageAddress = W25Q_LINEAR_TO_PAGE(address);
-
-	success = W25q_writeEnable();
-	W25q_waitForReady();
+	success = W25q_selectAddressDie(address) && W25q_writeEnable();
+	FlashDevice_strictWaitForReady(ptr_hqspi, FLASH_DEVICE_TYPE_NOR);
 
 	if(success) {
-		success = QuadSpiInstructionWithAddress(
-				ptr_hqspi,
-				W25Q_INSTR_64K_BLOCK_ERASE,
-				pageAddress,
-				QSPI_ADDRESS_24_BITS
-				);
+		success = W25q_addressedInstructionSend(W25Q_INSTR_64K_BLOCK_ERASE, address);
 	}
 
 	return success;
@@ -228,14 +872,17 @@ bool W25q_flexibleSizeErase(uint32_t size, uint32_t address)
 {
 	bool success = true;
 
-	if(size <= W25Q_32K_BLOCK_SIZE) {
+	if(w25qDevice == NULL) {
+		success = false;
+
+	} else if(size <= W25Q_32K_BLOCK_SIZE) {
 		success = W25q_blockErase32k(address);
 
 	} else if (size <= W25Q_64K_BLOCK_SIZE) {
 
 		success = W25q_blockErase64k(address);
 
-	} else if (size <= W25Q_CHIP_SIZE) {
+	} else if (size <= FlashDevice_totalCapacity(w25qDevice)) {
 
 		uint32_t numberOf64Blocks = size / W25Q_64K_BLOCK_SIZE;
 
@@ -253,15 +900,80 @@ bool W25q_flexibleSizeErase(uint32_t size, uint32_t address)
 	return success;
 }
 
+//! Starts the erase W25q_eraseRange picks at address, next is where the unit ends
+static const SfdpEraseType *W25q_startEraseUnit(uint32_t address, uint32_t end, uint32_t *next)
+{
+	// Stacked parts: erase units never straddle a die, stop the chunk at the die end
+	uint32_t die = FlashDevice_addressToDie(w25qDevice, address);
+	uint32_t dieEnd = (die + 1u) << FlashDevice_capacityShift(w25qDevice);
+	uint32_t chunkEnd = ((dieEnd != 0) && (dieEnd < end)) ? dieEnd : end;
+
+	// Largest erase type that is aligned here and doesn't run past the end, else the smallest one.
+	// Like W25q_sectorErase, an unaligned edge erases the whole unit containing it.
+	const SfdpEraseType *type = NULL;
+	for (uint32_t i = 0; i < SFDP_ERASE_TYPES; i++) {
+		const SfdpEraseType *candidate = &w25qConfig.erase[i];
+
+		if ((candidate->size == 0) || (W25q_addressedInstruction(candidate->instruction) == 0)) {
+			continue;
+		}
+
+		if ((type == NULL) || (((address & (candidate->size - 1u)) == 0) && (candidate->size <= (chunkEnd - address)))) {
+			type = candidate;
+		}
+	}
+
+	if (type != NULL) {
+		uint32_t eraseAddress = address & ~(type->size - 1u);
+
+		*next = eraseAddress + type->size;
+
+		if (!W25q_selectDie(die) || !W25q_writeEnable() || !W25q_addressedInstructionSend(type->instruction, eraseAddress)) {
+			type = NULL;
+		}
+	}
+
+	return type;
+}
+
+bool W25q_eraseRange(uint32_t address, uint32_t length)
+{
+	bool success = (w25qDevice != NULL);
+	uint32_t end = address + length;
+
+	while (success && (address < end)) {
+		const SfdpEraseType *type = W25q_startEraseUnit(address, end, &address);
+
+		success = (type != NULL) && W25q_waitForReadyTimeout(type->typicalMs, type->maxMs);
+	}
+
+	return success;
+}
+
+uint32_t W25q_startEraseRange(uint32_t address, uint32_t length)
+{
+	uint32_t next = address;
+
+	if ((w25qDevice == NULL) || (length == 0) || (W25q_startEraseUnit(address, address + length, &next) == NULL)) {
+		return 0;
+	}
+
+	return next - address;
+}
+
 bool W25q_chipErase(void)
 {
-	bool success = false;
+	bool success = (w25qDevice != NULL);
 
-	success = W25q_writeEnable();
-	W25q_waitForReady();
+	// Chip erase only covers the selected die, start it on every die so they erase side by side
+	for (uint8_t die = 0; success && (die < w25qDevice->dieCount); die++) {
+		success = W25q_selectDie(die) && W25q_writeEnable();
+		FlashDevice_strictWaitForReady(ptr_hqspi, FLASH_DEVICE_TYPE_NOR);
 
-	if(success){
-		success = QuadSpiInstruction(ptr_hqspi, W25Q_CHIP_ERASE);
+		if(success){
+			success = QuadSpiInstruction(ptr_hqspi, W25Q_CHIP_ERASE);
+			FlashDevice_expectBusy(FLASH_DEVICE_TYPE_NOR, w25qConfig.chipEraseMaxMs);
+		}
 	}
 
 	return success;
@@ -271,7 +983,10 @@ bool W25q_dynamicErase(uint32_t firmwareSize, uint32_t flashAddress)
 {
 	bool success = true;
 
-	if(firmwareSize <= W25Q_32K_BLOCK_SIZE) {
+	if(w25qDevice == NULL) {
+		success = false;
+
+	} else if(firmwareSize <= W25Q_32K_BLOCK_SIZE) {
 
 		success = W25q_blockErase32k(flashAddress);
 
@@ -279,7 +994,7 @@ bool W25q_dynamicErase(uint32_t firmwareSize, uint32_t flashAddress)
 
 		success = W25q_blockErase64k(flashAddress);
 
-	} else if (firmwareSize <= FLASH_SIZE) {
+	} else if (firmwareSize <= FlashDevice_totalCapacity(w25qDevice)) {
 
 		uint32_t numberOf64Blocks = firmwareSize / W25Q_64K_BLOCK_SIZE;
 
@@ -301,21 +1016,21 @@ bool W25q_quadPageProgram(uint32_t address, uint8_t *buffer, uint32_t length)
 {
 	bool success = false;
 
-	if(length <= W25Q_PAGE_SIZE) {
+	if((w25qDevice != NULL) && (length <= FlashDevice_pageSize(w25qDevice))) {
 
 		uint32_t pageAddress = W25Q_LINEAR_TO_PAGE(address);
 
-		success = W25q_writeEnable();
+		success = W25q_selectAddressDie(address) && W25q_writeEnable();
 
-		W25q_waitForReady();
+		FlashDevice_strictWaitForReady(ptr_hqspi, FLASH_DEVICE_TYPE_NOR);
 
 		if(success) {
 			success = QuadSpiTransmitWithAddress4Line(
 					ptr_hqspi,
-					W25_INSTR_QUAD_INPUT_PAGE_PROGRAM,
+					W25q_addressedInstruction(W25_INSTR_QUAD_INPUT_PAGE_PROGRAM),
 					W25Q_ZERO_DUMMY_CYCLES,
 					pageAddress,
-					QSPI_ADDRESS_24_BITS,
+					W25q_addressSize(),
 					buffer,
 					length
 					);
@@ -328,32 +1043,296 @@ bool W25q_quadPageProgram(uint32_t address, uint8_t *buffer, uint32_t length)
 	return success;
 }
 
-bool W25q_memoryMappedModeEnable(void)
+static void W25q_fillProgramCommand(QSPI_CommandTypeDef *cmd, uint32_t address, uint32_t length)
+{
+	cmd->InstructionMode	= QSPI_INSTRUCTION_1_LINE;
+	cmd->Instruction		= W25q_addressedInstruction(W25_INSTR_QUAD_INPUT_PAGE_PROGRAM);
+	cmd->AddressMode		= QSPI_ADDRESS_1_LINE;
+	cmd->AddressSize		= W25q_addressSize();
+	cmd->Address			= W25Q_LINEAR_TO_PAGE(address);
+	cmd->AlternateByteMode	= QSPI_ALTERNATE_BYTES_NONE;
+	cmd->DataMode			= QSPI_DATA_4_LINES;
+	cmd->DummyCycles		= W25Q_ZERO_DUMMY_CYCLES;
+	cmd->NbData				= length;
+	cmd->DdrMode			= QSPI_DDR_MODE_DISABLE;
+	cmd->DdrHoldHalfCycle	= QSPI_DDR_HHC_ANALOG_DELAY;
+	cmd->SIOOMode			= QSPI_SIOO_INST_EVERY_CMD;
+}
+
+bool W25q_writeVector(uint32_t address, const FlashIoVec *iov, uint32_t count)
+{
+	bool success = (w25qDevice != NULL);
+	bool programming = false;
+	FlashIoCursor cursor;
+	QSPI_CommandTypeDef cmd;
+	uint32_t length = FlashIoVec_totalLength(iov, count);
+
+	FlashIoCursor_init(&cursor, iov, count);
+
+	// Each page program pulls its bytes from however many fragments it spans, nothing is staged
+	while(success && (length > 0)) {
+		uint32_t chunk = FlashDevice_pageChunk(w25qDevice, address, length);
+
+		if (programming) {
+			success = W25q_waitForProgram();
+		}
+
+		success = success && W25q_selectAddressDie(address) && W25q_writeEnable();
+		programming = true;
+
+		if(success) {
+			W25q_fillProgramCommand(&cmd, address, chunk);
+			success = QuadSpiTransmitCursor(ptr_hqspi, &cmd, &cursor);
+		}
+
+		address += chunk;
+		length -= chunk;
+	}
+
+	return success;
+}
+
+bool W25q_readVector(uint32_t address, const FlashIoVec *iov, uint32_t count)
+{
+	FlashIoCursor cursor;
+	QSPI_CommandTypeDef cmd;
+	uint32_t length = FlashIoVec_totalLength(iov, count);
+
+	// NbData 0 would read on until the end of the part
+	if (length == 0) {
+		return true;
+	}
+
+	FlashIoCursor_init(&cursor, iov, count);
+	if (!W25q_selectAddressDie(address) || !W25q_waitForReady()) {
+		return false;
+	}
+
+	W25q_fillReadCommand(&cmd, W25Q_LINEAR_TO_PAGE(address), length);
+
+	return QuadSpiReceiveCursor(ptr_hqspi, &cmd, &cursor);
+}
+
+bool W25q_readWrapped(uint32_t address, uint8_t *line)
+{
+	uint32_t wrapSize = w25qConfig.wrapSize;
+	uint32_t offset = address & (wrapSize - 1u);
+	FlashIoCursor cursor;
+
+	if (wrapSize == 0) {
+		return false;
+	}
+
+	// The device returns address..end of line, then wraps to the line start, put each part where it belongs
+	FlashIoVec iov[2] = {
+		{ &line[offset],	wrapSize - offset },
+		{ &line[0],			offset },
+	};
+
+	FlashIoCursor_init(&cursor, iov, 2);
+
+	return W25q_receiveWrapped(address, &cursor, wrapSize);
+}
+
+bool W25q_readBytesAsync(uint32_t address, uint8_t *buffer, uint32_t length, QuadSpiDmaDone done, void *context)
+{
+	QSPI_CommandTypeDef cmd;
+
+	if (!W25q_selectAddressDie(address) || !W25q_waitForReady()) {
+		return false;
+	}
+	W25q_fillReadCommand(&cmd, W25Q_LINEAR_TO_PAGE(address), length);
+
+	return QuadSpiDma_receive(&cmd, buffer, done, context);
+}
+
+bool W25q_quadPageProgramAsync(uint32_t address, const uint8_t *buffer, uint32_t length, QuadSpiDmaDone done, void *context)
+{
+	bool success = false;
+	QSPI_CommandTypeDef cmd;
+
+	if((w25qDevice != NULL) && (length <= FlashDevice_pageSize(w25qDevice))) {
+		// W25q_writeEnable waits for the part itself
+		success = W25q_selectAddressDie(address) && W25q_writeEnable();
+
+		if(success) {
+			W25q_fillProgramCommand(&cmd, address, length);
+			success = QuadSpiDma_transmit(&cmd, buffer, done, context);
+		}
+	}
+
+	return success;
+}
+
+uint32_t W25q_fillProgramOps(QuadSpiOp *ops, uint32_t maxOps, uint32_t address, const uint8_t *buffer, uint32_t length)
+{
+	uint32_t count = 0;
+
+	if((w25qDevice == NULL) || (maxOps < 1)) {
+		return 0;
+	}
+
+	QuadSpiQueue_pollOp(&ops[count++], W25Q_INSTR_READ_STATUS_REG1, W25Q_STATUS_REG1_BUSY, 0);
+
+	while(length > 0) {
+		uint32_t chunk = FlashDevice_pageChunk(w25qDevice, address, length);
+
+		if((count + W25Q_PROGRAM_OPS_PER_PAGE) > maxOps) {
+			return 0;
+		}
+
+		QuadSpiQueue_commandOp(&ops[count++], W25Q_INSTR_WRITE_ENABLE);
+
+		ops[count].type = QUADSPI_OP_TRANSMIT;
+		ops[count].data = (uint8_t *)buffer;
+		W25q_fillProgramCommand(&ops[count].cmd, address, chunk);
+		count++;
+
+		QuadSpiQueue_pollOp(&ops[count++], W25Q_INSTR_READ_STATUS_REG1, W25Q_STATUS_REG1_BUSY, 0);
+
+		address += chunk;
+		buffer += chunk;
+		length -= chunk;
+	}
+
+	return count;
+}
+
+bool W25q_startPageProgram(uint32_t address, const uint8_t *buffer, uint32_t length)
+{
+	bool success = false;
+	QSPI_CommandTypeDef cmd;
+
+	// No ready wait and no WEL read-back, the caller has already seen the part idle
+	if((w25qDevice != NULL) && (length <= FlashDevice_pageSize(w25qDevice))) {
+		success = W25q_selectAddressDie(address) && QuadSpiInstruction(ptr_hqspi, W25Q_INSTR_WRITE_ENABLE);
+		FlashDevice_invalidateShadow(FLASH_DEVICE_TYPE_NOR);
+
+		if(success) {
+			W25q_fillProgramCommand(&cmd, address, length);
+			success = QuadSpiTransmitCommand(ptr_hqspi, &cmd, buffer);
+		}
+	}
+
+	return success;
+}
+
+bool W25q_waitForReadyPolled(uint32_t timeoutMs)
 {
-	bool success = true;
 	QSPI_CommandTypeDef cmd;
-	QSPI_MemoryMappedTypeDef memMappedCfg;
 
 	cmd.InstructionMode		= QSPI_INSTRUCTION_1_LINE;
-	cmd.Instruction			= W25Q_INSTR_FAST_READ_QUAD;
+	cmd.Instruction			= W25Q_INSTR_READ_STATUS_REG1;
+	cmd.AddressMode			= QSPI_ADDRESS_NONE;
 	cmd.AlternateByteMode	= QSPI_ALTERNATE_BYTES_NONE;
-	cmd.DataMode			= QSPI_DATA_4_LINES;
+	cmd.DataMode			= QSPI_DATA_1_LINE;
+	cmd.DummyCycles			= W25Q_ZERO_DUMMY_CYCLES;
+	cmd.NbData				= 1;
 	cmd.DdrMode				= QSPI_DDR_MODE_DISABLE;
 	cmd.DdrHoldHalfCycle	= QSPI_DDR_HHC_ANALOG_DELAY;
-	cmd.AddressMode			= QSPI_ADDRESS_4_LINES;
-	cmd.AddressSize			= QSPI_ADDRESS_24_BITS;
-	cmd.DummyCycles			= W25Q_DUMMY_CYCLES_FAST_READ_QUAD;
 	cmd.SIOOMode			= QSPI_SIOO_INST_EVERY_CMD;
 
-	memMappedCfg.TimeOutActivation = QSPI_TIMEOUT_COUNTER_DISABLE;
-	memMappedCfg.TimeOutPeriod = 0;
+	bool success = QuadSpiAutoPoll(ptr_hqspi, &cmd, W25Q_STATUS_REG1_BUSY, 0, timeoutMs);
+
+	if (success) {
+		FlashDevice_markIdle(FLASH_DEVICE_TYPE_NOR);
+	}
+
+	return success;
+}
+
+bool W25q_waitForProgram(void)
+{
+	// A page program takes well under a millisecond, round the maximum up to whole ticks
+	return W25q_waitForReadyPolled((w25qConfig.pageProgramMaxUs / 1000u) + 1u);
+}
+
+bool W25q_waitForChipErase(void)
+{
+	bool success = (w25qDevice != NULL);
+
+	if (w25qConfig.chipEraseTypicalMs > 1) {
+		HAL_Delay(w25qConfig.chipEraseTypicalMs - 1);
+	}
+
+	// W25q_chipErase started every die at once, each one has to report idle
+	for (uint8_t die = 0; success && (die < w25qDevice->dieCount); die++) {
+		success = W25q_selectDie(die) && W25q_waitForReadyPolled(w25qConfig.chipEraseMaxMs);
+	}
+
+	return success;
+}
+
+bool W25q_writeBytes(uint32_t address, const uint8_t *buffer, uint32_t length)
+{
+	bool success = (w25qDevice != NULL);
+	bool programming = false;
+
+	while(success && (length > 0)) {
+		uint32_t chunk = FlashDevice_pageChunk(w25qDevice, address, length);
+
+		// A page that never finishes fails here instead of hanging the next write enable
+		if (programming) {
+			success = W25q_waitForProgram();
+		}
+
+		success = success && W25q_quadPageProgram(address, (uint8_t *)buffer, chunk);
+		programming = true;
+
+		address += chunk;
+		buffer += chunk;
+		length -= chunk;
+	}
 
-	W25q_waitForReady();
+	return success;
+}
 
-	if (HAL_QSPI_MemoryMapped(ptr_hqspi, &cmd, &memMappedCfg) != HAL_OK)
+bool W25q_memoryMappedModeEnable(void)
+{
+	bool success = true;
+	QSPI_CommandTypeDef cmd;
+	QSPI_MemoryMappedTypeDef memMappedCfg;
+
+	if (w25qConfig.wrapSize == W25Q_WRAP_CACHE_LINE) {
+		// Every line fill is its own wrapped read from the missed word, chip select goes high after it
+		// so the controller never streams on into a burst that would start over at the line base
+		W25q_fillWrapReadCommand(&cmd, 0, 0);
+		memMappedCfg.TimeOutActivation = QSPI_TIMEOUT_COUNTER_ENABLE;
+		memMappedCfg.TimeOutPeriod = 1;
+	} else {
+		W25q_fillReadCommand(&cmd, 0, 0);
+		memMappedCfg.TimeOutActivation = QSPI_TIMEOUT_COUNTER_DISABLE;
+		memMappedCfg.TimeOutPeriod = 0;
+	}
+
+	if (!W25q_waitForReady() || (HAL_QSPI_MemoryMapped(ptr_hqspi, &cmd, &memMappedCfg) != HAL_OK))
 	{
 		success = false;
 	}
 
+	w25qMemoryMapped = success;
+
 	return success;
 }
+
+bool W25q_memoryMappedModeDisable(void)
+{
+	bool success = true;
+
+	// Abort is the only way out of memory-mapped mode, it also drops any prefetch in flight
+	if (w25qMemoryMapped && (HAL_QSPI_Abort(ptr_hqspi) != HAL_OK))
+	{
+		success = false;
+	}
+
+	if (success) {
+		w25qMemoryMapped = false;
+	}
+
+	return success;
+}
+
+bool W25q_isMemoryMapped(void)
+{
+	return w25qMemoryMapped;
+}
@@ -0,0 +1,196 @@
+/*
+ * This program is memory-mapped/indirect mode manager for W25Q.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "w25qmode.h"
+
+#define W25Q_MODE_CACHE_LINE	32u
+
+static bool w25qModeLazyRemap = false;
+static uint32_t w25qModeNesting = 0;
+static volatile uint32_t w25qModeEpoch = 0;
+static uint32_t w25qModeDirtyStart = 0;
+static uint32_t w25qModeDirtyEnd = 0;
+static W25qModeStats w25qModeStats;
+
+static void W25qMode_markDirty(uint32_t address, uint32_t length)
+{
+	if (w25qModeDirtyEnd == w25qModeDirtyStart) {
+		w25qModeDirtyStart = address;
+		w25qModeDirtyEnd = address + length;
+	} else {
+		if (address < w25qModeDirtyStart) {
+			w25qModeDirtyStart = address;
+		}
+		if ((address + length) > w25qModeDirtyEnd) {
+			w25qModeDirtyEnd = address + length;
+		}
+	}
+}
+
+static bool W25qMode_remap(void)
+{
+	bool success = W25q_isMemoryMapped();
+
+	if (!success) {
+		success = W25q_memoryMappedModeEnable();
+
+		if (success) {
+			w25qModeStats.remaps++;
+		} else {
+			w25qModeStats.failedRemaps++;
+		}
+	}
+
+	return success;
+}
+
+bool W25qMode_init(bool lazyRemap)
+{
+	w25qModeLazyRemap = lazyRemap;
+	w25qModeNesting = 0;
+	w25qModeDirtyStart = 0;
+	w25qModeDirtyEnd = 0;
+	memset(&w25qModeStats, 0, sizeof(w25qModeStats));
+
+	return W25qMode_remap();
+}
+
+bool W25qMode_beginUpdate(void)
+{
+	bool success = true;
+
+	// Nested updates share one switch, so a batch of writes costs a single unmap/remap pair
+	if (w25qModeNesting == 0) {
+		if (W25q_isMemoryMapped()) {
+			success = W25q_memoryMappedModeDisable();
+
+			if (success) {
+				w25qModeStats.unmaps++;
+			}
+		}
+	}
+
+	if (success) {
+		w25qModeNesting++;
+	}
+
+	return success;
+}
+
+bool W25qMode_endUpdate(void)
+{
+	bool success = true;
+
+	if (w25qModeNesting == 0) {
+		return false;
+	}
+
+	w25qModeNesting--;
+
+	if (w25qModeNesting == 0) {
+		success = W25q_waitForReady();
+
+		if (w25qModeDirtyEnd != w25qModeDirtyStart) {
+			// Lines fetched through the mapping before the update are stale now
+			uint32_t first = w25qModeDirtyStart & ~(W25Q_MODE_CACHE_LINE - 1u);
+			uint32_t last = (w25qModeDirtyEnd + W25Q_MODE_CACHE_LINE - 1u) & ~(W25Q_MODE_CACHE_LINE - 1u);
+
+			SCB_InvalidateDCache_by_Addr((void *)(W25Q_MAPPED_BASE + first), (int32_t)(last - first));
+			SCB_InvalidateICache();
+
+			w25qModeDirtyStart = 0;
+			w25qModeDirtyEnd = 0;
+			w25qModeEpoch++;
+		}
+
+		if (success && !w25qModeLazyRemap) {
+			success = W25qMode_remap();
+		}
+	}
+
+	return success;
+}
+
+bool W25qMode_writeBytes(uint32_t address, const uint8_t *buffer, uint32_t length)
+{
+	bool success = W25qMode_beginUpdate();
+
+	if (success) {
+		W25qMode_markDirty(address, length);
+		w25qModeStats.updates++;
+		success = W25q_writeBytes(address, buffer, length);
+
+		success = W25qMode_endUpdate() && success;
+	}
+
+	return success;
+}
+
+bool W25qMode_eraseRange(uint32_t address, uint32_t length)
+{
+	bool success = W25qMode_beginUpdate();
+
+	if (success) {
+		W25qMode_markDirty(address, length);
+		w25qModeStats.updates++;
+		success = W25q_eraseRange(address, length);
+
+		success = W25qMode_endUpdate() && success;
+	}
+
+	return success;
+}
+
+bool W25qMode_readBytes(uint32_t address, uint8_t *buffer, uint32_t length)
+{
+	bool success = true;
+
+	// Inside an update the bus is in indirect mode anyway, remapping for one read would cost two switches
+	if ((w25qModeNesting > 0) || !W25qMode_remap()) {
+		success = W25q_readBytes(address, buffer, length);
+	} else {
+		memcpy(buffer, (const void *)(W25Q_MAPPED_BASE + address), length);
+	}
+
+	return success;
+}
+
+const uint8_t *W25qMode_map(uint32_t address)
+{
+	const uint8_t *mapped = NULL;
+
+	if ((w25qModeNesting == 0) && W25qMode_remap()) {
+		mapped = (const uint8_t *)(W25Q_MAPPED_BASE + address);
+	}
+
+	return mapped;
+}
+
+uint32_t W25qMode_epoch(void)
+{
+	return w25qModeEpoch;
+}
+
+const W25qModeStats *W25qMode_getStats(void)
+{
+	return &w25qModeStats;
+}
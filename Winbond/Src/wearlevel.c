@@ -0,0 +1,337 @@
+/*
+ * This program is sector wear leveling for W25Q NOR flash.
+ * Copyright (C) 2020  Igor Misic, igy1000mb@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ *
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+
+#include "wearlevel.h"
+
+#define WEAR_LEVEL_STALE			0xFFFE	//!< Mount only: sector to recycle, erase count known
+#define WEAR_LEVEL_UNKNOWN			0xFFFD	//!< Mount only: sector without a valid header
+#define WEAR_LEVEL_COPY_CHUNK		256
+
+#ifndef FLASH_HOST_BUILD
+#include "w25q.h"
+
+static bool WearLevel_w25qRead(void *context, uint32_t address, uint8_t *buffer, uint32_t length)
+{
+	return W25q_readBytes(address, buffer, length);
+}
+
+static bool WearLevel_w25qProgram(void *context, uint32_t address, const uint8_t *buffer, uint32_t length)
+{
+	return W25q_writeBytes(address, buffer, length);
+}
+
+static bool WearLevel_w25qEraseSector(void *context, uint32_t address)
+{
+	return W25q_sectorErase(address);
+}
+
+const WearLevelIo WearLevel_w25qIo = {
+	.read			= WearLevel_w25qRead,
+	.program		= WearLevel_w25qProgram,
+	.eraseSector	= WearLevel_w25qEraseSector,
+	.context		= NULL,
+};
+#endif
+
+static uint32_t WearLevel_address(const WearLevel *wl, uint32_t physical)
+{
+	return wl->base + (physical * WEAR_LEVEL_SECTOR_SIZE);
+}
+
+static bool WearLevel_writeHeader(WearLevel *wl, uint32_t physical, uint16_t logical, uint16_t flags, uint32_t version)
+{
+	uint32_t header[4];
+
+	header[0] = WEAR_LEVEL_MAGIC;
+	header[1] = logical | ((uint32_t)flags << 16);
+	header[2] = wl->eraseCount[physical];
+	header[3] = version;
+
+	wl->stats.headerWrites++;
+	return wl->io->program(wl->io->context, WearLevel_address(wl, physical), (const uint8_t *)header, sizeof(header));
+}
+
+//! Erases a physical sector and writes its free header back with the incremented erase count
+static bool WearLevel_recycle(WearLevel *wl, uint32_t physical)
+{
+	// Kept out of the pool until the erase succeeds
+	wl->owner[physical] = WEAR_LEVEL_STALE;
+	wl->version[physical] = 0xFFFFFFFF;
+
+	if (!wl->io->eraseSector(wl->io->context, WearLevel_address(wl, physical))) {
+		return false;
+	}
+	wl->owner[physical] = WEAR_LEVEL_UNMAPPED;
+	wl->eraseCount[physical]++;
+	wl->stats.erases++;
+
+	return WearLevel_writeHeader(wl, physical, WEAR_LEVEL_UNMAPPED, 0xFFFF, 0xFFFFFFFF);
+}
+
+//! Free sector with the lowest (coldest) or highest (hottest) erase count, -1 if none
+static int32_t WearLevel_findFree(const WearLevel *wl, bool hottest)
+{
+	int32_t found = -1;
+
+	for (uint32_t p = 0; p < wl->physicalSectors; p++) {
+		if (wl->owner[p] != WEAR_LEVEL_UNMAPPED) {
+			continue;
+		}
+		if ((found < 0) ||
+			(hottest ? (wl->eraseCount[p] > wl->eraseCount[found]) : (wl->eraseCount[p] < wl->eraseCount[found]))) {
+			found = p;
+		}
+	}
+
+	return found;
+}
+
+static bool WearLevel_assign(WearLevel *wl, uint32_t physical, uint32_t logical, uint16_t flags, uint32_t version)
+{
+	wl->owner[physical] = logical;
+	wl->version[physical] = version;
+	wl->map[logical] = physical;
+
+	return WearLevel_writeHeader(wl, physical, logical, flags, version);
+}
+
+static uint32_t WearLevel_nextVersion(const WearLevel *wl, uint32_t logical)
+{
+	uint16_t physical = wl->map[logical];
+	return (physical == WEAR_LEVEL_UNMAPPED) ? 0 : (wl->version[physical] + 1);
+}
+
+/*
+ * Static wear leveling: data that is never erased pins its sector at a low count. Once the most
+ * worn free sector is more than WEAR_LEVEL_MAX_SPREAD ahead of the coldest mapped one, the cold
+ * data is copied there and its sector goes back to the pool. One move per call bounds the latency.
+ */
+static bool WearLevel_balance(WearLevel *wl)
+{
+	int32_t hot = WearLevel_findFree(wl, true);
+	int32_t cold = -1;
+
+	for (uint32_t p = 0; p < wl->physicalSectors; p++) {
+		uint16_t logical = wl->owner[p];
+		if ((logical < wl->logicalSectors) && ((cold < 0) || (wl->eraseCount[p] < wl->eraseCount[cold]))) {
+			cold = p;
+		}
+	}
+
+	if ((hot < 0) || (cold < 0) || (wl->eraseCount[hot] <= (wl->eraseCount[cold] + WEAR_LEVEL_MAX_SPREAD))) {
+		return true;
+	}
+
+	uint32_t logical = wl->owner[cold];
+	uint8_t chunk[WEAR_LEVEL_COPY_CHUNK];
+	uint32_t step;
+	bool success;
+
+	// Not committed until the copy completes, so an interrupted move loses to the original at mount
+	success = WearLevel_assign(wl, hot, logical, (uint16_t)~WEAR_LEVEL_FLAG_ASSIGNED, wl->version[cold] + 1);
+
+	for (uint32_t offset = WEAR_LEVEL_HEADER_SIZE; success && (offset < WEAR_LEVEL_SECTOR_SIZE); offset += step) {
+		bool blank = true;
+
+		// First step realigns to program pages so no chunk straddles one
+		step = WEAR_LEVEL_COPY_CHUNK - (offset % WEAR_LEVEL_COPY_CHUNK);
+		success = wl->io->read(wl->io->context, WearLevel_address(wl, cold) + offset, chunk, step);
+		for (uint32_t i = 0; success && blank && (i < step); i++) {
+			blank = (chunk[i] == 0xFF);
+		}
+		if (success && !blank) {
+			success = wl->io->program(wl->io->context, WearLevel_address(wl, hot) + offset, chunk, step);
+		}
+	}
+
+	if (success) {
+		success = WearLevel_writeHeader(wl, hot, logical,
+				(uint16_t)~(WEAR_LEVEL_FLAG_ASSIGNED | WEAR_LEVEL_FLAG_COMMITTED), wl->version[hot]);
+	}
+
+	if (success) {
+		wl->stats.migrations++;
+		success = WearLevel_recycle(wl, cold);
+	} else {
+		// Leave the original mapped, the half written copy is recycled on the next mount
+		wl->map[logical] = cold;
+		wl->owner[hot] = WEAR_LEVEL_STALE;
+	}
+
+	return success;
+}
+
+bool WearLevel_mount(WearLevel *wl, const WearLevelIo *io, uint32_t base, uint32_t physicalSectors, uint32_t logicalSectors)
+{
+	uint32_t maxCount = 0;
+	bool success = true;
+
+	if ((physicalSectors > WEAR_LEVEL_MAX_SECTORS) || (logicalSectors >= physicalSectors)) {
+		return false;
+	}
+
+	memset(wl, 0, sizeof(*wl));
+	wl->io = io;
+	wl->base = base;
+	wl->physicalSectors = physicalSectors;
+	wl->logicalSectors = logicalSectors;
+	memset(wl->map, 0xFF, sizeof(wl->map));
+
+	for (uint32_t p = 0; success && (p < physicalSectors); p++) {
+		uint32_t header[4];
+
+		success = io->read(io->context, WearLevel_address(wl, p), (uint8_t *)header, sizeof(header));
+		if (!success) {
+			break;
+		}
+
+		uint16_t logical = header[1] & 0xFFFF;
+		uint16_t flags = header[1] >> 16;
+
+		if (header[0] != WEAR_LEVEL_MAGIC) {
+			wl->owner[p] = WEAR_LEVEL_UNKNOWN;
+			continue;
+		}
+
+		wl->eraseCount[p] = header[2];
+		wl->version[p] = header[3];
+		if (header[2] > maxCount) {
+			maxCount = header[2];
+		}
+
+		if (flags & WEAR_LEVEL_FLAG_ASSIGNED) {
+			wl->owner[p] = WEAR_LEVEL_UNMAPPED;
+		} else if ((flags & WEAR_LEVEL_FLAG_COMMITTED) || (logical >= logicalSectors)) {
+			wl->owner[p] = WEAR_LEVEL_STALE;
+		} else if (wl->map[logical] == WEAR_LEVEL_UNMAPPED) {
+			wl->owner[p] = logical;
+			wl->map[logical] = p;
+		} else {
+			// Power was lost between writing the new copy and erasing the old one
+			uint16_t other = wl->map[logical];
+
+			if (wl->version[p] > wl->version[other]) {
+				wl->owner[other] = WEAR_LEVEL_STALE;
+				wl->owner[p] = logical;
+				wl->map[logical] = p;
+			} else {
+				wl->owner[p] = WEAR_LEVEL_STALE;
+			}
+		}
+	}
+
+	for (uint32_t p = 0; success && (p < physicalSectors); p++) {
+		if (wl->owner[p] == WEAR_LEVEL_UNKNOWN) {
+			// Count lost with the header, assume the worst seen so far
+			wl->eraseCount[p] = maxCount;
+		} else if (wl->owner[p] != WEAR_LEVEL_STALE) {
+			continue;
+		}
+		wl->stats.recovered++;
+		success = WearLevel_recycle(wl, p);
+	}
+
+	return success;
+}
+
+bool WearLevel_read(WearLevel *wl, uint32_t logical, uint32_t offset, uint8_t *buffer, uint32_t length)
+{
+	if ((logical >= wl->logicalSectors) || (offset > WEAR_LEVEL_PAYLOAD_SIZE) || (length > (WEAR_LEVEL_PAYLOAD_SIZE - offset))) {
+		return false;
+	}
+
+	uint16_t physical = wl->map[logical];
+
+	if (physical == WEAR_LEVEL_UNMAPPED) {
+		memset(buffer, 0xFF, length);
+		return true;
+	}
+
+	return wl->io->read(wl->io->context, WearLevel_address(wl, physical) + WEAR_LEVEL_HEADER_SIZE + offset, buffer, length);
+}
+
+bool WearLevel_program(WearLevel *wl, uint32_t logical, uint32_t offset, const uint8_t *data, uint32_t length)
+{
+	if ((logical >= wl->logicalSectors) || (offset > WEAR_LEVEL_PAYLOAD_SIZE) || (length > (WEAR_LEVEL_PAYLOAD_SIZE - offset))) {
+		return false;
+	}
+
+	if (wl->map[logical] == WEAR_LEVEL_UNMAPPED) {
+		int32_t physical = WearLevel_findFree(wl, false);
+
+		if ((physical < 0) || !WearLevel_assign(wl, physical, logical,
+				(uint16_t)~(WEAR_LEVEL_FLAG_ASSIGNED | WEAR_LEVEL_FLAG_COMMITTED), 0)) {
+			return false;
+		}
+	}
+
+	return wl->io->program(wl->io->context, WearLevel_address(wl, wl->map[logical]) + WEAR_LEVEL_HEADER_SIZE + offset, data, length);
+}
+
+/*
+ * A logical erase never erases in place: the least worn free sector takes over the logical
+ * sector first, then the old one is erased into the pool. Power loss in between leaves two
+ * copies and mount keeps the newer, already blank one.
+ */
+bool WearLevel_erase(WearLevel *wl, uint32_t logical)
+{
+	if (logical >= wl->logicalSectors) {
+		return false;
+	}
+
+	uint16_t old = wl->map[logical];
+	int32_t physical = WearLevel_findFree(wl, false);
+	bool success;
+
+	if (physical < 0) {
+		return false;
+	}
+
+	success = WearLevel_assign(wl, physical, logical,
+			(uint16_t)~(WEAR_LEVEL_FLAG_ASSIGNED | WEAR_LEVEL_FLAG_COMMITTED), WearLevel_nextVersion(wl, logical));
+
+	if (success && (old != WEAR_LEVEL_UNMAPPED)) {
+		success = WearLevel_recycle(wl, old);
+	}
+
+	if (success) {
+		success = WearLevel_balance(wl);
+	}
+
+	return success;
+}
+
+void WearLevel_eraseSpread(const WearLevel *wl, uint32_t *minCount, uint32_t *maxCount)
+{
+	*minCount = UINT32_MAX;
+	*maxCount = 0;
+
+	for (uint32_t p = 0; p < wl->physicalSectors; p++) {
+		if (wl->eraseCount[p] < *minCount) {
+			*minCount = wl->eraseCount[p];
+		}
+		if (wl->eraseCount[p] > *maxCount) {
+			*maxCount = wl->eraseCount[p];
+		}
+	}
+}